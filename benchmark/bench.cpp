@@ -91,11 +91,11 @@ int main(int argc, char* argv[]) {
                     torch::TensorOptions().dtype(to_torch_dtype(tensor.dtype)).pinned_memory(true));
       if (cuda) {
         tensors.insert(
-            std::move(key), std::move(blob.to(torch::kCUDA, true)));
+            std::string(key), std::move(blob.to(torch::kCUDA, true)));
       } else {
         // Use pinned memory for CPU tensors
       tensors.insert(
-          std::move(key), std::move(blob));
+          std::string(key), std::move(blob));
       }
     }
   }
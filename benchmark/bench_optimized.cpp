@@ -79,7 +79,7 @@ int main(int argc, char* argv[]) {
   auto keys = f.keys();
   
   // Pre-cache tensor metadata for multiple iterations
-  std::unordered_map<std::string, TensorInfo> tensor_cache;
+  std::unordered_map<std::string_view, TensorInfo> tensor_cache;
   
   if (loop_count > 1) {
     // Pre-populate cache for repeated access
@@ -111,7 +111,7 @@ int main(int argc, char* argv[]) {
       torch::NoGradGuard no_grad;
       for (const auto& key : keys) {
         const auto& info = tensor_cache[key];
-        tensors.insert(key, torch::from_blob(info.data_ptr, info.shape, info.options));
+        tensors.insert(std::string(key), torch::from_blob(info.data_ptr, info.shape, info.options));
       }
     } else {
       // Single iteration - direct access
@@ -124,7 +124,7 @@ int main(int argc, char* argv[]) {
             tensor.shape.begin(), tensor.shape.end(), std::back_inserter(shape),
             [](const auto& dim) { return static_cast<std::int64_t>(dim); });
         tensors.insert(
-            key, torch::from_blob(
+            std::string(key), torch::from_blob(
                     const_cast<void*>(tensor.data_ptr), shape,
                     torch::TensorOptions().dtype(to_torch_dtype(tensor.dtype)).pinned_memory(true)));
       }
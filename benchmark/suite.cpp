@@ -0,0 +1,553 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+// Load-path benchmarks without Torch: header parsing against tensor count,
+// cold and warm loads, data touch bandwidth, prefetch threading, I/O
+// backends, sharded opens and writes. Synthetic checkpoints are generated
+// under --dir. Results print as a table and, with --json, in Google
+// Benchmark's JSON format so that its compare.py can diff two runs. With
+// `--json -` the JSON goes to stdout and the table to stderr.
+//
+//   safetensors_bench --size-mb 1024 --json results.json
+//   safetensors_bench --filter load/cold --repetitions 3
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fmt/format.h"
+#include "safetensors/safetensors.hpp"
+#include "safetensors/sharded.hpp"
+#include "safetensors/writer.hpp"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+using namespace safetensors;
+
+namespace {
+
+struct Config {
+  fs::path dir = fs::temp_directory_path() / "safetensors-bench";
+  std::size_t size_mb = 256;
+  std::size_t repetitions = 5;
+  double min_time = 0.1;
+  std::string filter;
+  std::string json;
+  bool keep = false;
+};
+
+// One benchmark. `setup` runs untimed before every repetition; `body` is
+// timed and returns the bytes it processed. Cold cases run `body` once per
+// repetition, right after dropping the page cache; warm ones repeat it
+// until `min_time` has passed.
+struct Case {
+  std::string name;
+  std::function<std::size_t()> body;
+  std::function<void()> setup;
+  bool cold = false;
+  // Items per run of `body`, e.g. tensors parsed, for items_per_second.
+  std::size_t items = 0;
+};
+
+struct Result {
+  std::string name;
+  std::size_t iterations = 0;
+  // Medians over the repetitions, per iteration.
+  double real_ns = 0.0;
+  double cpu_ns = 0.0;
+  double min_ns = 0.0;
+  double bytes_per_second = 0.0;
+  double items_per_second = 0.0;
+  // Fraction of the data in the page cache before a cold run; should be
+  // near zero, otherwise the drop did not take.
+  double resident = -1.0;
+};
+
+double median(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  const std::size_t n = v.size();
+  return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// Fills `n` bytes with a cheap xorshift stream, so that no page is zero
+// and nothing compresses.
+void fillRandom(std::byte* p, const std::size_t n, std::uint64_t seed) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    std::memcpy(p + i, &seed, 8);
+  }
+  for (; i < n; ++i) p[i] = static_cast<std::byte>(seed >> (i % 8 * 8));
+}
+
+std::size_t fileSize(const fs::path& path) {
+  return static_cast<std::size_t>(fs::file_size(path));
+}
+
+// A checkpoint of `count` F32 tensors of `elements` each, written through
+// SafeWriter and synced so that its pages are clean and can be dropped.
+void writeCheckpoint(const fs::path& path, const std::size_t count,
+                     const std::size_t elements, const std::uint64_t seed) {
+  WriterOptions options;
+  SafeWriter w(path, options);
+  const std::array<std::size_t, 1> shape{elements};
+  for (std::size_t i = 0; i < count; ++i) {
+    w.add_tensor(fmt::format("model.layers.{}.weight", i), Dtype::F32, shape);
+  }
+  w.add_metadata("format", "pt");
+  std::vector<std::byte> data(elements * sizeof(float));
+  for (std::size_t i = 0; i < count; ++i) {
+    fillRandom(data.data(), data.size(), seed + i);
+    w.write(fmt::format("model.layers.{}.weight", i), data);
+  }
+  w.close();
+}
+
+// Writes `model.safetensors` split into `shards` files plus the Hugging
+// Face index that ShardedSafeOpen reads.
+fs::path writeSharded(const fs::path& dir, const std::size_t shards,
+                      const std::size_t per_shard,
+                      const std::size_t elements) {
+  std::string weight_map;
+  for (std::size_t s = 0; s < shards; ++s) {
+    const std::string name =
+        fmt::format("model-{:05}-of-{:05}.safetensors", s + 1, shards);
+    WriterOptions options;
+    SafeWriter w(dir / name, options);
+    const std::array<std::size_t, 1> shape{elements};
+    for (std::size_t i = 0; i < per_shard; ++i) {
+      const std::string key =
+          fmt::format("model.layers.{}.weight", s * per_shard + i);
+      w.add_tensor(key, Dtype::F32, shape);
+      weight_map += fmt::format("{}\"{}\": \"{}\"",
+                                weight_map.empty() ? "" : ", ", key, name);
+    }
+    std::vector<std::byte> data(elements * sizeof(float));
+    for (std::size_t i = 0; i < per_shard; ++i) {
+      fillRandom(data.data(), data.size(), s * per_shard + i);
+      w.write(fmt::format("model.layers.{}.weight", s * per_shard + i), data);
+    }
+    w.close();
+  }
+  const fs::path index = dir / "model.safetensors.index.json";
+  std::ofstream(index) << fmt::format(
+      "{{\"metadata\": {{}}, \"weight_map\": {{{}}}}}", weight_map);
+  return index;
+}
+
+// Drops the clean pages of `path` from the page cache. No root needed, but
+// only POSIX systems with posix_fadvise do it; false elsewhere.
+bool dropCache(const fs::path& path) {
+#if defined(POSIX_FADV_DONTNEED)
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  fdatasync(fd);
+  const bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  close(fd);
+  return ok;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+double residentFraction(const fs::path& path) {
+  File file(path);
+  Mmap mmap(&file, 0);
+  return mmap.size() ? static_cast<double>(mmap.residentBytes(0, mmap.size())) /
+                           static_cast<double>(mmap.size())
+                     : 1.0;
+}
+
+// Reads every byte of every tensor, 8 at a time.
+std::uint64_t touchAll(const SafeOpen& f) {
+  std::uint64_t acc = 0;
+  for (const SafeOpen::TensorView& view : f.tensors()) {
+    const auto* p = static_cast<const std::byte*>(view.data_ptr);
+    std::size_t i = 0;
+    for (; i + 8 <= view.data_len; i += 8) {
+      std::uint64_t word;
+      std::memcpy(&word, p + i, 8);
+      acc += word;
+    }
+    for (; i < view.data_len; ++i) acc += static_cast<std::uint8_t>(p[i]);
+  }
+  return acc;
+}
+
+volatile std::uint64_t g_sink;
+
+Result run(const Case& c, const Config& config,
+           const std::vector<fs::path>& cold_files) {
+  Result result;
+  result.name = c.name;
+  std::vector<double> real, cpu;
+  std::size_t bytes = 0;
+  std::vector<double> resident;
+  for (std::size_t rep = 0; rep < config.repetitions; ++rep) {
+    if (c.setup) c.setup();
+    if (c.cold) {
+      double fraction = 0.0;
+      for (const fs::path& p : cold_files) {
+        dropCache(p);
+        fraction += residentFraction(p) / static_cast<double>(cold_files.size());
+      }
+      resident.push_back(fraction);
+    }
+    std::size_t iterations = 0;
+    const std::clock_t cpu_start = std::clock();
+    const auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do {
+      bytes = c.body();
+      ++iterations;
+      elapsed = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    } while (!c.cold && elapsed < config.min_time);
+    const double cpu_seconds =
+        static_cast<double>(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+    real.push_back(elapsed * 1e9 / static_cast<double>(iterations));
+    cpu.push_back(cpu_seconds * 1e9 / static_cast<double>(iterations));
+    result.iterations += iterations;
+  }
+  result.real_ns = median(real);
+  result.cpu_ns = median(cpu);
+  result.min_ns = *std::min_element(real.begin(), real.end());
+  if (bytes) result.bytes_per_second = static_cast<double>(bytes) * 1e9 /
+                                       result.real_ns;
+  if (c.items) result.items_per_second = static_cast<double>(c.items) * 1e9 /
+                                         result.real_ns;
+  if (!resident.empty()) result.resident = median(resident);
+  return result;
+}
+
+std::string jsonEscape(std::string_view s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results,
+               const Config& config, const std::size_t data_bytes) {
+  char date[64];
+  const std::time_t now = std::time(nullptr);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z",
+                std::localtime(&now));
+  out << "{\n  \"context\": {\n";
+  out << fmt::format("    \"date\": \"{}\",\n", date);
+  out << fmt::format("    \"executable\": \"safetensors_bench\",\n");
+  out << fmt::format("    \"num_cpus\": {},\n",
+                     std::thread::hardware_concurrency());
+  out << fmt::format("    \"data_bytes\": {},\n", data_bytes);
+  out << fmt::format("    \"repetitions\": {},\n", config.repetitions);
+  out << fmt::format("    \"convert_isa\": \"{}\",\n", convert_isa());
+#if defined(NDEBUG)
+  out << "    \"library_build_type\": \"release\"\n";
+#else
+  out << "    \"library_build_type\": \"debug\"\n";
+#endif
+  out << "  },\n  \"benchmarks\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    out << (i ? ",\n" : "\n") << "    {";
+    out << fmt::format(
+        "\"name\": \"{}\", \"run_name\": \"{}\", \"run_type\": "
+        "\"aggregate\", \"aggregate_name\": \"median\", \"repetitions\": {}, "
+        "\"iterations\": {}, \"real_time\": {:.1f}, \"cpu_time\": {:.1f}, "
+        "\"min_time\": {:.1f}, \"time_unit\": \"ns\"",
+        jsonEscape(r.name), jsonEscape(r.name), config.repetitions,
+        r.iterations, r.real_ns, r.cpu_ns, r.min_ns);
+    if (r.bytes_per_second > 0) {
+      out << fmt::format(", \"bytes_per_second\": {:.0f}", r.bytes_per_second);
+    }
+    if (r.items_per_second > 0) {
+      out << fmt::format(", \"items_per_second\": {:.0f}", r.items_per_second);
+    }
+    if (r.resident >= 0) {
+      out << fmt::format(", \"resident_before\": {:.4f}", r.resident);
+    }
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+std::string humanTime(const double ns) {
+  if (ns >= 1e9) return fmt::format("{:.3f} s", ns / 1e9);
+  if (ns >= 1e6) return fmt::format("{:.3f} ms", ns / 1e6);
+  if (ns >= 1e3) return fmt::format("{:.3f} us", ns / 1e3);
+  return fmt::format("{:.0f} ns", ns);
+}
+
+void usage(const char* argv0) {
+  std::cerr << fmt::format(
+      "usage: {} [--dir DIR] [--size-mb N] [--repetitions N] "
+      "[--min-time SECONDS] [--filter SUBSTRING] [--json FILE|-] [--keep]\n",
+      argv0);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Config config;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        usage(argv[0]);
+        std::exit(1);
+      }
+      return argv[++i];
+    };
+    if (arg == "--dir") {
+      config.dir = value();
+    } else if (arg == "--size-mb") {
+      config.size_mb = std::stoul(value());
+    } else if (arg == "--repetitions") {
+      config.repetitions = std::max<std::size_t>(1, std::stoul(value()));
+    } else if (arg == "--min-time") {
+      config.min_time = std::stod(value());
+    } else if (arg == "--filter") {
+      config.filter = value();
+    } else if (arg == "--json") {
+      config.json = value();
+    } else if (arg == "--keep") {
+      config.keep = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  auto wanted = [&](std::string_view name) {
+    return config.filter.empty() ||
+           name.find(config.filter) != std::string_view::npos;
+  };
+
+  // Synthetic data: checkpoints of tiny tensors for parsing, one model of
+  // --size-mb in 4 MiB tensors, and the same model in four shards.
+  fs::create_directories(config.dir);
+  constexpr std::size_t kTensorElements = 1 << 20;
+  const std::size_t model_tensors = std::max<std::size_t>(
+      4, config.size_mb * (1 << 20) / (kTensorElements * sizeof(float)));
+  const fs::path model = config.dir / "model.safetensors";
+  std::cerr << fmt::format("generating {} MiB of checkpoints in {}\n",
+                           model_tensors * 4, config.dir.string());
+  writeCheckpoint(model, model_tensors, kTensorElements, 1);
+  const fs::path shard_index =
+      writeSharded(config.dir, 4, model_tensors / 4, kTensorElements);
+  std::vector<fs::path> shard_files;
+  for (std::size_t s = 0; s < 4; ++s) {
+    shard_files.push_back(config.dir /
+                          fmt::format("model-{:05}-of-00004.safetensors", s + 1));
+  }
+  const std::size_t data_bytes = fileSize(model);
+  const bool can_drop = dropCache(model);
+  if (!can_drop) {
+    std::cerr << "page cache cannot be dropped here, skipping cold cases\n";
+  }
+
+  std::vector<Case> cases;
+  for (const std::size_t n : {100, 1000, 10000, 100000}) {
+    const fs::path path = config.dir / fmt::format("parse-{}.safetensors", n);
+    writeCheckpoint(path, n, 4, 7);
+    File file(path);
+    auto header = std::make_shared<std::vector<std::uint8_t>>(file.size());
+    file.readRaw(header->data(), header->size());
+    for (const auto& [label, parser] :
+         {std::pair{"native", HeaderParser::Native},
+          std::pair{"rust", HeaderParser::Rust}}) {
+      cases.push_back(Case{fmt::format("parse/{}/{}", label, n), [=] {
+                             TensorIndex index = parse_header(
+                                 header->data(), header->size(), parser);
+                             g_sink = index.size();
+                             return std::size_t{0};
+                           },
+                           {}, false, n});
+    }
+  }
+
+  OpenOptions lazy;
+  lazy.parser = HeaderParser::Native;
+  lazy.prefetch = 0;
+  cases.push_back(Case{"open/warm", [&] {
+                         SafeOpen f(model.string(), lazy);
+                         g_sink = f.keys().size();
+                         return std::size_t{0};
+                       },
+                       {}, false, model_tensors});
+  auto load = [&] {
+    SafeOpen f(model.string(), lazy);
+    g_sink = touchAll(f);
+    return data_bytes;
+  };
+  cases.push_back(Case{"load/cold/touch", load, {}, true});
+  cases.push_back(Case{"load/warm/touch", load, {}, false});
+
+  std::unique_ptr<SafeOpen> opened;
+  cases.push_back(Case{"touch/warm",
+                       [&] {
+                         g_sink = touchAll(*opened);
+                         return data_bytes;
+                       },
+                       [&] {
+                         if (!opened) {
+                           opened = std::make_unique<SafeOpen>(model.string(),
+                                                               lazy);
+                         }
+                       },
+                       false});
+
+  const std::size_t cpus =
+      std::max<std::size_t>(1, std::thread::hardware_concurrency());
+  for (const std::size_t threads : {std::size_t{1}, std::size_t{4}, cpus}) {
+    if (threads > cpus) continue;
+    cases.push_back(Case{fmt::format("prefetch/cold/threads:{}", threads),
+                         [&, threads] {
+                           SafeOpen f(model.string(), lazy);
+                           PrefetchOptions options;
+                           options.threads = threads;
+                           return f.prefetch(options).bytes;
+                         },
+                         {}, true});
+    if (threads == cpus) break;
+  }
+
+  std::vector<std::byte> slab;
+  std::vector<SafeOpen::TensorRead> reads;
+  for (const auto& [label, backend] :
+       {std::pair{"mmap", IoBackend::Mmap},
+        std::pair{"buffered", IoBackend::Buffered},
+        std::pair{"direct", IoBackend::Direct}}) {
+    cases.push_back(Case{fmt::format("read_into/cold/{}", label),
+                         [&, backend] {
+                           OpenOptions options = lazy;
+                           options.io.backend = backend;
+                           SafeOpen f(model.string(), options);
+                           slab.resize(f.index().buffer_size());
+                           reads.clear();
+                           std::size_t pos = 0;
+                           for (std::size_t i = 0; i < f.keys().size(); ++i) {
+                             const std::size_t n = f.tensors()[i].data_len;
+                             reads.push_back({f.keys()[i], {slab.data() + pos, n}});
+                             pos += n;
+                           }
+                           f.read_into(reads);
+                           return pos;
+                         },
+                         {}, true});
+  }
+
+  for (const bool lazy_shards : {false, true}) {
+    cases.push_back(
+        Case{fmt::format("sharded/open/{}", lazy_shards ? "lazy" : "eager"),
+             [&, lazy_shards] {
+               ShardedOptions options;
+               options.open = lazy;
+               options.lazy = lazy_shards;
+               options.prefetch = false;
+               ShardedSafeOpen f(shard_index, options);
+               g_sink = f.keys().size();
+               return std::size_t{0};
+             },
+             {}, false, model_tensors});
+  }
+  cases.push_back(Case{"sharded/load/cold",
+                       [&] {
+                         ShardedOptions options;
+                         options.open = lazy;
+                         ShardedSafeOpen f(shard_index, options);
+                         std::size_t bytes = 0;
+                         for (std::size_t s = 0; s < f.num_shards(); ++s) {
+                           bytes += f.shard(s).index().buffer_size();
+                         }
+                         return bytes;
+                       },
+                       {}, true});
+
+  std::vector<std::byte> payload(kTensorElements * sizeof(float));
+  fillRandom(payload.data(), payload.size(), 3);
+  for (const auto& [label, sync] :
+       {std::pair{"nosync", Sync::None}, std::pair{"sync", Sync::OnClose}}) {
+    cases.push_back(Case{fmt::format("write/{}", label),
+                         [&, sync] {
+                           WriterOptions options;
+                           options.sync = sync;
+                           const fs::path out = config.dir / "write.safetensors";
+                           SafeWriter w(out, options);
+                           const std::array<std::size_t, 1> shape{
+                               kTensorElements};
+                           std::vector<std::string> keys;
+                           for (std::size_t i = 0; i < model_tensors; ++i) {
+                             keys.push_back(fmt::format("w.{}", i));
+                             w.add_tensor(keys.back(), Dtype::F32, shape);
+                           }
+                           std::vector<TensorWrite> writes;
+                           for (const std::string& key : keys) {
+                             writes.push_back({key, payload});
+                           }
+                           w.write(writes);
+                           w.close();
+                           return model_tensors * payload.size();
+                         },
+                         {}, false});
+  }
+
+  std::vector<Result> results;
+  // With `--json -` stdout carries only the JSON, so it stays parseable.
+  std::ostream& table = config.json == "-" ? std::cerr : std::cout;
+  table << fmt::format("{:<32} {:>14} {:>14} {:>12} {:>14} {:>10}\n",
+                           "benchmark", "time", "cpu", "iterations",
+                           "throughput", "resident");
+  for (const Case& c : cases) {
+    if (!wanted(c.name) || (c.cold && !can_drop)) continue;
+    std::vector<fs::path> cold_files{model};
+    if (c.name.starts_with("sharded")) cold_files = shard_files;
+    const Result r = run(c, config, cold_files);
+    std::string throughput;
+    if (r.bytes_per_second > 0) {
+      throughput = fmt::format("{:.2f} GB/s", r.bytes_per_second / 1e9);
+    } else if (r.items_per_second > 0) {
+      throughput = fmt::format("{:.2f} M/s", r.items_per_second / 1e6);
+    }
+    table << fmt::format(
+        "{:<32} {:>14} {:>14} {:>12} {:>14} {:>10}\n", r.name,
+        humanTime(r.real_ns), humanTime(r.cpu_ns), r.iterations, throughput,
+        r.resident >= 0 ? fmt::format("{:.3f}", r.resident) : "");
+    results.push_back(r);
+  }
+  opened.reset();
+
+  if (!config.json.empty()) {
+    if (config.json == "-") {
+      writeJson(std::cout, results, config, data_bytes);
+    } else {
+      std::ofstream out(config.json);
+      writeJson(out, results, config, data_bytes);
+    }
+  }
+  if (!config.keep) fs::remove_all(config.dir);
+  return 0;
+}
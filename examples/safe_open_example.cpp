@@ -13,6 +13,7 @@
 #include <iomanip>
 #include <iostream>
 #include <numeric>
+#include <span>
 
 #include "safetensors/safetensors.hpp"
 
@@ -51,13 +52,13 @@ std::string dtype_to_string(safetensors::Dtype dtype) {
 }
 
 // Helper function to calculate total elements in tensor
-std::size_t calculate_total_elements(const std::vector<std::size_t>& shape) {
+std::size_t calculate_total_elements(std::span<const std::size_t> shape) {
   return std::accumulate(shape.begin(), shape.end(), 1UL,
                          std::multiplies<std::size_t>());
 }
 
 // Helper function to print tensor shape
-void print_shape(const std::vector<std::size_t>& shape) {
+void print_shape(std::span<const std::size_t> shape) {
   std::cout << "[";
   for (std::size_t i = 0; i < shape.size(); ++i) {
     if (i > 0) std::cout << ", ";
@@ -195,7 +196,7 @@ int main(int argc, char* const argv[]) {
 
     // Example: Access a specific tensor by name (if it exists)
     if (!tensor_keys.empty()) {
-      const std::string first_key = tensor_keys[0];
+      const std::string first_key(tensor_keys[0]);
       std::cout << "=== Accessing Specific Tensor ===" << std::endl;
       std::cout << "Accessing tensor: \"" << first_key << "\"" << std::endl;
 
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "safetensors/header.hpp"
+#include "safetensors/index.hpp"
+#include "safetensors/mmap.hpp"
+
+namespace safetensors {
+
+// How SafeOpen shares what it opens, see `OpenOptions::cache`.
+enum class CheckpointCache {
+  // Every SafeOpen maps and parses the file itself.
+  None,
+  // Instances in this process that open the same file share one File, one
+  // Mmap and one parsed index, for as long as any of them is alive.
+  Process,
+  // As Process, and the parsed index is also published in a POSIX shared
+  // memory segment, so that other processes attach to it instead of
+  // parsing the header. Segments are checksummed and bounds checked on
+  // attach; a corrupt one, or one its publisher abandoned half written, is
+  // unlinked and published again. Same as Process on Windows.
+  SharedMemory,
+};
+
+// A file, its mapping and its parsed header, shared through the cache.
+struct Checkpoint {
+  std::unique_ptr<File> file;
+  std::unique_ptr<Mmap> mmap;
+  TensorIndex index;
+};
+
+struct CheckpointOptions {
+  HeaderParser parser = HeaderParser::Rust;
+  HugePages huge_pages = HugePages::None;
+  // Bytes to populate when the file is first mapped; later opens find the
+  // mapping as it is.
+  std::size_t prefetch = 0;
+  bool shared_memory = false;
+  // Sidecar index to load, or to write after parsing; empty for none.
+  // Shared memory is tried first.
+  std::filesystem::path sidecar;
+};
+
+// Returns the live checkpoint for `path` or opens it. Entries are keyed by
+// the canonical path, device, inode, size and modification time, and by
+// the huge page mode, so a rewritten file is opened afresh while live
+// users keep the old one. Concurrent first opens of one file wait for a
+// single parse. Throws what File, Mmap and parse_header throw.
+std::shared_ptr<Checkpoint> open_checkpoint(
+    const std::filesystem::path& path, const CheckpointOptions& options = {});
+
+// Number of checkpoints currently alive in the cache.
+std::size_t cached_checkpoints();
+
+// Name of the shared memory segment for the current version of `path`,
+// for shm_open(3); empty on Windows.
+std::string shared_index_name(const std::filesystem::path& path);
+
+// Removes the shared memory segment published for the current version of
+// `path`, if any. Segments otherwise stay until reboot; each version of a
+// file gets its own.
+bool unlink_shared_index(const std::filesystem::path& path);
+
+}  // namespace safetensors
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "safetensors/index.hpp"
+#include "safetensors/mmap.hpp"
+#include "safetensors/prefetch.hpp"
+
+namespace safetensors {
+
+// `__metadata__` key of the checksums SafeWriter stores with
+// `WriterOptions::checksums`: the CRC32C of every non-empty tensor in data
+// order, SafeWriter's `__padding_` fillers included, each as 8 lowercase
+// hex digits with no separator. Empty tensors are left out since several
+// may share an offset with their neighbour.
+constexpr std::string_view CHECKSUM_KEY = "__crc32c__";
+
+// CRC32C (Castagnoli) of `size` bytes, continuing from `crc`, the checksum
+// of the bytes before them. SSE4.2 or ARMv8 CRC instructions where the
+// CPU has them, see `crc32c_isa()`.
+std::uint32_t crc32c(const void* data, std::size_t size,
+                     std::uint32_t crc = 0) noexcept;
+
+// Checksum of A followed by B from those of A and B, the latter `size_b`
+// bytes long, so that pieces checksummed on different threads combine.
+std::uint32_t crc32c_combine(std::uint32_t crc_a, std::uint32_t crc_b,
+                             std::size_t size_b) noexcept;
+
+// "sse4.2", "armv8" or "scalar".
+std::string_view crc32c_isa() noexcept;
+
+// CRC32C of each of `ranges` of `mmap`, computed on a pool of worker threads
+// as `prefetch_ranges` does, which it replaces: reading the data faults it
+// in. Ranges larger than `chunk_bytes` are split over several work items.
+std::vector<std::uint32_t> crc32c_ranges(const Mmap& mmap,
+                                         std::span<const ByteRange> ranges,
+                                         const PrefetchOptions& options = {},
+                                         PrefetchStats* stats = nullptr);
+
+struct VerifyResult {
+  // Non-empty tensors checked, and those left out by `skip`.
+  std::size_t tensors = 0;
+  std::size_t skipped = 0;
+  // Names of the tensors whose data does not match, in data order.
+  std::vector<std::string_view> mismatched;
+  PrefetchStats stats;
+
+  bool ok() const noexcept { return mismatched.empty(); }
+};
+
+// Checks the data of every tensor of `index`, mapped by `mmap`, against the
+// checksums under CHECKSUM_KEY, except tensors `i` for which `skip(i)`
+// holds, e.g. those no longer mapped. Throws std::runtime_error if there
+// are no checksums or their number does not match the tensors.
+VerifyResult verify_checksums(
+    const TensorIndex& index, const Mmap& mmap,
+    const PrefetchOptions& options = {},
+    const std::function<bool(std::size_t)>& skip = {});
+
+}  // namespace safetensors
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "safetensors_abi/lib.h"
+
+namespace safetensors {
+
+// Block scales of a microscaling tensor: element i of the scaled tensor is
+// multiplied by `data[(offset + i) / block]`. MX checkpoints store them as
+// F8_E8M0 with 32 elements per block; F32, F16 and BF16 work as well.
+struct BlockScales {
+  const void* data = nullptr;
+  Dtype dtype = Dtype::F8_E8M0;
+  std::size_t block = 32;
+  // Index within the scaled tensor of the first element converted, for
+  // conversions done piece by piece.
+  std::size_t offset = 0;
+};
+
+// True if `convert` supports the pair: any dtype into F32, F16, BF16 or F64,
+// F32, F16, BF16 and F64 into F4, F6_E2M3, F6_E3M2, F8_E4M3 and F8_E5M2,
+// and any dtype into itself.
+bool can_convert(Dtype from, Dtype to) noexcept;
+
+// Converts `count` elements from `src` to `dst`, rounding to nearest even.
+// Sub-byte tensors start on a byte boundary; F4 holds the first element in
+// the low nibble, F6 packs four elements into three bytes, least significant
+// bits first. Encoding into F4, F6 and F8 saturates to the largest finite
+// value; NaN becomes zero in F4 and F6, which cannot represent it.
+// `scales` belong to the narrow side: decoding multiplies by them, encoding
+// into F4, F6 or F8 divides by them. Throws std::invalid_argument for
+// unsupported pairs.
+void convert(const void* src, Dtype from, void* dst, Dtype to,
+             std::size_t count, const BlockScales* scales = nullptr);
+
+// Quantizes `count` values into the MX element type `to` (F4, F6_E2M3,
+// F6_E3M2, F8_E4M3 or F8_E5M2) with one F8_E8M0 scale per `block` elements,
+// written to `scales`. As in the OCP MX specification, the scale is the
+// power of two that puts the largest magnitude of the block into the top
+// binade of `to`.
+void quantize_mx(const float* src, std::size_t count, Dtype to, void* dst,
+                 std::uint8_t* scales, std::size_t block = 32);
+
+// Kernels chosen for this CPU at run time: "avx512", "avx2", "neon" or
+// "scalar".
+std::string_view convert_isa() noexcept;
+
+}  // namespace safetensors
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+#include "safetensors/index.hpp"
+#include "safetensors_abi/lib.h"
+
+namespace safetensors {
+
+constexpr std::size_t N_LEN = 8;
+// Same limit as the Rust crate (`MAX_HEADER_SIZE`).
+constexpr std::size_t MAX_HEADER_SIZE = 100'000'000;
+// Names of the U8 tensors SafeWriter fills alignment gaps with.
+constexpr std::string_view PADDING_PREFIX = "__padding_";
+
+constexpr std::size_t bitsize(const Dtype dtype) noexcept {
+  switch (dtype) {
+    case Dtype::F4:
+      return 4;
+    case Dtype::F6_E2M3:
+    case Dtype::F6_E3M2:
+      return 6;
+    case Dtype::BOOL:
+    case Dtype::U8:
+    case Dtype::I8:
+    case Dtype::F8_E5M2:
+    case Dtype::F8_E4M3:
+    case Dtype::F8_E8M0:
+      return 8;
+    case Dtype::I16:
+    case Dtype::U16:
+    case Dtype::F16:
+    case Dtype::BF16:
+      return 16;
+    case Dtype::I32:
+    case Dtype::U32:
+    case Dtype::F32:
+      return 32;
+    case Dtype::F64:
+    case Dtype::I64:
+    case Dtype::U64:
+      return 64;
+    default:
+      return 0;
+  }
+}
+
+// Element types for the dtypes without a C++ counterpart, holding the raw
+// bits; `convert` decodes them.
+struct float16 {
+  std::uint16_t bits;
+};
+struct bfloat16 {
+  std::uint16_t bits;
+};
+struct float8_e4m3 {
+  std::uint8_t bits;
+};
+struct float8_e5m2 {
+  std::uint8_t bits;
+};
+struct float8_e8m0 {
+  std::uint8_t bits;
+};
+
+// The dtype whose elements `T` holds, for typed access such as
+// `SafeOpen::get_tensor<T>`. Sub-byte dtypes have no element type.
+template <class T>
+struct dtype_of {};
+
+template <Dtype D>
+struct dtype_constant : std::integral_constant<Dtype, D> {};
+
+// clang-format off
+template <> struct dtype_of<bool> : dtype_constant<Dtype::BOOL> {};
+template <> struct dtype_of<std::uint8_t> : dtype_constant<Dtype::U8> {};
+template <> struct dtype_of<std::int8_t> : dtype_constant<Dtype::I8> {};
+template <> struct dtype_of<std::uint16_t> : dtype_constant<Dtype::U16> {};
+template <> struct dtype_of<std::int16_t> : dtype_constant<Dtype::I16> {};
+template <> struct dtype_of<std::uint32_t> : dtype_constant<Dtype::U32> {};
+template <> struct dtype_of<std::int32_t> : dtype_constant<Dtype::I32> {};
+template <> struct dtype_of<std::uint64_t> : dtype_constant<Dtype::U64> {};
+template <> struct dtype_of<std::int64_t> : dtype_constant<Dtype::I64> {};
+template <> struct dtype_of<float> : dtype_constant<Dtype::F32> {};
+template <> struct dtype_of<double> : dtype_constant<Dtype::F64> {};
+template <> struct dtype_of<float16> : dtype_constant<Dtype::F16> {};
+template <> struct dtype_of<bfloat16> : dtype_constant<Dtype::BF16> {};
+template <> struct dtype_of<float8_e4m3> : dtype_constant<Dtype::F8_E4M3> {};
+template <> struct dtype_of<float8_e5m2> : dtype_constant<Dtype::F8_E5M2> {};
+template <> struct dtype_of<float8_e8m0> : dtype_constant<Dtype::F8_E8M0> {};
+// clang-format on
+
+template <class T>
+inline constexpr Dtype dtype_of_v = dtype_of<T>::value;
+
+template <class T>
+concept tensor_element = requires { dtype_of<T>::value; } &&
+                         sizeof(T) * 8 == bitsize(dtype_of<T>::value);
+
+static_assert(tensor_element<bool> && tensor_element<float16>);
+
+std::string_view to_string(const Dtype dtype) noexcept;
+std::optional<Dtype> dtype_from_string(std::string_view name) noexcept;
+
+enum class HeaderParser {
+  // `deserialize()`/`metadata()` from the Rust crate, across the cxx bridge.
+  Rust,
+  // One pass over the raw bytes, no bridge round-trip.
+  Native,
+};
+
+// Parses the header at the start of `data` (the whole file) into an index.
+//
+// The native parser performs the same checks as `SafeTensors::deserialize`
+// (header bounds, UTF-8, dtype names, contiguous offsets, shape/size
+// consistency, fully indexed buffer) and additionally rejects duplicate
+// tensor names. Throws std::runtime_error (or rust::Error) on failure.
+//
+// As with `deserialize()`, the last dimension of F4 tensors is reported
+// halved (two values are packed per byte).
+TensorIndex parse_header(const std::uint8_t* data,
+                         std::size_t size,
+                         HeaderParser parser = HeaderParser::Rust);
+
+// Native parse of the header alone: `data` holds the 8-byte length and the
+// JSON text, and may end right after it. Tensor offsets are checked for
+// contiguity; they are checked against the file only if `file_size` is
+// given. Throws std::runtime_error on failure.
+TensorIndex parse_header_only(
+    const std::uint8_t* data, std::size_t size,
+    std::optional<std::size_t> file_size = std::nullopt);
+
+}  // namespace safetensors
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "safetensors_abi/lib.h"
+
+namespace safetensors {
+
+// Immutable, flat description of a safetensors header.
+//
+// Every entry, shape, name and metadata string lives in one contiguous,
+// position-independent arena (offsets, no pointers), so building an index is
+// a handful of allocations regardless of the tensor count, and lookups by
+// name are a single open-addressing probe sequence with no heap traffic.
+// Entries are ordered by data offset, i.e. by on-disk access order.
+class TensorIndex {
+ public:
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+  struct Entry {
+    // Offsets relative to the start of the byte buffer, as in the header.
+    std::uint64_t begin;
+    std::uint64_t end;
+    std::uint32_t name_offset;
+    std::uint32_t name_size;
+    std::uint32_t shape_offset;
+    std::uint32_t rank;
+    Dtype dtype;
+  };
+
+  struct MetadataEntry {
+    std::uint32_t key_offset;
+    std::uint32_t key_size;
+    std::uint32_t value_offset;
+    std::uint32_t value_size;
+  };
+
+  using MetadataPair = std::pair<std::string_view, std::string_view>;
+
+  class Builder;
+
+  TensorIndex() = default;
+
+  TensorIndex(const TensorIndex&) = delete;
+  TensorIndex& operator=(const TensorIndex&) = delete;
+
+  TensorIndex(TensorIndex&&) = default;
+  TensorIndex& operator=(TensorIndex&&) = default;
+
+  ~TensorIndex() = default;
+
+  std::size_t size() const noexcept { return names_.size(); }
+  bool empty() const noexcept { return names_.empty(); }
+
+  // Length of the JSON header, i.e. the leading little-endian u64.
+  std::size_t header_size() const noexcept;
+  // Absolute file offset of the byte buffer.
+  std::size_t data_offset() const noexcept;
+  // Size of the byte buffer, i.e. the end offset of the last tensor.
+  std::size_t buffer_size() const noexcept;
+
+  // Position of `name` in access order, or `npos`.
+  std::size_t find(std::string_view name) const noexcept;
+
+  const Entry& entry(const std::size_t i) const noexcept {
+    return entries()[i];
+  }
+  std::string_view name(const std::size_t i) const noexcept {
+    return names_[i];
+  }
+  std::span<const std::size_t> shape(const std::size_t i) const noexcept;
+
+  // Tensor names in access order.
+  std::span<const std::string_view> names() const noexcept { return names_; }
+
+  // `__metadata__` pairs, sorted by key.
+  std::span<const MetadataPair> metadata() const noexcept { return metadata_; }
+  std::optional<std::string_view> metadata(std::string_view key) const;
+
+  // Another handle on the same arena, kept alive by both. Nothing is parsed
+  // or copied beyond the name and metadata tables.
+  TensorIndex share() const;
+
+  // The arena itself, e.g. to publish it for other processes.
+  std::span<const std::byte> blob() const noexcept;
+
+  // Attaches to an arena produced by `blob()`, in place. `owner` keeps the
+  // memory alive; the blob must be 8-byte aligned. Bounds are checked,
+  // tensor offsets included, which must tile [0, buffer_size()) as in a
+  // parsed header, so that a corrupt or truncated blob throws
+  // std::runtime_error instead of being read, or viewed, out of range.
+  static TensorIndex from_blob(std::shared_ptr<const void> owner,
+                               std::span<const std::byte> blob);
+
+ private:
+  struct Layout;
+
+  const Layout& layout() const noexcept;
+  const Entry* entries() const noexcept;
+
+  void attach(std::shared_ptr<const void> owner, const std::byte* blob);
+
+  std::shared_ptr<const void> owner_;
+  const std::byte* blob_ = nullptr;
+  std::vector<std::string_view> names_;
+  std::vector<MetadataPair> metadata_;
+};
+
+// Collects tensors and metadata, then lays them out into a TensorIndex.
+class TensorIndex::Builder {
+ public:
+  void reserve(const std::size_t tensors, const std::size_t name_bytes);
+
+  void addTensor(std::string_view name,
+                 const Dtype dtype,
+                 std::span<const std::size_t> shape,
+                 const std::size_t begin,
+                 const std::size_t end);
+  void addMetadata(std::string_view key, std::string_view value);
+
+  // Sorts tensors by data offset and builds the lookup table. Throws
+  // std::runtime_error on duplicate names or on contiguity violations when
+  // `check_offsets` is set (see `SafeTensors::validate`).
+  TensorIndex build(const std::size_t header_size, const bool check_offsets);
+
+ private:
+  std::vector<Entry> entries_;
+  std::vector<MetadataEntry> metadata_;
+  std::vector<std::size_t> shapes_;
+  std::string strings_;
+};
+
+}  // namespace safetensors
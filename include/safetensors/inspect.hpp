@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+#include "safetensors/index.hpp"
+#include "safetensors/reader.hpp"
+
+namespace safetensors {
+
+struct InspectOptions {
+  // Also require the file to be exactly the header plus the buffer it
+  // describes, as SafeOpen does. Needs the file size, which a local file
+  // has anyway but an object store answers with a separate request.
+  bool validate_size = false;
+  // Bytes requested with the length prefix, so that most headers arrive in
+  // the same read. Larger headers take one more read.
+  std::size_t first_read = 64 << 10;
+};
+
+// Names, dtypes, shapes, offsets and `__metadata__` of a checkpoint without
+// opening it for data: only the length prefix and the JSON header are read,
+// nothing is mapped. The header is checked as by the native parser (dtype
+// names, UTF-8, shape/size consistency, contiguous offsets, duplicates).
+// Throws std::runtime_error on I/O errors and invalid headers.
+TensorIndex inspect(const std::filesystem::path& path,
+                    const InspectOptions& options = {});
+
+// The same through any Reader, e.g. one serving range requests.
+TensorIndex inspect(const Reader& reader, const InspectOptions& options = {});
+
+}  // namespace safetensors
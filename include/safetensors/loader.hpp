@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <span>
+#include <string_view>
+
+#include "safetensors/safetensors.hpp"
+
+namespace safetensors {
+
+struct LoaderOptions {
+  // Tensors read or staged but not yet released by the consumer.
+  std::size_t max_in_flight = 4;
+  // Bytes of staging memory handed out at once. A tensor larger than this
+  // is still loaded, but only when nothing else is staged.
+  std::size_t staging_bytes = 256 << 20;
+  // Threads issuing reads.
+  std::size_t threads = 2;
+  // Staging memory, e.g. cudaHostAlloc/cudaFreeHost for pinned buffers.
+  // Buffers are reused, so these are called rarely. Defaults to page
+  // aligned heap memory.
+  std::function<void*(std::size_t)> allocate;
+  std::function<void(void*, std::size_t)> deallocate;
+};
+
+struct LoaderStats {
+  std::size_t tensors = 0;
+  std::size_t bytes = 0;
+  // Summed over reader threads.
+  double read_seconds = 0.0;
+  std::size_t peak_staged_bytes = 0;
+};
+
+// A tensor copied into staging memory. Its buffer goes back to the loader,
+// and the next read may start, when this is destroyed.
+class LoadedTensor {
+ public:
+  LoadedTensor() noexcept;
+  LoadedTensor(LoadedTensor&&) noexcept;
+  LoadedTensor& operator=(LoadedTensor&&) noexcept;
+  ~LoadedTensor();
+
+  std::string_view key() const noexcept { return key_; }
+  // `data_ptr` points into the staging buffer.
+  const SafeOpen::TensorView& view() const noexcept { return view_; }
+  std::span<const std::byte> data() const noexcept {
+    return {static_cast<const std::byte*>(view_.data_ptr), view_.data_len};
+  }
+
+ private:
+  friend class AsyncLoader;
+  struct Lease;
+
+  std::string_view key_;
+  SafeOpen::TensorView view_;
+  std::unique_ptr<Lease> lease_;
+};
+
+// Loads tensors of a SafeOpen on background threads so that disk reads
+// overlap with whatever the consumer does with the data, e.g. host to
+// device copies. Loads start in submission order as soon as both
+// `max_in_flight` and `staging_bytes` allow.
+//
+// The SafeOpen must outlive the loader. Results that are never released
+// hold on to their share of the budget, so waiting for a later future
+// while keeping earlier tensors alive can block once the budget is used
+// up.
+class AsyncLoader {
+ public:
+  explicit AsyncLoader(const SafeOpen& file,
+                       const LoaderOptions& options = {});
+
+  AsyncLoader(const AsyncLoader&) = delete;
+  AsyncLoader& operator=(const AsyncLoader&) = delete;
+
+  // Loads that have not started are dropped (their futures report
+  // std::future_errc::broken_promise); running ones are finished.
+  ~AsyncLoader();
+
+  // Throws immediately if `key` is not found or was unmapped. The tensor
+  // counts as consumed, see `SafeOpen::release_consumed()`, once it is
+  // read rather than when it is submitted.
+  std::future<LoadedTensor> load(std::string_view key);
+
+  // Calls `done` on a loader thread once the tensor is staged. The buffer
+  // is released when the LoadedTensor passed to `done` is destroyed,
+  // typically when `done` returns. Errors, including exceptions thrown by
+  // `done`, are rethrown by `wait()`.
+  void load(std::string_view key, std::function<void(LoadedTensor)> done);
+
+  // Blocks until every submitted load has been delivered and rethrows the
+  // first error of a callback load.
+  void wait();
+
+  LoaderStats stats() const;
+
+ private:
+  friend class LoadedTensor;
+  struct State;
+
+  void load(std::string_view key, std::promise<LoadedTensor> promise,
+            std::function<void(LoadedTensor)> done);
+
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace safetensors
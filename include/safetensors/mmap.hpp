@@ -26,6 +26,8 @@
 #include <cstdint>
 #include <filesystem>
 #include <memory>
+#include <span>
+#include <utility>
 #include <vector>
 
 namespace safetensors {
@@ -60,15 +62,42 @@ class File {
   void writeRaw(const void *ptr, const std::size_t len) const;
   void writeU32(const std::uint32_t val) const;
 
+  // Positioned write that leaves the stream position alone (pwrite).
+  // Safe to call from several threads for disjoint ranges.
+  void writeAt(const void *ptr, const std::size_t len,
+               const std::size_t offset) const;
+  // Flushes buffered writes and waits until the data is on disk.
+  void sync() const;
+  // Sets the size to `len` bytes, allocating the blocks up front where
+  // the file system supports it.
+  void reserve(const std::size_t len) const;
+
  private:
   struct impl;
   std::unique_ptr<impl> pimpl;
 };
 
+// How Mmap backs a mapping with huge pages. Both modes fall back to normal
+// pages where the system has none to give; `hugePageBytes()` tells.
+enum class HugePages {
+  None,
+  // Transparent huge pages on the file mapping itself (MADV_HUGEPAGE, and
+  // MADV_COLLAPSE over the prefetched range). The page cache must support
+  // large folios for this file, e.g. tmpfs with huge pages or a kernel built
+  // with CONFIG_READ_ONLY_THP_FOR_FS.
+  Advise,
+  // Reads the file into anonymous memory taken from the hugetlbfs pool
+  // (MAP_HUGETLB) or, when no pages are reserved, from transparent huge
+  // pages. The copy is private, so it is not shared with other processes
+  // through the page cache and discardFragment cannot drop it.
+  Copy,
+};
+
 struct Mmap {
   explicit Mmap(File *file,
                 const std::size_t prefetch = (std::size_t)-1,
-                const bool numa = false);
+                const bool numa = false,
+                const HugePages huge_pages = HugePages::None);
   Mmap(const Mmap &) = delete;
   Mmap &operator=(const Mmap &) = delete;
 
@@ -81,7 +110,46 @@ struct Mmap {
   void *addr() const;
   std::uint8_t *data() const;
 
-  void unmapFragment(const std::size_t first, const std::size_t last);
+  // Both release the pages fully inside [first, last) and return how many
+  // bytes that was. unmapFragment also gives up the address range, so the
+  // bytes must not be read again; after discardFragment (MADV_DONTNEED) they
+  // are faulted back in from the file on the next access.
+  std::size_t unmapFragment(const std::size_t first, const std::size_t last);
+  std::size_t discardFragment(const std::size_t first, const std::size_t last);
+
+  // Faults [first, last) into the page cache and page tables before
+  // returning where the OS allows it (MADV_POPULATE_READ), otherwise issues
+  // an asynchronous read-ahead hint (WILLNEED / PrefetchVirtualMemory).
+  void prefetch(const std::size_t first, const std::size_t last) const;
+  // Asynchronous read-ahead hint for [first, last) only.
+  void willNeed(const std::size_t first, const std::size_t last) const;
+
+  // Places the pages overlapping [first, last) on NUMA node `node`. The
+  // page cache allocates on the faulting CPU's node whatever the mapping's
+  // policy says, so the pages are faulted in first and then migrated
+  // (numa_bind with `move`). False if the kernel refused.
+  bool bindNode(const std::size_t first, const std::size_t last,
+                const int node) const;
+
+  // Bytes of [first, last) whose pages are resident: in the page cache for
+  // a file mapping (mincore), in this process's working set on Windows
+  // (QueryWorkingSetEx). Page granular but clipped to the range, so a page
+  // shared by two ranges counts for both. Unmapped pages count as absent.
+  std::size_t residentBytes(const std::size_t first,
+                            const std::size_t last) const;
+  // Same for many ranges at once, into `out[i]` for `ranges[i]`. Ranges
+  // sorted by offset take one query per window of pages.
+  void residentBytes(
+      std::span<const std::pair<std::size_t, std::size_t>> ranges,
+      std::span<std::size_t> out) const;
+
+  // Bytes of the mapping currently backed by huge pages (Linux only,
+  // from /proc/self/smaps; 0 elsewhere).
+  std::size_t hugePageBytes() const;
+
+  static std::size_t pageSize();
+  // Size of a PMD-level transparent huge page, typically 2 MiB.
+  static std::size_t hugePageSize();
 
   static const bool SUPPORTED;
 
@@ -97,12 +165,17 @@ struct Mlock {
   Mlock(const Mlock &) = delete;
   Mlock &operator=(const Mlock &) = delete;
 
-  Mlock(Mlock &&) = default;
-  Mlock &operator=(Mlock &&) = default;
+  Mlock(Mlock &&) noexcept;
+  Mlock &operator=(Mlock &&) noexcept;
 
   void init(void *ptr);
   void growTo(const std::size_t target_size);
 
+  // Bytes locked from `ptr` on, rounded to pages. Once a lock has failed,
+  // later `growTo` calls do nothing.
+  std::size_t size() const;
+  bool failed() const;
+
   static const bool SUPPORTED;
 
  private:
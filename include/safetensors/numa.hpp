@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+namespace safetensors {
+
+// NUMA placement through the raw Linux system calls (mbind, move_pages), so
+// there is no libnuma dependency. Elsewhere every call succeeds trivially
+// and memory is reported on node 0.
+
+// Number of NUMA nodes, 1 when the system has no NUMA information.
+std::size_t numa_nodes();
+
+// Node holding the page at `ptr`, or -1 if it is not resident. Does not
+// fault the page in.
+int numa_node_of(const void* ptr);
+
+// Restricts [ptr, ptr + len), widened to whole pages, to `node`
+// (MPOL_BIND). Pages faulted in later are placed on `node`; with `move`,
+// pages already resident and mapped only by this process are migrated.
+// Returns false, after printing a warning, if the kernel refused.
+bool numa_bind(const void* ptr, std::size_t len, int node, bool move);
+
+// Page aligned anonymous memory whose pages are allocated on one node.
+class NodeBuffer {
+ public:
+  NodeBuffer() = default;
+  NodeBuffer(std::size_t size, int node);
+
+  NodeBuffer(const NodeBuffer&) = delete;
+  NodeBuffer& operator=(const NodeBuffer&) = delete;
+
+  NodeBuffer(NodeBuffer&& other) noexcept;
+  NodeBuffer& operator=(NodeBuffer&& other) noexcept;
+
+  ~NodeBuffer();
+
+  std::span<std::byte> bytes() const noexcept { return {data_, size_}; }
+  int node() const noexcept { return node_; }
+
+ private:
+  std::byte* data_ = nullptr;
+  std::size_t size_ = 0;
+  int node_ = 0;
+};
+
+}  // namespace safetensors
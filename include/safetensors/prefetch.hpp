@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <span>
+
+#include "safetensors/mmap.hpp"
+
+namespace safetensors {
+
+// Absolute byte range [first, last) of a mapped file.
+struct ByteRange {
+  std::size_t first = 0;
+  std::size_t last = 0;
+};
+
+enum class Prefault {
+  // Mmap::prefetch per work item: MADV_POPULATE_READ where available,
+  // otherwise an asynchronous read-ahead hint.
+  Populate,
+  // Read one byte per page. Portable and always synchronous.
+  Touch,
+  // Mmap::willNeed per work item: queue read-ahead and return immediately.
+  Advise,
+};
+
+struct PrefetchOptions {
+  // Worker threads; 0 picks the hardware concurrency.
+  std::size_t threads = 0;
+  Prefault mode = Prefault::Populate;
+  // Ranges are handed out in access order and grouped into work items of
+  // about this size. Ranges larger than this are split at page boundaries.
+  std::size_t chunk_bytes = 16 << 20;
+  // Called after every work item with (bytes done, bytes total). Calls are
+  // serialized but come from the worker threads.
+  std::function<void(std::size_t, std::size_t)> progress;
+};
+
+struct PrefetchStats {
+  std::size_t bytes = 0;
+  std::size_t ranges = 0;
+  std::size_t threads = 0;
+  double seconds = 0.0;
+
+  // Bytes per second.
+  double bandwidth() const noexcept {
+    return seconds > 0.0 ? static_cast<double>(bytes) / seconds : 0.0;
+  }
+};
+
+// Prefaults `ranges` of `mmap` on a pool of worker threads. `ranges` must be
+// sorted and non-overlapping, e.g. tensors in data order.
+PrefetchStats prefetch_ranges(const Mmap& mmap,
+                              std::span<const ByteRange> ranges,
+                              const PrefetchOptions& options = {});
+
+}  // namespace safetensors
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+#include "safetensors/mmap.hpp"
+
+namespace safetensors {
+
+// One positional read: `size` bytes at `offset` of the file into `dst`.
+struct ReadRequest {
+  std::size_t offset = 0;
+  std::size_t size = 0;
+  void* dst = nullptr;
+};
+
+enum class IoBackend {
+  // memcpy out of a shared mapping; pages are faulted in on first touch.
+  Mmap,
+  // pread(2) through the page cache (ReadFile on Windows).
+  Buffered,
+  // O_DIRECT reads that bypass the page cache, submitted through io_uring
+  // where the kernel allows it and from a pool of pread threads otherwise.
+  // Falls back to Buffered if the file system does not support O_DIRECT.
+  Direct,
+  // Range requests to a remote object, see remote.hpp. `open_reader` does
+  // not open these.
+  Remote,
+};
+
+struct ReaderOptions {
+  IoBackend backend = IoBackend::Mmap;
+  // Reads kept in flight: io_uring queue depth, or pread threads.
+  std::size_t queue_depth = 64;
+  // Requests are split into reads of at most this many bytes.
+  std::size_t block_size = 1 << 20;
+};
+
+// Reads byte ranges of a file into caller-provided memory.
+class Reader {
+ public:
+  virtual ~Reader() = default;
+
+  virtual std::size_t size() const noexcept = 0;
+
+  // The backend in use, which may differ from the requested one after a
+  // fallback.
+  virtual IoBackend backend() const noexcept = 0;
+
+  // Completes every request before returning. Requests may be in any order
+  // and destinations need no particular alignment. Throws
+  // std::runtime_error on I/O errors and on ranges past the end of the
+  // file. Safe to call from several threads at once.
+  virtual void read(std::span<const ReadRequest> requests) const = 0;
+};
+
+std::unique_ptr<Reader> open_reader(const std::filesystem::path& path,
+                                    const ReaderOptions& options = {});
+
+// Serves `requests` from an existing mapping with a parallel memcpy, split
+// like the other backends. Offsets are relative to the start of `mmap`.
+void read_mapped(const Mmap& mmap, std::span<const ReadRequest> requests,
+                 const ReaderOptions& options = {});
+
+}  // namespace safetensors
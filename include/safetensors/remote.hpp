@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "safetensors/index.hpp"
+#include "safetensors/inspect.hpp"
+#include "safetensors/reader.hpp"
+
+namespace safetensors {
+
+// Copies bytes [offset, offset + size) of a remote object into `dst`, e.g.
+// with one ranged GET. Called from several threads at once; throws
+// std::runtime_error on failure.
+using RangeFetch =
+    std::function<void(std::size_t offset, std::size_t size, void* dst)>;
+
+struct RemoteOptions {
+  // Range requests kept in flight, one connection each.
+  std::size_t connections = 32;
+  // Requests are split into ranges of at most this many bytes, so that a
+  // large tensor downloads over several connections.
+  std::size_t block_size = 8 << 20;
+  // Tensors separated by at most this many bytes are fetched as one range
+  // and the bytes between them dropped: a round trip costs more than a
+  // few KiB of transfer. 0 only merges touching tensors.
+  std::size_t merge_gap = 64 << 10;
+  // Further attempts at a range after a failed fetch, waiting 50 ms before
+  // the first and twice as long before each next one, at most 3.2 s.
+  std::size_t retries = 3;
+  // Bytes fetched by `open_http_reader` together with the object size and
+  // kept, so that `inspect` usually finds the whole header in them.
+  std::size_t prefix = 64 << 10;
+  // Send and receive timeout of the HTTP client, in milliseconds.
+  std::size_t timeout_ms = 30000;
+  // Extra request headers for the HTTP client, e.g. "Authorization: ...".
+  std::vector<std::string> headers;
+};
+
+// A Reader over `fetch` for an object of `size` bytes. Each batch is sorted
+// by offset and merged into ranges as described in RemoteOptions, which
+// are fetched on `connections` threads and scattered to the destinations.
+// `prefix`, if given, holds the first bytes of the object and serves
+// reads that fall inside it.
+std::unique_ptr<Reader> open_remote_reader(
+    std::size_t size, RangeFetch fetch, const RemoteOptions& options = {},
+    std::vector<std::byte> prefix = {});
+
+// A Reader for `http://host[:port]/path` built on a small HTTP/1.1 client
+// with keep-alive connections; presigned S3 and GCS URLs work through a
+// plain HTTP endpoint or proxy. The first request learns the object size
+// and fetches `RemoteOptions::prefix`. TLS is not built in: for https
+// pass a RangeFetch over the client of your choice to
+// `open_remote_reader`. Throws std::invalid_argument for other schemes and
+// std::runtime_error if the server does not answer range requests.
+std::unique_ptr<Reader> open_http_reader(std::string_view url,
+                                         const RemoteOptions& options = {});
+
+// A checkpoint read through a Reader without mapping it, e.g. straight
+// from object storage into device staging buffers. The header costs one
+// range request, more only when it is larger than what the first one
+// returns; tensors are fetched on demand. Thread safe.
+class RemoteOpen {
+ public:
+  using MetadataPair = TensorIndex::MetadataPair;
+
+  struct TensorInfo {
+    // Points into the index arena; as with `parse_header`, the last
+    // dimension of F4 is halved.
+    std::span<const std::size_t> shape;
+    Dtype dtype;
+    // Offset of the data in the object.
+    std::size_t offset = 0;
+    std::size_t data_len = 0;
+  };
+
+  // Destination of one tensor in a batched `read_into`.
+  struct TensorRead {
+    std::string_view key;
+    std::span<std::byte> dst;
+  };
+
+  // Parses the header as `inspect` does, checking by default that the
+  // object is exactly as long as the header says.
+  explicit RemoteOpen(std::unique_ptr<Reader> reader,
+                      const InspectOptions& options = {true});
+
+  // Tensor names, sorted by data offset, with SafeWriter's padding
+  // fillers as in `SafeOpen::keys()`.
+  std::span<const std::string_view> keys() const noexcept;
+
+  std::optional<TensorInfo> find_tensor(std::string_view key) const noexcept;
+  // Throws std::runtime_error if `key` is not found.
+  TensorInfo get_tensor(std::string_view key) const;
+
+  // Fetches `key` into `dst`, which must hold `data_len` bytes. Throws if
+  // `key` is not found, `dst` is too small or a fetch fails.
+  void read_into(std::string_view key, std::span<std::byte> dst) const;
+  // Same for several tensors in one batch, so that neighbours come in the
+  // same range request and the ranges download in parallel.
+  void read_into(std::span<const TensorRead> reads) const;
+
+  std::span<const MetadataPair> get_metadata() const noexcept;
+  std::optional<std::string_view> get_metadata(std::string_view key) const;
+
+  const TensorIndex& index() const noexcept { return index_; }
+  const Reader& reader() const noexcept { return *reader_; }
+
+ private:
+  std::unique_ptr<Reader> reader_;
+  TensorIndex index_;
+};
+
+}  // namespace safetensors
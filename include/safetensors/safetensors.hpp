@@ -5,85 +5,323 @@
 
 #pragma once
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
 #include <vector>
-#include <algorithm>
-#include <unordered_map>
 
 #include "fmt/format.h"
 #include "rust/cxx.h"
+#include "safetensors/cache.hpp"
+#include "safetensors/checksum.hpp"
+#include "safetensors/convert.hpp"
+#include "safetensors/header.hpp"
+#include "safetensors/index.hpp"
 #include "safetensors/mmap.hpp"
+#include "safetensors/numa.hpp"
+#include "safetensors/prefetch.hpp"
+#include "safetensors/reader.hpp"
+#include "safetensors/sidecar.hpp"
+#include "safetensors/trace.hpp"
 #include "safetensors_abi/lib.h"
 
 namespace safetensors {
 
-constexpr std::size_t N_LEN = 8;
+// Which tensors SafeOpen pins in RAM with mlock, so that memory pressure
+// cannot evict them. Needs RLIMIT_MEMLOCK (ulimit -l) to cover the bytes;
+// what did not fit shows up in `SafeOpen::mlock_stats()`.
+enum class MlockPolicy {
+  None,
+  All,
+  // Tensors whose name matches `OpenOptions::mlock_filter`.
+  Filter,
+  // The first `OpenOptions::mlock_bytes` of tensor data in access order.
+  Prefix,
+};
+
+// Page rounded, so neighbouring tensors may count a shared page twice.
+struct MlockStats {
+  std::size_t locked_bytes = 0;
+  std::size_t failed_bytes = 0;
+};
+
+struct OpenOptions {
+  // The default of parse_header and CheckpointOptions as well.
+  HeaderParser parser = HeaderParser::Rust;
+  // Bytes from the start of the file to populate while mapping, see Mmap.
+  // Ignored unless `io.backend` is Mmap.
+  std::size_t prefetch = static_cast<std::size_t>(-1);
+  // If set, nothing is populated while mapping; instead read-ahead is queued
+  // for the tensors whose name matches, e.g. the layers owned by this rank.
+  std::function<bool(std::string_view)> prefetch_filter;
+  // Backend used by `read_into`. Views always point into the mapping.
+  ReaderOptions io;
+  // Huge pages for the mapping, see HugePages and `huge_page_bytes()`.
+  HugePages huge_pages = HugePages::None;
+  MlockPolicy mlock = MlockPolicy::None;
+  std::function<bool(std::string_view)> mlock_filter;
+  std::size_t mlock_bytes = 0;
+  // Share the mapping and the parsed index with other instances, see
+  // CheckpointCache. Release::Unmap then only discards pages, and since the
+  // kernel does not count locks, an instance unlocking on destruction also
+  // unlocks pages that others share with it.
+  CheckpointCache cache = CheckpointCache::None;
+  // Reopen through a binary index saved next to the file, or in
+  // `sidecar_dir` when set, instead of parsing the header; see
+  // `sidecar_path`. The first open writes it.
+  bool sidecar = false;
+  std::filesystem::path sidecar_dir;
+  // Timings, byte and fault counts and phase hooks, see `load_stats()`.
+  LoadTrace trace;
+  // Check every tensor against the checksums SafeWriter stored with
+  // `WriterOptions::checksums`, see `verify()`. This replaces populating
+  // `prefetch` bytes while mapping: the whole file is read instead, on all
+  // cores, and throws std::runtime_error if a tensor does not match or the
+  // file has no checksums.
+  bool verify = false;
+};
+
+// How SafeOpen::release gives pages back to the OS.
+enum class Release {
+  // MADV_DONTNEED: the tensor stays readable, its pages are faulted back in
+  // from the file if it is looked up again.
+  Discard,
+  // munmap: the address range is gone as well. find_tensor returns nullptr
+  // for the tensor afterwards and views obtained earlier must not be read.
+  // With a shared checkpoint (`OpenOptions::cache`) the pages are only
+  // discarded, though find_tensor still returns nullptr.
+  Unmap,
+};
 
+// Thread safety: the index and views are immutable once constructed and
+// every const member may be called from any number of threads at once;
+// lookups take no lock and allocate nothing. `release`, `release_consumed`,
+// `replicate` and `lock` may run concurrently with them and with each
+// other. Lookups then either see a tensor released with Release::Unmap as
+// gone or return it, so the caller still has to make sure that no thread
+// reads a tensor while another unmaps it. Moving and destroying a SafeOpen
+// need exclusive access.
 class SafeOpen {
  public:
   struct TensorView {
+    // Points into the index arena; valid for the lifetime of the SafeOpen.
+    // As with `parse_header`, the last dimension of F4 is halved, so use
+    // the accessors below for the logical layout.
+    std::span<const std::size_t> shape;
+    Dtype dtype;
+    const void* data_ptr = nullptr;
+    std::size_t data_len = 0;
+
+    // Logical element count, counting every packed F4 and F6 value.
+    std::size_t numel() const noexcept {
+      const std::size_t bits = bitsize(dtype);
+      return bits ? data_len * 8 / bits : 0;
+    }
+
+    // Rows are the slices along the last dimension; a scalar is one row.
+    std::size_t rows() const noexcept {
+      std::size_t n = 1;
+      for (std::size_t i = 0; i + 1 < shape.size(); ++i) n *= shape[i];
+      return n;
+    }
+
+    // Logical length of the last dimension.
+    std::size_t row_elements() const noexcept {
+      const std::size_t n = rows();
+      if (n) return numel() / n;
+      if (shape.empty()) return 1;
+      return dtype == Dtype::F4 ? shape.back() * 2 : shape.back();
+    }
+
+    // Packed bytes from one row to the next, 0 if the rows of a sub-byte
+    // tensor do not start on a byte boundary.
+    std::size_t row_stride() const noexcept {
+      const std::size_t bits = row_elements() * bitsize(dtype);
+      return bits % 8 ? 0 : bits / 8;
+    }
+
+    // Start of row `i`; requires a non-zero `row_stride()`.
+    const void* row(const std::size_t i) const noexcept {
+      return static_cast<const std::byte*>(data_ptr) + i * row_stride();
+    }
+
+    // The data as `T`, whose dtype must be this one (see `dtype_of`).
+    // Throws std::runtime_error if the dtype differs, or if the data is not
+    // aligned for `T`: a header length that is not a multiple of 8 shifts
+    // every tensor, see `SafeOpen::alignment()`. `key` only names the
+    // tensor in the message.
+    template <tensor_element T>
+    std::span<const T> as(std::string_view key = {}) const {
+      if (dtype != dtype_of_v<T>)
+        throw std::runtime_error(
+            fmt::format("{}:{} '{}' is {}, not {}", __FILE__, __LINE__, key,
+                        to_string(dtype), to_string(dtype_of_v<T>)));
+      if (reinterpret_cast<std::uintptr_t>(data_ptr) % alignof(T))
+        throw std::runtime_error(fmt::format(
+            "{}:{} '{}' is not aligned to {} bytes for {}, copy it with "
+            "read_into",
+            __FILE__, __LINE__, key, alignof(T), to_string(dtype)));
+      return {static_cast<const T*>(data_ptr), data_len / sizeof(T)};
+    }
+  };
+
+  using MetadataPair = TensorIndex::MetadataPair;
+
+  // Destination of one tensor in a batched `read_into`.
+  struct TensorRead {
+    std::string_view key;
+    std::span<std::byte> dst;
+  };
+
+  // Range [start, stop) of one dimension for `slice`, in logical elements.
+  struct SliceRange {
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+    std::size_t start = 0;
+    // npos selects up to the end of the dimension.
+    std::size_t stop = npos;
+  };
+
+  // A box of a tensor, viewed in place on the mapping. Strides count
+  // elements as in DLPack: index (i, j, ...) is `i * strides[0] + j *
+  // strides[1] + ...` elements past `data_ptr`.
+  struct SliceView {
     std::vector<std::size_t> shape;
+    std::vector<std::size_t> strides;
     Dtype dtype;
     const void* data_ptr = nullptr;
+    // Bytes of the slice once gathered, see `read_slice`.
     std::size_t data_len = 0;
+
+    std::size_t numel() const noexcept {
+      std::size_t n = 1;
+      for (std::size_t d : shape) n *= d;
+      return n;
+    }
+
+    // True if the slice is one run of memory, e.g. a block of rows.
+    bool contiguous() const noexcept {
+      if (numel() == 0) return true;
+      std::size_t run = 1;
+      for (std::size_t k = shape.size(); k-- > 0;) {
+        if (shape[k] != 1 && strides[k] != run) return false;
+        run *= shape[k];
+      }
+      return true;
+    }
   };
 
-  explicit SafeOpen(const std::string& filename)
-      : file_ptr_(std::make_unique<File>(filename)) {
-    mmap_ptr_ = std::make_unique<Mmap>(file_ptr_.get());
+  explicit SafeOpen(const std::string& filename,
+                    const OpenOptions& options = {})
+      : io_(options.io),
+        shared_(options.cache != CheckpointCache::None),
+        tracing_(options.trace.enabled || options.trace.begin ||
+                 options.trace.end || options.trace.first_touch),
+        touch_(options.trace.first_touch) {
+    const auto start = std::chrono::steady_clock::now();
+    if (tracing_) {
+      sync_->trace = options.trace;
+      sync_->faults = fault_counts();
+    }
+    LoadStats& stats = sync_->opened;
+    const bool populate = !options.prefetch_filter && !options.verify &&
+                          options.io.backend == IoBackend::Mmap;
+    const std::size_t prefetch = populate ? options.prefetch : 0;
+    if (shared_) {
+      phase("map", &stats.map, [&] {
+        CheckpointOptions checkpoint;
+        checkpoint.parser = options.parser;
+        checkpoint.huge_pages = options.huge_pages;
+        checkpoint.prefetch = prefetch;
+        checkpoint.shared_memory =
+            options.cache == CheckpointCache::SharedMemory;
+        if (options.sidecar) {
+          checkpoint.sidecar = sidecar_path(filename, options.sidecar_dir);
+        }
+        std::shared_ptr<Checkpoint> c = open_checkpoint(filename, checkpoint);
+        file_ptr_ = std::shared_ptr<File>(c, c->file.get());
+        mmap_ptr_ = std::shared_ptr<Mmap>(c, c->mmap.get());
+        index_ = c->index.share();
+      });
+    } else {
+      phase("map", &stats.map, [&] {
+        file_ptr_ = std::make_shared<File>(filename);
+        mmap_ptr_ = std::make_shared<Mmap>(file_ptr_.get(), prefetch, false,
+                                           options.huge_pages);
+      });
+      if (mmap_ptr_->size() < N_LEN) {
+        throw std::runtime_error(fmt::format(
+            "{}:{} file {} is too small: {} < {}", __FILE__, __LINE__,
+            filename, mmap_ptr_->size(), N_LEN));
+      }
+      phase("parse", &stats.parse, [&] {
+        index_ = parse_header_cached(
+            filename, mmap_ptr_->data(), mmap_ptr_->size(), options.parser,
+            options.sidecar ? sidecar_path(filename, options.sidecar_dir)
+                            : std::filesystem::path{});
+      });
+    }
+    stats.bytes_populated = std::min(prefetch, mmap_ptr_->size());
 
-    if (mmap_ptr_->size() < N_LEN) {
-      throw std::runtime_error(
-          fmt::format("{}:{} file {} is too small: {} < {}", __FILE__, __LINE__,
-                      filename, mmap_ptr_->size(), N_LEN));
-    }
-
-    buffer_ = rust::Slice<std::uint8_t const>(*mmap_ptr_);
-
-    tensor_views_ = deserialize(buffer_);
-    metadata_ = metadata(buffer_);
-
-    metadata_map_.reserve(metadata_.size());
-    for (const auto& pair : metadata_) {
-      std::string key(pair.key.data(), pair.key.size());
-      std::string value(pair.value.data(), pair.value.size());
-      metadata_map_[std::move(key)] = std::move(value);
-    }
-
-    std::vector<std::pair<std::string, TensorView>> tensor_views_vector;
-
-    tensor_views_vector.reserve(tensor_views_.size());
-    for (const auto& pair : tensor_views_) {
-      std::vector<std::size_t> shape(
-          pair.value.shape.begin(),
-          pair.value.shape.end());
-      Dtype dtype = pair.value.dtype;
-      const void* data_ptr = pair.value.data.data();
-      std::size_t data_len = pair.value.data_len;
-      std::string key(pair.key.data(), pair.key.size());
-      // TODO(dp): check the access order 
-      tensor_views_vector.emplace_back(
-          std::make_pair(std::move(key), TensorView{std::move(shape), dtype, data_ptr,
-                                         data_len}));
-      // tensor_views_map_[key] =
-      //     TensorView{std::move(shape), dtype, data_ptr, data_len,
-      //                std::move(data_offsets)};
-      // keys_.emplace_back(std::move(key));
-    }
-
-    std::sort(tensor_views_vector.begin(), tensor_views_vector.end(),
-              [](const auto& a, const auto& b) {
-                return a.second.data_ptr < b.second.data_ptr;
-              });
+    phase("index", &stats.index, [&] {
+      const std::uint8_t* data = mmap_ptr_->data() + index_.data_offset();
+      state_ = std::make_unique<std::atomic<std::uint8_t>[]>(index_.size());
+      views_.reserve(index_.size());
+      for (std::size_t i = 0; i < index_.size(); ++i) {
+        const TensorIndex::Entry& e = index_.entry(i);
+        views_.push_back(
+            TensorView{index_.shape(i), e.dtype, data + e.begin,
+                       static_cast<std::size_t>(e.end - e.begin)});
+      }
+      alignment_ = detectAlignment();
+    });
 
-    for (const auto& pair : tensor_views_vector) {
-      // Store the tensor view in the map and keys vector
-      tensor_views_map_[pair.first] = pair.second;
-      keys_.emplace_back(pair.first);
+    if (options.verify) {
+      phase("verify", &stats.verify, [&] {
+        VerifyResult result = verify();
+        stats.bytes_populated = result.stats.bytes;
+        if (!result.ok()) {
+          std::string names;
+          for (std::size_t i = 0; i < result.mismatched.size() && i < 8; ++i) {
+            names += fmt::format("{}'{}'", i ? ", " : "", result.mismatched[i]);
+          }
+          throw std::runtime_error(fmt::format(
+              "{}:{} {} of {} tensors in {} do not match their checksum: {}{}",
+              __FILE__, __LINE__, result.mismatched.size(), result.tensors,
+              filename, names, result.mismatched.size() > 8 ? ", ..." : ""));
+        }
+      });
     }
+
+    if (options.mlock != MlockPolicy::None) {
+      phase("mlock", &stats.mlock, [&] { lockPolicy(options); });
+    }
+
+    if (options.io.backend != IoBackend::Mmap) {
+      reader_ = open_reader(filename, options.io);
+    }
+
+    if (options.prefetch_filter) {
+      std::chrono::nanoseconds advised{0};
+      phase("prefetch", &advised, [&] {
+        PrefetchOptions advise;
+        advise.threads = 1;
+        advise.mode = Prefault::Advise;
+        prefetch_if(options.prefetch_filter, advise);
+      });
+    }
+    if (tracing_) stats.total = std::chrono::steady_clock::now() - start;
   }
 
   SafeOpen(const SafeOpen&) = delete;
@@ -94,30 +332,1003 @@ class SafeOpen {
 
   ~SafeOpen() = default;
 
-  inline std::vector<std::string> keys() const noexcept{
-    return keys_;
+  // Tensor names, sorted by data offset (on-disk access order). A file
+  // written with `WriterOptions::alignment` also lists its zero-filled
+  // `__padding_<n>__` fillers here; skip names starting with
+  // PADDING_PREFIX to leave them out.
+  inline std::span<const std::string_view> keys() const noexcept {
+    return index_.names();
+  }
+
+  // Views in the same order as `keys()`, fillers included.
+  inline std::span<const TensorView> tensors() const noexcept {
+    return views_;
+  }
+
+  // Returns nullptr if `key` is absent or was released with Release::Unmap.
+  // One hash probe, no allocation. Marks the tensor as consumed, see
+  // `release_consumed()`.
+  inline const TensorView* find_tensor(std::string_view key) const noexcept {
+    return findView(key, touch_);
+  }
+
+  inline std::optional<TensorView> try_get_tensor(
+      std::string_view key) const noexcept {
+    const TensorView* view = find_tensor(key);
+    if (!view) return std::nullopt;
+    return *view;
+  }
+
+  const TensorView& get_tensor(std::string_view key) const {
+    const TensorView* view = find_tensor(key);
+    if (!view) throw missing(key);
+    return *view;
+  }
+
+  // `get_tensor(key).as<T>(key)`: the data of `key` as a span of `T`,
+  // checked against the dtype at compile time through `dtype_of` and at
+  // run time against the tensor. Throws std::runtime_error if `key` is not
+  // found, has another dtype or is misaligned for `T`.
+  template <tensor_element T>
+  std::span<const T> get_tensor(std::string_view key) const {
+    return get_tensor(key).as<T>(key);
+  }
+
+  // Copies the data of `key` into `dst`, which must hold `data_len` bytes,
+  // through the backend chosen in `OpenOptions::io`. With IoBackend::Direct
+  // the bytes bypass both the mapping and the page cache. Throws if `key`
+  // is not found or `dst` is too small.
+  void read_into(std::string_view key, std::span<std::byte> dst) const {
+    const TensorView& view = checkedView(key);
+    if (dst.size() < view.data_len)
+      throw std::runtime_error(
+          fmt::format("{}:{} buffer for '{}' is too small: {} < {}", __FILE__,
+                      __LINE__, key, dst.size(), view.data_len));
+    ReadRequest request{offset(view), view.data_len, dst.data()};
+    read({&request, 1});
+  }
+
+  // Same for several tensors in one batch, so that the backend can keep
+  // many reads in flight and merge tensors that are adjacent both on disk
+  // and in memory.
+  void read_into(std::span<const TensorRead> reads) const {
+    std::vector<ReadRequest> requests;
+    requests.reserve(reads.size());
+    for (const TensorRead& r : reads) {
+      const TensorView& view = checkedView(r.key);
+      if (r.dst.size() < view.data_len)
+        throw std::runtime_error(
+            fmt::format("{}:{} buffer for '{}' is too small: {} < {}",
+                        __FILE__, __LINE__, r.key, r.dst.size(),
+                        view.data_len));
+      requests.push_back(ReadRequest{offset(view), view.data_len,
+                                     r.dst.data()});
+    }
+    read(requests);
+  }
+
+  // Largest power of two that divides the file offset of every non-empty
+  // tensor, ignoring SafeWriter's `__padding_` fillers; 1 without tensors.
+  // Files written with `WriterOptions::alignment` report at least that.
+  inline std::size_t alignment() const noexcept { return alignment_; }
+
+  // Reads `key` converted to `to` (see convert.hpp) into `dst`, which holds
+  // the element count times the size of `to`. The conversion is the copy:
+  // with the Mmap backend it reads the mapping directly, other backends
+  // read through chunks small enough to stay in cache. A non-empty
+  // `scale_key` names the block scales of an MX tensor, one per `block`
+  // elements. Throws if a key is not found, the pair is not supported or a
+  // buffer is too small.
+  void read_converted(std::string_view key, const Dtype to,
+                      std::span<std::byte> dst,
+                      std::string_view scale_key = {},
+                      const std::size_t block = 32) const {
+    const TensorView& view = checkedView(key);
+    convertRange(key, view, 0, view.numel(), to, dst, scale_key, block);
+  }
+
+  // As `read_converted`, for rows [first, first + count) only, e.g. to
+  // dequantize the rows of an MXFP4 embedding that a batch looks up.
+  // Throws std::out_of_range past the last row, and if row `first` of a
+  // sub-byte tensor does not start on a byte boundary.
+  void read_rows(std::string_view key, const std::size_t first,
+                 const std::size_t count, const Dtype to,
+                 std::span<std::byte> dst, std::string_view scale_key = {},
+                 const std::size_t block = 32) const {
+    const TensorView& view = checkedView(key);
+    if (first > view.rows() || count > view.rows() - first)
+      throw std::out_of_range(
+          fmt::format("{}:{} rows [{}, {}) of '{}' out of range [0, {})",
+                      __FILE__, __LINE__, first, first + count, key,
+                      view.rows()));
+    const std::size_t n = view.row_elements();
+    if (first * n * bitsize(view.dtype) % 8)
+      throw std::out_of_range(fmt::format(
+          "{}:{} row {} of '{}' ({} x {}) does not start on a byte", __FILE__,
+          __LINE__, first, key, to_string(view.dtype), n));
+    convertRange(key, view, first * n, count * n, to, dst, scale_key, block);
+  }
+
+  // Views `key[ranges[0], ranges[1], ...]` without reading anything;
+  // dimensions without a range are taken whole. F4 and F6 slices must
+  // start every contiguous run on a byte, and end it on one unless the
+  // slice is a single run. Throws as `get_tensor` for keys not found,
+  // std::out_of_range for more ranges than dimensions and ranges past a
+  // dimension, and std::invalid_argument for sub-byte runs off a byte
+  // boundary.
+  SliceView slice(std::string_view key,
+                  std::span<const SliceRange> ranges) const {
+    const TensorView& view = checkedView(key);
+    if (ranges.size() > view.shape.size())
+      throw std::out_of_range(fmt::format(
+          "{}:{} {} ranges for '{}' with {} dimensions", __FILE__, __LINE__,
+          ranges.size(), key, view.shape.size()));
+
+    SliceView out;
+    out.dtype = view.dtype;
+    out.shape.assign(view.shape.begin(), view.shape.end());
+    if (!out.shape.empty()) out.shape.back() = view.row_elements();
+    out.strides.resize(out.shape.size());
+    std::size_t stride = 1;
+    std::size_t first = 0;
+    for (std::size_t k = out.shape.size(); k-- > 0;) {
+      out.strides[k] = stride;
+      const std::size_t dim = out.shape[k];
+      stride *= dim;
+      if (k >= ranges.size()) continue;
+      std::size_t start = ranges[k].start;
+      std::size_t stop =
+          ranges[k].stop == SliceRange::npos ? dim : ranges[k].stop;
+      if (stop > dim || start > stop)
+        throw std::out_of_range(fmt::format(
+            "{}:{} range [{}, {}) of dimension {} of '{}' out of [0, {})",
+            __FILE__, __LINE__, start, stop, k, key, dim));
+      first += start * out.strides[k];
+      out.shape[k] = stop - start;
+    }
+
+    const std::size_t bits = bitsize(view.dtype);
+    const std::size_t count = out.numel();
+    out.data_len = (count * bits + 7) / 8;
+    out.data_ptr = static_cast<const std::byte*>(view.data_ptr) +
+                   (count ? first * bits / 8 : 0);
+    if (bits % 8 && count) {
+      std::size_t runs = 0;
+      bool aligned = true;
+      forEachRun(out, [&](std::size_t offset, std::size_t n) {
+        ++runs;
+        aligned &= (first + offset) * bits % 8 == 0 && n * bits % 8 == 0;
+      });
+      if (runs == 1) aligned = first * bits % 8 == 0;
+      if (!aligned)
+        throw std::invalid_argument(fmt::format(
+            "{}:{} slice of {} tensor '{}' is not byte aligned", __FILE__,
+            __LINE__, to_string(view.dtype), key));
+    }
+    return out;
+  }
+
+  // Gathers `slice(key, ranges)` into `dst` in row-major order and returns
+  // the bytes written. Only the runs of the slice are read: with the Mmap
+  // backend only their pages are faulted in (open with `prefetch = 0` so
+  // the rest is not populated up front), other backends issue one read
+  // per run, merged where runs touch. Throws as `slice`, and if `dst` is
+  // too small.
+  std::size_t read_slice(std::string_view key,
+                         std::span<const SliceRange> ranges,
+                         std::span<std::byte> dst) const {
+    const SliceView box = slice(key, ranges);
+    if (dst.size() < box.data_len)
+      throw std::runtime_error(
+          fmt::format("{}:{} buffer for slice of '{}' is too small: {} < {}",
+                      __FILE__, __LINE__, key, dst.size(), box.data_len));
+    const std::size_t bits = bitsize(box.dtype);
+    const std::size_t base = static_cast<std::size_t>(
+        static_cast<const std::uint8_t*>(box.data_ptr) - mmap_ptr_->data());
+    std::vector<ReadRequest> requests;
+    std::size_t pos = 0;
+    forEachRun(box, [&](std::size_t offset, std::size_t n) {
+      const std::size_t len = (n * bits + 7) / 8;
+      requests.push_back(
+          ReadRequest{base + offset * bits / 8, len, dst.data() + pos});
+      pos += len;
+    });
+    read(requests);
+    return box.data_len;
+  }
+
+  // Bytes needed to pack `keys` into one slab with `read_packed`, assuming
+  // the slab itself is aligned to `alignment` (a power of two).
+  std::size_t packed_size(std::span<const std::string_view> keys,
+                          const std::size_t alignment = 64) const {
+    std::size_t size = 0;
+    for (std::string_view key : keys) {
+      size = alignUp(size, alignment) + checkedView(key).data_len;
+    }
+    if (alignment >= alignment_) size = alignUp(size, alignment_);
+    return size;
+  }
+
+  // Reads `keys` back to back into `slab`, e.g. a pinned host allocation
+  // that is uploaded to the device in one copy. Every tensor starts at an
+  // address aligned to `alignment`. Returns views into the slab in the
+  // order of `keys`. Throws if the slab is too small.
+  //
+  // When `alignment` is at least `alignment()`, each read is rounded up to
+  // the file's alignment within the slab's padding, so with
+  // IoBackend::Direct an aligned file is read straight into the slab with
+  // no staging copies, and neighbouring tensors merge into single reads.
+  std::vector<TensorView> read_packed(std::span<const std::string_view> keys,
+                                      std::span<std::byte> slab,
+                                      const std::size_t alignment = 64) const {
+    const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(slab.data());
+    std::vector<TensorView> views;
+    std::vector<ReadRequest> requests;
+    views.reserve(keys.size());
+    requests.reserve(keys.size());
+    std::size_t pos = 0;
+    for (std::string_view key : keys) {
+      const TensorView& view = checkedView(key);
+      pos = alignUp(base + pos, alignment) - base;
+      if (pos > slab.size() || slab.size() - pos < view.data_len)
+        throw std::runtime_error(
+            fmt::format("{}:{} slab of {} bytes is too small for '{}'",
+                        __FILE__, __LINE__, slab.size(), key));
+      TensorView packed = view;
+      packed.data_ptr = slab.data() + pos;
+      views.push_back(packed);
+      std::size_t len = view.data_len;
+      if (alignment >= alignment_) {
+        // The bytes past the tensor are padding both in the file and in
+        // the slab; the next slot starts no earlier.
+        len = std::min({alignUp(len, alignment_), slab.size() - pos,
+                        mmap_ptr_->size() - offset(view)});
+      }
+      requests.push_back(ReadRequest{offset(view), len, slab.data() + pos});
+      pos += view.data_len;
+    }
+    read(requests);
+    return views;
+  }
+
+  // `__metadata__` pairs, sorted by key.
+  inline std::span<const MetadataPair> get_metadata() const noexcept {
+    return index_.metadata();
+  }
+
+  inline std::optional<std::string_view> get_metadata(
+      std::string_view key) const {
+    return index_.metadata(key);
+  }
+
+  inline const TensorIndex& index() const noexcept { return index_; }
+
+  // Checks every tensor against the checksums under CHECKSUM_KEY, reading
+  // the data on `options.threads` threads; the pages stay populated as with
+  // `prefetch`. Tensors released with Release::Unmap cannot be read and
+  // count as `VerifyResult::skipped`. Throws std::runtime_error if the file
+  // has no checksums. Must not race with `release(Release::Unmap)`.
+  VerifyResult verify(const PrefetchOptions& options = {}) const {
+    return verify_checksums(index_, *mmap_ptr_, options,
+                            [this](std::size_t i) { return unmapped(i); });
+  }
+
+  // Prefaults every tensor on a pool of threads, splitting the work by
+  // tensor boundaries in access order. Useful for handles opened with
+  // `prefetch = 0`. Tensors released with Release::Unmap are skipped.
+  inline PrefetchStats prefetch(const PrefetchOptions& options = {}) const {
+    return prefetch_ranges(
+        *mmap_ptr_, mappedRanges([](std::size_t) { return true; }), options);
+  }
+
+  // Same, restricted to `keys`. Throws if a key is not found.
+  PrefetchStats prefetch(std::span<const std::string_view> keys,
+                         const PrefetchOptions& options = {}) const {
+    std::vector<bool> selected(views_.size());
+    for (std::string_view key : keys) {
+      std::size_t i = index_.find(key);
+      if (i == TensorIndex::npos)
+        throw std::runtime_error(
+            fmt::format("{}:{} key '{}' not found", __FILE__, __LINE__, key));
+      selected[i] = true;
+    }
+    return prefetch_ranges(
+        *mmap_ptr_, mappedRanges([&](std::size_t i) { return selected[i]; }),
+        options);
+  }
+
+  // Same, restricted to the tensors whose name satisfies `pred`.
+  template <typename Pred>
+  PrefetchStats prefetch_if(Pred&& pred,
+                            const PrefetchOptions& options = {}) const {
+    return prefetch_ranges(
+        *mmap_ptr_,
+        mappedRanges([&](std::size_t i) { return pred(index_.name(i)); }),
+        options);
+  }
+
+  // Gives the pages of `key` back to the OS once its data has been copied
+  // out, e.g. uploaded to a device. Only whole pages are released: a page
+  // shared with a neighbouring tensor is kept until that one is released
+  // too. Returns the number of bytes released. Throws if `key` is not found.
+  std::size_t release(std::string_view key, Release mode = Release::Discard) {
+    std::size_t i = index_.find(key);
+    if (i == TensorIndex::npos)
+      throw std::runtime_error(
+          fmt::format("{}:{} key '{}' not found", __FILE__, __LINE__, key));
+    return releaseRun(i, i + 1, mode);
+  }
+
+  // Releases every tensor looked up since it was last released. Calling it
+  // after each layer keeps resident memory near one layer when streaming a
+  // checkpoint to a device.
+  std::size_t release_consumed(Release mode = Release::Discard) {
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < views_.size();) {
+      if (state_[i].load(std::memory_order_relaxed) != kConsumed) {
+        ++i;
+        continue;
+      }
+      std::size_t j = i + 1;
+      while (j < views_.size() &&
+             state_[j].load(std::memory_order_relaxed) == kConsumed) {
+        ++j;
+      }
+      bytes += releaseRun(i, j, mode);
+      i = j;
+    }
+    return bytes;
+  }
+
+  // Bytes of the mapping backed by huge pages right now; divide by
+  // Mmap::hugePageSize() for a page count. Reads /proc/self/smaps, so keep
+  // it out of hot paths.
+  std::size_t huge_page_bytes() const { return mmap_ptr_->hugePageBytes(); }
+
+  // How much of the checkpoint the page cache holds, see
+  // Mmap::residentBytes.
+  struct Residency {
+    std::size_t resident_bytes = 0;
+    std::size_t total_bytes = 0;
+    // Resident bytes of each tensor, in the order of `keys()`. Tensors
+    // released with Release::Unmap count as 0 of 0 bytes.
+    std::vector<std::size_t> tensors;
+
+    double fraction() const noexcept {
+      return total_bytes ? static_cast<double>(resident_bytes) /
+                               static_cast<double>(total_bytes)
+                         : 1.0;
+    }
+  };
+
+  // Residency of every tensor, in one pass of page queries over the
+  // mapping; cheap enough to ask before scheduling a model onto a node.
+  Residency residency() const {
+    std::vector<std::pair<std::size_t, std::size_t>> ranges;
+    ranges.reserve(views_.size());
+    for (std::size_t i = 0; i < views_.size(); ++i) {
+      // An empty range for unmapped tensors, whose pages are gone.
+      const ByteRange bytes = range(i);
+      ranges.emplace_back(bytes.first, unmapped(i) ? bytes.first : bytes.last);
+    }
+    Residency r;
+    r.tensors.resize(views_.size());
+    mmap_ptr_->residentBytes(ranges, r.tensors);
+    for (std::size_t i = 0; i < views_.size(); ++i) {
+      r.resident_bytes += r.tensors[i];
+      r.total_bytes += ranges[i].second - ranges[i].first;
+    }
+    return r;
+  }
+
+  // Resident bytes of `key`, 0 once released with Release::Unmap. Throws if
+  // `key` is not found.
+  std::size_t resident_bytes(std::string_view key) const {
+    const std::size_t i = index_.find(key);
+    if (i == TensorIndex::npos)
+      throw std::runtime_error(
+          fmt::format("{}:{} key '{}' not found", __FILE__, __LINE__, key));
+    if (unmapped(i)) return 0;
+    return mmap_ptr_->residentBytes(range(i).first, range(i).last);
+  }
+
+  // As `prefetch`, for the tensors not fully resident only, so that a warm
+  // node issues no I/O for what the page cache already holds.
+  PrefetchStats warm(const PrefetchOptions& options = {}) const {
+    const Residency r = residency();
+    return prefetch_ranges(*mmap_ptr_, mappedRanges([&](std::size_t i) {
+                             return r.tensors[i] < views_[i].data_len;
+                           }),
+                           options);
+  }
+
+  // Places the mapped pages of `keys` on NUMA node `node` (Mmap::bindNode).
+  // Pages that other processes map as well stay where they are. False if
+  // the kernel refused for any tensor. The keys do not count as consumed.
+  bool bind_to_node(std::span<const std::string_view> keys, const int node) {
+    bool ok = true;
+    for (std::string_view key : keys) {
+      const ByteRange bytes = range(mappedIndex(key));
+      ok &= mmap_ptr_->bindNode(bytes.first, bytes.last, node);
+    }
+    return ok;
+  }
+
+  // Copies `keys` into memory on each of `nodes`, for tensors every socket
+  // reads, and `find_tensor(key, node)` returns the local copy from then
+  // on. The keys count as consumed, so `release_consumed()` gives their
+  // mapped pages back. Later replicas of a key take precedence.
+  void replicate(std::span<const std::string_view> keys,
+                 std::span<const int> nodes) {
+    for (int node : nodes) {
+      auto replica = std::make_unique<Replica>(
+          Replica{NodeBuffer(packed_size(keys), node), {}, nullptr});
+      std::vector<TensorView> copies =
+          read_packed(keys, replica->buffer.bytes());
+      for (std::size_t j = 0; j < keys.size(); ++j) {
+        replica->views[index_.find(keys[j])] = copies[j];
+      }
+      // Published complete, in front of the older ones.
+      std::lock_guard<std::mutex> lock(sync_->mutex);
+      replica->next = sync_->replicas.load(std::memory_order_relaxed);
+      sync_->replicas.store(replica.get(), std::memory_order_release);
+      sync_->owned.push_back(std::move(replica));
+    }
+  }
+
+  // The replica of `key` on `node` if there is one, otherwise the same as
+  // `find_tensor(key)`.
+  const TensorView* find_tensor(std::string_view key,
+                                const int node) const noexcept {
+    std::size_t i = index_.find(key);
+    for (const Replica* r = sync_->replicas.load(std::memory_order_acquire);
+         r; r = r->next) {
+      if (r->buffer.node() != node) continue;
+      auto view = r->views.find(i);
+      if (view != r->views.end()) return &view->second;
+    }
+    return find_tensor(key);
+  }
+
+  // Node holding the first page of `key` in the mapping, -1 while it is
+  // not resident. Throws if `key` is not found. Does not count as a lookup
+  // for `release_consumed()`.
+  int numa_node(std::string_view key) const {
+    return numa_node_of(views_[mappedIndex(key)].data_ptr);
+  }
+
+  // Pins `keys` in RAM on top of `OpenOptions::mlock`, e.g. experts that
+  // turned out to be hot. Locks are held until the SafeOpen is destroyed;
+  // releasing a locked tensor with Release::Discard has no effect and
+  // Release::Unmap drops the lock. The keys do not count as consumed.
+  // Returns what this call locked.
+  MlockStats lock(std::span<const std::string_view> keys) {
+    std::vector<bool> wanted(views_.size());
+    for (std::string_view key : keys) wanted[mappedIndex(key)] = true;
+    return lockIf([&](std::size_t i) { return wanted[i]; });
+  }
+
+  // Totals over the open policy and every `lock` call.
+  MlockStats mlock_stats() const noexcept {
+    return {sync_->locked_bytes.load(std::memory_order_relaxed),
+            sync_->failed_bytes.load(std::memory_order_relaxed)};
+  }
+
+  // What opening measured and the counters since, with
+  // `OpenOptions::trace` enabled; all zero otherwise.
+  LoadStats load_stats() const noexcept {
+    if (!tracing_) return {};
+    LoadStats stats = sync_->opened;
+    stats.bytes_read = sync_->bytes_read.load(std::memory_order_relaxed);
+    stats.locked_bytes = sync_->locked_bytes.load(std::memory_order_relaxed);
+    stats.failed_lock_bytes =
+        sync_->failed_bytes.load(std::memory_order_relaxed);
+    const FaultCounts now = fault_counts();
+    stats.minor_faults = now.minor - sync_->faults.minor;
+    stats.major_faults = now.major - sync_->faults.major;
+    stats.touched = sync_->touched.load(std::memory_order_relaxed);
+    stats.touch_total = std::chrono::nanoseconds(
+        sync_->touch_total_ns.load(std::memory_order_relaxed));
+    stats.touch_max = std::chrono::nanoseconds(
+        sync_->touch_max_ns.load(std::memory_order_relaxed));
+    return stats;
   }
 
-  TensorView get_tensor(const std::string& key) {
-    if (tensor_views_map_.find(key) == tensor_views_map_.end())
-      throw std::runtime_error(fmt::format("{}:{} key '{}' not found", __FILE__,
-                                           __LINE__, std::string(key)));
-    return tensor_views_map_[key];
+  // True if `key` was released with Release::Unmap. It stays so: lookups
+  // return nullptr for it from then on.
+  bool is_unmapped(std::string_view key) const noexcept {
+    const std::size_t i = index_.find(key);
+    return i != TensorIndex::npos && unmapped(i);
   }
 
-  inline std::unordered_map<std::string, std::string> get_metadata() const noexcept {
-    return metadata_map_;
+  // True if `key` was released and not looked up since.
+  bool released(std::string_view key) const noexcept {
+    std::size_t i = index_.find(key);
+    return i != TensorIndex::npos &&
+           (state_[i].load(std::memory_order_relaxed) &
+            (kDiscarded | kUnmapped));
   }
 
  private:
-  std::unique_ptr<File> file_ptr_;
-  std::unique_ptr<Mmap> mmap_ptr_;
-  rust::Slice<std::uint8_t const> buffer_;
-  rust::Vec<PairStrTensorView> tensor_views_;
-  rust::Vec<PairStrStr> metadata_;
-  std::vector<std::string> keys_;
-  std::unordered_map<std::string, TensorView> tensor_views_map_;
-  std::unordered_map<std::string, std::string> metadata_map_;
+  // Looks `key` up as `find_tensor` does, marking it consumed, and faults
+  // its pages in with `touch` only. The helpers that read the data
+  // themselves pass false, since their reads may not go through the
+  // mapping at all, and so do slices, which read only part of it.
+  const TensorView* findView(std::string_view key,
+                             const bool touch) const noexcept {
+    std::size_t i = index_.find(key);
+    if (i == TensorIndex::npos) return nullptr;
+    std::uint8_t state = state_[i].load(std::memory_order_relaxed);
+    // Never clears kUnmapped set by a concurrent release.
+    while (state != kConsumed) {
+      if (state & kUnmapped) return nullptr;
+      if (state_[i].compare_exchange_weak(state, kConsumed,
+                                          std::memory_order_relaxed)) {
+        if (touch && state == 0) firstTouch(i);
+        break;
+      }
+    }
+    return &views_[i];
+  }
+
+  // Same without touching, throwing as `get_tensor` if `key` is missing.
+  const TensorView& checkedView(std::string_view key) const {
+    const TensorView* view = findView(key, false);
+    if (!view) throw missing(key);
+    return *view;
+  }
+
+  // Position of `key` in access order, leaving its state alone, for the
+  // calls that only place or inspect pages. Throws as `get_tensor`.
+  std::size_t mappedIndex(std::string_view key) const {
+    const std::size_t i = index_.find(key);
+    if (i == TensorIndex::npos || unmapped(i)) throw missing(key);
+    return i;
+  }
+
+  std::runtime_error missing(std::string_view key) const {
+    return std::runtime_error(
+        fmt::format("{}:{} key '{}' {}", __FILE__, __LINE__, key,
+                    released(key) ? "was unmapped" : "not found"));
+  }
+
+  // Absolute byte range of the i-th tensor in access order.
+  inline ByteRange range(const std::size_t i) const noexcept {
+    const TensorIndex::Entry& e = index_.entry(i);
+    return ByteRange{index_.data_offset() + static_cast<std::size_t>(e.begin),
+                     index_.data_offset() + static_cast<std::size_t>(e.end)};
+  }
+
+  // Byte ranges of the tensors for which `pred(i)` holds, in access order,
+  // leaving out those released with Release::Unmap: their pages are gone
+  // and touching them would fault.
+  template <typename Pred>
+  std::vector<ByteRange> mappedRanges(Pred&& pred) const {
+    std::vector<ByteRange> ranges;
+    for (std::size_t i = 0; i < views_.size(); ++i) {
+      if (!unmapped(i) && pred(i)) ranges.push_back(range(i));
+    }
+    return ranges;
+  }
+
+  bool unmapped(const std::size_t i) const noexcept {
+    return state_[i].load(std::memory_order_relaxed) & kUnmapped;
+  }
+
+  inline std::size_t offset(const TensorView& view) const noexcept {
+    return static_cast<std::size_t>(
+        static_cast<const std::uint8_t*>(view.data_ptr) - mmap_ptr_->data());
+  }
+
+  // Calls `f(offset, count)` for every contiguous run of `box` in order,
+  // with offsets in elements from `box.data_ptr`.
+  template <typename F>
+  static void forEachRun(const SliceView& box, F&& f) {
+    if (box.numel() == 0) return;
+    // Merge inner dimensions while they stay contiguous.
+    std::size_t outer = box.shape.size();
+    std::size_t run = 1;
+    while (outer > 0 &&
+           (box.shape[outer - 1] == 1 || box.strides[outer - 1] == run)) {
+      run *= box.shape[--outer];
+    }
+    std::vector<std::size_t> index(outer, 0);
+    while (true) {
+      std::size_t offset = 0;
+      for (std::size_t k = 0; k < outer; ++k) {
+        offset += index[k] * box.strides[k];
+      }
+      f(offset, run);
+      std::size_t k = outer;
+      while (k > 0 && ++index[k - 1] == box.shape[k - 1]) index[--k] = 0;
+      if (k == 0) return;
+    }
+  }
+
+  static std::size_t alignUp(const std::size_t n,
+                             const std::size_t alignment) noexcept {
+    return alignment > 1 ? (n + alignment - 1) & ~(alignment - 1) : n;
+  }
+
+  // Converts elements [first, first + count) of `view`; `first` starts on a
+  // byte, and on a group of four for F6.
+  void convertRange(std::string_view key, const TensorView& view,
+                    const std::size_t first, const std::size_t count,
+                    const Dtype to, std::span<std::byte> dst,
+                    std::string_view scale_key, const std::size_t block) const {
+    if (!can_convert(view.dtype, to))
+      throw std::runtime_error(fmt::format(
+          "{}:{} cannot convert '{}' from {} to {}", __FILE__, __LINE__, key,
+          to_string(view.dtype), to_string(to)));
+    if (dst.size() < (count * bitsize(to) + 7) / 8)
+      throw std::runtime_error(
+          fmt::format("{}:{} buffer for '{}' is too small: {} < {}", __FILE__,
+                      __LINE__, key, dst.size(), (count * bitsize(to) + 7) / 8));
+
+    BlockScales scales;
+    std::vector<std::byte> scale_copy;
+    if (!scale_key.empty()) {
+      const TensorView& s = checkedView(scale_key);
+      if (block == 0 || s.numel() < (view.numel() + block - 1) / block)
+        throw std::runtime_error(fmt::format(
+            "{}:{} '{}' has too few scales for '{}' in blocks of {}", __FILE__,
+            __LINE__, scale_key, key, block));
+      scales.dtype = s.dtype;
+      scales.block = block;
+      scales.data = s.data_ptr;
+      if (reader_) {
+        scale_copy.resize(s.data_len);
+        read_into(scale_key, scale_copy);
+        scales.data = scale_copy.data();
+      }
+    }
+    const BlockScales* scaled = scale_key.empty() ? nullptr : &scales;
+
+    const std::size_t bits = bitsize(view.dtype);
+    if (!reader_) {
+      scales.offset = first;
+      countRead(count * bits / 8);
+      convert(static_cast<const std::byte*>(view.data_ptr) + first * bits / 8,
+              view.dtype, dst.data(), to, count, scaled);
+      return;
+    }
+    // A multiple of four elements, so that every chunk starts on a byte.
+    constexpr std::size_t kChunk = 1 << 16;
+    const std::size_t end = (first + count) * bits;
+    std::vector<std::byte> staging(
+        std::min((count * bits + 7) / 8, kChunk * bits / 8));
+    for (std::size_t done = 0; done < count; done += kChunk) {
+      const std::size_t n = std::min(kChunk, count - done);
+      const std::size_t begin = (first + done) * bits / 8;
+      ReadRequest request{
+          offset(view) + begin,
+          std::min((end + 7) / 8 - begin, staging.size()), staging.data()};
+      read({&request, 1});
+      scales.offset = first + done;
+      convert(staging.data(), view.dtype, dst.data() + done * bitsize(to) / 8,
+              to, n, scaled);
+    }
+  }
+
+  // Runs `f` as phase `name` of opening, timed into `*elapsed` and
+  // reported to the trace hooks when tracing.
+  template <typename F>
+  void phase(std::string_view name, std::chrono::nanoseconds* elapsed,
+             F&& f) {
+    if (!tracing_) {
+      f();
+      return;
+    }
+    const LoadTrace& trace = sync_->trace;
+    if (trace.begin) trace.begin(name);
+    const auto start = std::chrono::steady_clock::now();
+    try {
+      f();
+    } catch (...) {
+      if (trace.end) trace.end(name, std::chrono::steady_clock::now() - start);
+      throw;
+    }
+    *elapsed = std::chrono::steady_clock::now() - start;
+    if (trace.end) trace.end(name, *elapsed);
+  }
+
+  void countRead(const std::size_t bytes) const noexcept {
+    if (tracing_) sync_->bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  // Faults in tensor `i` and records how long that took.
+  void firstTouch(const std::size_t i) const noexcept {
+    const TensorView& view = views_[i];
+    if (view.data_len == 0) return;
+    const auto start = std::chrono::steady_clock::now();
+    const auto* base = static_cast<const std::uint8_t*>(view.data_ptr);
+    const std::size_t page = Mmap::pageSize();
+    const auto addr = reinterpret_cast<std::uintptr_t>(base);
+    std::uint8_t acc = 0;
+    for (std::size_t pos = 0; pos < view.data_len;
+         pos = ((addr + pos) & ~(page - 1)) + page - addr) {
+      acc ^= *static_cast<volatile const std::uint8_t*>(base + pos);
+    }
+    acc ^= *static_cast<volatile const std::uint8_t*>(base + view.data_len - 1);
+    static_cast<void>(acc);
+    const std::chrono::nanoseconds took =
+        std::chrono::steady_clock::now() - start;
+
+    sync_->touched.fetch_add(1, std::memory_order_relaxed);
+    sync_->touch_total_ns.fetch_add(took.count(), std::memory_order_relaxed);
+    std::int64_t longest = sync_->touch_max_ns.load(std::memory_order_relaxed);
+    while (longest < took.count() &&
+           !sync_->touch_max_ns.compare_exchange_weak(
+               longest, took.count(), std::memory_order_relaxed)) {
+    }
+    if (sync_->trace.on_first_touch) {
+      sync_->trace.on_first_touch(index_.name(i), took);
+    }
+  }
+
+  void lockPolicy(const OpenOptions& options) {
+    switch (options.mlock) {
+      case MlockPolicy::None:
+        break;
+      case MlockPolicy::All:
+        lockRange(index_.data_offset(), mmap_ptr_->size());
+        break;
+      case MlockPolicy::Filter:
+        if (options.mlock_filter) {
+          lockIf([&](std::size_t i) {
+            return options.mlock_filter(index_.name(i));
+          });
+        }
+        break;
+      case MlockPolicy::Prefix:
+        lockRange(index_.data_offset(),
+                  index_.data_offset() +
+                      std::min(options.mlock_bytes, index_.buffer_size()));
+        break;
+    }
+  }
+
+  // Locks the pages overlapping [first, last) of the file.
+  MlockStats lockRange(const std::size_t first, const std::size_t last) {
+    MlockStats stats;
+    if (last <= first) return stats;
+    const std::size_t page = Mmap::pageSize();
+    const std::size_t start = first & ~(page - 1);
+    Mlock lock;
+    lock.init(mmap_ptr_->data() + start);
+    // In steps, so that hitting the limit still locks what fits.
+    constexpr std::size_t kStep = 1 << 20;
+    for (std::size_t n = std::min(kStep, last - start); !lock.failed();
+         n = std::min(n + kStep, last - start)) {
+      lock.growTo(n);
+      if (n == last - start) break;
+    }
+    stats.locked_bytes = lock.size();
+    stats.failed_bytes = alignUp(last - start, page) - lock.size();
+    sync_->locked_bytes.fetch_add(stats.locked_bytes,
+                                  std::memory_order_relaxed);
+    sync_->failed_bytes.fetch_add(stats.failed_bytes,
+                                  std::memory_order_relaxed);
+    if (lock.size()) {
+      std::lock_guard<std::mutex> guard(sync_->mutex);
+      sync_->locked.push_back(ByteRange{start, start + lock.size()});
+      sync_->mlocks.push_back(std::move(lock));
+    }
+    return stats;
+  }
+
+  // Locks runs of adjacent tensors for which `pred(i)` holds.
+  template <typename Pred>
+  MlockStats lockIf(Pred&& pred) {
+    MlockStats stats;
+    for (std::size_t i = 0; i < views_.size();) {
+      if (!pred(i)) {
+        ++i;
+        continue;
+      }
+      std::size_t j = i + 1;
+      while (j < views_.size() && pred(j)) ++j;
+      MlockStats run = lockRange(range(i).first, range(j - 1).last);
+      stats.locked_bytes += run.locked_bytes;
+      stats.failed_bytes += run.failed_bytes;
+      i = j;
+    }
+    return stats;
+  }
+
+  std::size_t detectAlignment() const noexcept {
+    std::size_t common = 0;
+    for (std::size_t i = 0; i < views_.size(); ++i) {
+      if (views_[i].data_len == 0 ||
+          index_.name(i).starts_with(PADDING_PREFIX)) {
+        continue;
+      }
+      common |= offset(views_[i]);
+    }
+    return common ? common & (~common + 1) : 1;
+  }
+
+  void read(std::span<const ReadRequest> requests) const {
+    if (tracing_) {
+      std::size_t bytes = 0;
+      for (const ReadRequest& r : requests) bytes += r.size;
+      countRead(bytes);
+    }
+    if (reader_) {
+      reader_->read(requests);
+    } else {
+      read_mapped(*mmap_ptr_, requests, io_);
+    }
+  }
+
+  // Releases tensors [first, last). The byte range is widened over
+  // neighbours released the same way, so that pages they share are freed.
+  std::size_t releaseRun(const std::size_t first, const std::size_t last,
+                         const Release mode) {
+    const std::uint8_t flag =
+        mode == Release::Unmap ? kUnmapped : kDiscarded;
+    bool mapped = false;
+    for (std::size_t i = first; i < last; ++i) {
+      std::uint8_t state = state_[i].load(std::memory_order_relaxed);
+      // Once unmapped, a tensor stays unmapped.
+      while (!(state & kUnmapped) &&
+             !state_[i].compare_exchange_weak(state, flag,
+                                              std::memory_order_relaxed)) {
+      }
+      mapped |= !(state & kUnmapped);
+    }
+    if (!mapped) return 0;
+
+    std::size_t page = Mmap::pageSize();
+    std::size_t lo = first;
+    std::size_t begin = range(first).first & ~(page - 1);
+    while (lo > 0 && range(lo).first > begin &&
+           state_[lo - 1].load(std::memory_order_relaxed) == flag) {
+      --lo;
+    }
+    begin = std::max(begin, range(lo).first);
+
+    std::size_t hi = last;
+    std::size_t end = (range(last - 1).last + page - 1) & ~(page - 1);
+    while (hi < views_.size() && range(hi - 1).last < end &&
+           state_[hi].load(std::memory_order_relaxed) == flag) {
+      ++hi;
+    }
+    end = std::min(end, range(hi - 1).last);
+
+    // A shared mapping stays in place for the other instances.
+    if (mode == Release::Unmap && !shared_) {
+      if (!sync_->locked_bytes.load(std::memory_order_relaxed)) {
+        return mmap_ptr_->unmapFragment(begin, end);
+      }
+      const std::vector<ByteRange> kept = unlockAround(begin, end);
+      const std::size_t bytes = mmap_ptr_->unmapFragment(begin, end);
+      for (const ByteRange& r : kept) relock(r);
+      return bytes;
+    }
+    if (!sync_->locked_bytes.load(std::memory_order_relaxed)) {
+      return mmap_ptr_->discardFragment(begin, end);
+    }
+    return discardUnlocked(begin, end);
+  }
+
+  // Discards the pages of [begin, end) outside every lock: MADV_DONTNEED
+  // fails on locked pages, which stay resident anyway.
+  std::size_t discardUnlocked(std::size_t begin, const std::size_t end) {
+    std::vector<ByteRange> locked;
+    {
+      std::lock_guard<std::mutex> guard(sync_->mutex);
+      for (const ByteRange& r : sync_->locked) {
+        if (r.first < end && r.last > begin) locked.push_back(r);
+      }
+    }
+    std::sort(locked.begin(), locked.end(),
+              [](const ByteRange& a, const ByteRange& b) {
+                return a.first < b.first;
+              });
+    std::size_t bytes = 0;
+    for (const ByteRange& r : locked) {
+      if (r.first > begin) bytes += mmap_ptr_->discardFragment(begin, r.first);
+      begin = std::max(begin, r.last);
+    }
+    if (begin < end) bytes += mmap_ptr_->discardFragment(begin, end);
+    return bytes;
+  }
+
+  // Drops the locks overlapping the whole pages of [begin, end), which are
+  // about to be unmapped, and returns the parts of them that stay mapped.
+  // Unlocking a range with a hole in it fails once the pages are gone, so
+  // the locks are taken down first and `relock` restores the rest.
+  std::vector<ByteRange> unlockAround(const std::size_t begin,
+                                      const std::size_t end) {
+    const std::size_t page = Mmap::pageSize();
+    const std::size_t lo = alignUp(begin, page);
+    const std::size_t hi =
+        end >= mmap_ptr_->size() ? alignUp(end, page) : end & ~(page - 1);
+    std::vector<ByteRange> kept;
+    if (lo >= hi) return kept;
+    std::vector<Mlock> dropped;
+    std::lock_guard<std::mutex> guard(sync_->mutex);
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < sync_->locked.size(); ++i) {
+      const ByteRange r = sync_->locked[i];
+      if (r.first < hi && r.last > lo) {
+        if (r.first < lo) kept.push_back(ByteRange{r.first, lo});
+        if (r.last > hi) kept.push_back(ByteRange{hi, r.last});
+        dropped.push_back(std::move(sync_->mlocks[i]));
+        continue;
+      }
+      sync_->locked[n] = r;
+      sync_->mlocks[n++] = std::move(sync_->mlocks[i]);
+    }
+    sync_->locked.resize(n);
+    sync_->mlocks.resize(n);
+    return kept;
+  }
+
+  // Locks [r.first, r.last) of the file again, which stayed locked but for
+  // a moment and so does not count towards `mlock_stats()` a second time.
+  void relock(const ByteRange& r) {
+    Mlock lock;
+    lock.init(mmap_ptr_->data() + r.first);
+    lock.growTo(r.last - r.first);
+    if (!lock.size()) return;
+    std::lock_guard<std::mutex> guard(sync_->mutex);
+    sync_->locked.push_back(ByteRange{r.first, r.first + lock.size()});
+    sync_->mlocks.push_back(std::move(lock));
+  }
+
+  struct Replica {
+    NodeBuffer buffer;
+    // Tensor index to its copy in `buffer`.
+    std::unordered_map<std::size_t, TensorView> views;
+    // The replica published before this one.
+    const Replica* next;
+  };
+
+  // State that `replicate` and `lock` add to while lookups run, behind a
+  // pointer so that SafeOpen stays movable.
+  struct Sync {
+    // Serializes writers; readers only follow `replicas`.
+    std::mutex mutex;
+    // Newest first, immutable once published.
+    std::atomic<const Replica*> replicas{nullptr};
+    std::vector<std::unique_ptr<Replica>> owned;
+    std::vector<Mlock> mlocks;
+    // File ranges of `mlocks`, page aligned.
+    std::vector<ByteRange> locked;
+    std::atomic<std::size_t> locked_bytes{0};
+    std::atomic<std::size_t> failed_bytes{0};
+    // Copied from `OpenOptions::trace`, with what opening measured.
+    LoadTrace trace;
+    LoadStats opened;
+    FaultCounts faults;
+    std::atomic<std::size_t> bytes_read{0};
+    std::atomic<std::size_t> touched{0};
+    std::atomic<std::int64_t> touch_total_ns{0};
+    std::atomic<std::int64_t> touch_max_ns{0};
+  };
+
+  static constexpr std::uint8_t kConsumed = 1;
+  static constexpr std::uint8_t kDiscarded = 2;
+  static constexpr std::uint8_t kUnmapped = 4;
+
+  // Owned by a cached Checkpoint when `shared_`.
+  std::shared_ptr<File> file_ptr_;
+  std::shared_ptr<Mmap> mmap_ptr_;
+  TensorIndex index_;
+  std::vector<TensorView> views_;
+  ReaderOptions io_;
+  bool shared_ = false;
+  bool tracing_ = false;
+  bool touch_ = false;
+  std::size_t alignment_ = 1;
+  // Only set for backends other than Mmap.
+  std::unique_ptr<Reader> reader_;
+  // kConsumed, kDiscarded or kUnmapped per tensor, in access order.
+  std::unique_ptr<std::atomic<std::uint8_t>[]> state_;
+  // Destroyed before the mapping its locks pin.
+  std::unique_ptr<Sync> sync_ = std::make_unique<Sync>();
 };
 
 }  // namespace safetensors
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "safetensors/safetensors.hpp"
+
+namespace safetensors {
+
+struct ShardedOptions {
+  // Applied to every shard. `prefetch` is ignored, see below.
+  OpenOptions open;
+  // Open each shard on first access instead of all of them up front.
+  bool lazy = false;
+  // Populate each shard right after opening it, see SafeOpen::prefetch.
+  bool prefetch = true;
+  // Shards already open in parallel, so one thread each by default.
+  std::size_t prefetch_threads = 1;
+  // Workers used to open shards up front; 0 picks the hardware concurrency.
+  std::size_t threads = 0;
+};
+
+struct ShardTiming {
+  std::string filename;
+  bool opened = false;
+  // File open, mapping and header parse.
+  double open_seconds = 0.0;
+  double prefetch_seconds = 0.0;
+};
+
+// A single `keys()`/`get_tensor()` namespace over a checkpoint split into
+// several files, as described by a Hugging Face
+// `model.safetensors.index.json` (`{"metadata": {...}, "weight_map":
+// {"tensor": "model-00001-of-00002.safetensors", ...}}`). Shard paths are
+// resolved relative to the index file.
+//
+// Shards are opened in parallel at construction, or lazily on first lookup
+// with `lazy = true`; lazy opening is safe to race from several threads.
+class ShardedSafeOpen {
+ public:
+  using TensorView = SafeOpen::TensorView;
+  using MetadataPair = TensorIndex::MetadataPair;
+
+  explicit ShardedSafeOpen(const std::filesystem::path& index_path,
+                           const ShardedOptions& options = {});
+
+  ShardedSafeOpen(const ShardedSafeOpen&) = delete;
+  ShardedSafeOpen& operator=(const ShardedSafeOpen&) = delete;
+
+  ShardedSafeOpen(ShardedSafeOpen&&) noexcept;
+  ShardedSafeOpen& operator=(ShardedSafeOpen&&) noexcept;
+
+  ~ShardedSafeOpen();
+
+  // Tensor names in `weight_map` order.
+  std::span<const std::string_view> keys() const noexcept;
+
+  // nullptr if `key` is not in the weight map or was released with
+  // Release::Unmap. Opens its shard if needed.
+  const TensorView* find_tensor(std::string_view key) const;
+  std::optional<TensorView> try_get_tensor(std::string_view key) const;
+  const TensorView& get_tensor(std::string_view key) const;
+  // Typed access as in `SafeOpen::get_tensor<T>`.
+  template <tensor_element T>
+  std::span<const T> get_tensor(std::string_view key) const {
+    return get_tensor(key).as<T>(key);
+  }
+
+  // SafeOpen::release on the shard holding `key`. Throws if `key` is not
+  // in the weight map.
+  std::size_t release(std::string_view key, Release mode = Release::Discard);
+
+  // `metadata` of the index file. Non-string values (e.g. `total_size`) are
+  // returned as their JSON text.
+  std::span<const MetadataPair> get_metadata() const noexcept;
+
+  std::size_t num_shards() const noexcept;
+  // Shard holding `key`, or `num_shards()` if absent.
+  std::size_t shard_of(std::string_view key) const noexcept;
+  // Opens shard `i` if needed.
+  const SafeOpen& shard(const std::size_t i) const;
+
+  // Opens every shard that is not open yet, in parallel.
+  void open_all() const;
+
+  std::vector<ShardTiming> timings() const;
+
+ private:
+  struct impl;
+  std::unique_ptr<impl> pimpl;
+};
+
+}  // namespace safetensors
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include "safetensors/header.hpp"
+#include "safetensors/index.hpp"
+
+namespace safetensors {
+
+// A sidecar is a checkpoint's parsed header saved as TensorIndex's arena,
+// so that reopening maps it instead of parsing JSON. It records the
+// checkpoint's size and modification time, the layout version and a
+// checksum, and is ignored when any of them does not match.
+
+// "<checkpoint>.stidx" next to the checkpoint, or, with a `dir`,
+// "<dir>/<file name>-<hash of the canonical path>.stidx".
+std::filesystem::path sidecar_path(const std::filesystem::path& checkpoint,
+                                   const std::filesystem::path& dir = {});
+
+// Writes `index`, parsed from `checkpoint`, to `sidecar` through a
+// temporary file and a rename, so readers never see a partial sidecar.
+// Returns false if it could not be written, e.g. in a read-only directory.
+bool write_sidecar(const std::filesystem::path& checkpoint,
+                   const TensorIndex& index,
+                   const std::filesystem::path& sidecar);
+
+// Maps `sidecar` and attaches to its index, or returns nullopt if it is
+// missing, stale, corrupt or from another layout version.
+std::optional<TensorIndex> load_sidecar(
+    const std::filesystem::path& checkpoint,
+    const std::filesystem::path& sidecar);
+
+// The index of `checkpoint`, whose bytes are mapped at [data, data + size):
+// from `sidecar` if that is current, otherwise parsed with `parser` and
+// saved to `sidecar` for the next open. An empty `sidecar` only parses.
+TensorIndex parse_header_cached(const std::filesystem::path& checkpoint,
+                                const std::uint8_t* data, std::size_t size,
+                                HeaderParser parser,
+                                const std::filesystem::path& sidecar);
+
+}  // namespace safetensors
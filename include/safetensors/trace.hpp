@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+namespace safetensors {
+
+// Page faults taken by the whole process so far (getrusage); zero where
+// the OS does not count them.
+struct FaultCounts {
+  std::uint64_t minor = 0;
+  std::uint64_t major = 0;
+};
+
+FaultCounts fault_counts() noexcept;
+
+// Opt-in instrumentation of SafeOpen, see `OpenOptions::trace`. The hooks
+// run on the thread doing the work and must not throw; those that fire on
+// lookups must be thread safe if tensors are looked up concurrently.
+struct LoadTrace {
+  // Collect LoadStats. Implied by any of the settings below.
+  bool enabled = false;
+  // Bracket each phase of opening ("map", "parse", "index", "verify",
+  // "mlock", "prefetch"), e.g. with nvtxRangePushA/nvtxRangePop or perfetto's
+  // TRACE_EVENT_BEGIN/END. Phase names are string literals.
+  std::function<void(std::string_view phase)> begin;
+  std::function<void(std::string_view phase, std::chrono::nanoseconds)> end;
+  // Fault in the pages of each tensor on its first lookup through
+  // find_tensor, get_tensor or try_get_tensor and time it, so that the
+  // faults the caller's reads of the view would take are measured per
+  // tensor. Helpers that copy the data out (read_into, read_packed,
+  // read_converted, slices) do not touch: their reads may bypass the
+  // mapping, and faulting it in would only add work.
+  bool first_touch = false;
+  std::function<void(std::string_view key, std::chrono::nanoseconds)>
+      on_first_touch;
+};
+
+struct LoadStats {
+  // Opening and mapping the file, including the populated prefix. With a
+  // cached checkpoint this covers the whole shared open, parse included.
+  std::chrono::nanoseconds map{0};
+  // Parsing the header into a TensorIndex, or attaching a sidecar.
+  std::chrono::nanoseconds parse{0};
+  // Building views and per-tensor state from the index.
+  std::chrono::nanoseconds index{0};
+  // Checking `OpenOptions::verify`, which populates the mapping.
+  std::chrono::nanoseconds verify{0};
+  // Locks requested by `OpenOptions::mlock`.
+  std::chrono::nanoseconds mlock{0};
+  // The whole constructor.
+  std::chrono::nanoseconds total{0};
+
+  // Bytes populated while mapping, or while verifying.
+  std::size_t bytes_populated = 0;
+  // Bytes copied out by `read_into`, `read_packed`, `read_converted`,
+  // `read_rows` and `read_slice` since opening.
+  std::size_t bytes_read = 0;
+  std::size_t locked_bytes = 0;
+  std::size_t failed_lock_bytes = 0;
+
+  // Process-wide faults between the start of opening and the call to
+  // `load_stats()`, so other threads' faults count as well.
+  std::uint64_t minor_faults = 0;
+  std::uint64_t major_faults = 0;
+
+  // With `LoadTrace::first_touch`: tensors touched so far, their summed
+  // and their longest fault-in time.
+  std::size_t touched = 0;
+  std::chrono::nanoseconds touch_total{0};
+  std::chrono::nanoseconds touch_max{0};
+};
+
+}  // namespace safetensors
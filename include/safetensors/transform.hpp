@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "safetensors/safetensors.hpp"
+#include "safetensors/sharded.hpp"
+#include "safetensors/writer.hpp"
+
+namespace safetensors {
+
+// What one source tensor becomes in the output.
+struct TensorPlan {
+  static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+  std::string name;
+  // Dtypes other than the source's go through `convert`, see can_convert.
+  Dtype dtype;
+  // Dimension split evenly over `TransformOptions::ranks`, rank k getting
+  // the k-th block, e.g. 0 for column-parallel and the last for
+  // row-parallel linear layers; npos gives every rank the whole tensor.
+  std::size_t split_dim = npos;
+};
+
+// Called once per source tensor, in source order, with its name and view;
+// std::nullopt drops the tensor.
+using TransformPlan = std::function<std::optional<TensorPlan>(
+    std::string_view name, const SafeOpen::TensorView& view)>;
+
+struct TransformOptions {
+  // Keeps every tensor as it is when unset. SafeWriter's `__padding_`
+  // fillers in the source are always dropped.
+  TransformPlan plan;
+  // Output checkpoints, one per tensor-parallel rank.
+  std::size_t ranks = 1;
+  // Splits each rank's checkpoint into shards of at most this many bytes of
+  // tensor data, a larger tensor getting a shard of its own, listed in a
+  // Hugging Face index. 0 writes a single file.
+  std::size_t max_shard_bytes = 0;
+  // Copied into every output, except the source's checksums; `metadata`
+  // entries are added on top.
+  bool copy_metadata = true;
+  std::vector<std::pair<std::string, std::string>> metadata;
+  // Tensors are converted and written in pieces of about `chunk_bytes` on
+  // `threads` workers (0 picks the hardware concurrency), each with one
+  // staging buffer. Tensors whose slice for a rank is strided, e.g. split
+  // along the last dimension, are gathered whole first.
+  std::size_t threads = 0;
+  std::size_t chunk_bytes = 16 << 20;
+  // Discard the source pages of a tensor once it is written, so that
+  // resident memory stays at a few tensors whatever the checkpoint size.
+  bool release_source = true;
+  // For every output file; `threads` and `chunk_bytes` are not used.
+  WriterOptions writer;
+  // Called after every piece with (bytes written, bytes total). Calls are
+  // serialized but come from the worker threads.
+  std::function<void(std::size_t, std::size_t)> progress;
+};
+
+struct TransformResult {
+  // Per rank, what to open: the checkpoint, or the index of its shards.
+  std::vector<std::filesystem::path> outputs;
+  // Files written, shards of every rank.
+  std::vector<std::filesystem::path> files;
+  // Tensors and bytes of tensor data written over all ranks.
+  std::size_t tensors = 0;
+  std::size_t bytes = 0;
+  double seconds = 0.0;
+};
+
+// Writes what `options.plan` makes of `source` to `output`, e.g.
+// "out/model.safetensors", streaming: tensors are read from the mapping,
+// converted piece by piece and written with positioned writes into every
+// output file at once. Open the source with `prefetch = 0` so that nothing
+// is read up front.
+//
+// With several ranks, rank k is written to `<stem>-rank<k><ext>`. A
+// sharded output `<stem><ext>` goes to `<stem>-00001-of-0000N<ext>` and so
+// on, indexed by `<stem><ext>.index.json`. Throws std::invalid_argument for
+// unsupported conversions and splits that do not divide a dimension.
+TransformResult transform(SafeOpen& source,
+                          const std::filesystem::path& output,
+                          const TransformOptions& options = {});
+// Same for a sharded checkpoint, tensors taken in `weight_map` order.
+TransformResult transform(ShardedSafeOpen& source,
+                          const std::filesystem::path& output,
+                          const TransformOptions& options = {});
+
+}  // namespace safetensors
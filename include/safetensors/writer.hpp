@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string_view>
+
+#include "safetensors_abi/lib.h"
+
+namespace safetensors {
+
+enum class Sync {
+  // Leave flushing to the OS.
+  None,
+  // Flush once in close(), before the file is renamed into place.
+  OnClose,
+  // Also flush every time a tensor has been written completely.
+  PerTensor,
+};
+
+struct WriterOptions {
+  Sync sync = Sync::OnClose;
+  // Write to `<path>.tmp` and rename it over `path` in close(), so readers
+  // never see a partial file. An unclosed writer removes the temporary.
+  bool atomic = true;
+  // Threads for batch writes (0 picks the hardware concurrency), and the
+  // piece size large tensors are split into so they spread over them.
+  std::size_t threads = 0;
+  std::size_t chunk_bytes = 16 << 20;
+  // If set (a power of two), every non-empty tensor starts at a file
+  // offset that is a multiple of it, e.g. 4096 for O_DIRECT or 2 MiB for
+  // huge pages, and the file size is rounded up to it. The header is padded
+  // with spaces and each gap is indexed as a zero-filled U8 tensor named
+  // `__padding_<n>__` (see PADDING_PREFIX), since the format does not allow
+  // holes. Every reader, `SafeOpen::keys()` included, lists these as
+  // ordinary tensors.
+  std::size_t alignment = 0;
+  // Store the CRC32C of every tensor under CHECKSUM_KEY in `__metadata__`
+  // (see checksum.hpp), computed from the data as it is written, for
+  // `OpenOptions::verify`. The header holds a placeholder that close()
+  // fills in, and each byte must be written exactly once.
+  bool checksums = false;
+};
+
+struct TensorWrite {
+  std::string_view key;
+  std::span<const std::byte> data;
+};
+
+// Writes a safetensors file without holding all tensors in memory. Tensors
+// are declared first, which fixes the header and every data offset; their
+// bytes can then be written as they become available, in any order and in
+// any number of pieces. The layout matches `serialize()`: tensors ordered
+// by decreasing dtype, then by name, and the header padded to 8 bytes,
+// unless `WriterOptions::alignment` asks for more.
+//
+//   SafeWriter w("model.safetensors");
+//   w.add_tensor("weight", Dtype::F32, std::array<std::size_t, 2>{4, 4});
+//   w.write("weight", std::as_bytes(std::span(data)));
+//   w.close();
+class SafeWriter {
+ public:
+  explicit SafeWriter(const std::filesystem::path& path,
+                      const WriterOptions& options = {});
+
+  SafeWriter(const SafeWriter&) = delete;
+  SafeWriter& operator=(const SafeWriter&) = delete;
+
+  SafeWriter(SafeWriter&&) noexcept;
+  SafeWriter& operator=(SafeWriter&&) noexcept;
+
+  ~SafeWriter();
+
+  // `shape` is the logical shape. Throws on duplicate names and on sizes
+  // that are not a whole number of bytes. Only allowed before `begin()`.
+  void add_tensor(std::string_view name, Dtype dtype,
+                  std::span<const std::size_t> shape);
+  void add_metadata(std::string_view key, std::string_view value);
+
+  // Writes the header. Called by the first `write` if needed.
+  void begin();
+
+  // Writes `data` at byte `offset` of tensor `name`'s data. Once the header
+  // is written, writes of disjoint ranges may come from several threads.
+  // Bytes may be written again, except with `WriterOptions::checksums`,
+  // where an overlapping write throws std::invalid_argument and the writer
+  // can no longer be closed.
+  void write(std::string_view name, std::size_t offset,
+             std::span<const std::byte> data);
+  void write(std::string_view name, std::span<const std::byte> data) {
+    write(name, 0, data);
+  }
+
+  // Writes whole tensors with positioned writes spread over
+  // `options.threads`. Every size is checked before anything is written.
+  void write(std::span<const TensorWrite> tensors);
+
+  // Byte size of tensor `name`'s data.
+  std::size_t size_of(std::string_view name) const;
+
+  // Checks that every byte of every tensor was written, syncs according to
+  // the options and moves the file into place. Throws if data is missing.
+  void close();
+
+ private:
+  struct impl;
+  std::unique_ptr<impl> pimpl;
+};
+
+}  // namespace safetensors
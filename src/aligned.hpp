@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace safetensors::detail {
+
+inline void* alignedAlloc(const std::size_t size, const std::size_t align) {
+  void* p = nullptr;
+#if defined(_WIN32)
+  p = _aligned_malloc(size, align);
+#else
+  if (posix_memalign(&p, align, size)) p = nullptr;
+#endif
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+inline void alignedFree(void* p) noexcept {
+#if defined(_WIN32)
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+struct AlignedFree {
+  void operator()(std::uint8_t* p) const noexcept { alignedFree(p); }
+};
+
+using AlignedBuffer = std::unique_ptr<std::uint8_t, AlignedFree>;
+
+inline AlignedBuffer allocateAligned(const std::size_t size,
+                                     const std::size_t align) {
+  return AlignedBuffer(static_cast<std::uint8_t*>(alignedAlloc(size, align)));
+}
+
+}  // namespace safetensors::detail
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/cache.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "fmt/format.h"
+#include "identity.hpp"
+#include "safetensors/checksum.hpp"
+#include "safetensors/sidecar.hpp"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace safetensors {
+
+namespace {
+
+struct CacheKey {
+  detail::FileIdentity file;
+  HugePages huge_pages;
+
+  bool operator<(const CacheKey& other) const {
+    if (file.tie() != other.file.tie()) return file.tie() < other.file.tie();
+    return huge_pages < other.huge_pages;
+  }
+};
+
+struct Slot {
+  std::weak_ptr<Checkpoint> live;
+  // Set while the first opener builds the checkpoint.
+  std::shared_future<std::shared_ptr<Checkpoint>> pending;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::map<CacheKey, Slot> slots;
+};
+
+// Never destroyed, so that checkpoints outliving main still find it.
+Registry& registry() {
+  static Registry* r = new Registry;
+  return *r;
+}
+
+#if !defined(_WIN32)
+
+// A published index: this header, then the blob at kBlobOffset.
+struct SegmentHeader {
+  std::uint64_t magic;
+  std::uint64_t device;
+  std::uint64_t inode;
+  std::uint64_t size;
+  std::int64_t mtime_ns;
+  std::uint64_t blob_size;
+  // Process that created the segment.
+  std::uint64_t owner;
+  // CRC32C of the blob.
+  std::uint32_t checksum;
+  // Set last, once the blob is complete.
+  std::atomic<std::uint32_t> ready;
+};
+
+// "STIDX" plus a layout version; bump it when TensorIndex::Layout or the
+// header above changes.
+constexpr std::uint64_t kSegmentMagic = 0x0002584449545354ULL;
+constexpr std::size_t kBlobOffset = 64;
+static_assert(sizeof(SegmentHeader) <= kBlobOffset);
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+// Publishing takes a copy of the blob; a segment left incomplete for
+// longer than this was abandoned.
+constexpr auto kPublishTimeout = std::chrono::seconds(10);
+
+std::string segmentName(const detail::FileIdentity& key) {
+  std::size_t h = std::hash<std::string>{}(
+      fmt::format("{}:{}:{}:{}", key.device, key.inode, key.size,
+                  key.mtime_ns));
+  return fmt::format("/safetensors-{:016x}", h);
+}
+
+bool sameFile(const SegmentHeader& header, const detail::FileIdentity& key) {
+  return header.device == key.device && header.inode == key.inode &&
+         header.size == key.size && header.mtime_ns == key.mtime_ns;
+}
+
+// Whether an incomplete segment, whose publisher crashed or was killed
+// before setting `ready`, would otherwise keep every later open from
+// attaching or publishing: its owner is gone, or it has not been written
+// to for kPublishTimeout. A segment of another layout version is left to
+// the version that reads it.
+bool abandoned(const SegmentHeader& header, const struct stat& st,
+               const std::size_t len) {
+  const bool ours = len >= kBlobOffset && header.magic == kSegmentMagic;
+  if (len >= kBlobOffset && !ours && header.magic != 0) return false;
+  if (ours && header.ready.load(std::memory_order_acquire) == 1) return false;
+  if (ours && header.owner != 0 &&
+      kill(static_cast<pid_t>(header.owner), 0) != 0 && errno == ESRCH) {
+    return true;
+  }
+#if defined(__APPLE__)
+  const auto modified = std::chrono::seconds(st.st_mtimespec.tv_sec) +
+                        std::chrono::nanoseconds(st.st_mtimespec.tv_nsec);
+#else
+  const auto modified = std::chrono::seconds(st.st_mtim.tv_sec) +
+                        std::chrono::nanoseconds(st.st_mtim.tv_nsec);
+#endif
+  return std::chrono::system_clock::now().time_since_epoch() - modified >
+         kPublishTimeout;
+}
+
+// Attaches to the segment published for `key`. A segment still being
+// written is skipped rather than waited for; one that was abandoned, or
+// whose blob is corrupt, is unlinked so that this open publishes anew.
+// Offsets are checked by from_blob, as the segment is only as trustworthy
+// as the processes that can write to it.
+std::optional<TensorIndex> attachSegment(const detail::FileIdentity& key) {
+  const std::string name = segmentName(key);
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) return std::nullopt;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return std::nullopt;
+  }
+  const std::size_t len = static_cast<std::size_t>(st.st_size);
+  void* p = MAP_FAILED;
+  if (len >= kBlobOffset) {
+    p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) {
+    if (len < kBlobOffset) {
+      const SegmentHeader empty{};
+      if (abandoned(empty, st, len)) shm_unlink(name.c_str());
+    }
+    return std::nullopt;
+  }
+  std::shared_ptr<const void> owner(p, [len](const void* q) {
+    munmap(const_cast<void*>(q), len);
+  });
+
+  const auto* header = static_cast<const SegmentHeader*>(p);
+  if (header->magic != kSegmentMagic ||
+      header->ready.load(std::memory_order_acquire) != 1) {
+    if (abandoned(*header, st, len)) shm_unlink(name.c_str());
+    return std::nullopt;
+  }
+  if (!sameFile(*header, key)) return std::nullopt;
+  try {
+    if (header->blob_size > len - kBlobOffset) {
+      throw std::runtime_error("segment truncated");
+    }
+    const std::span<const std::byte> blob(
+        static_cast<const std::byte*>(p) + kBlobOffset,
+        static_cast<std::size_t>(header->blob_size));
+    if (crc32c(blob.data(), blob.size()) != header->checksum) {
+      throw std::runtime_error("segment checksum mismatch");
+    }
+    return TensorIndex::from_blob(std::move(owner), blob);
+  } catch (const std::runtime_error&) {
+    shm_unlink(name.c_str());
+    return std::nullopt;
+  }
+}
+
+// Best effort: if the segment exists already or cannot be created, the
+// index simply stays private to this process.
+void publishSegment(const detail::FileIdentity& key, const TensorIndex& index) {
+  const std::string name = segmentName(key);
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) return;
+  std::span<const std::byte> blob = index.blob();
+  const std::size_t len = kBlobOffset + blob.size();
+  void* p = MAP_FAILED;
+  if (ftruncate(fd, static_cast<off_t>(len)) == 0) {
+    p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    return;
+  }
+  auto* header = new (p) SegmentHeader{};
+  header->owner = static_cast<std::uint64_t>(getpid());
+  header->magic = kSegmentMagic;
+  header->device = key.device;
+  header->inode = key.inode;
+  header->size = key.size;
+  header->mtime_ns = key.mtime_ns;
+  header->blob_size = blob.size();
+  header->checksum = crc32c(blob.data(), blob.size());
+  std::memcpy(static_cast<std::byte*>(p) + kBlobOffset, blob.data(),
+              blob.size());
+  header->ready.store(1, std::memory_order_release);
+  munmap(p, len);
+}
+
+#endif
+
+std::shared_ptr<Checkpoint> build(const std::filesystem::path& path,
+                                  const CacheKey& key,
+                                  const CheckpointOptions& options) {
+  // Drops the registry slot with the last reference.
+  std::shared_ptr<Checkpoint> checkpoint(new Checkpoint, [key](Checkpoint* c) {
+    delete c;
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto it = r.slots.find(key);
+    if (it != r.slots.end() && it->second.live.expired() &&
+        !it->second.pending.valid()) {
+      r.slots.erase(it);
+    }
+  });
+  checkpoint->file = std::make_unique<File>(path);
+  checkpoint->mmap = std::make_unique<Mmap>(
+      checkpoint->file.get(), options.prefetch, false, options.huge_pages);
+  const Mmap& m = *checkpoint->mmap;
+  if (m.size() < N_LEN) {
+    throw std::runtime_error(
+        fmt::format("{}:{} file {} is too small: {} < {}", __FILE__, __LINE__,
+                    path.string(), m.size(), N_LEN));
+  }
+
+#if !defined(_WIN32)
+  if (options.shared_memory) {
+    if (std::optional<TensorIndex> index = attachSegment(key.file)) {
+      // The header length and buffer size must still match this file.
+      if (index->data_offset() + index->buffer_size() == m.size()) {
+        checkpoint->index = std::move(*index);
+        return checkpoint;
+      }
+    }
+  }
+#endif
+  checkpoint->index = parse_header_cached(path, m.data(), m.size(),
+                                          options.parser, options.sidecar);
+#if !defined(_WIN32)
+  if (options.shared_memory) publishSegment(key.file, checkpoint->index);
+#endif
+  return checkpoint;
+}
+
+}  // namespace
+
+std::shared_ptr<Checkpoint> open_checkpoint(const std::filesystem::path& path,
+                                            const CheckpointOptions& options) {
+  const CacheKey key{detail::fileIdentity(path), options.huge_pages};
+  Registry& r = registry();
+  std::promise<std::shared_ptr<Checkpoint>> promise;
+  {
+    std::unique_lock<std::mutex> lock(r.mutex);
+    Slot& slot = r.slots[key];
+    if (std::shared_ptr<Checkpoint> live = slot.live.lock()) return live;
+    if (slot.pending.valid()) {
+      auto pending = slot.pending;
+      lock.unlock();
+      return pending.get();
+    }
+    slot.pending = promise.get_future().share();
+  }
+
+  std::shared_ptr<Checkpoint> checkpoint;
+  try {
+    checkpoint = build(path, key, options);
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.slots.erase(key);
+    throw;
+  }
+  promise.set_value(checkpoint);
+  std::lock_guard<std::mutex> lock(r.mutex);
+  Slot& slot = r.slots[key];
+  slot.live = checkpoint;
+  slot.pending = {};
+  return checkpoint;
+}
+
+std::size_t cached_checkpoints() {
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  std::size_t n = 0;
+  for (const auto& [key, slot] : r.slots) n += !slot.live.expired();
+  return n;
+}
+
+std::string shared_index_name(const std::filesystem::path& path) {
+#if defined(_WIN32)
+  (void)path;
+  return {};
+#else
+  return segmentName(detail::fileIdentity(path));
+#endif
+}
+
+bool unlink_shared_index(const std::filesystem::path& path) {
+#if defined(_WIN32)
+  (void)path;
+  return false;
+#else
+  return shm_unlink(shared_index_name(path).c_str()) == 0;
+#endif
+}
+
+}  // namespace safetensors
@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/checksum.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include "fmt/format.h"
+#include "parallel.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAFETENSORS_CRC_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define SAFETENSORS_CRC_ARM 1
+#include <arm_acle.h>
+#endif
+
+namespace safetensors {
+
+namespace {
+
+// Castagnoli polynomial, bit-reflected.
+constexpr std::uint32_t kPoly = 0x82F63B78;
+
+// The hardware loop runs three independent streams of kLong, then kShort,
+// bytes to hide the latency of the CRC instruction, and merges them by
+// shifting the first two over the bytes that follow.
+constexpr std::size_t kLong = 8192;
+constexpr std::size_t kShort = 256;
+
+// a * b modulo the polynomial, both reflected.
+std::uint32_t multModP(std::uint32_t a, std::uint32_t b) noexcept {
+  std::uint32_t m = 1u << 31;
+  std::uint32_t p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) break;
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ kPoly : b >> 1;
+  }
+  return p;
+}
+
+// x^(8n) modulo the polynomial: the operator appending n zero bytes.
+std::uint32_t zerosOperator(std::size_t n) noexcept {
+  // x^1, squared once per bit of the bit count 8n.
+  std::uint32_t power = 1u << 30;
+  std::uint32_t result = 1u << 31;
+  for (n <<= 3; n; n >>= 1) {
+    if (n & 1) result = multModP(power, result);
+    power = multModP(power, power);
+  }
+  return result;
+}
+
+struct Tables {
+  // Slicing-by-8 for the portable path.
+  std::uint32_t bytes[8][256];
+  // `multModP(zerosOperator(kLong), crc)` one byte of `crc` at a time.
+  std::uint32_t shift_long[4][256];
+  std::uint32_t shift_short[4][256];
+};
+
+void fillShift(std::uint32_t (&table)[4][256], const std::size_t n) {
+  const std::uint32_t op = zerosOperator(n);
+  for (std::uint32_t k = 0; k < 4; ++k) {
+    for (std::uint32_t b = 0; b < 256; ++b) {
+      table[k][b] = multModP(op, b << (8 * k));
+    }
+  }
+}
+
+const Tables& tables() noexcept {
+  static const Tables* t = [] {
+    auto* t = new Tables;
+    for (std::uint32_t b = 0; b < 256; ++b) {
+      std::uint32_t c = b;
+      for (int k = 0; k < 8; ++k) c = c & 1 ? (c >> 1) ^ kPoly : c >> 1;
+      t->bytes[0][b] = c;
+    }
+    for (std::uint32_t b = 0; b < 256; ++b) {
+      for (int k = 1; k < 8; ++k) {
+        const std::uint32_t c = t->bytes[k - 1][b];
+        t->bytes[k][b] = (c >> 8) ^ t->bytes[0][c & 0xFF];
+      }
+    }
+    fillShift(t->shift_long, kLong);
+    fillShift(t->shift_short, kShort);
+    return t;
+  }();
+  return *t;
+}
+
+[[maybe_unused]] std::uint32_t shift(const std::uint32_t (&table)[4][256],
+                                     const std::uint32_t crc) noexcept {
+  return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^
+         table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+}
+
+std::uint64_t load64(const std::uint8_t* p) noexcept {
+  std::uint64_t v;
+  std::memcpy(&v, p, 8);
+  return v;
+}
+
+// The update functions take and return the register, i.e. the inverted
+// checksum.
+std::uint32_t updateScalar(std::uint32_t crc, const std::uint8_t* p,
+                           std::size_t n) noexcept {
+  const Tables& t = tables();
+  for (; n >= 8; n -= 8, p += 8) {
+    // Little endian: the first byte meets the low byte of the register.
+    const std::uint64_t v =
+        load64(p) ^ crc;
+    crc = t.bytes[7][v & 0xFF] ^ t.bytes[6][(v >> 8) & 0xFF] ^
+          t.bytes[5][(v >> 16) & 0xFF] ^ t.bytes[4][(v >> 24) & 0xFF] ^
+          t.bytes[3][(v >> 32) & 0xFF] ^ t.bytes[2][(v >> 40) & 0xFF] ^
+          t.bytes[1][(v >> 48) & 0xFF] ^ t.bytes[0][v >> 56];
+  }
+  for (; n; --n) crc = (crc >> 8) ^ t.bytes[0][(crc ^ *p++) & 0xFF];
+  return crc;
+}
+
+#if defined(SAFETENSORS_CRC_X86) || defined(SAFETENSORS_CRC_ARM)
+
+#if defined(SAFETENSORS_CRC_X86)
+#define SAFETENSORS_CRC_TARGET __attribute__((target("sse4.2")))
+#if defined(__x86_64__)
+SAFETENSORS_CRC_TARGET inline std::uint32_t crcWord(std::uint32_t crc,
+                                                    std::uint64_t v) {
+  return static_cast<std::uint32_t>(_mm_crc32_u64(crc, v));
+}
+#else
+SAFETENSORS_CRC_TARGET inline std::uint32_t crcWord(std::uint32_t crc,
+                                                    std::uint64_t v) {
+  crc = _mm_crc32_u32(crc, static_cast<std::uint32_t>(v));
+  return _mm_crc32_u32(crc, static_cast<std::uint32_t>(v >> 32));
+}
+#endif
+SAFETENSORS_CRC_TARGET inline std::uint32_t crcByte(std::uint32_t crc,
+                                                    std::uint8_t v) {
+  return _mm_crc32_u8(crc, v);
+}
+#else
+#define SAFETENSORS_CRC_TARGET
+inline std::uint32_t crcWord(std::uint32_t crc, std::uint64_t v) {
+  return __crc32cd(crc, v);
+}
+inline std::uint32_t crcByte(std::uint32_t crc, std::uint8_t v) {
+  return __crc32cb(crc, v);
+}
+#endif
+
+template <std::size_t Block>
+SAFETENSORS_CRC_TARGET std::uint32_t streams3(
+    std::uint32_t crc, const std::uint8_t*& p, std::size_t& n,
+    const std::uint32_t (&table)[4][256]) {
+  while (n >= 3 * Block) {
+    std::uint32_t c0 = crc;
+    std::uint32_t c1 = 0;
+    std::uint32_t c2 = 0;
+    const std::uint8_t* end = p + Block;
+    do {
+      c0 = crcWord(c0, load64(p));
+      c1 = crcWord(c1, load64(p + Block));
+      c2 = crcWord(c2, load64(p + 2 * Block));
+      p += 8;
+    } while (p < end);
+    crc = shift(table, shift(table, c0) ^ c1) ^ c2;
+    p += 2 * Block;
+    n -= 3 * Block;
+  }
+  return crc;
+}
+
+SAFETENSORS_CRC_TARGET std::uint32_t updateHardware(std::uint32_t crc,
+                                                    const std::uint8_t* p,
+                                                    std::size_t n) noexcept {
+  for (; n && reinterpret_cast<std::uintptr_t>(p) & 7; --n) {
+    crc = crcByte(crc, *p++);
+  }
+  const Tables& t = tables();
+  crc = streams3<kLong>(crc, p, n, t.shift_long);
+  crc = streams3<kShort>(crc, p, n, t.shift_short);
+  for (; n >= 8; n -= 8, p += 8) crc = crcWord(crc, load64(p));
+  for (; n; --n) crc = crcByte(crc, *p++);
+  return crc;
+}
+
+#endif
+
+struct Kernel {
+  std::string_view isa;
+  std::uint32_t (*update)(std::uint32_t, const std::uint8_t*, std::size_t);
+};
+
+Kernel pickKernel() noexcept {
+#if defined(SAFETENSORS_CRC_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) return Kernel{"sse4.2", updateHardware};
+#elif defined(SAFETENSORS_CRC_ARM)
+  return Kernel{"armv8", updateHardware};
+#endif
+  return Kernel{"scalar", updateScalar};
+}
+
+const Kernel& kernel() noexcept {
+  static const Kernel k = pickKernel();
+  return k;
+}
+
+// Piece [offset, offset + size) of range `range`.
+struct Piece {
+  std::size_t range;
+  std::size_t offset;
+  std::size_t size;
+};
+
+}  // namespace
+
+std::uint32_t crc32c(const void* data, const std::size_t size,
+                     const std::uint32_t crc) noexcept {
+  return ~kernel().update(~crc, static_cast<const std::uint8_t*>(data), size);
+}
+
+std::uint32_t crc32c_combine(const std::uint32_t crc_a,
+                             const std::uint32_t crc_b,
+                             const std::size_t size_b) noexcept {
+  return multModP(zerosOperator(size_b), crc_a) ^ crc_b;
+}
+
+std::string_view crc32c_isa() noexcept { return kernel().isa; }
+
+std::vector<std::uint32_t> crc32c_ranges(const Mmap& mmap,
+                                         std::span<const ByteRange> ranges,
+                                         const PrefetchOptions& options,
+                                         PrefetchStats* stats) {
+  const auto start = std::chrono::steady_clock::now();
+  const std::size_t chunk = std::max<std::size_t>(Mmap::pageSize(),
+                                                  options.chunk_bytes);
+  // Large ranges are split into pieces of `chunk` bytes; small ones are
+  // grouped into work items of about that size.
+  std::vector<Piece> pieces;
+  std::vector<std::size_t> items;
+  std::size_t item_bytes = chunk;
+  std::size_t total = 0;
+  for (std::size_t r = 0; r < ranges.size(); ++r) {
+    const std::size_t size = ranges[r].last > ranges[r].first
+                                 ? ranges[r].last - ranges[r].first
+                                 : 0;
+    std::size_t offset = 0;
+    do {
+      const std::size_t n = std::min(chunk, size - offset);
+      if (item_bytes >= chunk || n >= chunk) {
+        items.push_back(pieces.size());
+        item_bytes = 0;
+      }
+      pieces.push_back(Piece{r, offset, n});
+      item_bytes += n;
+      offset += n;
+    } while (offset < size);
+    total += size;
+  }
+  items.push_back(pieces.size());
+
+  const std::size_t threads =
+      std::min(options.threads ? options.threads : detail::defaultThreads(),
+               std::max<std::size_t>(1, items.size() - 1));
+  std::vector<std::uint32_t> crcs(pieces.size());
+  std::size_t done = 0;
+  std::mutex progress_mutex;
+  const std::uint8_t* base = mmap.data();
+  detail::parallelFor(items.size() - 1, threads, [&](std::size_t i) {
+    std::size_t bytes = 0;
+    for (std::size_t k = items[i]; k < items[i + 1]; ++k) {
+      const Piece& piece = pieces[k];
+      crcs[k] = crc32c(base + ranges[piece.range].first + piece.offset,
+                       piece.size);
+      bytes += piece.size;
+    }
+    if (options.progress) {
+      std::lock_guard<std::mutex> lock(progress_mutex);
+      done += bytes;
+      options.progress(done, total);
+    }
+  });
+
+  std::vector<std::uint32_t> out(ranges.size(), 0);
+  for (std::size_t k = 0; k < pieces.size(); ++k) {
+    const Piece& piece = pieces[k];
+    out[piece.range] = piece.offset ? crc32c_combine(out[piece.range], crcs[k],
+                                                     piece.size)
+                                    : crcs[k];
+  }
+  if (stats) {
+    stats->bytes = total;
+    stats->ranges = ranges.size();
+    stats->threads = threads;
+    stats->seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  }
+  return out;
+}
+
+VerifyResult verify_checksums(const TensorIndex& index, const Mmap& mmap,
+                              const PrefetchOptions& options,
+                              const std::function<bool(std::size_t)>& skip) {
+  std::optional<std::string_view> text = index.metadata(CHECKSUM_KEY);
+  if (!text) {
+    throw std::runtime_error(
+        fmt::format("no {} checksums in the metadata", CHECKSUM_KEY));
+  }
+  std::vector<ByteRange> ranges;
+  std::vector<std::size_t> tensors;
+  const std::size_t base = index.data_offset();
+  for (std::size_t i = 0; i < index.size(); ++i) {
+    const TensorIndex::Entry& e = index.entry(i);
+    if (e.end == e.begin) continue;
+    ranges.push_back(ByteRange{base + static_cast<std::size_t>(e.begin),
+                               base + static_cast<std::size_t>(e.end)});
+    tensors.push_back(i);
+  }
+  if (text->size() != 8 * ranges.size()) {
+    throw std::runtime_error(
+        fmt::format("{} holds {} characters, expected 8 for each of {} "
+                    "tensors",
+                    CHECKSUM_KEY, text->size(), ranges.size()));
+  }
+  std::vector<std::uint32_t> expected(ranges.size());
+  for (std::size_t i = 0; i < ranges.size(); ++i) {
+    std::uint32_t v = 0;
+    for (std::size_t k = 0; k < 8; ++k) {
+      const char c = (*text)[8 * i + k];
+      std::uint32_t digit;
+      if (c >= '0' && c <= '9') {
+        digit = static_cast<std::uint32_t>(c - '0');
+      } else if (c >= 'a' && c <= 'f') {
+        digit = static_cast<std::uint32_t>(c - 'a' + 10);
+      } else if (c >= 'A' && c <= 'F') {
+        digit = static_cast<std::uint32_t>(c - 'A' + 10);
+      } else {
+        throw std::runtime_error(fmt::format(
+            "{} is not hexadecimal at character {}", CHECKSUM_KEY, 8 * i + k));
+      }
+      v = v << 4 | digit;
+    }
+    expected[i] = v;
+  }
+
+  VerifyResult result;
+  if (skip) {
+    // Every checksum is parsed above since they are stored by position.
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < ranges.size(); ++i) {
+      if (skip(tensors[i])) continue;
+      ranges[kept] = ranges[i];
+      tensors[kept] = tensors[i];
+      expected[kept] = expected[i];
+      ++kept;
+    }
+    result.skipped = ranges.size() - kept;
+    ranges.resize(kept);
+    tensors.resize(kept);
+    expected.resize(kept);
+  }
+  result.tensors = ranges.size();
+  std::vector<std::uint32_t> actual =
+      crc32c_ranges(mmap, ranges, options, &result.stats);
+  for (std::size_t i = 0; i < ranges.size(); ++i) {
+    if (actual[i] != expected[i]) {
+      result.mismatched.push_back(index.name(tensors[i]));
+    }
+  }
+  return result;
+}
+
+}  // namespace safetensors
@@ -0,0 +1,843 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/convert.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "fmt/format.h"
+#include "safetensors/header.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAFETENSORS_CONVERT_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define SAFETENSORS_CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace safetensors {
+
+namespace {
+
+float asFloat(const std::uint32_t bits) noexcept {
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+std::uint32_t asBits(const float f) noexcept {
+  std::uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+// IEEE half conversions without F16C, after Maratyszcza's FP16 library.
+float halfToFloat(const std::uint16_t h) noexcept {
+  const std::uint32_t w = static_cast<std::uint32_t>(h) << 16;
+  const std::uint32_t sign = w & 0x80000000u;
+  const std::uint32_t two_w = w + w;
+  const float normalized = asFloat((two_w >> 4) + (0xE0u << 23)) * 0x1.0p-112f;
+  const float denormalized = asFloat((two_w >> 17) | (126u << 23)) - 0.5f;
+  return asFloat(sign | (two_w < (1u << 27) ? asBits(denormalized)
+                                            : asBits(normalized)));
+}
+
+std::uint16_t floatToHalf(const float f) noexcept {
+  float base = (std::fabs(f) * 0x1.0p+112f) * 0x1.0p-110f;
+  const std::uint32_t w = asBits(f);
+  const std::uint32_t shl1_w = w + w;
+  const std::uint32_t sign = w & 0x80000000u;
+  std::uint32_t bias = shl1_w & 0xFF000000u;
+  if (bias < 0x71000000u) bias = 0x71000000u;
+  base = asFloat((bias >> 1) + 0x07800000u) + base;
+  const std::uint32_t bits = asBits(base);
+  const std::uint32_t nonsign = ((bits >> 13) & 0x7C00u) + (bits & 0x0FFFu);
+  return static_cast<std::uint16_t>((sign >> 16) |
+                                    (shl1_w > 0xFF000000u ? 0x7E00u : nonsign));
+}
+
+float bf16ToFloat(const std::uint16_t h) noexcept {
+  return asFloat(static_cast<std::uint32_t>(h) << 16);
+}
+
+std::uint16_t floatToBf16(const float f) noexcept {
+  std::uint32_t bits = asBits(f);
+  if ((bits & 0x7FFFFFFFu) > 0x7F800000u) {
+    return static_cast<std::uint16_t>((bits >> 16) | 0x0040u);
+  }
+  bits += 0x7FFFu + ((bits >> 16) & 1u);
+  return static_cast<std::uint16_t>(bits >> 16);
+}
+
+// A float of at most eight bits for the F32 encoder: `mbits` mantissa bits,
+// exponent `bias`, sign at bit `sign_shift`. Out of range values saturate
+// to `max_code`; NaN becomes `nan_code` (zero for formats without NaN).
+struct MiniFormat {
+  std::uint32_t mbits;
+  std::uint32_t bias;
+  std::uint32_t max_code;
+  std::uint32_t nan_code;
+  std::uint32_t sign_shift;
+  // Exponent of the largest finite value, used to choose MX scales.
+  int emax;
+
+  // F32 bits of the largest finite value and of the smallest normal one.
+  constexpr std::uint32_t maxBits() const noexcept {
+    return (((max_code >> mbits) + 127 - bias) << 23) |
+           ((max_code & ((1u << mbits) - 1)) << (23 - mbits));
+  }
+  constexpr std::uint32_t minNormalBits() const noexcept {
+    return (128 - bias) << 23;
+  }
+  // A power of two whose ulp is the subnormal step, so that adding it
+  // rounds a subnormal to nearest even in hardware.
+  constexpr std::uint32_t magicBits() const noexcept {
+    return (127 + 24 - bias - mbits) << 23;
+  }
+};
+
+constexpr MiniFormat kE2M1{1, 1, 0x07, 0x00, 3, 2};
+constexpr MiniFormat kE2M3{3, 1, 0x1F, 0x00, 5, 2};
+constexpr MiniFormat kE3M2{2, 3, 0x1F, 0x00, 5, 4};
+constexpr MiniFormat kE4M3{3, 7, 0x7E, 0x7F, 7, 8};
+constexpr MiniFormat kE5M2{2, 15, 0x7B, 0x7F, 7, 15};
+
+const MiniFormat* miniFormat(const Dtype dtype) noexcept {
+  switch (dtype) {
+    case Dtype::F4:
+      return &kE2M1;
+    case Dtype::F6_E2M3:
+      return &kE2M3;
+    case Dtype::F6_E3M2:
+      return &kE3M2;
+    case Dtype::F8_E4M3:
+      return &kE4M3;
+    case Dtype::F8_E5M2:
+      return &kE5M2;
+    default:
+      return nullptr;
+  }
+}
+
+std::uint32_t encodeMini(const float f, const MiniFormat& fmt) noexcept {
+  const std::uint32_t bits = asBits(f);
+  std::uint32_t abs = bits & 0x7FFFFFFFu;
+  if (abs > 0x7F800000u) return fmt.nan_code;
+  // Non-negative floats order like their bits.
+  abs = std::min(abs, fmt.maxBits());
+  std::uint32_t code;
+  if (abs < fmt.minNormalBits()) {
+    code = asBits(asFloat(abs) + asFloat(fmt.magicBits())) - fmt.magicBits();
+  } else {
+    const std::uint32_t shift = 23 - fmt.mbits;
+    const std::uint32_t round = (1u << (shift - 1)) - 1 + ((abs >> shift) & 1);
+    code = ((abs + round) >> shift) - ((127 - fmt.bias) << fmt.mbits);
+  }
+  return code | ((bits >> 31) << fmt.sign_shift);
+}
+
+// Kernels with a SIMD variant. All take unaligned pointers.
+struct Kernels {
+  std::string_view isa;
+  void (*f16ToF32)(const std::uint16_t*, float*, std::size_t);
+  void (*bf16ToF32)(const std::uint16_t*, float*, std::size_t);
+  void (*f32ToF16)(const float*, std::uint16_t*, std::size_t);
+  void (*f32ToBf16)(const float*, std::uint16_t*, std::size_t);
+  // `n` values packed two per byte (F4) or four per three bytes (F6),
+  // decoded through a table of 16 or 64 entries.
+  void (*f4ToF32)(const std::uint8_t*, const float*, float*, std::size_t);
+  void (*f6ToF32)(const std::uint8_t*, const float*, float*, std::size_t);
+  // One code per byte; F4 and F6 are packed afterwards.
+  void (*f32ToMini)(const float*, std::uint8_t*, std::size_t,
+                    const MiniFormat&);
+};
+
+void f16ToF32Scalar(const std::uint16_t* src, float* dst, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) dst[i] = halfToFloat(src[i]);
+}
+
+void bf16ToF32Scalar(const std::uint16_t* src, float* dst, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) dst[i] = bf16ToFloat(src[i]);
+}
+
+void f32ToF16Scalar(const float* src, std::uint16_t* dst, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) dst[i] = floatToHalf(src[i]);
+}
+
+void f32ToBf16Scalar(const float* src, std::uint16_t* dst, std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) dst[i] = floatToBf16(src[i]);
+}
+
+void f4ToF32Scalar(const std::uint8_t* src, const float* table, float* dst,
+                   std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) {
+    dst[i] = table[(src[i / 2] >> (4 * (i & 1))) & 0xF];
+  }
+}
+
+void f6ToF32Scalar(const std::uint8_t* src, const float* table, float* dst,
+                   std::size_t n) {
+  for (std::size_t i = 0; i < n; i += 4, src += 3) {
+    std::uint32_t w = src[0] | (static_cast<std::uint32_t>(src[1]) << 8) |
+                      (static_cast<std::uint32_t>(src[2]) << 16);
+    for (std::size_t k = 0; k < 4 && i + k < n; ++k) {
+      dst[i + k] = table[(w >> (6 * k)) & 0x3F];
+    }
+  }
+}
+
+void f32ToMiniScalar(const float* src, std::uint8_t* dst, std::size_t n,
+                     const MiniFormat& fmt) {
+  for (std::size_t i = 0; i < n; ++i) {
+    dst[i] = static_cast<std::uint8_t>(encodeMini(src[i], fmt));
+  }
+}
+
+#if defined(SAFETENSORS_CONVERT_X86)
+
+__attribute__((target("avx2,f16c"))) void f16ToF32Avx2(
+    const std::uint16_t* src, float* dst, std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+  }
+  f16ToF32Scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2"))) void bf16ToF32Avx2(const std::uint16_t* src,
+                                                   float* dst, std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m256i w = _mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), w);
+  }
+  bf16ToF32Scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2,f16c"))) void f32ToF16Avx2(const float* src,
+                                                       std::uint16_t* dst,
+                                                       std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+  }
+  f32ToF16Scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2"))) void f32ToBf16Avx2(const float* src,
+                                                   std::uint16_t* dst,
+                                                   std::size_t n) {
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i round = _mm256_set1_epi32(0x7FFF);
+  const __m256i quiet = _mm256_set1_epi32(0x0040);
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(src + i);
+    __m256i x = _mm256_castps_si256(v);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(x, 16), one);
+    __m256i r = _mm256_srli_epi32(
+        _mm256_add_epi32(x, _mm256_add_epi32(round, lsb)), 16);
+    __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+    __m256i q = _mm256_or_si256(_mm256_srli_epi32(x, 16), quiet);
+    r = _mm256_blendv_epi8(r, q, nan);
+    // packus works per 128-bit lane; gather the two low quadwords.
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm256_castsi256_si128(packed));
+  }
+  f32ToBf16Scalar(src + i, dst + i, n - i);
+}
+
+// Eight table entries hold the magnitudes; bit 3 of the nibble is the sign.
+__attribute__((target("avx2"))) void f4ToF32Avx2(const std::uint8_t* src,
+                                                 const float* table,
+                                                 float* dst, std::size_t n) {
+  const __m256 magnitudes = _mm256_loadu_ps(table);
+  const __m256i nibble = _mm256_set1_epi32(0xF);
+  const __m256i sign = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i b = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i / 2)));
+    __m256i lo = _mm256_and_si256(b, nibble);
+    __m256i hi = _mm256_srli_epi32(b, 4);
+    __m256 vlo = _mm256_or_ps(
+        _mm256_permutevar8x32_ps(magnitudes, lo),
+        _mm256_castsi256_ps(_mm256_and_si256(_mm256_slli_epi32(lo, 28), sign)));
+    __m256 vhi = _mm256_or_ps(
+        _mm256_permutevar8x32_ps(magnitudes, hi),
+        _mm256_castsi256_ps(_mm256_and_si256(_mm256_slli_epi32(hi, 28), sign)));
+    // Interleave low and high nibbles; unpack works per 128-bit lane.
+    __m256 a = _mm256_unpacklo_ps(vlo, vhi);
+    __m256 c = _mm256_unpackhi_ps(vlo, vhi);
+    _mm256_storeu_ps(dst + i, _mm256_permute2f128_ps(a, c, 0x20));
+    _mm256_storeu_ps(dst + i + 8, _mm256_permute2f128_ps(a, c, 0x31));
+  }
+  f4ToF32Scalar(src + i / 2, table, dst + i, n - i);
+}
+
+__attribute__((target("avx2"))) void f6ToF32Avx2(const std::uint8_t* src,
+                                                 const float* table,
+                                                 float* dst, std::size_t n) {
+  const __m256i shifts = _mm256_setr_epi32(0, 6, 12, 18, 0, 6, 12, 18);
+  const __m256i mask = _mm256_set1_epi32(0x3F);
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8, src += 6) {
+    int w0 = src[0] | (src[1] << 8) | (src[2] << 16);
+    int w1 = src[3] | (src[4] << 8) | (src[5] << 16);
+    __m256i w = _mm256_setr_epi32(w0, w0, w0, w0, w1, w1, w1, w1);
+    __m256i idx = _mm256_and_si256(_mm256_srlv_epi32(w, shifts), mask);
+    _mm256_storeu_ps(dst + i, _mm256_i32gather_ps(table, idx, 4));
+  }
+  f6ToF32Scalar(src, table, dst + i, n - i);
+}
+
+__attribute__((target("avx2"))) void f32ToMiniAvx2(const float* src,
+                                                   std::uint8_t* dst,
+                                                   std::size_t n,
+                                                   const MiniFormat& fmt) {
+  const std::uint32_t shift = 23 - fmt.mbits;
+  const __m256i abs_mask = _mm256_set1_epi32(0x7FFFFFFF);
+  const __m256i inf = _mm256_set1_epi32(0x7F800000);
+  const __m256i max_bits = _mm256_set1_epi32(static_cast<int>(fmt.maxBits()));
+  const __m256i min_normal =
+      _mm256_set1_epi32(static_cast<int>(fmt.minNormalBits()));
+  const __m256i magic = _mm256_set1_epi32(static_cast<int>(fmt.magicBits()));
+  const __m256i round = _mm256_set1_epi32((1 << (shift - 1)) - 1);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i rebias =
+      _mm256_set1_epi32(static_cast<int>((127 - fmt.bias) << fmt.mbits));
+  const __m256i nan_code = _mm256_set1_epi32(static_cast<int>(fmt.nan_code));
+  const __m128i mshift = _mm_cvtsi32_si128(static_cast<int>(shift));
+  const __m128i sshift = _mm_cvtsi32_si128(static_cast<int>(fmt.sign_shift));
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    __m256i a = _mm256_and_si256(x, abs_mask);
+    __m256i nan = _mm256_cmpgt_epi32(a, inf);
+    a = _mm256_min_epi32(a, max_bits);
+    __m256i sub = _mm256_sub_epi32(
+        _mm256_castps_si256(_mm256_add_ps(_mm256_castsi256_ps(a),
+                                          _mm256_castsi256_ps(magic))),
+        magic);
+    __m256i lsb = _mm256_and_si256(_mm256_srl_epi32(a, mshift), one);
+    __m256i normal = _mm256_sub_epi32(
+        _mm256_srl_epi32(_mm256_add_epi32(a, _mm256_add_epi32(round, lsb)),
+                         mshift),
+        rebias);
+    __m256i code =
+        _mm256_blendv_epi8(normal, sub, _mm256_cmpgt_epi32(min_normal, a));
+    code = _mm256_or_si256(code,
+                           _mm256_sll_epi32(_mm256_srli_epi32(x, 31), sshift));
+    code = _mm256_blendv_epi8(code, nan_code, nan);
+    // Bytes 0-3 of each 128-bit lane end up holding the four codes.
+    __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(code, code),
+                                         _mm256_setzero_si256());
+    std::uint32_t lo = static_cast<std::uint32_t>(
+        _mm_cvtsi128_si32(_mm256_castsi256_si128(packed)));
+    std::uint32_t hi =
+        static_cast<std::uint32_t>(_mm256_extract_epi32(packed, 4));
+    std::memcpy(dst + i, &lo, 4);
+    std::memcpy(dst + i + 4, &hi, 4);
+  }
+  f32ToMiniScalar(src + i, dst + i, n - i, fmt);
+}
+
+// GCC 12 warns about the _mm512_undefined_* placeholders in its headers.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f"))) void f16ToF32Avx512(
+    const std::uint16_t* src, float* dst, std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(h));
+  }
+  f16ToF32Scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx512f"))) void bf16ToF32Avx512(
+    const std::uint16_t* src, float* dst, std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    __m512i w = _mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16);
+    _mm512_storeu_si512(dst + i, w);
+  }
+  bf16ToF32Scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx512f"))) void f32ToF16Avx512(const float* src,
+                                                       std::uint16_t* dst,
+                                                       std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i h = _mm512_cvtps_ph(_mm512_loadu_ps(src + i),
+                                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), h);
+  }
+  f32ToF16Scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx512f"))) void f32ToBf16Avx512(const float* src,
+                                                        std::uint16_t* dst,
+                                                        std::size_t n) {
+  const __m512i one = _mm512_set1_epi32(1);
+  const __m512i round = _mm512_set1_epi32(0x7FFF);
+  const __m512i quiet = _mm512_set1_epi32(0x0040);
+  std::size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 v = _mm512_loadu_ps(src + i);
+    __m512i x = _mm512_castps_si512(v);
+    __m512i hi = _mm512_srli_epi32(x, 16);
+    __m512i lsb = _mm512_and_si512(hi, one);
+    __m512i r = _mm512_srli_epi32(
+        _mm512_add_epi32(x, _mm512_add_epi32(round, lsb)), 16);
+    __mmask16 nan = _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q);
+    r = _mm512_mask_mov_epi32(r, nan, _mm512_or_si512(hi, quiet));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm512_cvtepi32_epi16(r));
+  }
+  f32ToBf16Scalar(src + i, dst + i, n - i);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#elif defined(SAFETENSORS_CONVERT_NEON)
+
+void f16ToF32Neon(const std::uint16_t* src, float* dst, std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float16x4_t h = vreinterpret_f16_u16(vld1_u16(src + i));
+    vst1q_f32(dst + i, vcvt_f32_f16(h));
+  }
+  f16ToF32Scalar(src + i, dst + i, n - i);
+}
+
+void bf16ToF32Neon(const std::uint16_t* src, float* dst, std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_u32(reinterpret_cast<std::uint32_t*>(dst + i),
+              vshll_n_u16(vld1_u16(src + i), 16));
+  }
+  bf16ToF32Scalar(src + i, dst + i, n - i);
+}
+
+void f32ToF16Neon(const float* src, std::uint16_t* dst, std::size_t n) {
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1_u16(dst + i,
+             vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+  }
+  f32ToF16Scalar(src + i, dst + i, n - i);
+}
+
+void f32ToBf16Neon(const float* src, std::uint16_t* dst, std::size_t n) {
+  const uint32x4_t round = vdupq_n_u32(0x7FFF);
+  const uint32x4_t quiet = vdupq_n_u32(0x00400000);
+  std::size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t v = vld1q_f32(src + i);
+    uint32x4_t x = vreinterpretq_u32_f32(v);
+    uint32x4_t lsb = vandq_u32(vshrq_n_u32(x, 16), vdupq_n_u32(1));
+    uint32x4_t r = vaddq_u32(x, vaddq_u32(round, lsb));
+    // Lanes that are not equal to themselves are NaN.
+    uint32x4_t ok = vceqq_f32(v, v);
+    r = vbslq_u32(ok, r, vorrq_u32(x, quiet));
+    vst1_u16(dst + i, vshrn_n_u32(r, 16));
+  }
+  f32ToBf16Scalar(src + i, dst + i, n - i);
+}
+
+#endif
+
+Kernels pickKernels() noexcept {
+#if defined(SAFETENSORS_CONVERT_X86)
+  __builtin_cpu_init();
+  // Every AVX-512 CPU has AVX2, which the packed formats use.
+  if (__builtin_cpu_supports("avx512f")) {
+    return Kernels{"avx512",       f16ToF32Avx512, bf16ToF32Avx512,
+                   f32ToF16Avx512, f32ToBf16Avx512, f4ToF32Avx2,
+                   f6ToF32Avx2,    f32ToMiniAvx2};
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) {
+    return Kernels{"avx2",       f16ToF32Avx2, bf16ToF32Avx2,
+                   f32ToF16Avx2, f32ToBf16Avx2, f4ToF32Avx2,
+                   f6ToF32Avx2,  f32ToMiniAvx2};
+  }
+#elif defined(SAFETENSORS_CONVERT_NEON)
+  return Kernels{"neon",        f16ToF32Neon,  bf16ToF32Neon,
+                 f32ToF16Neon,  f32ToBf16Neon, f4ToF32Scalar,
+                 f6ToF32Scalar, f32ToMiniScalar};
+#endif
+  return Kernels{"scalar",        f16ToF32Scalar,  bf16ToF32Scalar,
+                 f32ToF16Scalar,  f32ToBf16Scalar, f4ToF32Scalar,
+                 f6ToF32Scalar,   f32ToMiniScalar};
+}
+
+const Kernels& kernels() noexcept {
+  static const Kernels k = pickKernels();
+  return k;
+}
+
+// Value of a small float with `ebits` exponent and `mbits` mantissa bits and
+// no infinities; the all-ones encoding is NaN if `nan_ones` is set.
+float decodeMini(const unsigned bits, const int ebits, const int mbits,
+                 const int bias, const bool nan_ones) noexcept {
+  const unsigned mmask = (1u << mbits) - 1;
+  const unsigned emask = (1u << ebits) - 1;
+  const bool negative = (bits >> (ebits + mbits)) & 1u;
+  const unsigned e = (bits >> mbits) & emask;
+  const unsigned m = bits & mmask;
+  float v;
+  if (nan_ones && e == emask && m == mmask) {
+    v = std::numeric_limits<float>::quiet_NaN();
+  } else if (e == 0) {
+    v = std::ldexp(static_cast<float>(m), 1 - bias - mbits);
+  } else {
+    v = std::ldexp(static_cast<float>(m | (1u << mbits)),
+                   static_cast<int>(e) - bias - mbits);
+  }
+  return negative ? -v : v;
+}
+
+using Table8 = std::array<float, 256>;
+
+template <typename F>
+Table8 makeTable(F&& decode) {
+  Table8 table{};
+  for (unsigned i = 0; i < 256; ++i) table[i] = decode(i);
+  return table;
+}
+
+const Table8& e4m3Table() {
+  static const Table8 t =
+      makeTable([](unsigned b) { return decodeMini(b, 4, 3, 7, true); });
+  return t;
+}
+
+const Table8& e5m2Table() {
+  // E5M2 is the upper byte of an IEEE half, with infinities.
+  static const Table8 t = makeTable([](unsigned b) {
+    return halfToFloat(static_cast<std::uint16_t>(b << 8));
+  });
+  return t;
+}
+
+const Table8& e8m0Table() {
+  static const Table8 t = makeTable([](unsigned b) {
+    return b == 0xFF ? std::numeric_limits<float>::quiet_NaN()
+                     : std::ldexp(1.0f, static_cast<int>(b) - 127);
+  });
+  return t;
+}
+
+// Both nibbles of a byte of F4 (E2M1), low nibble first.
+const std::array<float, 16>& e2m1Table() {
+  static const std::array<float, 16> t = [] {
+    std::array<float, 16> table{};
+    for (unsigned i = 0; i < 16; ++i) table[i] = decodeMini(i, 2, 1, 1, false);
+    return table;
+  }();
+  return t;
+}
+
+const std::array<float, 64>& f6Table(const Dtype dtype) {
+  static const std::array<float, 64> e2m3 = [] {
+    std::array<float, 64> table{};
+    for (unsigned i = 0; i < 64; ++i) table[i] = decodeMini(i, 2, 3, 1, false);
+    return table;
+  }();
+  static const std::array<float, 64> e3m2 = [] {
+    std::array<float, 64> table{};
+    for (unsigned i = 0; i < 64; ++i) table[i] = decodeMini(i, 3, 2, 3, false);
+    return table;
+  }();
+  return dtype == Dtype::F6_E2M3 ? e2m3 : e3m2;
+}
+
+// Elements converted per pass through the F32 staging buffer.
+constexpr std::size_t kBlock = 2048;
+
+template <typename T>
+void castToF32(const void* src, float* dst, std::size_t n) {
+  const T* s = static_cast<const T*>(src);
+  for (std::size_t i = 0; i < n; ++i) dst[i] = static_cast<float>(s[i]);
+}
+
+void lookup(const void* src, const Table8& table, float* dst, std::size_t n) {
+  const auto* s = static_cast<const std::uint8_t*>(src);
+  for (std::size_t i = 0; i < n; ++i) dst[i] = table[s[i]];
+}
+
+// Elements [first, first + n) of `src` as F32. `first` is a multiple of four
+// so that packed sources start on a byte.
+void toF32(const void* src, const Dtype from, const std::size_t first,
+           const std::size_t n, float* dst) {
+  const auto* bytes = static_cast<const std::uint8_t*>(src);
+  switch (from) {
+    case Dtype::F32:
+      std::memcpy(dst, bytes + first * 4, n * 4);
+      return;
+    case Dtype::F16:
+      kernels().f16ToF32(reinterpret_cast<const std::uint16_t*>(bytes) + first,
+                         dst, n);
+      return;
+    case Dtype::BF16:
+      kernels().bf16ToF32(reinterpret_cast<const std::uint16_t*>(bytes) + first,
+                          dst, n);
+      return;
+    case Dtype::F8_E4M3:
+      return lookup(bytes + first, e4m3Table(), dst, n);
+    case Dtype::F8_E5M2:
+      return lookup(bytes + first, e5m2Table(), dst, n);
+    case Dtype::F8_E8M0:
+      return lookup(bytes + first, e8m0Table(), dst, n);
+    case Dtype::F4:
+      return kernels().f4ToF32(bytes + first / 2, e2m1Table().data(), dst, n);
+    case Dtype::F6_E2M3:
+    case Dtype::F6_E3M2:
+      return kernels().f6ToF32(bytes + first / 4 * 3, f6Table(from).data(),
+                               dst, n);
+    case Dtype::BOOL:
+    case Dtype::U8:
+      return castToF32<std::uint8_t>(bytes + first, dst, n);
+    case Dtype::I8:
+      return castToF32<std::int8_t>(bytes + first, dst, n);
+    case Dtype::I16:
+      return castToF32<std::int16_t>(bytes + first * 2, dst, n);
+    case Dtype::U16:
+      return castToF32<std::uint16_t>(bytes + first * 2, dst, n);
+    case Dtype::I32:
+      return castToF32<std::int32_t>(bytes + first * 4, dst, n);
+    case Dtype::U32:
+      return castToF32<std::uint32_t>(bytes + first * 4, dst, n);
+    case Dtype::F64:
+      return castToF32<double>(bytes + first * 8, dst, n);
+    case Dtype::I64:
+      return castToF32<std::int64_t>(bytes + first * 8, dst, n);
+    case Dtype::U64:
+      return castToF32<std::uint64_t>(bytes + first * 8, dst, n);
+    default:
+      break;
+  }
+}
+
+void fromF32(const float* src, const Dtype to, void* dst,
+             const std::size_t first, const std::size_t n) {
+  auto* bytes = static_cast<std::uint8_t*>(dst);
+  switch (to) {
+    case Dtype::F32:
+      std::memcpy(bytes + first * 4, src, n * 4);
+      return;
+    case Dtype::F16:
+      kernels().f32ToF16(src, reinterpret_cast<std::uint16_t*>(bytes) + first,
+                         n);
+      return;
+    case Dtype::BF16:
+      kernels().f32ToBf16(src, reinterpret_cast<std::uint16_t*>(bytes) + first,
+                          n);
+      return;
+    case Dtype::F64: {
+      double* d = reinterpret_cast<double*>(bytes) + first;
+      for (std::size_t i = 0; i < n; ++i) d[i] = src[i];
+      return;
+    }
+    case Dtype::F8_E4M3:
+    case Dtype::F8_E5M2:
+      kernels().f32ToMini(src, bytes + first, n, *miniFormat(to));
+      return;
+    case Dtype::F4: {
+      alignas(64) std::uint8_t codes[kBlock];
+      kernels().f32ToMini(src, codes, n, kE2M1);
+      std::uint8_t* d = bytes + first / 2;
+      for (std::size_t i = 0; i + 1 < n; i += 2) {
+        d[i / 2] = static_cast<std::uint8_t>(codes[i] | (codes[i + 1] << 4));
+      }
+      if (n & 1) d[n / 2] = codes[n - 1];
+      return;
+    }
+    case Dtype::F6_E2M3:
+    case Dtype::F6_E3M2: {
+      alignas(64) std::uint8_t codes[kBlock + 3] = {};
+      kernels().f32ToMini(src, codes, n, *miniFormat(to));
+      std::uint8_t* d = bytes + first / 4 * 3;
+      for (std::size_t i = 0; i < n; i += 4, d += 3) {
+        std::uint32_t w = codes[i] | (codes[i + 1] << 6) |
+                          (codes[i + 2] << 12) | (codes[i + 3] << 18);
+        const std::size_t len = std::min<std::size_t>(3, (6 * (n - i) + 7) / 8);
+        for (std::size_t k = 0; k < len; ++k) {
+          d[k] = static_cast<std::uint8_t>(w >> (8 * k));
+        }
+      }
+      return;
+    }
+    default:
+      break;
+  }
+}
+
+// Elements whose F64 value does not survive the round trip through F32.
+bool wide(const Dtype dtype) noexcept {
+  return dtype == Dtype::F64 || dtype == Dtype::I64 || dtype == Dtype::U64 ||
+         dtype == Dtype::I32 || dtype == Dtype::U32;
+}
+
+template <typename T>
+void castToF64(const void* src, double* dst, std::size_t n) {
+  const T* s = static_cast<const T*>(src);
+  for (std::size_t i = 0; i < n; ++i) dst[i] = static_cast<double>(s[i]);
+}
+
+float scaleAt(const BlockScales& scales, const std::size_t i) {
+  switch (scales.dtype) {
+    case Dtype::F8_E8M0:
+      return e8m0Table()[static_cast<const std::uint8_t*>(scales.data)[i]];
+    case Dtype::F32:
+      return static_cast<const float*>(scales.data)[i];
+    case Dtype::F16:
+      return halfToFloat(static_cast<const std::uint16_t*>(scales.data)[i]);
+    case Dtype::BF16:
+      return bf16ToFloat(static_cast<const std::uint16_t*>(scales.data)[i]);
+    default:
+      throw std::invalid_argument(
+          fmt::format("{}:{} unsupported scale dtype {}", __FILE__, __LINE__,
+                      to_string(scales.dtype)));
+  }
+}
+
+// Multiplies elements [first, first + n) by their block scales, or divides
+// them if `invert` is set.
+void applyScales(const BlockScales& scales, const std::size_t first,
+                 const std::size_t n, const bool invert, float* values) {
+  std::size_t i = 0;
+  while (i < n) {
+    std::size_t pos = scales.offset + first + i;
+    std::size_t block = pos / scales.block;
+    std::size_t run = std::min(n - i, (block + 1) * scales.block - pos);
+    const float s = invert ? 1.0f / scaleAt(scales, block)
+                           : scaleAt(scales, block);
+    for (std::size_t k = 0; k < run; ++k) values[i + k] *= s;
+    i += run;
+  }
+}
+
+}  // namespace
+
+bool can_convert(const Dtype from, const Dtype to) noexcept {
+  if (bitsize(from) == 0) return false;
+  auto floating = [](const Dtype d) {
+    return d == Dtype::F32 || d == Dtype::F16 || d == Dtype::BF16 ||
+           d == Dtype::F64;
+  };
+  if (from == to || floating(to)) return true;
+  return miniFormat(to) != nullptr && floating(from);
+}
+
+void convert(const void* src, const Dtype from, void* dst, const Dtype to,
+             const std::size_t count, const BlockScales* scales) {
+  if (!can_convert(from, to)) {
+    throw std::invalid_argument(
+        fmt::format("{}:{} cannot convert {} to {}", __FILE__, __LINE__,
+                    to_string(from), to_string(to)));
+  }
+  if (scales && scales->block == 0) {
+    throw std::invalid_argument(
+        fmt::format("{}:{} block scales need a block size", __FILE__,
+                    __LINE__));
+  }
+  if (from == to && !scales) {
+    std::memcpy(dst, src, (count * bitsize(from) + 7) / 8);
+    return;
+  }
+  if (to == Dtype::F64 && wide(from) && !scales) {
+    double* d = static_cast<double*>(dst);
+    switch (from) {
+      case Dtype::I32:
+        return castToF64<std::int32_t>(src, d, count);
+      case Dtype::U32:
+        return castToF64<std::uint32_t>(src, d, count);
+      case Dtype::I64:
+        return castToF64<std::int64_t>(src, d, count);
+      default:
+        return castToF64<std::uint64_t>(src, d, count);
+    }
+  }
+
+  // Through F32 in blocks that stay in L1; F32 sources and destinations
+  // skip the intermediate buffer.
+  const bool encode = miniFormat(to) && from != to;
+  alignas(64) float tmp[kBlock];
+  for (std::size_t first = 0; first < count; first += kBlock) {
+    const std::size_t n = std::min(kBlock, count - first);
+    const float* values;
+    if (from == Dtype::F32 && !scales) {
+      values = static_cast<const float*>(src) + first;
+    } else {
+      float* out = to == Dtype::F32 ? static_cast<float*>(dst) + first : tmp;
+      toF32(src, from, first, n, out);
+      if (scales) applyScales(*scales, first, n, encode, out);
+      values = out;
+    }
+    if (to != Dtype::F32) fromF32(values, to, dst, first, n);
+  }
+}
+
+void quantize_mx(const float* src, const std::size_t count, const Dtype to,
+                 void* dst, std::uint8_t* scales, const std::size_t block) {
+  const MiniFormat* mini = miniFormat(to);
+  if (!mini) {
+    throw std::invalid_argument(
+        fmt::format("{}:{} {} is not an MX element type", __FILE__, __LINE__,
+                    to_string(to)));
+  }
+  if (block == 0) {
+    throw std::invalid_argument(
+        fmt::format("{}:{} block scales need a block size", __FILE__,
+                    __LINE__));
+  }
+  for (std::size_t first = 0, b = 0; first < count; first += block, ++b) {
+    const std::size_t n = std::min(block, count - first);
+    float amax = 0.0f;
+    bool nan = false;
+    for (std::size_t i = 0; i < n; ++i) {
+      const float a = std::fabs(src[first + i]);
+      nan |= a != a;
+      amax = a > amax ? a : amax;
+    }
+    if (nan) {
+      scales[b] = 0xFF;
+      continue;
+    }
+    // A block of zeros keeps scale 2^-emax, as if its maximum were one.
+    const int exponent = amax > 0.0f ? std::ilogb(amax) : 0;
+    const int biased = std::clamp(exponent - mini->emax + 127, 0, 254);
+    scales[b] = static_cast<std::uint8_t>(biased);
+  }
+  BlockScales s;
+  s.data = scales;
+  s.block = block;
+  convert(src, Dtype::F32, dst, to, count, &s);
+}
+
+std::string_view convert_isa() noexcept { return kernels().isa; }
+
+}  // namespace safetensors
@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/header.hpp"
+
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "fmt/format.h"
+#include "json.hpp"
+#include "rust/cxx.h"
+
+namespace safetensors {
+
+namespace {
+
+struct DtypeName {
+  std::string_view name;
+  Dtype dtype;
+};
+
+constexpr std::array<DtypeName, 19> kDtypeNames = {{
+    {"BOOL", Dtype::BOOL},
+    {"F4", Dtype::F4},
+    {"F6_E2M3", Dtype::F6_E2M3},
+    {"F6_E3M2", Dtype::F6_E3M2},
+    {"U8", Dtype::U8},
+    {"I8", Dtype::I8},
+    {"F8_E5M2", Dtype::F8_E5M2},
+    {"F8_E4M3", Dtype::F8_E4M3},
+    {"F8_E8M0", Dtype::F8_E8M0},
+    {"I16", Dtype::I16},
+    {"U16", Dtype::U16},
+    {"F16", Dtype::F16},
+    {"BF16", Dtype::BF16},
+    {"I32", Dtype::I32},
+    {"U32", Dtype::U32},
+    {"F32", Dtype::F32},
+    {"F64", Dtype::F64},
+    {"I64", Dtype::I64},
+    {"U64", Dtype::U64},
+}};
+
+std::uint64_t readLeU64(const std::uint8_t* p) noexcept {
+  std::uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+struct TensorInfo {
+  Dtype dtype;
+  std::vector<std::size_t> shape;
+  std::size_t begin = 0;
+  std::size_t end = 0;
+};
+
+void parseTensorInfo(detail::JsonReader* reader,
+                     std::string* scratch,
+                     TensorInfo* tensor) {
+  bool has_dtype = false;
+  bool has_shape = false;
+  bool has_offsets = false;
+  tensor->shape.clear();
+  reader->readObject(scratch, [&](std::string_view field) {
+    if (field == "dtype") {
+      if (has_dtype) reader->fail("duplicate field `dtype`");
+      has_dtype = true;
+      std::string_view name = reader->readString(scratch);
+      auto dtype = dtype_from_string(name);
+      if (!dtype) reader->fail(fmt::format("unknown dtype `{}`", name));
+      tensor->dtype = *dtype;
+    } else if (field == "shape") {
+      if (has_shape) reader->fail("duplicate field `shape`");
+      has_shape = true;
+      reader->readArray([&] {
+        tensor->shape.push_back(static_cast<std::size_t>(reader->readUint()));
+      });
+    } else if (field == "data_offsets") {
+      if (has_offsets) reader->fail("duplicate field `data_offsets`");
+      has_offsets = true;
+      reader->expect('[');
+      tensor->begin = static_cast<std::size_t>(reader->readUint());
+      reader->expect(',');
+      tensor->end = static_cast<std::size_t>(reader->readUint());
+      reader->expect(']');
+    } else {
+      reader->skipValue();
+    }
+  });
+  if (!has_dtype) reader->fail("missing field `dtype`");
+  if (!has_shape) reader->fail("missing field `shape`");
+  if (!has_offsets) reader->fail("missing field `data_offsets`");
+}
+
+// Per-tensor half of `Metadata::validate`; contiguity is checked by the
+// index builder once the entries are sorted.
+void validate(std::string_view name, const TensorInfo& tensor) {
+  if (tensor.end < tensor.begin) {
+    throw std::runtime_error(fmt::format("invalid offset for tensor {}", name));
+  }
+  std::size_t nelements = 1;
+  for (std::size_t dim : tensor.shape) {
+    if (dim != 0 && nelements > SIZE_MAX / dim) {
+      throw std::runtime_error(fmt::format(
+          "validation overflow for tensor {}: shape too large", name));
+    }
+    nelements *= dim;
+  }
+  std::size_t bits = bitsize(tensor.dtype);
+  if (nelements > SIZE_MAX / bits) {
+    throw std::runtime_error(fmt::format(
+        "validation overflow for tensor {}: shape too large", name));
+  }
+  std::size_t nbits = nelements * bits;
+  if (nbits % 8 != 0) {
+    throw std::runtime_error(
+        fmt::format("misaligned slice for tensor {}: {} bits", name, nbits));
+  }
+  if (tensor.end - tensor.begin != nbits / 8) {
+    throw std::runtime_error(fmt::format(
+        "tensor {} has invalid info: {} bytes for {} elements of {}", name,
+        tensor.end - tensor.begin, nelements, to_string(tensor.dtype)));
+  }
+}
+
+// `size` bytes at `data` hold at least the length and the JSON text. With
+// `file_size` set, the header must describe exactly the rest of the file.
+TensorIndex parseNative(const std::uint8_t* data, std::size_t size,
+                        const std::optional<std::size_t> file_size) {
+  if (size < N_LEN) {
+    throw std::runtime_error(
+        fmt::format("header too small: {} < {}", size, N_LEN));
+  }
+  std::uint64_t n = readLeU64(data);
+  if (n > MAX_HEADER_SIZE) {
+    throw std::runtime_error(
+        fmt::format("header too large: {} > {}", n, MAX_HEADER_SIZE));
+  }
+  if (n + N_LEN > size) {
+    throw std::runtime_error(fmt::format(
+        "invalid header length: {} exceeds buffer of {} bytes", n, size));
+  }
+
+  const std::uint8_t* text = data + N_LEN;
+  if (!detail::isValidUtf8(text, n)) {
+    throw std::runtime_error("invalid header: not valid UTF-8");
+  }
+  if (n == 0 || text[0] != '{') {
+    throw std::runtime_error("invalid header start: expected '{'");
+  }
+
+  detail::JsonReader reader(
+      std::string_view(reinterpret_cast<const char*>(text), n));
+  TensorIndex::Builder builder;
+  std::string scratch;
+  std::string key_scratch;
+  TensorInfo tensor;
+  bool has_metadata = false;
+
+  reader.readObject(&key_scratch, [&](std::string_view key) {
+    if (key == "__metadata__") {
+      if (has_metadata) reader.fail("duplicate field `__metadata__`");
+      has_metadata = true;
+      if (reader.readNull()) return;
+      std::string meta_key;
+      reader.readObject(&scratch, [&](std::string_view k) {
+        meta_key.assign(k);
+        builder.addMetadata(meta_key, reader.readString(&scratch));
+      });
+      return;
+    }
+    parseTensorInfo(&reader, &scratch, &tensor);
+    validate(key, tensor);
+    if (tensor.dtype == Dtype::F4 && !tensor.shape.empty()) {
+      tensor.shape.back() /= 2;  // F4 is stored as F8
+    }
+    builder.addTensor(key, tensor.dtype, tensor.shape, tensor.begin,
+                      tensor.end);
+  });
+  if (!reader.atEnd()) reader.fail("trailing characters");
+
+  TensorIndex index = builder.build(static_cast<std::size_t>(n), true);
+  if (file_size && index.buffer_size() + N_LEN + n != *file_size) {
+    throw std::runtime_error(fmt::format(
+        "metadata incomplete buffer: header describes {} bytes, file has {}",
+        index.buffer_size() + N_LEN + n, *file_size));
+  }
+  return index;
+}
+
+TensorIndex parseRust(const std::uint8_t* data, std::size_t size) {
+  rust::Slice<std::uint8_t const> buffer(data, size);
+  rust::Vec<PairStrTensorView> tensors = deserialize(buffer);
+  rust::Vec<PairStrStr> pairs = metadata(buffer);
+
+  std::size_t n = static_cast<std::size_t>(readLeU64(data));
+  const std::uint8_t* base = data + N_LEN + n;
+
+  TensorIndex::Builder builder;
+  std::size_t name_bytes = 0;
+  for (const auto& pair : tensors) name_bytes += pair.key.size();
+  builder.reserve(tensors.size(), name_bytes);
+  for (const auto& pair : tensors) {
+    std::size_t begin = static_cast<std::size_t>(pair.value.data.data() - base);
+    builder.addTensor(
+        std::string_view(pair.key.data(), pair.key.size()), pair.value.dtype,
+        std::span<const std::size_t>(pair.value.shape.data(),
+                                     pair.value.shape.size()),
+        begin, begin + pair.value.data_len);
+  }
+  for (const auto& pair : pairs) {
+    builder.addMetadata(std::string_view(pair.key.data(), pair.key.size()),
+                        std::string_view(pair.value.data(), pair.value.size()));
+  }
+  return builder.build(n, false);
+}
+
+}  // namespace
+
+std::string_view to_string(const Dtype dtype) noexcept {
+  for (const auto& entry : kDtypeNames) {
+    if (entry.dtype == dtype) return entry.name;
+  }
+  return "UNKNOWN";
+}
+
+std::optional<Dtype> dtype_from_string(std::string_view name) noexcept {
+  for (const auto& entry : kDtypeNames) {
+    if (entry.name == name) return entry.dtype;
+  }
+  return std::nullopt;
+}
+
+TensorIndex parse_header(const std::uint8_t* data,
+                         std::size_t size,
+                         HeaderParser parser) {
+  if (parser == HeaderParser::Rust) {
+    return parseRust(data, size);
+  }
+  return parseNative(data, size, size);
+}
+
+TensorIndex parse_header_only(const std::uint8_t* data, std::size_t size,
+                              const std::optional<std::size_t> file_size) {
+  return parseNative(data, size, file_size);
+}
+
+namespace detail {
+
+bool isValidUtf8(const std::uint8_t* data, std::size_t len) noexcept {
+  std::size_t i = 0;
+  while (i < len) {
+    // Fast path for runs of ASCII, which is nearly all of a header.
+    while (i + 8 <= len) {
+      std::uint64_t word;
+      std::memcpy(&word, data + i, sizeof(word));
+      if (word & 0x8080808080808080ULL) break;
+      i += 8;
+    }
+    if (i >= len) break;
+    std::uint8_t c = data[i];
+    if (c < 0x80) {
+      ++i;
+      continue;
+    }
+    std::size_t width;
+    std::uint8_t lo = 0x80;
+    std::uint8_t hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+      width = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      width = 3;
+      if (c == 0xE0) lo = 0xA0;
+      if (c == 0xED) hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      width = 4;
+      if (c == 0xF0) lo = 0x90;
+      if (c == 0xF4) hi = 0x8F;
+    } else {
+      return false;
+    }
+    if (i + width > len) return false;
+    if (data[i + 1] < lo || data[i + 1] > hi) return false;
+    for (std::size_t k = 2; k < width; ++k) {
+      if ((data[i + k] & 0xC0) != 0x80) return false;
+    }
+    i += width;
+  }
+  return true;
+}
+
+void appendJsonString(std::string_view s, std::string* out) {
+  out->push_back('"');
+  for (char c : s) {
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '\b':
+        out->append("\\b");
+        break;
+      case '\f':
+        out->append("\\f");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\r':
+        out->append("\\r");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          fmt::format_to(std::back_inserter(*out), "\\u{:04x}",
+                         static_cast<unsigned>(c));
+        } else {
+          out->push_back(c);
+        }
+    }
+  }
+  out->push_back('"');
+}
+
+}  // namespace detail
+
+}  // namespace safetensors
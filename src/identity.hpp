@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+#include "fmt/format.h"
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
+namespace safetensors::detail {
+
+// Identity of one version of a file. Device and inode are 0 on Windows.
+struct FileIdentity {
+  std::string path;
+  std::uint64_t device = 0;
+  std::uint64_t inode = 0;
+  std::uint64_t size = 0;
+  std::int64_t mtime_ns = 0;
+
+  auto tie() const { return std::tie(path, device, inode, size, mtime_ns); }
+};
+
+// Identifies `path` by its canonical form and stat(2). Throws
+// std::runtime_error (or std::filesystem::filesystem_error) if it is absent.
+inline FileIdentity fileIdentity(const std::filesystem::path& path) {
+  FileIdentity id;
+  id.path = std::filesystem::canonical(path).string();
+#if defined(_WIN32)
+  id.size = std::filesystem::file_size(id.path);
+  id.mtime_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::filesystem::last_write_time(id.path)
+                        .time_since_epoch())
+                    .count();
+#else
+  struct stat st;
+  if (stat(id.path.c_str(), &st) != 0) {
+    throw std::runtime_error(fmt::format("{}:{} cannot stat {}: {}", __FILE__,
+                                         __LINE__, id.path, strerror(errno)));
+  }
+  id.device = static_cast<std::uint64_t>(st.st_dev);
+  id.inode = static_cast<std::uint64_t>(st.st_ino);
+  id.size = static_cast<std::uint64_t>(st.st_size);
+#if defined(__APPLE__)
+  id.mtime_ns =
+      st.st_mtimespec.tv_sec * 1'000'000'000LL + st.st_mtimespec.tv_nsec;
+#else
+  id.mtime_ns = st.st_mtim.tv_sec * 1'000'000'000LL + st.st_mtim.tv_nsec;
+#endif
+#endif
+  return id;
+}
+
+}  // namespace safetensors::detail
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/index.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <tuple>
+
+#include "fmt/format.h"
+#include "safetensors/header.hpp"
+
+namespace safetensors {
+
+namespace {
+
+std::uint64_t hashName(std::string_view name) noexcept {
+  std::uint64_t h = 0xcbf29ce484222325ULL ^ name.size();
+  std::size_t i = 0;
+  for (; i + 8 <= name.size(); i += 8) {
+    std::uint64_t word;
+    std::memcpy(&word, name.data() + i, sizeof(word));
+    h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 32;
+  }
+  for (; i < name.size(); ++i) {
+    h = (h ^ static_cast<std::uint8_t>(name[i])) * 0x100000001B3ULL;
+  }
+  // fmix64 from MurmurHash3
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+constexpr std::size_t alignUp(const std::size_t n) noexcept {
+  return (n + 7) & ~static_cast<std::size_t>(7);
+}
+
+std::size_t slotCount(const std::size_t tensors) noexcept {
+  if (tensors == 0) return 0;
+  std::size_t slots = 1;
+  while (slots < tensors * 2) slots <<= 1;
+  return slots;
+}
+
+}  // namespace
+
+struct TensorIndex::Layout {
+  std::uint64_t tensor_count;
+  std::uint64_t metadata_count;
+  std::uint64_t slot_count;
+  std::uint64_t shape_count;
+  std::uint64_t string_size;
+  std::uint64_t header_size;
+  std::uint64_t buffer_size;
+
+  // Section offsets from the start of the blob, all 8-byte aligned.
+  std::uint64_t entries_offset;
+  std::uint64_t metadata_offset;
+  std::uint64_t slots_offset;
+  std::uint64_t shapes_offset;
+  std::uint64_t strings_offset;
+  std::uint64_t total_size;
+};
+
+const TensorIndex::Layout& TensorIndex::layout() const noexcept {
+  return *reinterpret_cast<const Layout*>(blob_);
+}
+
+const TensorIndex::Entry* TensorIndex::entries() const noexcept {
+  return reinterpret_cast<const Entry*>(blob_ + layout().entries_offset);
+}
+
+std::size_t TensorIndex::header_size() const noexcept {
+  return blob_ ? layout().header_size : 0;
+}
+
+std::size_t TensorIndex::data_offset() const noexcept {
+  return N_LEN + header_size();
+}
+
+std::size_t TensorIndex::buffer_size() const noexcept {
+  return blob_ ? layout().buffer_size : 0;
+}
+
+std::span<const std::size_t> TensorIndex::shape(
+    const std::size_t i) const noexcept {
+  const Entry& e = entry(i);
+  const auto* shapes =
+      reinterpret_cast<const std::size_t*>(blob_ + layout().shapes_offset);
+  return {shapes + e.shape_offset, e.rank};
+}
+
+std::size_t TensorIndex::find(std::string_view name) const noexcept {
+  if (!blob_ || layout().slot_count == 0) return npos;
+  const Layout& l = layout();
+  const auto* slots =
+      reinterpret_cast<const std::uint32_t*>(blob_ + l.slots_offset);
+  const std::size_t mask = l.slot_count - 1;
+  for (std::size_t i = hashName(name) & mask;; i = (i + 1) & mask) {
+    std::uint32_t slot = slots[i];
+    if (slot == 0) return npos;
+    if (names_[slot - 1] == name) return slot - 1;
+  }
+}
+
+std::optional<std::string_view> TensorIndex::metadata(
+    std::string_view key) const {
+  auto it = std::lower_bound(
+      metadata_.begin(), metadata_.end(), key,
+      [](const MetadataPair& pair, std::string_view k) {
+        return pair.first < k;
+      });
+  if (it == metadata_.end() || it->first != key) return std::nullopt;
+  return it->second;
+}
+
+void TensorIndex::attach(std::shared_ptr<const void> owner,
+                         const std::byte* blob) {
+  owner_ = std::move(owner);
+  blob_ = blob;
+
+  const Layout& l = layout();
+  const char* strings = reinterpret_cast<const char*>(blob_ + l.strings_offset);
+  const Entry* e = entries();
+  names_.resize(l.tensor_count);
+  for (std::size_t i = 0; i < l.tensor_count; ++i) {
+    names_[i] = std::string_view(strings + e[i].name_offset, e[i].name_size);
+  }
+
+  const auto* m =
+      reinterpret_cast<const MetadataEntry*>(blob_ + l.metadata_offset);
+  metadata_.resize(l.metadata_count);
+  for (std::size_t i = 0; i < l.metadata_count; ++i) {
+    metadata_[i] = {std::string_view(strings + m[i].key_offset, m[i].key_size),
+                    std::string_view(strings + m[i].value_offset,
+                                     m[i].value_size)};
+  }
+}
+
+TensorIndex TensorIndex::share() const {
+  TensorIndex index;
+  index.owner_ = owner_;
+  index.blob_ = blob_;
+  index.names_ = names_;
+  index.metadata_ = metadata_;
+  return index;
+}
+
+std::span<const std::byte> TensorIndex::blob() const noexcept {
+  if (!blob_) return {};
+  return {blob_, static_cast<std::size_t>(layout().total_size)};
+}
+
+TensorIndex TensorIndex::from_blob(std::shared_ptr<const void> owner,
+                                   std::span<const std::byte> blob) {
+  auto fail = [](std::string_view what) {
+    throw std::runtime_error(
+        fmt::format("{}:{} invalid index blob: {}", __FILE__, __LINE__, what));
+  };
+  if (blob.size() < sizeof(Layout) ||
+      reinterpret_cast<std::uintptr_t>(blob.data()) % 8 != 0) {
+    fail("too small or misaligned");
+  }
+  Layout l;
+  std::memcpy(&l, blob.data(), sizeof(l));
+  if (l.total_size > blob.size() || l.total_size % 8 != 0) fail("truncated");
+  // Every section lies inside the blob, after the layout.
+  auto section = [&](std::uint64_t offset, std::uint64_t count,
+                     std::uint64_t size) {
+    if (offset % 8 != 0 || offset < sizeof(Layout) ||
+        offset > l.total_size || count > (l.total_size - offset) / size) {
+      fail("section out of bounds");
+    }
+  };
+  section(l.entries_offset, l.tensor_count, sizeof(Entry));
+  section(l.metadata_offset, l.metadata_count, sizeof(MetadataEntry));
+  section(l.slots_offset, l.slot_count, sizeof(std::uint32_t));
+  section(l.shapes_offset, l.shape_count, sizeof(std::size_t));
+  section(l.strings_offset, l.string_size, 1);
+  // Probing stops at an empty slot, so there must be one.
+  if (l.tensor_count && (l.slot_count <= l.tensor_count ||
+                         (l.slot_count & (l.slot_count - 1)) != 0)) {
+    fail("bad slot count");
+  }
+
+  const std::byte* base = blob.data();
+  const auto* entries = reinterpret_cast<const Entry*>(base + l.entries_offset);
+  // Entries are sorted by offset and, as `build` checks when parsing, tile
+  // the buffer; views are made from these offsets without further checks.
+  std::uint64_t buffer_end = 0;
+  for (std::uint64_t i = 0; i < l.tensor_count; ++i) {
+    const Entry& e = entries[i];
+    if (std::uint64_t{e.name_offset} + e.name_size > l.string_size ||
+        std::uint64_t{e.shape_offset} + e.rank > l.shape_count ||
+        e.end < e.begin || bitsize(e.dtype) == 0) {
+      fail("bad tensor entry");
+    }
+    if (e.begin != buffer_end || e.end > l.buffer_size) {
+      fail("tensor data out of bounds");
+    }
+    buffer_end = e.end;
+  }
+  if (buffer_end != l.buffer_size) fail("tensor data out of bounds");
+  const auto* metadata =
+      reinterpret_cast<const MetadataEntry*>(base + l.metadata_offset);
+  for (std::uint64_t i = 0; i < l.metadata_count; ++i) {
+    const MetadataEntry& m = metadata[i];
+    if (std::uint64_t{m.key_offset} + m.key_size > l.string_size ||
+        std::uint64_t{m.value_offset} + m.value_size > l.string_size) {
+      fail("bad metadata entry");
+    }
+  }
+  const auto* slots =
+      reinterpret_cast<const std::uint32_t*>(base + l.slots_offset);
+  for (std::uint64_t i = 0; i < l.slot_count; ++i) {
+    if (slots[i] > l.tensor_count) fail("bad slot");
+  }
+
+  TensorIndex index;
+  index.attach(std::move(owner), base);
+  return index;
+}
+
+// Builder
+
+void TensorIndex::Builder::reserve(const std::size_t tensors,
+                                   const std::size_t name_bytes) {
+  entries_.reserve(tensors);
+  shapes_.reserve(tensors * 2);
+  strings_.reserve(name_bytes);
+}
+
+void TensorIndex::Builder::addTensor(std::string_view name,
+                                     const Dtype dtype,
+                                     std::span<const std::size_t> shape,
+                                     const std::size_t begin,
+                                     const std::size_t end) {
+  Entry e{};
+  e.begin = begin;
+  e.end = end;
+  e.name_offset = static_cast<std::uint32_t>(strings_.size());
+  e.name_size = static_cast<std::uint32_t>(name.size());
+  e.shape_offset = static_cast<std::uint32_t>(shapes_.size());
+  e.rank = static_cast<std::uint32_t>(shape.size());
+  e.dtype = dtype;
+  strings_.append(name);
+  shapes_.insert(shapes_.end(), shape.begin(), shape.end());
+  entries_.push_back(e);
+}
+
+void TensorIndex::Builder::addMetadata(std::string_view key,
+                                       std::string_view value) {
+  MetadataEntry m;
+  m.key_offset = static_cast<std::uint32_t>(strings_.size());
+  m.key_size = static_cast<std::uint32_t>(key.size());
+  strings_.append(key);
+  m.value_offset = static_cast<std::uint32_t>(strings_.size());
+  m.value_size = static_cast<std::uint32_t>(value.size());
+  strings_.append(value);
+  metadata_.push_back(m);
+}
+
+TensorIndex TensorIndex::Builder::build(const std::size_t header_size,
+                                        const bool check_offsets) {
+  std::sort(entries_.begin(), entries_.end(),
+            [](const Entry& a, const Entry& b) {
+              return std::tie(a.begin, a.end) < std::tie(b.begin, b.end);
+            });
+
+  auto str = [this](std::uint32_t offset, std::uint32_t size) {
+    return std::string_view(strings_.data() + offset, size);
+  };
+
+  std::uint64_t buffer_end = 0;
+  for (const Entry& e : entries_) {
+    if (check_offsets && (e.begin != buffer_end || e.end < e.begin)) {
+      throw std::runtime_error(fmt::format("invalid offset for tensor {}",
+                                           str(e.name_offset, e.name_size)));
+    }
+    buffer_end = std::max(buffer_end, e.end);
+  }
+
+  // Later duplicates win, like inserting into a HashMap.
+  std::stable_sort(metadata_.begin(), metadata_.end(),
+                   [&](const MetadataEntry& a, const MetadataEntry& b) {
+                     return str(a.key_offset, a.key_size) <
+                            str(b.key_offset, b.key_size);
+                   });
+  std::vector<MetadataEntry> metadata;
+  metadata.reserve(metadata_.size());
+  for (const MetadataEntry& m : metadata_) {
+    if (!metadata.empty() &&
+        str(metadata.back().key_offset, metadata.back().key_size) ==
+            str(m.key_offset, m.key_size)) {
+      metadata.back() = m;
+    } else {
+      metadata.push_back(m);
+    }
+  }
+
+  Layout l{};
+  l.tensor_count = entries_.size();
+  l.metadata_count = metadata.size();
+  l.slot_count = slotCount(entries_.size());
+  l.shape_count = shapes_.size();
+  l.string_size = strings_.size();
+  l.header_size = header_size;
+  l.buffer_size = buffer_end;
+  l.entries_offset = alignUp(sizeof(Layout));
+  l.metadata_offset =
+      alignUp(l.entries_offset + l.tensor_count * sizeof(Entry));
+  l.slots_offset =
+      alignUp(l.metadata_offset + l.metadata_count * sizeof(MetadataEntry));
+  l.shapes_offset =
+      alignUp(l.slots_offset + l.slot_count * sizeof(std::uint32_t));
+  l.strings_offset =
+      alignUp(l.shapes_offset + l.shape_count * sizeof(std::size_t));
+  l.total_size = alignUp(l.strings_offset + l.string_size);
+
+  std::shared_ptr<std::uint64_t[]> storage(
+      new std::uint64_t[l.total_size / sizeof(std::uint64_t)]());
+  auto* blob = reinterpret_cast<std::byte*>(storage.get());
+
+  std::memcpy(blob, &l, sizeof(l));
+  if (!entries_.empty()) {
+    std::memcpy(blob + l.entries_offset, entries_.data(),
+                entries_.size() * sizeof(Entry));
+  }
+  if (!metadata.empty()) {
+    std::memcpy(blob + l.metadata_offset, metadata.data(),
+                metadata.size() * sizeof(MetadataEntry));
+  }
+  if (!shapes_.empty()) {
+    std::memcpy(blob + l.shapes_offset, shapes_.data(),
+                shapes_.size() * sizeof(std::size_t));
+  }
+  if (!strings_.empty()) {
+    std::memcpy(blob + l.strings_offset, strings_.data(), strings_.size());
+  }
+
+  auto* slots = reinterpret_cast<std::uint32_t*>(blob + l.slots_offset);
+  const std::size_t mask = l.slot_count - 1;
+  for (std::size_t idx = 0; idx < entries_.size(); ++idx) {
+    std::string_view name =
+        str(entries_[idx].name_offset, entries_[idx].name_size);
+    std::size_t i = hashName(name) & mask;
+    for (; slots[i] != 0; i = (i + 1) & mask) {
+      const Entry& other = entries_[slots[i] - 1];
+      if (str(other.name_offset, other.name_size) == name) {
+        throw std::runtime_error(fmt::format("duplicate tensor {}", name));
+      }
+    }
+    slots[i] = static_cast<std::uint32_t>(idx + 1);
+  }
+
+  TensorIndex index;
+  index.attach(std::move(storage), blob);
+  return index;
+}
+
+}  // namespace safetensors
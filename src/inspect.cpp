@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/inspect.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include "fmt/format.h"
+#include "safetensors/header.hpp"
+#include "safetensors/mmap.hpp"
+
+namespace safetensors {
+
+namespace {
+
+std::uint64_t headerLength(const std::uint8_t* p) noexcept {
+  std::uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+// Length prefix of the first `size` bytes of a file of `file_size` bytes,
+// checked before anything is allocated for it.
+std::size_t checkedLength(const std::uint8_t* data, const std::size_t size,
+                          const std::size_t file_size) {
+  if (size < N_LEN) {
+    throw std::runtime_error(
+        fmt::format("{}:{} header too small: {} < {}", __FILE__, __LINE__,
+                    file_size, N_LEN));
+  }
+  std::uint64_t n = headerLength(data);
+  if (n > MAX_HEADER_SIZE) {
+    throw std::runtime_error(fmt::format("{}:{} header too large: {} > {}",
+                                         __FILE__, __LINE__, n,
+                                         MAX_HEADER_SIZE));
+  }
+  if (n + N_LEN > file_size) {
+    throw std::runtime_error(fmt::format(
+        "{}:{} invalid header length: {} exceeds file of {} bytes", __FILE__,
+        __LINE__, n, file_size));
+  }
+  return static_cast<std::size_t>(n);
+}
+
+std::optional<std::size_t> sizeToCheck(const InspectOptions& options,
+                                       const std::size_t file_size) {
+  if (!options.validate_size) return std::nullopt;
+  return file_size;
+}
+
+}  // namespace
+
+TensorIndex inspect(const std::filesystem::path& path,
+                    const InspectOptions& options) {
+  File file(path);
+  std::vector<std::uint8_t> buffer(std::min(N_LEN, file.size()));
+  file.readRaw(buffer.data(), buffer.size());
+  const std::size_t n = checkedLength(buffer.data(), buffer.size(),
+                                      file.size());
+  buffer.resize(N_LEN + n);
+  file.readRaw(buffer.data() + N_LEN, n);
+  return parse_header_only(buffer.data(), buffer.size(),
+                           sizeToCheck(options, file.size()));
+}
+
+TensorIndex inspect(const Reader& reader, const InspectOptions& options) {
+  const std::size_t file_size = reader.size();
+  std::vector<std::uint8_t> buffer(
+      std::min(std::max(options.first_read, N_LEN), file_size));
+  ReadRequest first{0, buffer.size(), buffer.data()};
+  reader.read({&first, 1});
+  const std::size_t n = checkedLength(buffer.data(), buffer.size(),
+                                      file_size);
+  if (buffer.size() < N_LEN + n) {
+    const std::size_t have = buffer.size();
+    buffer.resize(N_LEN + n);
+    ReadRequest rest{have, N_LEN + n - have, buffer.data() + have};
+    reader.read({&rest, 1});
+  }
+  return parse_header_only(buffer.data(), buffer.size(),
+                           sizeToCheck(options, file_size));
+}
+
+}  // namespace safetensors
@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+// Minimal pull-style JSON reader used by the native header parser. It only
+// understands what the safetensors header (and the Hugging Face index files)
+// need: objects, arrays, strings, unsigned integers, and skipping of anything
+// else. Errors are reported as std::runtime_error.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "fmt/format.h"
+
+namespace safetensors::detail {
+
+class JsonReader {
+ public:
+  explicit JsonReader(std::string_view text) noexcept : text_(text) {}
+
+  [[noreturn]] void fail(std::string_view what) const {
+    throw std::runtime_error(fmt::format(
+        "invalid header deserialization: {} at offset {}", what, pos_));
+  }
+
+  void skipWs() noexcept {
+    while (pos_ < text_.size()) {
+      char c = text_[pos_];
+      if (c != ' ' && c != '\n' && c != '\r' && c != '\t') break;
+      ++pos_;
+    }
+  }
+
+  bool atEnd() noexcept {
+    skipWs();
+    return pos_ == text_.size();
+  }
+
+  char peek() noexcept {
+    skipWs();
+    return pos_ < text_.size() ? text_[pos_] : '\0';
+  }
+
+  bool consume(char c) noexcept {
+    if (peek() != c) return false;
+    ++pos_;
+    return true;
+  }
+
+  void expect(char c) {
+    if (!consume(c)) fail(fmt::format("expected '{}'", c));
+  }
+
+  // Reads a JSON string. The returned view points into the source text when
+  // the string has no escapes, and into `scratch` otherwise, so it is only
+  // valid until the next call that reuses `scratch`.
+  std::string_view readString(std::string* scratch) {
+    expect('"');
+    std::size_t start = pos_;
+    while (pos_ < text_.size()) {
+      char c = text_[pos_];
+      if (c == '"') {
+        return text_.substr(start, pos_++ - start);
+      }
+      if (c == '\\') break;
+      if (static_cast<unsigned char>(c) < 0x20) {
+        fail("control character in string");
+      }
+      ++pos_;
+    }
+    scratch->assign(text_.data() + start, pos_ - start);
+    while (pos_ < text_.size()) {
+      char c = text_[pos_++];
+      if (c == '"') return *scratch;
+      if (static_cast<unsigned char>(c) < 0x20) {
+        fail("control character in string");
+      }
+      if (c != '\\') {
+        scratch->push_back(c);
+        continue;
+      }
+      if (pos_ >= text_.size()) break;
+      switch (text_[pos_++]) {
+        case '"':
+          scratch->push_back('"');
+          break;
+        case '\\':
+          scratch->push_back('\\');
+          break;
+        case '/':
+          scratch->push_back('/');
+          break;
+        case 'b':
+          scratch->push_back('\b');
+          break;
+        case 'f':
+          scratch->push_back('\f');
+          break;
+        case 'n':
+          scratch->push_back('\n');
+          break;
+        case 'r':
+          scratch->push_back('\r');
+          break;
+        case 't':
+          scratch->push_back('\t');
+          break;
+        case 'u':
+          appendUtf8(readCodepoint(), scratch);
+          break;
+        default:
+          fail("invalid escape");
+      }
+    }
+    fail("unterminated string");
+  }
+
+  // Reads a non-negative integer that fits in 64 bits. Fractions, exponents,
+  // signs and leading zeros are rejected, like serde_json does for `usize`.
+  std::uint64_t readUint() {
+    skipWs();
+    std::size_t start = pos_;
+    std::uint64_t value = 0;
+    while (pos_ < text_.size() && text_[pos_] >= '0' && text_[pos_] <= '9') {
+      std::uint64_t digit = static_cast<std::uint64_t>(text_[pos_] - '0');
+      if (value > (UINT64_MAX - digit) / 10) fail("integer overflow");
+      value = value * 10 + digit;
+      ++pos_;
+    }
+    if (pos_ == start) fail("expected unsigned integer");
+    if (text_[start] == '0' && pos_ - start > 1) fail("leading zero");
+    if (pos_ < text_.size() &&
+        (text_[pos_] == '.' || text_[pos_] == 'e' || text_[pos_] == 'E')) {
+      fail("expected unsigned integer");
+    }
+    return value;
+  }
+
+  // Iterates the members of an object, calling `on_member(key)` with the
+  // reader positioned on the value. The callback must consume the value.
+  template <typename F>
+  void readObject(std::string* scratch, F&& on_member) {
+    expect('{');
+    if (consume('}')) return;
+    do {
+      std::string_view key = readString(scratch);
+      expect(':');
+      on_member(key);
+    } while (consume(','));
+    expect('}');
+  }
+
+  // Iterates the elements of an array, calling `on_element()` with the
+  // reader positioned on the element. The callback must consume it.
+  template <typename F>
+  void readArray(F&& on_element) {
+    expect('[');
+    if (consume(']')) return;
+    do {
+      on_element();
+    } while (consume(','));
+    expect(']');
+  }
+
+  void skipValue(int depth = 0) {
+    if (depth > kMaxDepth) fail("recursion limit exceeded");
+    std::string scratch;
+    switch (peek()) {
+      case '{':
+        readObject(&scratch, [&](std::string_view) { skipValue(depth + 1); });
+        return;
+      case '[':
+        readArray([&] { skipValue(depth + 1); });
+        return;
+      case '"':
+        readString(&scratch);
+        return;
+      case 't':
+        return literal("true");
+      case 'f':
+        return literal("false");
+      case 'n':
+        return literal("null");
+      default:
+        return skipNumber();
+    }
+  }
+
+  // Skips a value and returns its raw source text.
+  std::string_view readRawValue() {
+    skipWs();
+    std::size_t start = pos_;
+    skipValue();
+    return text_.substr(start, pos_ - start);
+  }
+
+  bool readNull() {
+    if (peek() != 'n') return false;
+    literal("null");
+    return true;
+  }
+
+  std::size_t position() const noexcept { return pos_; }
+
+ private:
+  static constexpr int kMaxDepth = 128;
+
+  void literal(std::string_view word) {
+    if (text_.substr(pos_, word.size()) != word) fail("invalid literal");
+    pos_ += word.size();
+  }
+
+  void skipNumber() {
+    std::size_t start = pos_;
+    if (pos_ < text_.size() && text_[pos_] == '-') ++pos_;
+    while (pos_ < text_.size()) {
+      char c = text_[pos_];
+      if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' ||
+          c == '+' || c == '-') {
+        ++pos_;
+      } else {
+        break;
+      }
+    }
+    if (pos_ == start) fail("expected value");
+  }
+
+  std::uint32_t readHex4() {
+    if (pos_ + 4 > text_.size()) fail("truncated unicode escape");
+    std::uint32_t cp = 0;
+    for (int i = 0; i < 4; ++i) {
+      char c = text_[pos_++];
+      cp <<= 4;
+      if (c >= '0' && c <= '9') {
+        cp |= static_cast<std::uint32_t>(c - '0');
+      } else if (c >= 'a' && c <= 'f') {
+        cp |= static_cast<std::uint32_t>(c - 'a' + 10);
+      } else if (c >= 'A' && c <= 'F') {
+        cp |= static_cast<std::uint32_t>(c - 'A' + 10);
+      } else {
+        fail("invalid unicode escape");
+      }
+    }
+    return cp;
+  }
+
+  std::uint32_t readCodepoint() {
+    std::uint32_t cp = readHex4();
+    if (cp >= 0xDC00 && cp <= 0xDFFF) fail("lone trailing surrogate");
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+      if (text_.substr(pos_, 2) != "\\u") fail("lone leading surrogate");
+      pos_ += 2;
+      std::uint32_t low = readHex4();
+      if (low < 0xDC00 || low > 0xDFFF) fail("invalid surrogate pair");
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+    }
+    return cp;
+  }
+
+  static void appendUtf8(std::uint32_t cp, std::string* out) {
+    if (cp < 0x80) {
+      out->push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+      out->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+      out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+      out->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+      out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+      out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+      out->push_back(static_cast<char>(0xF0 | (cp >> 18)));
+      out->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+      out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+      out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+  }
+
+  std::string_view text_;
+  std::size_t pos_ = 0;
+};
+
+// Returns true if `data` is well-formed UTF-8 (no overlongs, no surrogates,
+// nothing above U+10FFFF), matching what Rust's `str::from_utf8` accepts.
+bool isValidUtf8(const std::uint8_t* data, std::size_t len) noexcept;
+
+// Appends `s` to `out` as a quoted, escaped JSON string.
+void appendJsonString(std::string_view s, std::string* out);
+
+}  // namespace safetensors::detail
@@ -123,9 +123,12 @@ fn deserialize(bytes: &[u8]) -> Result<Vec<PairStrTensorView>, SafeTensorError>
         let mut shape = tensor.shape().to_vec();
         let dtype = tensor.dtype();
         if dtype == RDtype::F4 {
-            let n = shape.len();
-            shape[n - 1] /= 2; // F4 is stored as F8
+            if let Some(last) = shape.last_mut() {
+                *last /= 2; // F4 is stored as F8
+            }
         }
+        // F6 keeps its logical shape: four values take three bytes, so
+        // there is no whole number of bytes per value to report instead.
         let data = tensor.data();
         let data_len = tensor.data_len();
         items.push(PairStrTensorView {
@@ -180,15 +183,15 @@ fn prepare(
 ) -> Result<HashMap<String, TensorView>, SafeTensorError> {
     let mut tensors = HashMap::with_capacity(tensor_dict.len());
     for tensor in tensor_dict {
-        let mut shape: Vec<usize> = tensor.value.shape().to_vec();
-        let dtype: RDtype = tensor.value.dtype();
-
-        if dtype == RDtype::F4 {
-            let n = shape.len();
-            shape[n - 1] *= 2;
-        };
-
-        tensors.insert(tensor.key, tensor.value);
+        let mut value = tensor.value;
+        // Undo the halving done by `deserialize`. F6 shapes are passed
+        // through unchanged in both directions.
+        if value.dtype() == RDtype::F4 {
+            if let Some(last) = value.shape.last_mut() {
+                *last *= 2;
+            }
+        }
+        tensors.insert(tensor.key, value);
     }
     Ok(tensors)
 }
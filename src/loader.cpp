@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/loader.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "aligned.hpp"
+#include "fmt/format.h"
+
+namespace safetensors {
+
+namespace {
+
+struct Buffer {
+  void* ptr = nullptr;
+  std::size_t capacity = 0;
+};
+
+}  // namespace
+
+struct AsyncLoader::State : std::enable_shared_from_this<State> {
+  struct Job {
+    std::string_view key;
+    const SafeOpen::TensorView* view;
+    std::promise<LoadedTensor> promise;
+    std::function<void(LoadedTensor)> done;
+  };
+
+  State(const SafeOpen& f, const LoaderOptions& opts)
+      : file(f), options(opts), page(Mmap::pageSize()) {
+    options.max_in_flight = std::max<std::size_t>(1, options.max_in_flight);
+  }
+
+  ~State() {
+    for (const Buffer& buf : free_buffers) deallocate(buf);
+  }
+
+  void start() {
+    std::size_t threads = std::max<std::size_t>(1, options.threads);
+    workers.reserve(threads);
+    for (std::size_t t = 0; t < threads; ++t) {
+      workers.emplace_back([this] { run(); });
+    }
+  }
+
+  void stop() {
+    std::deque<Job> dropped;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+      pending -= queue.size();
+      dropped.swap(queue);
+    }
+    dropped.clear();
+    start_cv.notify_all();
+    idle_cv.notify_all();
+    for (auto& worker : workers) worker.join();
+  }
+
+  // Staging bytes for a view: the data sits at the same offset within a
+  // page as in the file, so that direct I/O can read into it in place.
+  std::size_t footprint(const SafeOpen::TensorView& view) const noexcept {
+    std::size_t misalign =
+        reinterpret_cast<std::uintptr_t>(view.data_ptr) & (page - 1);
+    return std::max(page, (misalign + view.data_len + page - 1) & ~(page - 1));
+  }
+
+  bool canStart(const std::size_t need) const noexcept {
+    return in_flight < options.max_in_flight &&
+           (staged == 0 || staged + need <= options.staging_bytes);
+  }
+
+  // Takes the smallest cached buffer that fits and keeps `staged` within
+  // budget, as `canStart` checked for `need` bytes. Otherwise returns an
+  // empty buffer of the right capacity to allocate outside the lock, after
+  // moving cached buffers that would push us over budget to `evicted`.
+  Buffer takeBuffer(const std::size_t need, std::vector<Buffer>* evicted) {
+    // Only a tensor larger than the whole budget may exceed it, alone.
+    const std::size_t limit = staged + need <= options.staging_bytes
+                                  ? options.staging_bytes - staged
+                                  : need;
+    auto best = free_buffers.end();
+    for (auto it = free_buffers.begin(); it != free_buffers.end(); ++it) {
+      if (it->capacity >= need && it->capacity <= limit &&
+          (best == free_buffers.end() || it->capacity < best->capacity)) {
+        best = it;
+      }
+    }
+    if (best != free_buffers.end()) {
+      Buffer buf = *best;
+      free_buffers.erase(best);
+      return buf;
+    }
+    std::sort(free_buffers.begin(), free_buffers.end(),
+              [](const Buffer& a, const Buffer& b) {
+                return a.capacity < b.capacity;
+              });
+    while (!free_buffers.empty() &&
+           allocated + need > options.staging_bytes) {
+      allocated -= free_buffers.back().capacity;
+      evicted->push_back(free_buffers.back());
+      free_buffers.pop_back();
+    }
+    allocated += need;
+    return Buffer{nullptr, need};
+  }
+
+  void* allocate(const std::size_t size) const {
+    if (options.allocate) {
+      void* p = options.allocate(size);
+      if (!p) throw std::bad_alloc();
+      return p;
+    }
+    return detail::alignedAlloc(size, page);
+  }
+
+  void deallocate(const Buffer& buf) const noexcept {
+    if (!buf.ptr) return;
+    if (options.deallocate) {
+      options.deallocate(buf.ptr, buf.capacity);
+    } else {
+      detail::alignedFree(buf.ptr);
+    }
+  }
+
+  void release(const Buffer& buf) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      staged -= buf.capacity;
+      --in_flight;
+      if (buf.ptr) {
+        free_buffers.push_back(buf);
+      } else {
+        allocated -= buf.capacity;
+      }
+    }
+    start_cv.notify_all();
+  }
+
+  void fail(Job* job, std::exception_ptr e) {
+    if (job->done) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) error = e;
+    } else {
+      job->promise.set_exception(e);
+    }
+  }
+
+  // Reads and delivers one job. Takes it by value so that a promise whose
+  // future is already gone releases its tensor here, without the lock.
+  void process(Job job, Buffer buf) {
+    auto start = std::chrono::steady_clock::now();
+    bool leased = false;
+    try {
+      if (!buf.ptr) buf.ptr = allocate(buf.capacity);
+
+      LoadedTensor tensor;
+      tensor.key_ = job.key;
+      tensor.view_ = *job.view;
+      auto* dst = static_cast<std::byte*>(buf.ptr) +
+                  (reinterpret_cast<std::uintptr_t>(job.view->data_ptr) &
+                   (page - 1));
+      tensor.view_.data_ptr = dst;
+      tensor.lease_ = std::make_unique<LoadedTensor::Lease>(
+          shared_from_this(), buf);
+      leased = true;
+      file.read_into(job.key, {dst, job.view->data_len});
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+      {
+        std::lock_guard<std::mutex> stats_lock(mutex);
+        ++stats.tensors;
+        stats.bytes += job.view->data_len;
+        stats.read_seconds += seconds;
+      }
+      if (job.done) {
+        job.done(std::move(tensor));
+      } else {
+        job.promise.set_value(std::move(tensor));
+      }
+    } catch (...) {
+      // Once the lease exists, destroying the tensor returns the buffer.
+      if (!leased) release(buf);
+      fail(&job, std::current_exception());
+    }
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      start_cv.wait(lock, [this] {
+        return stopping ||
+               (!queue.empty() && canStart(footprint(*queue.front().view)));
+      });
+      if (stopping) return;
+
+      Job job = std::move(queue.front());
+      queue.pop_front();
+      std::vector<Buffer> evicted;
+      Buffer buf = takeBuffer(footprint(*job.view), &evicted);
+      ++in_flight;
+      staged += buf.capacity;
+      stats.peak_staged_bytes = std::max(stats.peak_staged_bytes, staged);
+      lock.unlock();
+
+      for (const Buffer& old : evicted) deallocate(old);
+      process(std::move(job), buf);
+
+      lock.lock();
+      --pending;
+      if (pending == 0) idle_cv.notify_all();
+    }
+  }
+
+  const SafeOpen& file;
+  LoaderOptions options;
+  const std::size_t page;
+
+  std::mutex mutex;
+  std::condition_variable start_cv;
+  std::condition_variable idle_cv;
+  std::deque<Job> queue;
+  // Loads submitted and not yet delivered.
+  std::size_t pending = 0;
+  // Loads started whose tensor has not been released.
+  std::size_t in_flight = 0;
+  // Bytes of buffers held by those loads, and of all buffers incl. cached.
+  std::size_t staged = 0;
+  std::size_t allocated = 0;
+  std::vector<Buffer> free_buffers;
+  std::exception_ptr error;
+  bool stopping = false;
+  LoaderStats stats;
+  std::vector<std::thread> workers;
+};
+
+struct LoadedTensor::Lease {
+  Lease(std::shared_ptr<AsyncLoader::State> s, const Buffer& b)
+      : state(std::move(s)), buffer(b) {}
+  ~Lease() { state->release(buffer); }
+
+  std::shared_ptr<AsyncLoader::State> state;
+  Buffer buffer;
+};
+
+LoadedTensor::LoadedTensor() noexcept = default;
+LoadedTensor::LoadedTensor(LoadedTensor&&) noexcept = default;
+LoadedTensor& LoadedTensor::operator=(LoadedTensor&&) noexcept = default;
+LoadedTensor::~LoadedTensor() = default;
+
+AsyncLoader::AsyncLoader(const SafeOpen& file, const LoaderOptions& options)
+    : state_(std::make_shared<State>(file, options)) {
+  state_->start();
+}
+
+AsyncLoader::~AsyncLoader() { state_->stop(); }
+
+std::future<LoadedTensor> AsyncLoader::load(std::string_view key) {
+  std::promise<LoadedTensor> promise;
+  std::future<LoadedTensor> future = promise.get_future();
+  load(key, std::move(promise), nullptr);
+  return future;
+}
+
+void AsyncLoader::load(std::string_view key,
+                       std::function<void(LoadedTensor)> done) {
+  if (!done) {
+    throw std::invalid_argument(
+        fmt::format("{}:{} empty callback for '{}'", __FILE__, __LINE__, key));
+  }
+  load(key, std::promise<LoadedTensor>(), std::move(done));
+}
+
+void AsyncLoader::load(std::string_view key,
+                       std::promise<LoadedTensor> promise,
+                       std::function<void(LoadedTensor)> done) {
+  // Not find_tensor: the tensor is consumed when the worker reads it, so
+  // that release_consumed() leaves queued ones alone, and nothing is
+  // touched on the caller's thread.
+  const SafeOpen& file = state_->file;
+  const std::size_t i = file.index().find(key);
+  if (i == TensorIndex::npos || file.is_unmapped(key)) {
+    throw std::runtime_error(
+        fmt::format("{}:{} key '{}' {}", __FILE__, __LINE__, key,
+                    i == TensorIndex::npos ? "not found" : "was unmapped"));
+  }
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    // Keep the key alive with the index rather than the caller's string.
+    state_->queue.push_back(State::Job{file.keys()[i], &file.tensors()[i],
+                                       std::move(promise), std::move(done)});
+    ++state_->pending;
+  }
+  state_->start_cv.notify_one();
+}
+
+void AsyncLoader::wait() {
+  std::unique_lock<std::mutex> lock(state_->mutex);
+  state_->idle_cv.wait(lock, [this] { return state_->pending == 0; });
+  if (state_->error) {
+    std::exception_ptr error = std::exchange(state_->error, nullptr);
+    std::rethrow_exception(error);
+  }
+}
+
+LoaderStats AsyncLoader::stats() const {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->stats;
+}
+
+}  // namespace safetensors
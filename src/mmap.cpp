@@ -28,9 +28,13 @@
 #include <climits>
 #include <cstring>
 #include <filesystem>
+#include <mutex>
 #include <stdexcept>
+#include <vector>
 
 #include "fmt/format.h"
+#include "parallel.hpp"
+#include "safetensors/numa.hpp"
 
 #ifdef __has_include
 // cppcheck-suppress preprocessorErrorDirective
@@ -52,6 +56,7 @@
 #define NOMINMAX
 #endif
 #include <windows.h>
+#include <psapi.h>
 #ifndef PATH_MAX
 #define PATH_MAX MAX_PATH
 #endif
@@ -154,6 +159,85 @@ struct File::impl {
 
   void writeU32(const std::uint32_t val) const { writeRaw(&val, sizeof(val)); }
 
+  void writeAt(const void* ptr, std::size_t len, std::size_t offset) const {
+    const auto* src = static_cast<const std::uint8_t*>(ptr);
+#ifdef _WIN32
+    HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(fp)));
+    while (len > 0) {
+      OVERLAPPED ov = {};
+      ov.Offset = static_cast<DWORD>(offset);
+      ov.OffsetHigh = static_cast<DWORD>(static_cast<std::uint64_t>(offset) >>
+                                         32);
+      DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(len, 1u << 30));
+      DWORD n = 0;
+      if (!WriteFile(handle, src, chunk, &n, &ov)) {
+        throw std::runtime_error(
+            fmt::format("write error: {}", winErr(GetLastError())));
+      }
+      src += n;
+      len -= n;
+      offset += n;
+    }
+#else
+    int fd = fileno(fp);
+    while (len > 0) {
+      ssize_t n = pwrite(fd, src, len, static_cast<off_t>(offset));
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error(
+            fmt::format("write error: {}", strerror(errno)));
+      }
+      src += n;
+      len -= static_cast<std::size_t>(n);
+      offset += static_cast<std::size_t>(n);
+    }
+#endif
+  }
+
+  void reserve(const std::size_t len) const {
+#ifdef _WIN32
+    if (_chsize_s(_fileno(fp), static_cast<__int64>(len))) {
+      throw std::runtime_error(fmt::format("resize error: {}", strerror(errno)));
+    }
+#else
+    int fd = fileno(fp);
+#if defined(__linux__)
+    // Unlike posix_fallocate, fails instead of writing zeros when the file
+    // system cannot allocate extents.
+    if (fallocate(fd, 0, 0, static_cast<off_t>(len)) == 0) return;
+#endif
+    if (ftruncate(fd, static_cast<off_t>(len))) {
+      throw std::runtime_error(fmt::format("resize error: {}", strerror(errno)));
+    }
+#endif
+  }
+
+  void sync() const {
+    if (std::fflush(fp)) {
+      throw std::runtime_error(fmt::format("flush error: {}", strerror(errno)));
+    }
+#ifdef _WIN32
+    HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(fp)));
+    if (!FlushFileBuffers(handle)) {
+      throw std::runtime_error(
+          fmt::format("sync error: {}", winErr(GetLastError())));
+    }
+#elif defined(__APPLE__)
+    // fsync does not reach the platter on macOS.
+    if (fcntl(fileno(fp), F_FULLFSYNC) == -1 && fsync(fileno(fp))) {
+      throw std::runtime_error(fmt::format("sync error: {}", strerror(errno)));
+    }
+#elif defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    if (fdatasync(fileno(fp))) {
+      throw std::runtime_error(fmt::format("sync error: {}", strerror(errno)));
+    }
+#else
+    if (fsync(fileno(fp))) {
+      throw std::runtime_error(fmt::format("sync error: {}", strerror(errno)));
+    }
+#endif
+  }
+
   ~impl() {
     if (fp) {
       std::fclose(fp);
@@ -198,6 +282,13 @@ void File::writeRaw(const void* ptr, const std::size_t len) const {
 }
 void File::writeU32(const std::uint32_t val) const { pimpl->writeU32(val); }
 
+void File::writeAt(const void* ptr, const std::size_t len,
+                   const std::size_t offset) const {
+  pimpl->writeAt(ptr, len, offset);
+}
+void File::sync() const { pimpl->sync(); }
+void File::reserve(const std::size_t len) const { pimpl->reserve(len); }
+
 // Mmap
 
 struct Mmap::impl {
@@ -218,9 +309,122 @@ struct Mmap::impl {
   }
 #endif
 
-  impl(File* file, std::size_t prefetch, const bool numa) {
+#if defined(_WIN32)
+  static void prefetchRange(void* start, const std::size_t len) {
+#if _WIN32_WINNT >= 0x602
+    BOOL(WINAPI * pPrefetchVirtualMemory)(HANDLE, ULONG_PTR,
+                                          PWIN32_MEMORY_RANGE_ENTRY, ULONG);
+    HMODULE hKernel32 = GetModuleHandleW(L"kernel32.dll");
+
+    pPrefetchVirtualMemory =
+        (decltype(pPrefetchVirtualMemory))static_cast<void*>(
+            GetProcAddress(hKernel32, "PrefetchVirtualMemory"));
+
+    if (pPrefetchVirtualMemory) {
+      WIN32_MEMORY_RANGE_ENTRY range;
+      range.VirtualAddress = start;
+      range.NumberOfBytes = (SIZE_T)len;
+      if (!pPrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0)) {
+        fmt::print("warning: PrefetchVirtualMemory failed: {}\n",
+                   winErr(GetLastError()));
+      }
+    }
+#else
+    void(start);
+    void(len);
+    fmt::print("skipping PrefetchVirtualMemory because _WIN32_WINNT < 0x602\n");
+#endif
+  }
+#endif
+
+#if defined(__linux__)
+  // Reserves `len` bytes of address space starting at a multiple of `align`,
+  // to be replaced with MAP_FIXED. A PMD can only map a huge page if the
+  // virtual address is aligned like the data.
+  static void* reserveAligned(const std::size_t len, const std::size_t align) {
+    void* p = mmap(NULL, len + align, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+      return MAP_FAILED;
+    }
+    std::uintptr_t base = reinterpret_cast<std::uintptr_t>(p);
+    std::uintptr_t start = (base + align - 1) & ~(align - 1);
+    if (start > base) {
+      munmap(p, start - base);
+    }
+    if (base + align > start) {
+      munmap(reinterpret_cast<void*>(start + len), base + align - start);
+    }
+    return reinterpret_cast<void*>(start);
+  }
+
+  // Reads the file into anonymous huge pages, see HugePages::Copy.
+  void copyToHugePages(File* file) {
+    std::size_t huge = Mmap::hugePageSize();
+    mapped = (size + huge - 1) & ~(huge - 1);
+    addr = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr != MAP_FAILED) {
+      granularity = huge;
+    } else {
+      // No reserved hugetlbfs pages (ENOMEM) or no such page size (EINVAL).
+      addr = reserveAligned(mapped, huge);
+      if (addr == MAP_FAILED ||
+          mmap(addr, mapped, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        throw std::runtime_error(
+            fmt::format("mmap failed: {}", strerror(errno)));
+      }
+#if defined(MADV_HUGEPAGE)
+      if (madvise(addr, mapped, MADV_HUGEPAGE) && errno != EINVAL) {
+        fmt::print("warning: madvise(.., MADV_HUGEPAGE) failed: {}\n",
+                   strerror(errno));
+      }
+#endif
+    }
+    anonymous = true;
+
+    try {
+      constexpr std::size_t kChunk = 64 << 20;
+      int fd = file->fileId();
+      auto* dst = static_cast<std::uint8_t*>(addr);
+      detail::parallelFor((size + kChunk - 1) / kChunk, 0, [&](std::size_t i) {
+        std::size_t pos = i * kChunk;
+        std::size_t end = std::min(size, pos + kChunk);
+        while (pos < end) {
+          ssize_t n = pread(fd, dst + pos, end - pos, static_cast<off_t>(pos));
+          if (n < 0 && errno == EINTR) continue;
+          if (n <= 0) {
+            throw std::runtime_error(fmt::format(
+                "read error: {}", n ? strerror(errno) : "unexpected EOF"));
+          }
+          pos += static_cast<std::size_t>(n);
+        }
+      });
+    } catch (...) {
+      munmap(addr, mapped);
+      throw;
+    }
+    if (mprotect(addr, mapped, PROT_READ)) {
+      fmt::print("warning: mprotect(.., PROT_READ) failed: {}\n",
+                 strerror(errno));
+    }
+  }
+#endif
+
+  impl(File* file, std::size_t prefetch, const bool numa,
+       const HugePages huge_pages) {
 #ifdef _POSIX_MAPPED_FILES
     size = file->size();
+    mapped = size;
+    granularity = Mmap::pageSize();
+#ifdef __linux__
+    if (huge_pages == HugePages::Copy && size > 0) {
+      copyToHugePages(file);
+      mapped_fragments.emplace_back(0, mapped);
+      return;
+    }
+#endif
     int fd = file->fileId();
     int flags = MAP_SHARED;
     if (numa) {
@@ -232,15 +436,53 @@ struct Mmap::impl {
           "warning: posix_fadvise(.., POSIX_FADV_SEQUENTIAL) failed: {}\n",
           strerror(errno));
     }
-    if (prefetch) {
+    // With huge pages, faulting must wait until the advice is in place.
+    if (prefetch && huge_pages == HugePages::None) {
       flags |= MAP_POPULATE;
     }
 #endif
-    addr = mmap(NULL, file->size(), PROT_READ, flags, fd, 0);
+    addr = MAP_FAILED;
+#ifdef __linux__
+    if (huge_pages == HugePages::Advise && size > 0) {
+      std::size_t len = (size + granularity - 1) & ~(granularity - 1);
+      void* want = reserveAligned(len, Mmap::hugePageSize());
+      if (want != MAP_FAILED) {
+        addr = mmap(want, size, PROT_READ, flags | MAP_FIXED, fd, 0);
+        if (addr == MAP_FAILED) {
+          munmap(want, len);
+        }
+      }
+    }
+#endif
+    if (addr == MAP_FAILED) {
+      addr = mmap(NULL, file->size(), PROT_READ, flags, fd, 0);
+    }
     if (addr == MAP_FAILED) {
       throw std::runtime_error(fmt::format("mmap failed: {}", strerror(errno)));
     }
 
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (huge_pages == HugePages::Advise) {
+      // EINVAL: no transparent huge pages, stay with normal pages.
+      if (madvise(addr, size, MADV_HUGEPAGE) && errno != EINVAL) {
+        fmt::print("warning: madvise(.., MADV_HUGEPAGE) failed: {}\n",
+                   strerror(errno));
+      }
+      if (prefetch > 0) {
+        std::size_t last = std::min(size, prefetch);
+        this->prefetch(0, last);
+#if defined(MADV_COLLAPSE)
+        // Best effort: fails when the file system has no large folios.
+        last &= ~(Mmap::hugePageSize() - 1);
+        if (last > 0) {
+          madvise(addr, last, MADV_COLLAPSE);
+        }
+#endif
+        prefetch = 0;
+      }
+    }
+#endif
+
     if (prefetch > 0) {
       if (posix_madvise(addr, std::min(file->size(), prefetch),
                         POSIX_MADV_WILLNEED)) {
@@ -259,6 +501,7 @@ struct Mmap::impl {
     mapped_fragments.emplace_back(0, file->size());
 #elif defined(_WIN32)
     void(numa);
+    void(huge_pages);
 
     size = file->size();
 
@@ -283,45 +526,144 @@ struct Mmap::impl {
     }
 
     if (prefetch > 0) {
-#if _WIN32_WINNT >= 0x602
-      BOOL(WINAPI * pPrefetchVirtualMemory)(HANDLE, ULONG_PTR,
-                                            PWIN32_MEMORY_RANGE_ENTRY, ULONG);
-      HMODULE hKernel32 = GetModuleHandleW(L"kernel32.dll");
-
-      pPrefetchVirtualMemory =
-          (decltype(pPrefetchVirtualMemory))static_cast<void*>(
-              GetProcAddress(hKernel32, "PrefetchVirtualMemory"));
-
-      if (pPrefetchVirtualMemory) {
-        WIN32_MEMORY_RANGE_ENTRY range;
-        range.VirtualAddress = addr;
-        range.NumberOfBytes = (SIZE_T)std::min(size, prefetch);
-        if (!pPrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0)) {
-          fmt::print("warning: PrefetchVirtualMemory failed: {}\n",
-                     win_err(GetLastError()));
-        }
-      }
-#else
-      fmt::print(
-          "skipping PrefetchVirtualMemory because _WIN32_WINNT < 0x602\n");
-#endif
+      prefetchRange(addr, std::min(size, prefetch));
+    }
 #else
     void(file);
     void(prefetch);
     void(numa);
+    void(huge_pages);
 
     throw std::runtime_error("mmap not supported");
 #endif
   }
 
-  void unmapFragment(std::size_t first, std::size_t last) {
+  void prefetch(std::size_t first, std::size_t last) const {
+    last = std::min(last, size);
+    if (last <= first) {
+      return;
+    }
+#if defined(_POSIX_MAPPED_FILES)
+    std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    first &= ~(page_size - 1);
+    void* start = static_cast<std::uint8_t*>(addr) + first;
+    std::size_t len = last - first;
+#if defined(MADV_POPULATE_READ)
+    if (!madvise(start, len, MADV_POPULATE_READ)) {
+      return;
+    }
+    // EINVAL: kernel older than 5.14, fall back to read-ahead below.
+    if (errno != EINVAL) {
+      fmt::print("warning: madvise(.., MADV_POPULATE_READ) failed: {}\n",
+                 strerror(errno));
+      return;
+    }
+#endif
+    int err = posix_madvise(start, len, POSIX_MADV_WILLNEED);
+    if (err) {
+      fmt::print("warning: posix_madvise(.., POSIX_MADV_WILLNEED) failed: {}\n",
+                 strerror(err));
+    }
+#elif defined(_WIN32)
+    prefetchRange(static_cast<std::uint8_t*>(addr) + first, last - first);
+#else
+    void(first);
+    void(last);
+#endif
+  }
+
+  void willNeed(std::size_t first, std::size_t last) const {
+    last = std::min(last, size);
+    if (last <= first) {
+      return;
+    }
+#if defined(_POSIX_MAPPED_FILES)
+    std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    first &= ~(page_size - 1);
+    int err = posix_madvise(static_cast<std::uint8_t*>(addr) + first,
+                            last - first, POSIX_MADV_WILLNEED);
+    if (err) {
+      fmt::print("warning: posix_madvise(.., POSIX_MADV_WILLNEED) failed: {}\n",
+                 strerror(err));
+    }
+#elif defined(_WIN32)
+    prefetchRange(static_cast<std::uint8_t*>(addr) + first, last - first);
+#else
+    void(first);
+    void(last);
+#endif
+  }
+
+  std::size_t discardFragment(std::size_t first, std::size_t last) {
+    last = std::min(last, size);
+    if (last <= first) {
+      return 0;
+    }
+#if defined(_POSIX_MAPPED_FILES)
+    // MADV_DONTNEED would zero a private copy instead of rereading it.
+    if (anonymous) {
+      return 0;
+    }
+    alignRange(&first, &last, granularity);
+    std::size_t len = last - first;
+
+    if (len == 0) {
+      return 0;
+    }
+
+    void* start = static_cast<std::uint8_t*>(addr) + first;
+#if defined(MADV_DONTNEED)
+    if (madvise(start, len, MADV_DONTNEED)) {
+      fmt::print("warning: madvise(.., MADV_DONTNEED) failed: {}\n",
+                 strerror(errno));
+      return 0;
+    }
+#else
+    // POSIX_MADV_DONTNEED is only a hint and may keep the pages resident.
+    int err = posix_madvise(start, len, POSIX_MADV_DONTNEED);
+    if (err) {
+      fmt::print("warning: posix_madvise(.., POSIX_MADV_DONTNEED) failed: {}\n",
+                 strerror(err));
+      return 0;
+    }
+#endif
+    return len;
+#elif defined(_WIN32)
+    std::size_t page_size = Mmap::pageSize();
+    first = (first + page_size - 1) & ~(page_size - 1);
+    last &= ~(page_size - 1);
+    if (last <= first) {
+      return 0;
+    }
+    // Unlocking pages that are not locked trims them from the working set.
+    if (!VirtualUnlock(static_cast<std::uint8_t*>(addr) + first,
+                       last - first) &&
+        GetLastError() != ERROR_NOT_LOCKED) {
+      fmt::print("warning: VirtualUnlock failed: {}\n",
+                 winErr(GetLastError()));
+      return 0;
+    }
+    return last - first;
+#else
+    void(first);
+    void(last);
+    return 0;
+#endif
+  }
+
+  std::size_t unmapFragment(std::size_t first, std::size_t last) {
 #if defined(_POSIX_MAPPED_FILES)
-    int page_size = sysconf(_SC_PAGESIZE);
+    // hugetlbfs pages are only unmapped whole. The last one extends past
+    // the file, up to `mapped`.
+    std::size_t page_size = granularity;
+    if (last >= size) {
+      last = mapped;
+    }
     alignRange(&first, &last, page_size);
     std::size_t len = last - first;
 
     if (len == 0) {
-      return;
+      return 0;
     }
 
     FMT_ASSERT(first % page_size == 0, "first is not page aligned");
@@ -330,6 +672,8 @@ struct Mmap::impl {
 
     void* next_page_start = static_cast<std::uint8_t*>(addr) + first;
 
+    // Concurrent releases of different tensors share the fragment list.
+    std::lock_guard<std::mutex> lock(fragments_mutex);
     if (munmap(next_page_start, len)) {
       fmt::print("warning: munmap failed: {}\n", strerror(errno));
     }
@@ -349,9 +693,11 @@ struct Mmap::impl {
       }
     }
     mapped_fragments = std::move(new_mapped_fragments);
+    return len;
 #elif defined(_WIN32)
       void(first);
       void(last);
+      return 0;
 #else
     void(first);
     void(last);
@@ -376,16 +722,97 @@ struct Mmap::impl {
 #endif
   }
 
+  // Sets out[i] to 1 if page `first_page + i` of the mapping is resident,
+  // 0 otherwise. False if the OS cannot tell, e.g. for an unmapped range.
+  bool residentPages(const std::size_t first_page, const std::size_t pages,
+                     std::uint8_t* out) const {
+    const std::size_t page_size = Mmap::pageSize();
+    auto* start = static_cast<std::uint8_t*>(addr) + first_page * page_size;
+#if defined(_POSIX_MAPPED_FILES)
+#if defined(__APPLE__)
+    auto* vec = reinterpret_cast<char*>(out);
+#else
+    auto* vec = reinterpret_cast<unsigned char*>(out);
+#endif
+    if (mincore(start, pages * page_size, vec)) return false;
+    for (std::size_t i = 0; i < pages; ++i) out[i] &= 1;
+    return true;
+#elif defined(_WIN32)
+    // The working set of this process only; pages on the standby list
+    // count as absent.
+    std::vector<PSAPI_WORKING_SET_EX_INFORMATION> info(pages);
+    for (std::size_t i = 0; i < pages; ++i) {
+      info[i].VirtualAddress = start + i * page_size;
+    }
+    if (!QueryWorkingSetEx(
+            GetCurrentProcess(), info.data(),
+            static_cast<DWORD>(info.size() * sizeof(info[0])))) {
+      return false;
+    }
+    for (std::size_t i = 0; i < pages; ++i) {
+      out[i] = info[i].VirtualAttributes.Valid ? 1 : 0;
+    }
+    return true;
+#else
+    void(start);
+    void(pages);
+    void(out);
+    return false;
+#endif
+  }
+
+  std::size_t hugePageBytes() const {
+#if defined(__linux__)
+    std::FILE* smaps = std::fopen("/proc/self/smaps", "r");
+    if (!smaps) {
+      return 0;
+    }
+    const std::uintptr_t lo = reinterpret_cast<std::uintptr_t>(addr);
+    const std::uintptr_t hi = lo + mapped;
+    std::size_t kb = 0;
+    bool inside = false;
+    char line[512];
+    while (std::fgets(line, sizeof(line), smaps)) {
+      unsigned long long first, last;
+      char name[64];
+      std::size_t value;
+      if (std::sscanf(line, "%llx-%llx ", &first, &last) == 2) {
+        inside = first < hi && last > lo;
+      } else if (inside &&
+                 std::sscanf(line, "%63[^:]: %zu kB", name, &value) == 2) {
+        std::string_view field(name);
+        if (field == "AnonHugePages" || field == "FilePmdMapped" ||
+            field == "ShmemPmdMapped" || field == "Private_Hugetlb" ||
+            field == "Shared_Hugetlb") {
+          kb += value;
+        }
+      }
+    }
+    std::fclose(smaps);
+    return kb << 10;
+#else
+    return 0;
+#endif
+  }
+
 #ifdef _POSIX_MAPPED_FILES
   std::vector<std::pair<std::size_t, std::size_t>> mapped_fragments;
+  std::mutex fragments_mutex;
+  // Unit of unmapping, larger than a page for hugetlbfs copies.
+  std::size_t granularity = 0;
+  // Private copy (HugePages::Copy) rather than a file mapping.
+  bool anonymous = false;
 #endif
 
   void* addr;
   std::size_t size;
+  // Address range in use, `size` rounded up for hugetlbfs copies.
+  std::size_t mapped = 0;
 };  // NOLINT
 
-Mmap::Mmap(File* file, const std::size_t prefetch, const bool numa)
-    : pimpl(std::make_unique<impl>(file, prefetch, numa)) {}
+Mmap::Mmap(File* file, const std::size_t prefetch, const bool numa,
+           const HugePages huge_pages)
+    : pimpl(std::make_unique<impl>(file, prefetch, numa, huge_pages)) {}
 Mmap::~Mmap() = default;
 
 std::size_t Mmap::size() const { return pimpl->size; }
@@ -394,8 +821,119 @@ std::uint8_t* Mmap::data() const {
   return static_cast<std::uint8_t*>(pimpl->addr);
 }
 
-void Mmap::unmapFragment(const std::size_t first, const std::size_t last) {
-  pimpl->unmapFragment(first, last);
+std::size_t Mmap::unmapFragment(const std::size_t first,
+                                const std::size_t last) {
+  return pimpl->unmapFragment(first, last);
+}
+
+std::size_t Mmap::discardFragment(const std::size_t first,
+                                  const std::size_t last) {
+  return pimpl->discardFragment(first, last);
+}
+
+void Mmap::prefetch(const std::size_t first, const std::size_t last) const {
+  pimpl->prefetch(first, last);
+}
+
+void Mmap::willNeed(const std::size_t first, const std::size_t last) const {
+  pimpl->willNeed(first, last);
+}
+
+bool Mmap::bindNode(const std::size_t first, std::size_t last,
+                    const int node) const {
+  last = std::min(last, pimpl->size);
+  if (last <= first) {
+    return true;
+  }
+  pimpl->prefetch(first, last);
+  return numa_bind(data() + first, last - first, node, true);
+}
+
+std::size_t Mmap::residentBytes(const std::size_t first,
+                                std::size_t last) const {
+  const std::pair<std::size_t, std::size_t> range{first, last};
+  std::size_t bytes = 0;
+  residentBytes({&range, 1}, {&bytes, 1});
+  return bytes;
+}
+
+void Mmap::residentBytes(
+    std::span<const std::pair<std::size_t, std::size_t>> ranges,
+    std::span<std::size_t> out) const {
+  // Pages are queried in windows, so that a large checkpoint needs neither
+  // one call per tensor nor one vector entry per page of the whole file.
+  constexpr std::size_t kWindow = 1 << 16;
+  const std::size_t page = pageSize();
+  std::vector<std::uint8_t> resident;
+  std::size_t window = 0;  // first page of `resident`
+  bool valid = false;
+  for (std::size_t r = 0; r < ranges.size() && r < out.size(); ++r) {
+    const std::size_t first = ranges[r].first;
+    const std::size_t last = std::min(ranges[r].second, pimpl->size);
+    out[r] = 0;
+    if (last <= first) continue;
+    const std::size_t first_page = first / page;
+    const std::size_t last_page = (last + page - 1) / page;
+    if (!valid || first_page < window ||
+        last_page > window + resident.size()) {
+      window = first_page;
+      const std::size_t end = std::min(
+          std::max(last_page, first_page + kWindow),
+          (pimpl->size + page - 1) / page);
+      resident.resize(end - window);
+      valid = pimpl->residentPages(window, resident.size(), resident.data());
+      if (!valid) {
+        // Part of the window is unmapped; fall back to this range alone,
+        // page by page.
+        for (std::size_t p = first_page; p < last_page; ++p) {
+          std::uint8_t one = 0;
+          if (pimpl->residentPages(p, 1, &one) && one) {
+            out[r] += std::min(last, (p + 1) * page) -
+                      std::max(first, p * page);
+          }
+        }
+        continue;
+      }
+    }
+    for (std::size_t p = first_page; p < last_page; ++p) {
+      if (resident[p - window]) {
+        out[r] += std::min(last, (p + 1) * page) - std::max(first, p * page);
+      }
+    }
+  }
+}
+
+std::size_t Mmap::hugePageBytes() const { return pimpl->hugePageBytes(); }
+
+std::size_t Mmap::hugePageSize() {
+#if defined(__linux__)
+  static const std::size_t size = [] {
+    std::size_t bytes = 0;
+    if (std::FILE* f = std::fopen(
+            "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r")) {
+      if (std::fscanf(f, "%zu", &bytes) != 1) {
+        bytes = 0;
+      }
+      std::fclose(f);
+    }
+    return bytes ? bytes : std::size_t{2} << 20;
+  }();
+  return size;
+#else
+  return std::size_t{2} << 20;
+#endif
+}
+
+std::size_t Mmap::pageSize() {
+#if defined(_POSIX_MAPPED_FILES)
+  return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#elif defined(_WIN32)
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return static_cast<std::size_t>(si.dwPageSize);
+#else
+  return 4096;
+#endif
 }
 
 #if defined(_POSIX_MEMLOCK_RANGE) || defined(_WIN32)
@@ -523,6 +1061,12 @@ struct Mlock::impl {
 
   impl() : addr(NULL), size(0), failed_already(false) {}
 
+  ~impl() {
+    if (size) {
+      raw_unlock(addr, size);
+    }
+  }
+
   void init(void* ptr) {
     FMT_ASSERT(addr == NULL && size == 0, "Memory region already initialized");
     addr = ptr;
@@ -553,11 +1097,15 @@ struct Mlock::impl {
 
 Mlock::Mlock() : pimpl(std::make_unique<impl>()) {}
 Mlock::~Mlock() = default;
+Mlock::Mlock(Mlock&&) noexcept = default;
+Mlock& Mlock::operator=(Mlock&&) noexcept = default;
 
 void Mlock::init(void* ptr) { pimpl->init(ptr); }
 void Mlock::growTo(const std::size_t target_size) {
   pimpl->growTo(target_size);
 }
+std::size_t Mlock::size() const { return pimpl->size; }
+bool Mlock::failed() const { return pimpl->failed_already; }
 
 #if defined(_POSIX_MEMLOCK_RANGE) || defined(_WIN32)
 const bool Mlock::SUPPORTED = true;
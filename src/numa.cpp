@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/numa.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include "aligned.hpp"
+#include "fmt/format.h"
+#include "safetensors/mmap.hpp"
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace safetensors {
+
+namespace {
+
+#if defined(__linux__)
+// Node masks cover this many nodes, the kernel's largest MAX_NUMNODES.
+constexpr std::size_t kMaxNodes = 1024;
+constexpr std::size_t kMaskWords = kMaxNodes / (8 * sizeof(unsigned long));
+#endif
+
+// [ptr, ptr + len) widened to whole pages.
+std::pair<std::uintptr_t, std::size_t> pageSpan(const void* ptr,
+                                               const std::size_t len) {
+  const std::size_t page = Mmap::pageSize();
+  std::uintptr_t first = reinterpret_cast<std::uintptr_t>(ptr) & ~(page - 1);
+  std::uintptr_t last =
+      (reinterpret_cast<std::uintptr_t>(ptr) + len + page - 1) & ~(page - 1);
+  return {first, last - first};
+}
+
+}  // namespace
+
+std::size_t numa_nodes() {
+#if defined(__linux__)
+  static const std::size_t nodes = [] {
+    // "0-1" or "0,2-3": the highest online node plus one.
+    std::size_t highest = 0;
+    if (std::FILE* f = std::fopen("/sys/devices/system/node/online", "r")) {
+      char line[256];
+      if (std::fgets(line, sizeof(line), f)) {
+        const char* p = line;
+        while (*p) {
+          char* end;
+          unsigned long n = std::strtoul(p, &end, 10);
+          if (end == p) break;
+          highest = std::max<std::size_t>(highest, n);
+          p = *end ? end + 1 : end;
+        }
+      }
+      std::fclose(f);
+    }
+    return std::min(highest + 1, kMaxNodes);
+  }();
+  return nodes;
+#else
+  return 1;
+#endif
+}
+
+int numa_node_of(const void* ptr) {
+#if defined(__linux__) && defined(SYS_move_pages)
+  // With no target nodes move_pages only reports where each page is.
+  void* page = reinterpret_cast<void*>(reinterpret_cast<std::uintptr_t>(ptr) &
+                                       ~(Mmap::pageSize() - 1));
+  int status = -1;
+  if (syscall(SYS_move_pages, 0, 1UL, &page, nullptr, &status, 0) != 0) {
+    return -1;
+  }
+  return status < 0 ? -1 : status;
+#else
+  (void)ptr;
+  return 0;
+#endif
+}
+
+bool numa_bind(const void* ptr, const std::size_t len, const int node,
+               const bool move) {
+  if (len == 0) return true;
+  if (node < 0 || static_cast<std::size_t>(node) >= numa_nodes()) {
+    throw std::out_of_range(fmt::format("{}:{} node {} out of range [0, {})",
+                                        __FILE__, __LINE__, node,
+                                        numa_nodes()));
+  }
+#if defined(__linux__) && defined(SYS_mbind)
+  auto [first, size] = pageSpan(ptr, len);
+  unsigned long mask[kMaskWords] = {};
+  constexpr std::size_t bits = 8 * sizeof(unsigned long);
+  mask[node / bits] = 1UL << (node % bits);
+  // The kernel reads maxnode - 1 bits.
+  if (syscall(SYS_mbind, first, size, MPOL_BIND, mask, kMaxNodes + 1,
+              move ? MPOL_MF_MOVE : 0)) {
+    fmt::print("warning: mbind(.., MPOL_BIND, node {}) failed: {}\n", node,
+               strerror(errno));
+    return false;
+  }
+  return true;
+#else
+  (void)ptr;
+  (void)move;
+  return true;
+#endif
+}
+
+NodeBuffer::NodeBuffer(const std::size_t size, const int node)
+    : size_(size), node_(node) {
+  if (size == 0) return;
+#if defined(__linux__)
+  void* p = mmap(nullptr, pageSpan(nullptr, size).second,
+                 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) throw std::bad_alloc();
+  data_ = static_cast<std::byte*>(p);
+  // Nothing is touched yet, so the first write allocates on `node`. If
+  // binding fails the buffer is still usable, just not placed.
+  try {
+    numa_bind(data_, size_, node, false);
+  } catch (...) {
+    munmap(data_, pageSpan(nullptr, size).second);
+    throw;
+  }
+#else
+  data_ = static_cast<std::byte*>(
+      detail::alignedAlloc(size, Mmap::pageSize()));
+#endif
+}
+
+NodeBuffer::NodeBuffer(NodeBuffer&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      node_(other.node_) {}
+
+NodeBuffer& NodeBuffer::operator=(NodeBuffer&& other) noexcept {
+  if (this != &other) {
+    NodeBuffer old(std::move(*this));
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    node_ = other.node_;
+  }
+  return *this;
+}
+
+NodeBuffer::~NodeBuffer() {
+  if (!data_) return;
+#if defined(__linux__)
+  munmap(data_, pageSpan(nullptr, size_).second);
+#else
+  detail::alignedFree(data_);
+#endif
+}
+
+}  // namespace safetensors
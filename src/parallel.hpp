@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace safetensors::detail {
+
+inline std::size_t defaultThreads() noexcept {
+  return std::max<std::size_t>(1, std::thread::hardware_concurrency());
+}
+
+// Calls `fn(i)` for every i in [0, n) on up to `threads` workers (0 picks the
+// hardware concurrency). Work is handed out dynamically, so uneven items
+// balance themselves. The first exception is rethrown after all workers have
+// stopped; remaining items are skipped once an exception is seen.
+template <typename F>
+void parallelFor(const std::size_t n, std::size_t threads, F&& fn) {
+  if (threads == 0) threads = defaultThreads();
+  threads = std::min(threads, n);
+  if (threads <= 1) {
+    for (std::size_t i = 0; i < n; ++i) fn(i);
+    return;
+  }
+
+  std::atomic<std::size_t> next{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto worker = [&] {
+    for (;;) {
+      if (failed.load(std::memory_order_relaxed)) return;
+      std::size_t i = next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= n) return;
+      try {
+        fn(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) error = std::current_exception();
+        failed.store(true, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  std::vector<std::thread> pool;
+  pool.reserve(threads - 1);
+  for (std::size_t t = 1; t < threads; ++t) pool.emplace_back(worker);
+  worker();
+  for (auto& thread : pool) thread.join();
+
+  if (error) std::rethrow_exception(error);
+}
+
+// Long-lived workers for loops that run often, e.g. on every read of a
+// Reader, where starting threads each time would cost more than the work.
+// `parallelFor` behaves as the free function; loops from several threads
+// share the workers, and each caller works on its own loop as well, so a
+// busy pool costs parallelism but never blocks. Workers start on demand, up
+// to `size`.
+class WorkerPool {
+ public:
+  explicit WorkerPool(const std::size_t size) : size_(size) {}
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_) thread.join();
+  }
+
+  template <typename F>
+  void parallelFor(const std::size_t n, std::size_t threads, F&& fn) {
+    if (threads == 0) threads = defaultThreads();
+    threads = std::min({threads, n, size_ + 1});
+    if (threads <= 1) {
+      for (std::size_t i = 0; i < n; ++i) fn(i);
+      return;
+    }
+
+    Job job;
+    job.fn = [&fn](std::size_t i) { fn(i); };
+    job.n = n;
+    job.wanted = threads - 1;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(&job);
+      while (idle_ < job.wanted && threads_.size() < size_) {
+        threads_.emplace_back([this] { loop(); });
+        ++idle_;
+      }
+    }
+    wake_.notify_all();
+    work(job);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto it = std::find(jobs_.begin(), jobs_.end(), &job);
+      if (it != jobs_.end()) jobs_.erase(it);
+      done_.wait(lock, [&] { return job.helpers == 0; });
+    }
+    if (job.error) std::rethrow_exception(job.error);
+  }
+
+ private:
+  struct Job {
+    std::function<void(std::size_t)> fn;
+    std::size_t n = 0;
+    std::atomic<std::size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    // Workers still to join, and those working on it; behind `mutex_`.
+    std::size_t wanted = 0;
+    std::size_t helpers = 0;
+  };
+
+  static void work(Job& job) noexcept {
+    for (;;) {
+      if (job.failed.load(std::memory_order_relaxed)) return;
+      std::size_t i = job.next.fetch_add(1, std::memory_order_relaxed);
+      if (i >= job.n) return;
+      try {
+        job.fn(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(job.error_mutex);
+        if (!job.error) job.error = std::current_exception();
+        job.failed.store(true, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      wake_.wait(lock, [&] { return stop_ || !jobs_.empty(); });
+      if (stop_) return;
+      Job* job = jobs_.front();
+      if (--job->wanted == 0) jobs_.pop_front();
+      ++job->helpers;
+      --idle_;
+      lock.unlock();
+      work(*job);
+      lock.lock();
+      ++idle_;
+      if (--job->helpers == 0) done_.notify_all();
+    }
+  }
+
+  const std::size_t size_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  // Loops still wanting workers, oldest first.
+  std::deque<Job*> jobs_;
+  std::vector<std::thread> threads_;
+  std::size_t idle_ = 0;
+  bool stop_ = false;
+};
+
+}  // namespace safetensors::detail
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/prefetch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "parallel.hpp"
+
+namespace safetensors {
+
+namespace {
+
+// Groups adjacent ranges into items of about `chunk` bytes and splits larger
+// ones at page boundaries, so that every worker gets a similar share.
+std::vector<ByteRange> workItems(std::span<const ByteRange> ranges,
+                                 std::size_t chunk,
+                                 const std::size_t page) {
+  chunk = std::max(page, chunk & ~(page - 1));
+  std::vector<ByteRange> items;
+  ByteRange current;
+  for (const ByteRange& range : ranges) {
+    if (range.last <= range.first) continue;
+    if (current.last != range.first ||
+        current.last - current.first >= chunk) {
+      if (current.last > current.first) items.push_back(current);
+      current = ByteRange{range.first, range.first};
+    }
+    std::size_t pos = range.first;
+    while (range.last - pos > chunk) {
+      std::size_t split = (pos + chunk) & ~(page - 1);
+      if (split <= pos) split = pos + chunk;
+      current.last = split;
+      items.push_back(current);
+      current = ByteRange{split, split};
+      pos = split;
+    }
+    current.last = range.last;
+  }
+  if (current.last > current.first) items.push_back(current);
+  return items;
+}
+
+void touch(const std::uint8_t* base, const ByteRange& range, std::size_t page) {
+  std::uint8_t acc = 0;
+  std::size_t pos = range.first;
+  for (; pos < range.last; pos = (pos & ~(page - 1)) + page) {
+    acc ^= *static_cast<volatile const std::uint8_t*>(base + pos);
+  }
+  acc ^= *static_cast<volatile const std::uint8_t*>(base + range.last - 1);
+  static_cast<void>(acc);
+}
+
+}  // namespace
+
+PrefetchStats prefetch_ranges(const Mmap& mmap,
+                              std::span<const ByteRange> ranges,
+                              const PrefetchOptions& options) {
+  auto start = std::chrono::steady_clock::now();
+  const std::size_t page = Mmap::pageSize();
+  std::vector<ByteRange> items = workItems(ranges, options.chunk_bytes, page);
+
+  PrefetchStats stats;
+  stats.ranges = ranges.size();
+  for (const ByteRange& item : items) stats.bytes += item.last - item.first;
+  stats.threads = std::min(
+      options.threads ? options.threads : detail::defaultThreads(),
+      std::max<std::size_t>(1, items.size()));
+
+  std::size_t done = 0;
+  std::mutex progress_mutex;
+  const std::uint8_t* base = mmap.data();
+
+  detail::parallelFor(items.size(), stats.threads, [&](std::size_t i) {
+    const ByteRange& item = items[i];
+    switch (options.mode) {
+      case Prefault::Touch:
+        touch(base, item, page);
+        break;
+      case Prefault::Advise:
+        mmap.willNeed(item.first, item.last);
+        break;
+      default:
+        mmap.prefetch(item.first, item.last);
+        break;
+    }
+    if (options.progress) {
+      std::lock_guard<std::mutex> lock(progress_mutex);
+      done += item.last - item.first;
+      options.progress(done, stats.bytes);
+    }
+  });
+
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return stats;
+}
+
+}  // namespace safetensors
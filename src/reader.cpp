@@ -0,0 +1,697 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/reader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "aligned.hpp"
+#include "fmt/format.h"
+#include "parallel.hpp"
+#include "safetensors/mmap.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define SAFETENSORS_IO_URING 1
+#endif
+#endif
+#endif
+
+namespace safetensors {
+
+namespace {
+
+std::size_t roundUp(const std::size_t n, const std::size_t align) {
+  return (n + align - 1) & ~(align - 1);
+}
+
+using detail::AlignedBuffer;
+using detail::allocateAligned;
+
+void checkBounds(std::span<const ReadRequest> requests,
+                 const std::size_t size) {
+  for (const ReadRequest& r : requests) {
+    if (r.offset > size || r.size > size - r.offset) {
+      throw std::runtime_error(
+          fmt::format("read of [{}, {}) past end of file ({} bytes)", r.offset,
+                      r.offset + r.size, size));
+    }
+  }
+}
+
+// Sorts requests by offset and merges those that are adjacent both in the
+// file and in memory, e.g. tensors packed back to back into one slab.
+std::vector<ReadRequest> coalesce(std::span<const ReadRequest> requests) {
+  std::vector<ReadRequest> sorted;
+  sorted.reserve(requests.size());
+  for (const ReadRequest& r : requests) {
+    if (r.size) sorted.push_back(r);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const ReadRequest& a, const ReadRequest& b) {
+              return a.offset < b.offset;
+            });
+  std::vector<ReadRequest> merged;
+  merged.reserve(sorted.size());
+  for (const ReadRequest& r : sorted) {
+    if (!merged.empty()) {
+      ReadRequest& last = merged.back();
+      if (last.offset + last.size == r.offset &&
+          static_cast<std::uint8_t*>(last.dst) + last.size == r.dst) {
+        last.size += r.size;
+        continue;
+      }
+    }
+    merged.push_back(r);
+  }
+  return merged;
+}
+
+// One read of [offset, offset + size). With `buf` set the bytes land in
+// caller memory directly; otherwise they go to a staging buffer, from which
+// `copy_size` bytes at `copy_from` are copied to `dst`.
+struct Op {
+  std::size_t offset = 0;
+  std::size_t size = 0;
+  std::uint8_t* buf = nullptr;
+  std::uint8_t* dst = nullptr;
+  std::size_t copy_from = 0;
+  std::size_t copy_size = 0;
+};
+
+// Splits requests into reads of at most `block` bytes straight into the
+// destination.
+std::vector<Op> planBuffered(std::span<const ReadRequest> requests,
+                             const std::size_t block) {
+  std::vector<Op> ops;
+  for (const ReadRequest& r : requests) {
+    auto* dst = static_cast<std::uint8_t*>(r.dst);
+    for (std::size_t pos = 0; pos < r.size; pos += block) {
+      ops.push_back(Op{r.offset + pos, std::min(block, r.size - pos),
+                       dst + pos});
+    }
+  }
+  return ops;
+}
+
+// O_DIRECT needs file offset, length and memory aligned to `align`. When
+// the destination is misaligned by the same amount as the offset, the
+// aligned middle of a request is read in place and only the head and tail
+// go through staging buffers; otherwise the whole request is staged.
+std::vector<Op> planDirect(std::span<const ReadRequest> requests,
+                           const std::size_t align, const std::size_t block) {
+  std::vector<Op> ops;
+  auto stage = [&](std::uint8_t* dst, std::size_t pos, const std::size_t end) {
+    while (pos < end) {
+      std::size_t first = pos & ~(align - 1);
+      std::size_t last = std::min(end, first + block);
+      ops.push_back(Op{first, roundUp(last, align) - first, nullptr, dst,
+                       pos - first, last - pos});
+      dst += last - pos;
+      pos = last;
+    }
+  };
+
+  for (const ReadRequest& r : requests) {
+    if (r.size == 0) continue;
+    auto* dst = static_cast<std::uint8_t*>(r.dst);
+    std::size_t pos = r.offset;
+    const std::size_t end = r.offset + r.size;
+    if ((reinterpret_cast<std::uintptr_t>(dst) - r.offset) % align == 0) {
+      const std::size_t body_first = roundUp(pos, align);
+      const std::size_t body_last = end & ~(align - 1);
+      if (body_first < body_last) {
+        stage(dst, pos, body_first);
+        for (std::size_t b = body_first; b < body_last; b += block) {
+          ops.push_back(Op{b, std::min(block, body_last - b),
+                           dst + (b - r.offset)});
+        }
+        pos = body_last;
+      }
+    }
+    stage(dst + (pos - r.offset), pos, end);
+  }
+  return ops;
+}
+
+// Delivers a completed op of `got` bytes; false if the file ended early.
+bool finish(const Op& op, const std::size_t got, const std::uint8_t* staging) {
+  if (op.buf) return got == op.size;
+  if (got < op.copy_from + op.copy_size) return false;
+  std::memcpy(op.dst, staging + op.copy_from, op.copy_size);
+  return true;
+}
+
+// Staging buffers shared by the pread workers, one per worker at most.
+class StagingPool {
+ public:
+  StagingPool(const std::size_t size, const std::size_t align)
+      : size_(size), align_(align) {}
+
+  AlignedBuffer acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        AlignedBuffer buf = std::move(free_.back());
+        free_.pop_back();
+        return buf;
+      }
+    }
+    return allocateAligned(size_, align_);
+  }
+
+  void release(AlignedBuffer buf) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(std::move(buf));
+  }
+
+ private:
+  std::size_t size_;
+  std::size_t align_;
+  std::mutex mutex_;
+  std::vector<AlignedBuffer> free_;
+};
+
+#if defined(SAFETENSORS_IO_URING)
+
+// Just enough of io_uring for batched reads, on raw system calls so that
+// liburing is not needed.
+class IoUring {
+ public:
+  // nullptr if io_uring is unavailable, e.g. an old kernel or a seccomp
+  // profile that blocks it.
+  static std::unique_ptr<IoUring> create(const unsigned entries) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd < 0) return nullptr;
+    std::unique_ptr<IoUring> ring(new IoUring(fd));
+    if (!ring->map(p)) return nullptr;
+    return ring;
+  }
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  ~IoUring() {
+    if (sqes_) munmap(sqes_, sqes_size_);
+    if (cq_ && cq_ != sq_) munmap(cq_, cq_size_);
+    if (sq_) munmap(sq_, sq_size_);
+    close(fd_);
+  }
+
+  unsigned capacity() const noexcept { return entries_; }
+
+  // Queues a readv of `iov`, which must stay alive until its completion.
+  bool push(const int fd, const iovec* iov, const std::uint64_t offset,
+            const std::uint64_t user_data) {
+    unsigned tail = *sq_tail_;
+    unsigned head = std::atomic_ref<unsigned>(*sq_head_).load(
+        std::memory_order_acquire);
+    if (tail - head >= entries_) return false;
+    unsigned idx = tail & *sq_mask_;
+    io_uring_sqe* sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(iov);
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    sq_array_[idx] = idx;
+    std::atomic_ref<unsigned>(*sq_tail_).store(tail + 1,
+                                               std::memory_order_release);
+    ++pending_;
+    return true;
+  }
+
+  // Submits what was pushed and waits for `min_complete` completions.
+  void enter(const unsigned min_complete) {
+    for (;;) {
+      long ret = syscall(__NR_io_uring_enter, fd_, pending_, min_complete,
+                         IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret >= 0) {
+        pending_ -= static_cast<unsigned>(ret);
+        return;
+      }
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        throw std::runtime_error(
+            fmt::format("io_uring_enter failed: {}", strerror(errno)));
+      }
+    }
+  }
+
+  // Waits, without submitting more, for the `in_flight` reads pushed so
+  // far to complete, dropping their results; those that the kernel never
+  // took are not waited for. False if the ring cannot be waited on.
+  bool drain(unsigned in_flight) noexcept {
+    const unsigned untaken =
+        *sq_tail_ -
+        std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire);
+    in_flight -= std::min(in_flight, untaken);
+    while (in_flight) {
+      long ret = syscall(__NR_io_uring_enter, fd_, 0, 1,
+                         IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        return false;
+      }
+      reap([&](std::uint64_t, int) { in_flight -= in_flight > 0; });
+    }
+    return true;
+  }
+
+  // Calls `fn(user_data, res)` for every completion. `fn` must not throw.
+  template <typename F>
+  void reap(F&& fn) {
+    unsigned head = *cq_head_;
+    unsigned tail = std::atomic_ref<unsigned>(*cq_tail_).load(
+        std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+      fn(cqe.user_data, cqe.res);
+    }
+    std::atomic_ref<unsigned>(*cq_head_).store(head,
+                                               std::memory_order_release);
+  }
+
+ private:
+  explicit IoUring(const int fd) : fd_(fd) {}
+
+  bool map(const io_uring_params& p) {
+    entries_ = p.sq_entries;
+    sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+
+    sq_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ == MAP_FAILED) {
+      sq_ = nullptr;
+      return false;
+    }
+    cq_ = single ? sq_
+                 : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    if (cq_ == MAP_FAILED) {
+      cq_ = nullptr;
+      return false;
+    }
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    auto* sq = static_cast<std::uint8_t*>(sq_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    auto* cq = static_cast<std::uint8_t*>(cq_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+  }
+
+  int fd_;
+  unsigned entries_ = 0;
+  unsigned pending_ = 0;
+  void* sq_ = nullptr;
+  void* cq_ = nullptr;
+  io_uring_sqe* sqes_ = nullptr;
+  std::size_t sq_size_ = 0;
+  std::size_t cq_size_ = 0;
+  std::size_t sqes_size_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+#endif  // SAFETENSORS_IO_URING
+
+// Positional reads on a file descriptor (a HANDLE on Windows).
+class DescriptorReader final : public Reader {
+ public:
+  DescriptorReader(const std::filesystem::path& path,
+                   const ReaderOptions& options)
+      : options_(options),
+        backend_(options.backend),
+        workers_(std::max<std::size_t>(1, options.queue_depth) - 1) {
+#if defined(_WIN32)
+    // FILE_FLAG_NO_BUFFERING is not wired up, Direct reads are buffered.
+    backend_ = IoBackend::Buffered;
+    handle_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                          nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                          nullptr);
+    if (handle_ == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error(fmt::format("failed to open {}: error {}",
+                                           path.string(), GetLastError()));
+    }
+#else
+    int flags = O_RDONLY | O_CLOEXEC;
+#if defined(O_DIRECT)
+    if (backend_ == IoBackend::Direct) {
+      fd_ = open(path.c_str(), flags | O_DIRECT);
+      // EINVAL: the file system does not do direct I/O (e.g. tmpfs).
+      if (fd_ < 0 && errno != EINVAL) {
+        throw std::runtime_error(fmt::format("failed to open {}: {}",
+                                             path.string(), strerror(errno)));
+      }
+    }
+#endif
+    if (fd_ < 0) {
+      backend_ = IoBackend::Buffered;
+      fd_ = open(path.c_str(), flags);
+    }
+    if (fd_ < 0) {
+      throw std::runtime_error(fmt::format("failed to open {}: {}",
+                                           path.string(), strerror(errno)));
+    }
+    if (backend_ == IoBackend::Direct) {
+      align_ = directAlignment();
+    }
+#endif
+    size_ = std::filesystem::file_size(path);
+    block_ = std::max(align_, options.block_size & ~(align_ - 1));
+    staging_ = std::make_unique<StagingPool>(block_, align_);
+  }
+
+  ~DescriptorReader() override {
+#if defined(_WIN32)
+    CloseHandle(handle_);
+#else
+    close(fd_);
+#endif
+  }
+
+  std::size_t size() const noexcept override { return size_; }
+  IoBackend backend() const noexcept override { return backend_; }
+
+  void read(std::span<const ReadRequest> requests) const override {
+    checkBounds(requests, size_);
+    std::vector<ReadRequest> merged = coalesce(requests);
+    std::vector<Op> ops = backend_ == IoBackend::Direct
+                              ? planDirect(merged, align_, block_)
+                              : planBuffered(merged, block_);
+    if (ops.empty()) return;
+    const std::size_t depth =
+        std::max<std::size_t>(1, std::min(options_.queue_depth, ops.size()));
+#if defined(SAFETENSORS_IO_URING)
+    if (depth > 1 && readRing(ops, depth)) return;
+#endif
+    readThreads(ops, depth);
+  }
+
+ private:
+#if !defined(_WIN32)
+  std::size_t directAlignment() const {
+#if defined(STATX_DIOALIGN)
+    struct statx stx;
+    if (statx(fd_, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align) {
+      return std::max<std::size_t>(stx.stx_dio_offset_align,
+                                   stx.stx_dio_mem_align);
+    }
+#endif
+    return 4096;
+  }
+#endif
+
+  // Reads until `size` bytes are in or the file ends.
+  std::size_t readAt(std::uint8_t* buf, const std::size_t size,
+                     const std::size_t offset) const {
+    std::size_t done = 0;
+    while (done < size && offset + done < size_) {
+#if defined(_WIN32)
+      OVERLAPPED ov = {};
+      std::uint64_t pos = offset + done;
+      ov.Offset = static_cast<DWORD>(pos);
+      ov.OffsetHigh = static_cast<DWORD>(pos >> 32);
+      DWORD chunk = static_cast<DWORD>(
+          std::min<std::size_t>(size - done, 1u << 30));
+      DWORD n = 0;
+      if (!ReadFile(handle_, buf + done, chunk, &n, &ov)) {
+        DWORD err = GetLastError();
+        if (err == ERROR_HANDLE_EOF) break;
+        throw std::runtime_error(fmt::format("ReadFile failed: error {}", err));
+      }
+#else
+      ssize_t n = pread(fd_, buf + done, size - done,
+                        static_cast<off_t>(offset + done));
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error(
+            fmt::format("pread failed: {}", strerror(errno)));
+      }
+#endif
+      if (n == 0) break;
+      done += static_cast<std::size_t>(n);
+    }
+    return done;
+  }
+
+  void readThreads(const std::vector<Op>& ops, const std::size_t threads) const {
+    workers_.parallelFor(ops.size(), threads, [&](std::size_t i) {
+      const Op& op = ops[i];
+      AlignedBuffer buf;
+      if (!op.buf) buf = staging_->acquire();
+      std::size_t got = readAt(op.buf ? op.buf : buf.get(), op.size, op.offset);
+      if (!finish(op, got, buf.get())) {
+        throw std::runtime_error("unexpectedly reached end of file");
+      }
+      if (buf) staging_->release(std::move(buf));
+    });
+  }
+
+#if defined(SAFETENSORS_IO_URING)
+  // A ring of `queue_depth` entries from the idle ones, created if there
+  // are none; nullptr if io_uring is unavailable.
+  std::unique_ptr<IoUring> acquireRing() const {
+    {
+      std::lock_guard<std::mutex> lock(rings_mutex_);
+      if (!rings_.empty()) {
+        std::unique_ptr<IoUring> ring = std::move(rings_.back());
+        rings_.pop_back();
+        return ring;
+      }
+    }
+    if (no_ring_.load(std::memory_order_relaxed)) return nullptr;
+    std::unique_ptr<IoUring> ring = IoUring::create(static_cast<unsigned>(
+        std::min<std::size_t>(options_.queue_depth, 4096)));
+    if (!ring) no_ring_.store(true, std::memory_order_relaxed);
+    return ring;
+  }
+
+  void releaseRing(std::unique_ptr<IoUring> ring) const {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    rings_.push_back(std::move(ring));
+  }
+
+  // False if io_uring is unavailable; the caller then uses threads.
+  bool readRing(const std::vector<Op>& ops, const std::size_t depth) const {
+    std::unique_ptr<IoUring> ring = acquireRing();
+    if (!ring) return false;
+
+    struct Slot {
+      std::size_t op = 0;
+      std::size_t done = 0;
+      iovec iov{};
+      AlignedBuffer staging;
+    };
+    std::vector<Slot> slots(std::min<std::size_t>(depth, ring->capacity()));
+    std::vector<std::size_t> free_slots;
+    for (std::size_t s = slots.size(); s-- > 0;) free_slots.push_back(s);
+
+    auto submit = [&](const std::size_t s) {
+      Slot& slot = slots[s];
+      const Op& op = ops[slot.op];
+      std::uint8_t* buf = op.buf ? op.buf : slot.staging.get();
+      slot.iov.iov_base = buf + slot.done;
+      slot.iov.iov_len = op.size - slot.done;
+      // Never more slots in flight than ring entries, so this cannot fail.
+      ring->push(fd_, &slot.iov, op.offset + slot.done, s);
+    };
+
+    std::size_t next = 0;
+    std::size_t in_flight = 0;
+    // The first failure: an errno, or the file ending early. Nothing below
+    // allocates once reads are in flight, other than staging buffers.
+    int error = 0;
+    bool truncated = false;
+    auto failed = [&] { return error != 0 || truncated; };
+    try {
+      while ((!failed() && next < ops.size()) || in_flight) {
+        while (!failed() && next < ops.size() && !free_slots.empty()) {
+          std::size_t s = free_slots.back();
+          free_slots.pop_back();
+          Slot& slot = slots[s];
+          slot.op = next++;
+          slot.done = 0;
+          if (!ops[slot.op].buf && !slot.staging) {
+            slot.staging = staging_->acquire();
+          }
+          submit(s);
+          ++in_flight;
+        }
+        // Reads in flight point at caller memory, so they have to be
+        // drained even after an error.
+        ring->enter(in_flight ? 1 : 0);
+        ring->reap([&](std::uint64_t s, int res) {
+          Slot& slot = slots[s];
+          const Op& op = ops[slot.op];
+          if (res == -EINTR || res == -EAGAIN) {
+            submit(s);
+            return;
+          }
+          if (res < 0) {
+            if (!failed()) error = -res;
+          } else {
+            slot.done += static_cast<std::size_t>(res);
+            if (res > 0 && slot.done < op.size &&
+                op.offset + slot.done < size_) {
+              submit(s);
+              return;
+            }
+            if (!finish(op, slot.done, slot.staging.get()) && !failed()) {
+              truncated = true;
+            }
+          }
+          --in_flight;
+          free_slots.push_back(s);
+        });
+      }
+    } catch (...) {
+      // Reads in flight write into caller memory and the staging buffers,
+      // so none of them may be freed before the kernel is done. If the
+      // ring cannot even be waited on, it is leaked along with the
+      // buffers rather than have them reused under a pending read.
+      if (!ring->drain(static_cast<unsigned>(in_flight))) {
+        static_cast<void>(ring.release());
+        for (Slot& slot : slots) static_cast<void>(slot.staging.release());
+      }
+      throw;
+    }
+    // Drained, so the next read can use it. A ring that failed is dropped
+    // instead, see above.
+    releaseRing(std::move(ring));
+    for (Slot& slot : slots) {
+      if (slot.staging) staging_->release(std::move(slot.staging));
+    }
+    if (error) {
+      throw std::runtime_error(
+          fmt::format("io_uring read failed: {}", strerror(error)));
+    }
+    if (truncated) {
+      throw std::runtime_error(
+          "io_uring read failed: unexpectedly reached end of file");
+    }
+    return true;
+  }
+#endif
+
+  ReaderOptions options_;
+  IoBackend backend_;
+#if defined(_WIN32)
+  HANDLE handle_ = INVALID_HANDLE_VALUE;
+#else
+  int fd_ = -1;
+#endif
+  std::size_t size_ = 0;
+  std::size_t align_ = 1;
+  std::size_t block_ = 0;
+  // Kept across reads: staging buffers, pread workers, and idle rings,
+  // each used by one read at a time.
+  std::unique_ptr<StagingPool> staging_;
+  mutable detail::WorkerPool workers_;
+#if defined(SAFETENSORS_IO_URING)
+  mutable std::mutex rings_mutex_;
+  mutable std::vector<std::unique_ptr<IoUring>> rings_;
+  mutable std::atomic<bool> no_ring_{false};
+#endif
+};
+
+// memcpy out of a private read-only mapping.
+class MmapReader final : public Reader {
+ public:
+  MmapReader(const std::filesystem::path& path, const ReaderOptions& options)
+      : options_(options), file_(path), mmap_(&file_, 0) {}
+
+  std::size_t size() const noexcept override { return mmap_.size(); }
+  IoBackend backend() const noexcept override { return IoBackend::Mmap; }
+
+  void read(std::span<const ReadRequest> requests) const override {
+    read_mapped(mmap_, requests, options_);
+  }
+
+ private:
+  ReaderOptions options_;
+  File file_;
+  Mmap mmap_;
+};
+
+}  // namespace
+
+std::unique_ptr<Reader> open_reader(const std::filesystem::path& path,
+                                    const ReaderOptions& options) {
+  if (options.backend == IoBackend::Mmap) {
+    return std::make_unique<MmapReader>(path, options);
+  }
+  if (options.backend == IoBackend::Remote) {
+    throw std::invalid_argument(fmt::format(
+        "{} is a local path, remote objects open with open_http_reader",
+        path.string()));
+  }
+  return std::make_unique<DescriptorReader>(path, options);
+}
+
+void read_mapped(const Mmap& mmap, std::span<const ReadRequest> requests,
+                 const ReaderOptions& options) {
+  checkBounds(requests, mmap.size());
+  std::vector<Op> ops = planBuffered(
+      coalesce(requests), std::max<std::size_t>(1, options.block_size));
+  // Faults on the mapping, not memory bandwidth, bound a cold copy, so
+  // several threads help even on one socket.
+  const std::uint8_t* base = mmap.data();
+  detail::parallelFor(
+      ops.size(), std::min(options.queue_depth, detail::defaultThreads()),
+      [&](std::size_t i) {
+        std::memcpy(ops[i].buf, base + ops[i].offset, ops[i].size);
+      });
+}
+
+}  // namespace safetensors
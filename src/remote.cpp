@@ -0,0 +1,641 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/remote.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "aligned.hpp"
+#include "fmt/format.h"
+#include "parallel.hpp"
+#include "safetensors/header.hpp"
+
+#if !defined(_WIN32)
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace safetensors {
+
+namespace {
+
+// One fetch of [offset, offset + size), scattered to the requests it
+// covers. Straight into the destination when `direct`, otherwise through a
+// staging buffer.
+struct Range {
+  std::size_t offset = 0;
+  std::size_t size = 0;
+  bool direct = true;
+  std::vector<ReadRequest> parts;
+};
+
+// Splits requests into pieces of at most `block` bytes, then merges
+// neighbours closer than `gap` while a range stays within `block`.
+std::vector<Range> planRanges(std::vector<ReadRequest> pieces,
+                              const std::size_t block, const std::size_t gap) {
+  std::vector<ReadRequest> split;
+  split.reserve(pieces.size());
+  for (const ReadRequest& r : pieces) {
+    auto* dst = static_cast<std::uint8_t*>(r.dst);
+    for (std::size_t pos = 0; pos < r.size; pos += block) {
+      split.push_back(ReadRequest{r.offset + pos,
+                                  std::min(block, r.size - pos), dst + pos});
+    }
+  }
+  std::sort(split.begin(), split.end(),
+            [](const ReadRequest& a, const ReadRequest& b) {
+              return a.offset < b.offset;
+            });
+
+  std::vector<Range> ranges;
+  for (const ReadRequest& r : split) {
+    if (!ranges.empty()) {
+      Range& last = ranges.back();
+      const std::size_t end = last.offset + last.size;
+      const std::size_t merged = std::max(end, r.offset + r.size);
+      if (r.offset <= end + gap && merged - last.offset <= block) {
+        // Still one run of memory if it continues the previous part.
+        const ReadRequest& prev = last.parts.back();
+        last.direct = last.direct && r.offset == end &&
+                      static_cast<std::uint8_t*>(prev.dst) + prev.size ==
+                          r.dst;
+        last.size = merged - last.offset;
+        last.parts.push_back(r);
+        continue;
+      }
+    }
+    ranges.push_back(Range{r.offset, r.size, true, {r}});
+  }
+  return ranges;
+}
+
+// Waits between attempts at a range double from this, up to 3.2 s.
+constexpr std::chrono::milliseconds kFirstBackoff{50};
+constexpr std::size_t kMaxBackoffDoublings = 6;
+
+class RangeReader final : public Reader {
+ public:
+  RangeReader(const std::size_t size, RangeFetch fetch,
+              const RemoteOptions& options, std::vector<std::byte> prefix)
+      : size_(size),
+        fetch_(std::move(fetch)),
+        options_(options),
+        prefix_(std::move(prefix)) {
+    if (!fetch_) {
+      throw std::invalid_argument(fmt::format(
+          "{}:{} open_remote_reader needs a fetch function", __FILE__,
+          __LINE__));
+    }
+    prefix_.resize(std::min(prefix_.size(), size_));
+  }
+
+  std::size_t size() const noexcept override { return size_; }
+  IoBackend backend() const noexcept override { return IoBackend::Remote; }
+
+  void read(std::span<const ReadRequest> requests) const override {
+    std::vector<ReadRequest> pending;
+    pending.reserve(requests.size());
+    for (ReadRequest r : requests) {
+      if (r.offset > size_ || r.size > size_ - r.offset) {
+        throw std::runtime_error(fmt::format(
+            "{}:{} read of [{}, {}) past end of object ({} bytes)", __FILE__,
+            __LINE__, r.offset, r.offset + r.size, size_));
+      }
+      if (r.offset < prefix_.size()) {
+        const std::size_t n = std::min(r.size, prefix_.size() - r.offset);
+        std::memcpy(r.dst, prefix_.data() + r.offset, n);
+        r.offset += n;
+        r.size -= n;
+        r.dst = static_cast<std::uint8_t*>(r.dst) + n;
+      }
+      if (r.size) pending.push_back(r);
+    }
+    if (pending.empty()) return;
+
+    const std::size_t block = std::max<std::size_t>(1, options_.block_size);
+    std::vector<Range> ranges =
+        planRanges(std::move(pending), block, options_.merge_gap);
+    detail::parallelFor(
+        ranges.size(), std::max<std::size_t>(1, options_.connections),
+        [&](std::size_t i) { fetchRange(ranges[i]); });
+  }
+
+ private:
+  void fetchRange(const Range& range) const {
+    if (range.direct) {
+      fetchRetrying(range.offset, range.size, range.parts.front().dst);
+      return;
+    }
+    detail::AlignedBuffer staging = detail::allocateAligned(range.size, 64);
+    fetchRetrying(range.offset, range.size, staging.get());
+    for (const ReadRequest& part : range.parts) {
+      std::memcpy(part.dst, staging.get() + (part.offset - range.offset),
+                  part.size);
+    }
+  }
+
+  void fetchRetrying(const std::size_t offset, const std::size_t size,
+                     void* dst) const {
+    for (std::size_t attempt = 0;; ++attempt) {
+      try {
+        fetch_(offset, size, dst);
+        return;
+      } catch (const std::runtime_error&) {
+        if (attempt >= options_.retries) throw;
+      }
+      std::this_thread::sleep_for(
+          kFirstBackoff *
+          (std::int64_t{1} << std::min(attempt, kMaxBackoffDoublings)));
+    }
+  }
+
+  std::size_t size_;
+  RangeFetch fetch_;
+  RemoteOptions options_;
+  std::vector<std::byte> prefix_;
+};
+
+#if !defined(_WIN32)
+
+#if defined(MSG_NOSIGNAL)
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+constexpr std::size_t kUnknown = static_cast<std::size_t>(-1);
+
+struct Url {
+  std::string host;
+  std::string port = "80";
+  std::string target = "/";
+};
+
+Url parseUrl(std::string_view url) {
+  constexpr std::string_view kScheme = "http://";
+  if (!url.starts_with(kScheme)) {
+    throw std::invalid_argument(fmt::format(
+        "{}:{} unsupported URL '{}': only http:// is built in, use "
+        "open_remote_reader with a fetch function for other schemes",
+        __FILE__, __LINE__, url));
+  }
+  url.remove_prefix(kScheme.size());
+  Url out;
+  const std::size_t slash = url.find('/');
+  std::string_view authority = url.substr(0, slash);
+  if (slash != std::string_view::npos) out.target = url.substr(slash);
+  // [v6 address]:port
+  std::size_t colon = authority.rfind(':');
+  if (authority.starts_with('[')) {
+    const std::size_t close = authority.find(']');
+    if (close == std::string_view::npos) {
+      throw std::invalid_argument(fmt::format("{}:{} malformed URL '{}'",
+                                              __FILE__, __LINE__, url));
+    }
+    out.host = authority.substr(1, close - 1);
+    if (colon != std::string_view::npos && colon > close) {
+      out.port = authority.substr(colon + 1);
+    }
+  } else if (colon != std::string_view::npos) {
+    out.host = authority.substr(0, colon);
+    out.port = authority.substr(colon + 1);
+  } else {
+    out.host = authority;
+  }
+  if (out.host.empty()) {
+    throw std::invalid_argument(
+        fmt::format("{}:{} malformed URL '{}'", __FILE__, __LINE__, url));
+  }
+  return out;
+}
+
+// The Host header: the port only if not the default, v6 addresses in
+// brackets as in the URL.
+std::string hostHeader(const Url& url) {
+  std::string host = url.host.find(':') == std::string::npos
+                         ? url.host
+                         : fmt::format("[{}]", url.host);
+  if (url.port != "80") host += ":" + url.port;
+  return host;
+}
+
+std::string lower(std::string_view s) {
+  std::string out(s);
+  for (char& c : out) {
+    if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+  }
+  return out;
+}
+
+bool parseSize(std::string_view s, std::size_t* value) {
+  while (!s.empty() && s.front() == ' ') s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\r')) {
+    s.remove_suffix(1);
+  }
+  auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), *value);
+  return ec == std::errc() && end == s.data() + s.size();
+}
+
+// The parts of a response that the client acts on.
+struct Response {
+  int status = 0;
+  std::size_t content_length = 0;
+  bool has_length = false;
+  // "bytes first-last/total"; total stays kUnknown for "*".
+  std::size_t range_first = 0;
+  std::size_t range_last = 0;
+  std::size_t total = kUnknown;
+  bool has_range = false;
+  bool chunked = false;
+  bool close = false;
+};
+
+// HTTP/1.1 ranged GETs over a pool of keep-alive connections.
+class HttpClient {
+ public:
+  HttpClient(Url url, const RemoteOptions& options)
+      : url_(std::move(url)),
+        timeout_ms_(options.timeout_ms),
+        headers_(options.headers) {}
+
+  HttpClient(const HttpClient&) = delete;
+  HttpClient& operator=(const HttpClient&) = delete;
+
+  ~HttpClient() {
+    for (int fd : idle_) ::close(fd);
+  }
+
+  // Fetches [offset, offset + size) into `dst`. Returns the bytes written,
+  // fewer than `size` only when the object ends first, and stores the
+  // object size in `total` if the server reported it.
+  std::size_t get(const std::size_t offset, const std::size_t size,
+                  void* dst, std::size_t* total = nullptr) {
+    // A pooled connection may have been closed by the server meanwhile;
+    // one retry on a fresh connection covers that.
+    for (int attempt = 0;; ++attempt) {
+      bool reused = false;
+      int fd = acquire(&reused);
+      try {
+        std::size_t got = exchange(fd, offset, size, dst, total);
+        return got;
+      } catch (const StaleConnection&) {
+        ::close(fd);
+        if (!reused || attempt > 0) {
+          throw std::runtime_error(fmt::format(
+              "{}:{} connection to {}:{} closed without a response",
+              __FILE__, __LINE__, url_.host, url_.port));
+        }
+      } catch (...) {
+        ::close(fd);
+        throw;
+      }
+    }
+  }
+
+ private:
+  struct StaleConnection {};
+
+  int acquire(bool* reused) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!idle_.empty()) {
+        int fd = idle_.back();
+        idle_.pop_back();
+        *reused = true;
+        return fd;
+      }
+    }
+    *reused = false;
+    return connectTo();
+  }
+
+  void recycle(const int fd) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(fd);
+  }
+
+  int connectTo() const {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    int err = getaddrinfo(url_.host.c_str(), url_.port.c_str(), &hints, &found);
+    if (err) {
+      throw std::runtime_error(fmt::format("{}:{} failed to resolve {}: {}",
+                                           __FILE__, __LINE__, url_.host,
+                                           gai_strerror(err)));
+    }
+    int fd = -1;
+    int last_errno = 0;
+    for (addrinfo* a = found; a; a = a->ai_next) {
+      fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+      if (fd < 0) {
+        last_errno = errno;
+        continue;
+      }
+      configure(fd);
+      if (connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+      last_errno = errno;
+      ::close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(found);
+    if (fd < 0) {
+      throw std::runtime_error(fmt::format(
+          "{}:{} failed to connect to {}:{}: {}", __FILE__, __LINE__,
+          url_.host, url_.port, strerror(last_errno)));
+    }
+    return fd;
+  }
+
+  void configure(const int fd) const {
+    timeval tv{};
+    tv.tv_sec = static_cast<time_t>(timeout_ms_ / 1000);
+    tv.tv_usec = static_cast<suseconds_t>(timeout_ms_ % 1000 * 1000);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#if defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  }
+
+  // Sends one request and reads its response. Throws StaleConnection if
+  // the connection fails before any byte of the response arrived.
+  std::size_t exchange(const int fd, const std::size_t offset,
+                       const std::size_t size, void* dst,
+                       std::size_t* total) {
+    std::string request = fmt::format(
+        "GET {} HTTP/1.1\r\nHost: {}\r\nRange: bytes={}-{}\r\n"
+        "Accept-Encoding: identity\r\n",
+        url_.target, hostHeader(url_), offset, offset + size - 1);
+    for (const std::string& h : headers_) request += h + "\r\n";
+    request += "\r\n";
+    for (std::size_t sent = 0; sent < request.size();) {
+      ssize_t n = send(fd, request.data() + sent, request.size() - sent,
+                       kSendFlags);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) throw StaleConnection{};
+      sent += static_cast<std::size_t>(n);
+    }
+
+    // Head first; whatever arrives past it is the start of the body.
+    std::string head;
+    std::size_t end = std::string::npos;
+    char buf[16 << 10];
+    while (end == std::string::npos) {
+      ssize_t n = recv(fd, buf, sizeof(buf), 0);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        if (head.empty()) throw StaleConnection{};
+        throw std::runtime_error(fmt::format(
+            "{}:{} incomplete response from {}: {}", __FILE__, __LINE__,
+            url_.host, n < 0 ? strerror(errno) : "connection closed"));
+      }
+      head.append(buf, static_cast<std::size_t>(n));
+      end = head.find("\r\n\r\n");
+      if (end == std::string::npos && head.size() > (64 << 10)) {
+        throw std::runtime_error(fmt::format(
+            "{}:{} HTTP response head is too large", __FILE__, __LINE__));
+      }
+    }
+    const Response response = parseHead(std::string_view(head).substr(0, end));
+    std::string_view early = std::string_view(head).substr(end + 4);
+
+    if (response.chunked) {
+      throw std::runtime_error(
+          fmt::format("{}:{} {} answered a range request with a chunked body",
+                      __FILE__, __LINE__, url_.host));
+    }
+    std::size_t body = 0;
+    bool whole = false;
+    if (response.status == 206 && response.has_range) {
+      if (response.range_first != offset ||
+          response.range_last < response.range_first ||
+          response.range_last - offset >= size) {
+        throw std::runtime_error(fmt::format(
+            "{}:{} {} returned bytes {}-{} for a request of {}-{}", __FILE__,
+            __LINE__, url_.host, response.range_first, response.range_last,
+            offset, offset + size - 1));
+      }
+      body = response.range_last - response.range_first + 1;
+      if (total) *total = response.total;
+    } else if (response.status == 200 && response.has_length &&
+               offset == 0) {
+      // Ranges ignored: the whole object comes back, of which only the
+      // requested bytes are read before dropping the connection.
+      whole = true;
+      body = std::min(size, response.content_length);
+      if (total) *total = response.content_length;
+    } else if (response.status == 200 || response.status == 206) {
+      throw std::runtime_error(
+          fmt::format("{}:{} {} does not support range requests", __FILE__,
+                      __LINE__, url_.host));
+    } else {
+      throw std::runtime_error(fmt::format("{}:{} GET {} from {}: HTTP {}",
+                                           __FILE__, __LINE__, url_.target,
+                                           url_.host, response.status));
+    }
+
+    auto* out = static_cast<std::uint8_t*>(dst);
+    const std::size_t first = std::min(early.size(), body);
+    std::memcpy(out, early.data(), first);
+    for (std::size_t done = first; done < body;) {
+      ssize_t n = recv(fd, out + done, body - done, 0);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        throw std::runtime_error(
+            fmt::format("{}:{} body from {} ended after {} of {} bytes",
+                        __FILE__, __LINE__, url_.host, done, body));
+      }
+      done += static_cast<std::size_t>(n);
+    }
+    if (whole || response.close || early.size() > body) {
+      ::close(fd);
+    } else {
+      recycle(fd);
+    }
+    return body;
+  }
+
+  static Response parseHead(std::string_view head) {
+    Response r;
+    std::size_t eol = head.find("\r\n");
+    std::string_view status = head.substr(0, eol);
+    // "HTTP/1.1 206 Partial Content"
+    const std::size_t sp = status.find(' ');
+    if (!status.starts_with("HTTP/") || sp == std::string_view::npos ||
+        std::from_chars(status.data() + sp + 1,
+                        status.data() + status.size(), r.status)
+                .ec != std::errc()) {
+      throw std::runtime_error(fmt::format("{}:{} malformed HTTP status line",
+                                           __FILE__, __LINE__));
+    }
+    r.close = status.starts_with("HTTP/1.0");
+    while (eol != std::string_view::npos) {
+      head.remove_prefix(eol + 2);
+      eol = head.find("\r\n");
+      std::string_view line = head.substr(0, eol);
+      const std::size_t colon = line.find(':');
+      if (colon == std::string_view::npos) continue;
+      const std::string name = lower(line.substr(0, colon));
+      std::string_view value = line.substr(colon + 1);
+      while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+      if (name == "content-length") {
+        r.has_length = parseSize(value, &r.content_length);
+      } else if (name == "content-range" && value.starts_with("bytes ")) {
+        value.remove_prefix(6);
+        const std::size_t dash = value.find('-');
+        const std::size_t slash = value.find('/');
+        if (dash == std::string_view::npos || slash == std::string_view::npos ||
+            dash > slash) {
+          continue;
+        }
+        r.has_range =
+            parseSize(value.substr(0, dash), &r.range_first) &&
+            parseSize(value.substr(dash + 1, slash - dash - 1), &r.range_last);
+        std::size_t total = 0;
+        if (parseSize(value.substr(slash + 1), &total)) r.total = total;
+      } else if (name == "transfer-encoding") {
+        r.chunked = lower(value).find("chunked") != std::string::npos;
+      } else if (name == "connection") {
+        const std::string v = lower(value);
+        if (v.find("close") != std::string::npos) r.close = true;
+        if (v.find("keep-alive") != std::string::npos) r.close = false;
+      }
+    }
+    return r;
+  }
+
+  Url url_;
+  std::size_t timeout_ms_;
+  std::vector<std::string> headers_;
+  std::mutex mutex_;
+  std::vector<int> idle_;
+};
+
+#endif
+
+}  // namespace
+
+std::unique_ptr<Reader> open_remote_reader(const std::size_t size,
+                                           RangeFetch fetch,
+                                           const RemoteOptions& options,
+                                           std::vector<std::byte> prefix) {
+  return std::make_unique<RangeReader>(size, std::move(fetch), options,
+                                       std::move(prefix));
+}
+
+std::unique_ptr<Reader> open_http_reader(std::string_view url,
+                                         const RemoteOptions& options) {
+#if defined(_WIN32)
+  (void)options;
+  throw std::runtime_error(fmt::format(
+      "{}:{} {}: the HTTP client needs POSIX sockets, use open_remote_reader",
+      __FILE__, __LINE__, url));
+#else
+  auto client = std::make_shared<HttpClient>(parseUrl(url), options);
+  std::vector<std::byte> prefix(std::max(options.prefix, N_LEN));
+  std::size_t total = kUnknown;
+  prefix.resize(client->get(0, prefix.size(), prefix.data(), &total));
+  if (total == kUnknown) {
+    throw std::runtime_error(fmt::format(
+        "{}:{} {} did not report the object size", __FILE__, __LINE__, url));
+  }
+  return open_remote_reader(
+      total,
+      [client, target = std::string(url)](std::size_t offset, std::size_t size,
+                                          void* dst) {
+        if (client->get(offset, size, dst) != size) {
+          throw std::runtime_error(fmt::format("{}:{} {} ended before byte {}",
+                                               __FILE__, __LINE__, target,
+                                               offset + size));
+        }
+      },
+      options, std::move(prefix));
+#endif
+}
+
+RemoteOpen::RemoteOpen(std::unique_ptr<Reader> reader,
+                       const InspectOptions& options)
+    : reader_(std::move(reader)) {
+  if (!reader_) {
+    throw std::invalid_argument(
+        fmt::format("{}:{} RemoteOpen needs a reader", __FILE__, __LINE__));
+  }
+  index_ = inspect(*reader_, options);
+}
+
+std::span<const std::string_view> RemoteOpen::keys() const noexcept {
+  return index_.names();
+}
+
+std::optional<RemoteOpen::TensorInfo> RemoteOpen::find_tensor(
+    std::string_view key) const noexcept {
+  const std::size_t i = index_.find(key);
+  if (i == TensorIndex::npos) return std::nullopt;
+  const TensorIndex::Entry& e = index_.entry(i);
+  return TensorInfo{index_.shape(i), e.dtype,
+                    index_.data_offset() + static_cast<std::size_t>(e.begin),
+                    static_cast<std::size_t>(e.end - e.begin)};
+}
+
+RemoteOpen::TensorInfo RemoteOpen::get_tensor(std::string_view key) const {
+  std::optional<TensorInfo> info = find_tensor(key);
+  if (!info) {
+    throw std::runtime_error(
+        fmt::format("{}:{} key '{}' not found", __FILE__, __LINE__, key));
+  }
+  return *info;
+}
+
+void RemoteOpen::read_into(std::string_view key,
+                           std::span<std::byte> dst) const {
+  const TensorRead read{key, dst};
+  read_into({&read, 1});
+}
+
+void RemoteOpen::read_into(std::span<const TensorRead> reads) const {
+  std::vector<ReadRequest> requests;
+  requests.reserve(reads.size());
+  for (const TensorRead& r : reads) {
+    const TensorInfo info = get_tensor(r.key);
+    if (r.dst.size() < info.data_len) {
+      throw std::runtime_error(
+          fmt::format("{}:{} buffer for '{}' is too small: {} < {}", __FILE__,
+                      __LINE__, r.key, r.dst.size(), info.data_len));
+    }
+    requests.push_back(ReadRequest{info.offset, info.data_len, r.dst.data()});
+  }
+  reader_->read(requests);
+}
+
+std::span<const RemoteOpen::MetadataPair> RemoteOpen::get_metadata()
+    const noexcept {
+  return index_.metadata();
+}
+
+std::optional<std::string_view> RemoteOpen::get_metadata(
+    std::string_view key) const {
+  return index_.metadata(key);
+}
+
+}  // namespace safetensors
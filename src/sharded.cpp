@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/sharded.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "fmt/format.h"
+#include "json.hpp"
+#include "parallel.hpp"
+
+namespace safetensors {
+
+namespace {
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace
+
+struct ShardedSafeOpen::impl {
+  struct Shard {
+    std::filesystem::path path;
+    std::once_flag once;
+    std::unique_ptr<SafeOpen> file;
+    std::atomic<bool> opened{false};
+    double open_seconds = 0.0;
+    double prefetch_seconds = 0.0;
+  };
+
+  struct Key {
+    std::string_view name;
+    std::uint32_t shard;
+  };
+
+  impl(const std::filesystem::path& index_path, const ShardedOptions& opts)
+      : options(opts) {
+    options.open.prefetch = 0;
+
+    File file(index_path);
+    std::string text(file.size(), '\0');
+    file.readRaw(text.data(), text.size());
+
+    try {
+      parse(text, index_path.parent_path());
+    } catch (const std::exception& e) {
+      throw std::runtime_error(
+          fmt::format("failed to parse {}: {}", index_path.string(), e.what()));
+    }
+  }
+
+  void parse(std::string_view text, const std::filesystem::path& dir) {
+    struct PendingKey {
+      std::size_t offset;
+      std::size_t size;
+      std::uint32_t shard;
+    };
+    struct PendingPair {
+      std::size_t key_offset;
+      std::size_t key_size;
+      std::size_t value_offset;
+      std::size_t value_size;
+    };
+    std::vector<PendingKey> pending_keys;
+    std::vector<PendingPair> pending_metadata;
+    std::unordered_map<std::string, std::uint32_t> shard_ids;
+
+    detail::JsonReader reader(text);
+    std::string scratch;
+    std::string value_scratch;
+    bool has_weight_map = false;
+
+    reader.readObject(&scratch, [&](std::string_view field) {
+      if (field == "weight_map") {
+        has_weight_map = true;
+        reader.readObject(&scratch, [&](std::string_view name) {
+          PendingKey key{strings.size(), name.size(), 0};
+          strings.append(name);
+          std::string filename(reader.readString(&value_scratch));
+          auto [it, inserted] = shard_ids.emplace(
+              filename, static_cast<std::uint32_t>(shards.size()));
+          if (inserted) {
+            auto shard = std::make_unique<Shard>();
+            shard->path = dir / filename;
+            shards.push_back(std::move(shard));
+          }
+          key.shard = it->second;
+          pending_keys.push_back(key);
+        });
+      } else if (field == "metadata") {
+        if (reader.readNull()) return;
+        reader.readObject(&scratch, [&](std::string_view key) {
+          PendingPair pair{strings.size(), key.size(), 0, 0};
+          strings.append(key);
+          std::string_view value = reader.peek() == '"'
+                                       ? reader.readString(&value_scratch)
+                                       : reader.readRawValue();
+          pair.value_offset = strings.size();
+          pair.value_size = value.size();
+          strings.append(value);
+          pending_metadata.push_back(pair);
+        });
+      } else {
+        reader.skipValue();
+      }
+    });
+    if (!reader.atEnd()) reader.fail("trailing characters");
+    if (!has_weight_map) reader.fail("missing field `weight_map`");
+
+    // `strings` no longer grows, views into it are stable from here on.
+    keys.reserve(pending_keys.size());
+    lookup.reserve(pending_keys.size());
+    for (const auto& key : pending_keys) {
+      std::string_view name(strings.data() + key.offset, key.size);
+      keys.push_back(name);
+      lookup.push_back(Key{name, key.shard});
+    }
+    std::sort(lookup.begin(), lookup.end(),
+              [](const Key& a, const Key& b) { return a.name < b.name; });
+    for (std::size_t i = 1; i < lookup.size(); ++i) {
+      if (lookup[i - 1].name == lookup[i].name) {
+        reader.fail(fmt::format("duplicate tensor `{}`", lookup[i].name));
+      }
+    }
+
+    metadata.reserve(pending_metadata.size());
+    for (const auto& pair : pending_metadata) {
+      metadata.emplace_back(
+          std::string_view(strings.data() + pair.key_offset, pair.key_size),
+          std::string_view(strings.data() + pair.value_offset,
+                           pair.value_size));
+    }
+    std::stable_sort(metadata.begin(), metadata.end(),
+                     [](const MetadataPair& a, const MetadataPair& b) {
+                       return a.first < b.first;
+                     });
+  }
+
+  const Key* findKey(std::string_view name) const noexcept {
+    auto it = std::lower_bound(
+        lookup.begin(), lookup.end(), name,
+        [](const Key& key, std::string_view n) { return key.name < n; });
+    if (it == lookup.end() || it->name != name) return nullptr;
+    return &*it;
+  }
+
+  const SafeOpen& open(const std::size_t i) const {
+    Shard& shard = *shards[i];
+    std::call_once(shard.once, [&] {
+      auto start = std::chrono::steady_clock::now();
+      shard.file = std::make_unique<SafeOpen>(shard.path.string(), options.open);
+      shard.open_seconds = secondsSince(start);
+      if (options.prefetch) {
+        start = std::chrono::steady_clock::now();
+        PrefetchOptions prefetch;
+        prefetch.threads = options.prefetch_threads;
+        shard.file->prefetch(prefetch);
+        shard.prefetch_seconds = secondsSince(start);
+      }
+      shard.opened.store(true, std::memory_order_release);
+    });
+    return *shard.file;
+  }
+
+  void openAll() const {
+    detail::parallelFor(shards.size(), options.threads,
+                        [this](std::size_t i) { open(i); });
+  }
+
+  // nullptr for keys not in the weight map and for tensors released from
+  // their shard with Release::Unmap.
+  const TensorView* find(std::string_view name) const {
+    const Key* key = findKey(name);
+    if (!key) return nullptr;
+    const SafeOpen& shard = open(key->shard);
+    const TensorView* view = shard.find_tensor(name);
+    if (!view && !shard.is_unmapped(name)) {
+      throw std::runtime_error(fmt::format(
+          "{}:{} index maps '{}' to {} but the shard does not contain it",
+          __FILE__, __LINE__, name, shards[key->shard]->path.string()));
+    }
+    return view;
+  }
+
+  ShardedOptions options;
+  std::string strings;
+  std::vector<std::string_view> keys;
+  std::vector<Key> lookup;
+  std::vector<MetadataPair> metadata;
+  std::vector<std::unique_ptr<Shard>> shards;
+};
+
+ShardedSafeOpen::ShardedSafeOpen(const std::filesystem::path& index_path,
+                                 const ShardedOptions& options)
+    : pimpl(std::make_unique<impl>(index_path, options)) {
+  if (!options.lazy) {
+    pimpl->openAll();
+  }
+}
+
+ShardedSafeOpen::ShardedSafeOpen(ShardedSafeOpen&&) noexcept = default;
+ShardedSafeOpen& ShardedSafeOpen::operator=(ShardedSafeOpen&&) noexcept =
+    default;
+ShardedSafeOpen::~ShardedSafeOpen() = default;
+
+std::span<const std::string_view> ShardedSafeOpen::keys() const noexcept {
+  return pimpl->keys;
+}
+
+const ShardedSafeOpen::TensorView* ShardedSafeOpen::find_tensor(
+    std::string_view key) const {
+  return pimpl->find(key);
+}
+
+std::optional<ShardedSafeOpen::TensorView> ShardedSafeOpen::try_get_tensor(
+    std::string_view key) const {
+  const TensorView* view = pimpl->find(key);
+  if (!view) return std::nullopt;
+  return *view;
+}
+
+const ShardedSafeOpen::TensorView& ShardedSafeOpen::get_tensor(
+    std::string_view key) const {
+  const TensorView* view = pimpl->find(key);
+  if (!view) {
+    throw std::runtime_error(fmt::format(
+        "{}:{} key '{}' {}", __FILE__, __LINE__, key,
+        pimpl->findKey(key) ? "was unmapped" : "not found"));
+  }
+  return *view;
+}
+
+std::size_t ShardedSafeOpen::release(std::string_view key, Release mode) {
+  const impl::Key* k = pimpl->findKey(key);
+  if (!k) {
+    throw std::runtime_error(
+        fmt::format("{}:{} key '{}' not found", __FILE__, __LINE__, key));
+  }
+  pimpl->open(k->shard);
+  return pimpl->shards[k->shard]->file->release(key, mode);
+}
+
+std::span<const ShardedSafeOpen::MetadataPair> ShardedSafeOpen::get_metadata()
+    const noexcept {
+  return pimpl->metadata;
+}
+
+std::size_t ShardedSafeOpen::num_shards() const noexcept {
+  return pimpl->shards.size();
+}
+
+std::size_t ShardedSafeOpen::shard_of(std::string_view key) const noexcept {
+  const impl::Key* k = pimpl->findKey(key);
+  return k ? k->shard : pimpl->shards.size();
+}
+
+const SafeOpen& ShardedSafeOpen::shard(const std::size_t i) const {
+  if (i >= pimpl->shards.size()) {
+    throw std::out_of_range(fmt::format("{}:{} shard {} out of range ({})",
+                                        __FILE__, __LINE__, i,
+                                        pimpl->shards.size()));
+  }
+  return pimpl->open(i);
+}
+
+void ShardedSafeOpen::open_all() const { pimpl->openAll(); }
+
+std::vector<ShardTiming> ShardedSafeOpen::timings() const {
+  std::vector<ShardTiming> out;
+  out.reserve(pimpl->shards.size());
+  for (const auto& shard : pimpl->shards) {
+    ShardTiming timing;
+    timing.filename = shard->path.filename().string();
+    if (shard->opened.load(std::memory_order_acquire)) {
+      timing.opened = true;
+      timing.open_seconds = shard->open_seconds;
+      timing.prefetch_seconds = shard->prefetch_seconds;
+    }
+    out.push_back(std::move(timing));
+  }
+  return out;
+}
+
+}  // namespace safetensors
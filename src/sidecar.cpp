@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/sidecar.hpp"
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include "fmt/format.h"
+#include "identity.hpp"
+#include "safetensors/mmap.hpp"
+
+namespace safetensors {
+
+namespace {
+
+// "STSIDE" followed by the layout version; bump it whenever
+// TensorIndex's arena or this header changes.
+constexpr std::uint64_t kMagic = 0x0001454449535453ULL;
+// The arena starts here, keeping it 8-byte aligned in the mapping.
+constexpr std::size_t kBlobOffset = 64;
+
+struct SidecarHeader {
+  std::uint64_t magic;
+  // sizeof(std::size_t) of the writer; shapes are stored as size_t.
+  std::uint64_t word_size;
+  std::uint64_t file_size;
+  std::int64_t mtime_ns;
+  std::uint64_t blob_size;
+  std::uint64_t checksum;
+};
+static_assert(sizeof(SidecarHeader) <= kBlobOffset);
+
+// Word-at-a-time multiply-xorshift hash; catches truncation and bit rot,
+// not tampering.
+std::uint64_t checksum(std::span<const std::byte> bytes) noexcept {
+  std::uint64_t h = 0x9E3779B97F4A7C15ULL ^ bytes.size();
+  std::size_t i = 0;
+  for (; i + 8 <= bytes.size(); i += 8) {
+    std::uint64_t word;
+    std::memcpy(&word, bytes.data() + i, sizeof(word));
+    h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 29;
+  }
+  for (; i < bytes.size(); ++i) {
+    h = (h ^ static_cast<std::uint8_t>(bytes[i])) * 0x100000001B3ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// The sidecar file and its mapping, owned by the index attached to it.
+struct Mapped {
+  explicit Mapped(const std::filesystem::path& path)
+      : file(path), mmap(&file, 0) {}
+  File file;
+  Mmap mmap;
+};
+
+}  // namespace
+
+std::filesystem::path sidecar_path(const std::filesystem::path& checkpoint,
+                                   const std::filesystem::path& dir) {
+  if (dir.empty()) {
+    std::filesystem::path path = checkpoint;
+    path += ".stidx";
+    return path;
+  }
+  std::error_code ec;
+  std::filesystem::path canonical =
+      std::filesystem::weakly_canonical(checkpoint, ec);
+  if (ec) canonical = std::filesystem::absolute(checkpoint);
+  const std::size_t h = std::hash<std::string>{}(canonical.string());
+  return dir / fmt::format("{}-{:016x}.stidx",
+                           checkpoint.filename().string(), h);
+}
+
+bool write_sidecar(const std::filesystem::path& checkpoint,
+                   const TensorIndex& index,
+                   const std::filesystem::path& sidecar) {
+  std::filesystem::path tmp = sidecar;
+  tmp += fmt::format(".{:08x}.tmp", std::random_device{}());
+  try {
+    const detail::FileIdentity id = detail::fileIdentity(checkpoint);
+    std::span<const std::byte> blob = index.blob();
+    SidecarHeader header{kMagic,        sizeof(std::size_t), id.size,
+                         id.mtime_ns,   blob.size(),         checksum(blob)};
+    std::byte prefix[kBlobOffset] = {};
+    std::memcpy(prefix, &header, sizeof(header));
+    {
+      File file(tmp, "wb");
+      file.writeRaw(prefix, sizeof(prefix));
+      file.writeRaw(blob.data(), blob.size());
+    }
+    std::filesystem::rename(tmp, sidecar);
+    return true;
+  } catch (const std::exception&) {
+    std::error_code ec;
+    std::filesystem::remove(tmp, ec);
+    return false;
+  }
+}
+
+std::optional<TensorIndex> load_sidecar(
+    const std::filesystem::path& checkpoint,
+    const std::filesystem::path& sidecar) {
+  try {
+    std::error_code ec;
+    if (!std::filesystem::exists(sidecar, ec)) return std::nullopt;
+    const detail::FileIdentity id = detail::fileIdentity(checkpoint);
+    auto mapped = std::make_shared<Mapped>(sidecar);
+    const Mmap& m = mapped->mmap;
+    if (m.size() < kBlobOffset) return std::nullopt;
+    SidecarHeader header;
+    std::memcpy(&header, m.data(), sizeof(header));
+    if (header.magic != kMagic || header.word_size != sizeof(std::size_t) ||
+        header.file_size != id.size || header.mtime_ns != id.mtime_ns ||
+        header.blob_size > m.size() - kBlobOffset) {
+      return std::nullopt;
+    }
+    std::span<const std::byte> blob(
+        reinterpret_cast<const std::byte*>(m.data()) + kBlobOffset,
+        static_cast<std::size_t>(header.blob_size));
+    if (checksum(blob) != header.checksum) return std::nullopt;
+    TensorIndex index = TensorIndex::from_blob(std::move(mapped), blob);
+    if (index.data_offset() + index.buffer_size() != id.size) {
+      return std::nullopt;
+    }
+    return index;
+  } catch (const std::exception&) {
+    return std::nullopt;
+  }
+}
+
+TensorIndex parse_header_cached(const std::filesystem::path& checkpoint,
+                                const std::uint8_t* data,
+                                const std::size_t size,
+                                const HeaderParser parser,
+                                const std::filesystem::path& sidecar) {
+  if (!sidecar.empty()) {
+    if (std::optional<TensorIndex> index = load_sidecar(checkpoint, sidecar)) {
+      if (index->data_offset() + index->buffer_size() == size) {
+        return std::move(*index);
+      }
+    }
+  }
+  TensorIndex index = parse_header(data, size, parser);
+  if (!sidecar.empty()) write_sidecar(checkpoint, index, sidecar);
+  return index;
+}
+
+}  // namespace safetensors
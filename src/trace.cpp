@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/trace.hpp"
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+namespace safetensors {
+
+FaultCounts fault_counts() noexcept {
+  FaultCounts counts;
+#if !defined(_WIN32)
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    counts.minor = static_cast<std::uint64_t>(usage.ru_minflt);
+    counts.major = static_cast<std::uint64_t>(usage.ru_majflt);
+  }
+#endif
+  return counts;
+}
+
+}  // namespace safetensors
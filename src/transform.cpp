@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/transform.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include "fmt/format.h"
+#include "json.hpp"
+#include "parallel.hpp"
+#include "safetensors/checksum.hpp"
+#include "safetensors/convert.hpp"
+
+namespace safetensors {
+
+namespace {
+
+struct Source {
+  std::string_view name;
+  const SafeOpen* file;
+  const SafeOpen::TensorView* view;
+};
+
+// One tensor of one output file.
+struct Output {
+  std::size_t source;
+  std::size_t rank;
+  std::string name;
+  Dtype dtype;
+  // The block of the source for this rank, and its logical shape.
+  std::vector<SafeOpen::SliceRange> ranges;
+  std::vector<std::size_t> shape;
+  std::size_t numel = 1;
+  std::size_t bytes = 0;
+  // Index into the writers.
+  std::size_t file = 0;
+  // Start of the block if it is contiguous, else nullptr and `gather`
+  // bytes to read with `read_slice`.
+  const std::byte* data = nullptr;
+  std::size_t gather = 0;
+};
+
+// Elements [first, first + count) of an output.
+struct Piece {
+  std::size_t output;
+  std::size_t first;
+  std::size_t count;
+};
+
+// Staging buffers, reused so that each worker touches its memory once.
+class BufferPool {
+ public:
+  std::vector<std::byte> take() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) return {};
+    std::vector<std::byte> buffer = std::move(free_.back());
+    free_.pop_back();
+    return buffer;
+  }
+
+  void give(std::vector<std::byte> buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(std::move(buffer));
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::vector<std::byte>> free_;
+};
+
+std::filesystem::path withSuffix(const std::filesystem::path& path,
+                                 std::string_view suffix) {
+  return path.parent_path() / fmt::format("{}{}{}", path.stem().string(),
+                                          suffix, path.extension().string());
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+void writeIndex(const std::filesystem::path& path,
+                const std::vector<Output>& outputs,
+                const std::vector<std::filesystem::path>& files,
+                const std::size_t rank, const std::size_t total) {
+  std::string text =
+      fmt::format("{{\"metadata\":{{\"total_size\":{}}},\"weight_map\":{{",
+                  total);
+  bool first = true;
+  for (const Output& o : outputs) {
+    if (o.rank != rank) continue;
+    if (!first) text.push_back(',');
+    first = false;
+    detail::appendJsonString(o.name, &text);
+    text.push_back(':');
+    detail::appendJsonString(files[o.file].filename().string(), &text);
+  }
+  text.append("}}\n");
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(text.data(), static_cast<std::streamsize>(text.size()));
+  if (!out.flush()) {
+    throw std::runtime_error(fmt::format("{}:{} cannot write {}", __FILE__,
+                                         __LINE__, path.string()));
+  }
+}
+
+TransformResult run(const std::vector<Source>& sources,
+                    std::span<const TensorIndex::MetadataPair> metadata,
+                    const std::function<void(std::string_view)>& release,
+                    const std::filesystem::path& path,
+                    const TransformOptions& options) {
+  const auto start = std::chrono::steady_clock::now();
+  if (options.ranks == 0) {
+    throw std::invalid_argument(
+        fmt::format("{}:{} ranks must be at least 1", __FILE__, __LINE__));
+  }
+
+  // Plan every output tensor, grouped by rank.
+  std::vector<Output> outputs;
+  std::vector<std::vector<Output>> by_rank(options.ranks);
+  for (std::size_t s = 0; s < sources.size(); ++s) {
+    const Source& source = sources[s];
+    if (source.name.starts_with(PADDING_PREFIX)) continue;
+    const SafeOpen::TensorView& view = *source.view;
+    std::optional<TensorPlan> plan =
+        options.plan ? options.plan(source.name, view)
+                     : TensorPlan{std::string(source.name), view.dtype};
+    if (!plan) continue;
+    if (!can_convert(view.dtype, plan->dtype)) {
+      throw std::invalid_argument(fmt::format(
+          "{}:{} cannot convert '{}' from {} to {}", __FILE__, __LINE__,
+          source.name, to_string(view.dtype), to_string(plan->dtype)));
+    }
+    std::vector<std::size_t> shape(view.shape.begin(), view.shape.end());
+    if (!shape.empty()) shape.back() = view.row_elements();
+    const std::size_t split =
+        options.ranks > 1 ? plan->split_dim : TensorPlan::npos;
+    if (split != TensorPlan::npos &&
+        (split >= shape.size() || shape[split] % options.ranks)) {
+      throw std::invalid_argument(fmt::format(
+          "{}:{} dimension {} of '{}' does not split into {} ranks",
+          __FILE__, __LINE__, split, source.name, options.ranks));
+    }
+    for (std::size_t k = 0; k < options.ranks; ++k) {
+      Output o;
+      o.source = s;
+      o.rank = k;
+      o.name = plan->name;
+      o.dtype = plan->dtype;
+      o.shape = shape;
+      if (split != TensorPlan::npos) {
+        const std::size_t n = shape[split] / options.ranks;
+        o.ranges.resize(split + 1);
+        o.ranges[split] = SafeOpen::SliceRange{k * n, (k + 1) * n};
+        o.shape[split] = n;
+      }
+      for (std::size_t d : o.shape) o.numel *= d;
+      o.bytes = (o.numel * bitsize(o.dtype) + 7) / 8;
+      by_rank[k].push_back(std::move(o));
+    }
+  }
+
+  // Cut each rank into shards and name the files.
+  TransformResult result;
+  std::vector<std::filesystem::path> index_paths(options.ranks);
+  std::vector<std::size_t> rank_bytes(options.ranks, 0);
+  for (std::size_t k = 0; k < options.ranks; ++k) {
+    const std::filesystem::path base =
+        options.ranks > 1 ? withSuffix(path, fmt::format("-rank{}", k)) : path;
+    std::vector<std::size_t> shard(by_rank[k].size());
+    std::size_t shards = 1;
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < by_rank[k].size(); ++i) {
+      const std::size_t n = by_rank[k][i].bytes;
+      if (options.max_shard_bytes && bytes &&
+          bytes + n > options.max_shard_bytes) {
+        ++shards;
+        bytes = 0;
+      }
+      shard[i] = shards - 1;
+      bytes += n;
+      rank_bytes[k] += n;
+    }
+    const std::size_t first = result.files.size();
+    for (std::size_t j = 0; j < shards; ++j) {
+      result.files.push_back(
+          shards == 1 ? base
+                      : withSuffix(base, fmt::format("-{:05}-of-{:05}", j + 1,
+                                                     shards)));
+    }
+    if (shards == 1) {
+      result.outputs.push_back(base);
+    } else {
+      index_paths[k] = base;
+      index_paths[k] += ".index.json";
+      result.outputs.push_back(index_paths[k]);
+    }
+    for (std::size_t i = 0; i < by_rank[k].size(); ++i) {
+      by_rank[k][i].file = first + shard[i];
+      outputs.push_back(std::move(by_rank[k][i]));
+    }
+  }
+
+  // Declare everything up front, which fixes every offset, so that pieces
+  // can be written in any order.
+  WriterOptions writer_options = options.writer;
+  writer_options.threads = 1;
+  std::vector<std::unique_ptr<SafeWriter>> writers;
+  for (const std::filesystem::path& file : result.files) {
+    writers.push_back(std::make_unique<SafeWriter>(file, writer_options));
+    if (options.copy_metadata) {
+      for (const auto& [key, value] : metadata) {
+        if (key != CHECKSUM_KEY) writers.back()->add_metadata(key, value);
+      }
+    }
+    for (const auto& [key, value] : options.metadata) {
+      writers.back()->add_metadata(key, value);
+    }
+  }
+  for (const Output& o : outputs) {
+    writers[o.file]->add_tensor(o.name, o.dtype, o.shape);
+  }
+  for (auto& writer : writers) writer->begin();
+
+  const std::size_t chunk = std::max<std::size_t>(1, options.chunk_bytes);
+  std::vector<Piece> pieces;
+  auto remaining =
+      std::make_unique<std::atomic<std::size_t>[]>(sources.size());
+  for (std::size_t i = 0; i < outputs.size(); ++i) {
+    Output& o = outputs[i];
+    const Source& source = sources[o.source];
+    const SafeOpen::SliceView box = source.file->slice(source.name, o.ranges);
+    if (o.numel == 0) continue;
+    if (!box.contiguous()) {
+      o.gather = box.data_len;
+      pieces.push_back(Piece{i, 0, o.numel});
+      remaining[o.source].fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    o.data = static_cast<const std::byte*>(box.data_ptr);
+    // Multiples of 32 elements start every piece on a byte, F4 and F6
+    // included, and on an MX block.
+    const std::size_t bits =
+        std::max(bitsize(source.view->dtype), bitsize(o.dtype));
+    const std::size_t step = std::max<std::size_t>(32, chunk * 8 / bits) &
+                             ~static_cast<std::size_t>(31);
+    for (std::size_t first = 0; first < o.numel; first += step) {
+      pieces.push_back(Piece{i, first, std::min(step, o.numel - first)});
+      remaining[o.source].fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  for (const Output& o : outputs) result.bytes += o.bytes;
+  result.tensors = outputs.size();
+
+  BufferPool pool;
+  std::mutex progress_mutex;
+  std::size_t done = 0;
+  detail::parallelFor(pieces.size(), options.threads, [&](std::size_t p) {
+    const Piece& piece = pieces[p];
+    const Output& o = outputs[piece.output];
+    const Source& source = sources[o.source];
+    const Dtype from = source.view->dtype;
+    std::vector<std::byte> gathered;
+    const std::byte* src = o.data;
+    if (o.gather) {
+      gathered = pool.take();
+      gathered.resize(o.gather);
+      source.file->read_slice(source.name, o.ranges, gathered);
+      src = gathered.data();
+    } else {
+      src += piece.first * bitsize(from) / 8;
+    }
+    const std::size_t offset = piece.first * bitsize(o.dtype) / 8;
+    const std::size_t bytes = (piece.count * bitsize(o.dtype) + 7) / 8;
+    if (from == o.dtype) {
+      writers[o.file]->write(o.name, offset, {src, bytes});
+    } else {
+      std::vector<std::byte> staging = pool.take();
+      staging.resize(bytes);
+      convert(src, from, staging.data(), o.dtype, piece.count);
+      writers[o.file]->write(o.name, offset, staging);
+      pool.give(std::move(staging));
+    }
+    if (o.gather) pool.give(std::move(gathered));
+    if (remaining[o.source].fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+        options.release_source) {
+      release(source.name);
+    }
+    if (options.progress) {
+      std::lock_guard<std::mutex> lock(progress_mutex);
+      done += bytes;
+      options.progress(done, result.bytes);
+    }
+  });
+
+  detail::parallelFor(writers.size(), options.threads,
+                      [&](std::size_t i) { writers[i]->close(); });
+  for (std::size_t k = 0; k < options.ranks; ++k) {
+    if (!index_paths[k].empty()) {
+      writeIndex(index_paths[k], outputs, result.files, k, rank_bytes[k]);
+    }
+  }
+  result.seconds = secondsSince(start);
+  return result;
+}
+
+}  // namespace
+
+TransformResult transform(SafeOpen& source, const std::filesystem::path& output,
+                          const TransformOptions& options) {
+  std::vector<Source> sources;
+  sources.reserve(source.keys().size());
+  for (std::size_t i = 0; i < source.keys().size(); ++i) {
+    sources.push_back(
+        Source{source.keys()[i], &source, &source.tensors()[i]});
+  }
+  return run(
+      sources, source.get_metadata(),
+      [&](std::string_view key) { source.release(key); }, output, options);
+}
+
+TransformResult transform(ShardedSafeOpen& source,
+                          const std::filesystem::path& output,
+                          const TransformOptions& options) {
+  std::vector<Source> sources;
+  sources.reserve(source.keys().size());
+  for (std::string_view key : source.keys()) {
+    sources.push_back(Source{key, &source.shard(source.shard_of(key)),
+                             &source.get_tensor(key)});
+  }
+  // The shards' own metadata, e.g. {"format": "pt"}; the index's describes
+  // the old layout.
+  std::span<const TensorIndex::MetadataPair> metadata;
+  if (!sources.empty()) metadata = sources.front().file->get_metadata();
+  return run(
+      sources, metadata,
+      [&](std::string_view key) { source.release(key); }, output, options);
+}
+
+}  // namespace safetensors
@@ -0,0 +1,470 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include "safetensors/writer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "fmt/format.h"
+#include "fmt/ranges.h"
+#include "json.hpp"
+#include "parallel.hpp"
+#include "safetensors/checksum.hpp"
+#include "safetensors/header.hpp"
+#include "safetensors/mmap.hpp"
+
+namespace safetensors {
+
+namespace {
+
+std::size_t alignUp(const std::size_t n, const std::size_t alignment) noexcept {
+  return alignment > 1 ? (n + alignment - 1) & ~(alignment - 1) : n;
+}
+
+// CRC32C of `n` zero bytes, for the fillers that are never written.
+std::uint32_t zerosCrc(std::size_t n) {
+  static const std::vector<std::byte> zeros(64 << 10);
+  std::uint32_t crc = 0;
+  for (; n; n -= std::min(n, zeros.size())) {
+    crc = crc32c(zeros.data(), std::min(n, zeros.size()), crc);
+  }
+  return crc;
+}
+
+void checkUtf8(std::string_view s) {
+  if (!detail::isValidUtf8(reinterpret_cast<const std::uint8_t*>(s.data()),
+                           s.size())) {
+    throw std::invalid_argument(
+        fmt::format("{}:{} string is not valid UTF-8", __FILE__, __LINE__));
+  }
+}
+
+}  // namespace
+
+struct SafeWriter::impl {
+  struct Tensor {
+    std::string name;
+    Dtype dtype;
+    std::vector<std::size_t> shape;
+    std::size_t size = 0;
+    std::size_t begin = 0;
+  };
+
+  // Checksum of bytes [offset, offset + size) of a tensor.
+  struct Piece {
+    std::size_t offset;
+    std::size_t size;
+    std::uint32_t crc;
+  };
+
+  impl(const std::filesystem::path& p, const WriterOptions& opts)
+      : path(p), options(opts) {
+    if (options.alignment & (options.alignment - 1)) {
+      throw std::invalid_argument(
+          fmt::format("{}:{} alignment {} is not a power of two", __FILE__,
+                      __LINE__, options.alignment));
+    }
+    target = path;
+    if (options.atomic) {
+      target += ".tmp";
+    }
+    file = std::make_unique<File>(target, "wb");
+  }
+
+  ~impl() {
+    if (closed) return;
+    file.reset();
+    if (options.atomic) {
+      std::error_code ec;
+      std::filesystem::remove(target, ec);
+    }
+  }
+
+  void addTensor(std::string_view name, const Dtype dtype,
+                 std::span<const std::size_t> shape) {
+    if (begun) {
+      throw std::logic_error(fmt::format(
+          "{}:{} add_tensor('{}') after begin()", __FILE__, __LINE__, name));
+    }
+    checkUtf8(name);
+    std::size_t numel = 1;
+    for (std::size_t d : shape) {
+      if (d && numel > SIZE_MAX / d) {
+        throw std::invalid_argument(fmt::format(
+            "{}:{} shape of '{}' overflows", __FILE__, __LINE__, name));
+      }
+      numel *= d;
+    }
+    std::size_t bits = bitsize(dtype);
+    if (numel > SIZE_MAX / bits || (numel * bits) % 8 != 0) {
+      throw std::invalid_argument(
+          fmt::format("{}:{} '{}' of {} elements of {} is not a whole "
+                      "number of bytes",
+                      __FILE__, __LINE__, name, numel, to_string(dtype)));
+    }
+    auto [it, inserted] = lookup.emplace(std::string(name), tensors.size());
+    if (!inserted) {
+      throw std::invalid_argument(
+          fmt::format("{}:{} duplicate tensor '{}'", __FILE__, __LINE__, name));
+    }
+    tensors.push_back(Tensor{std::string(name), dtype,
+                             std::vector<std::size_t>(shape.begin(),
+                                                      shape.end()),
+                             numel * bits / 8, 0});
+  }
+
+  void addMetadata(std::string_view key, std::string_view value) {
+    if (begun) {
+      throw std::logic_error(fmt::format(
+          "{}:{} add_metadata('{}') after begin()", __FILE__, __LINE__, key));
+    }
+    checkUtf8(key);
+    checkUtf8(value);
+    metadata[std::string(key)] = std::string(value);
+  }
+
+  // `checksums_at` receives the position of the CHECKSUM_KEY value.
+  std::string header(std::size_t* checksums_at) const {
+    std::string out = "{";
+    if (!metadata.empty()) {
+      out.append("\"__metadata__\":{");
+      bool first = true;
+      for (const auto& [key, value] : metadata) {
+        if (!first) out.push_back(',');
+        first = false;
+        detail::appendJsonString(key, &out);
+        out.push_back(':');
+        if (key == CHECKSUM_KEY) *checksums_at = out.size() + 1;
+        detail::appendJsonString(value, &out);
+      }
+      out.push_back('}');
+    }
+    for (const Tensor* p : layout) {
+      const Tensor& t = *p;
+      if (out.size() > 1) out.push_back(',');
+      detail::appendJsonString(t.name, &out);
+      fmt::format_to(std::back_inserter(out), ":{{\"dtype\":\"{}\",\"shape\":[{}"
+                     "],\"data_offsets\":[{},{}]}}",
+                     to_string(t.dtype), fmt::join(t.shape, ","), t.begin,
+                     t.begin + t.size);
+    }
+    out.push_back('}');
+    // Trailing spaces are valid JSON; with an alignment they also move the
+    // start of the data to an aligned offset.
+    std::size_t align = std::max(N_LEN, options.alignment);
+    out.append(alignUp(N_LEN + out.size(), align) - N_LEN - out.size(), ' ');
+    return out;
+  }
+
+  void begin() {
+    if (begun) return;
+    // Same order as `serialize()`: larger dtypes first keeps every tensor
+    // aligned to its element size.
+    order.resize(tensors.size());
+    for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) {
+      if (tensors[a].dtype != tensors[b].dtype) {
+        return tensors[a].dtype > tensors[b].dtype;
+      }
+      return tensors[a].name < tensors[b].name;
+    });
+    // The data buffer may not have holes, so gaps in front of aligned
+    // tensors, and up to the aligned end of the file, become U8 fillers.
+    std::size_t offset = 0;
+    std::size_t fillers = 0;
+    auto pad = [&](const std::size_t to) {
+      if (to == offset) return;
+      std::string name;
+      do {
+        name = fmt::format("{}{}__", PADDING_PREFIX, fillers++);
+      } while (lookup.count(name));
+      padding.push_back(
+          Tensor{std::move(name), Dtype::U8, {to - offset}, to - offset,
+                 offset});
+      offset = to;
+    };
+    padding.reserve(tensors.size() + 1);
+    for (std::size_t i : order) {
+      if (tensors[i].size > 0) pad(alignUp(offset, options.alignment));
+      tensors[i].begin = offset;
+      offset += tensors[i].size;
+    }
+    pad(alignUp(offset, options.alignment));
+    for (std::size_t i : order) layout.push_back(&tensors[i]);
+    for (const Tensor& p : padding) layout.push_back(&p);
+    std::stable_sort(layout.begin(), layout.end(),
+                     [](const Tensor* a, const Tensor* b) {
+                       return a->begin < b->begin;
+                     });
+
+    std::size_t checksums_at = 0;
+    if (options.checksums) {
+      std::size_t n = 0;
+      for (const Tensor* t : layout) n += t->size > 0;
+      metadata[std::string(CHECKSUM_KEY)] = std::string(8 * n, '0');
+      pieces.resize(tensors.size());
+    }
+    std::string text = header(&checksums_at);
+    if (text.size() > MAX_HEADER_SIZE) {
+      throw std::runtime_error(fmt::format("{}:{} header too large: {} > {}",
+                                           __FILE__, __LINE__, text.size(),
+                                           MAX_HEADER_SIZE));
+    }
+    std::uint8_t prefix[N_LEN];
+    std::uint64_t n = text.size();
+    for (std::size_t i = 0; i < N_LEN; ++i) {
+      prefix[i] = static_cast<std::uint8_t>(n >> (8 * i));
+    }
+    // Sizing the file first keeps concurrent writes past the end from
+    // serializing on the file size and lets the blocks be laid out at once.
+    file->reserve(N_LEN + text.size() + offset);
+    file->writeAt(prefix, N_LEN, 0);
+    file->writeAt(text.data(), text.size(), N_LEN);
+    data_offset = N_LEN + text.size();
+    checksum_offset = N_LEN + checksums_at;
+    covered.resize(tensors.size());
+    covered_bytes.assign(tensors.size(), 0);
+    begun = true;
+  }
+
+  void checkOpen(std::string_view name) const {
+    if (closed) {
+      throw std::logic_error(fmt::format("{}:{} write('{}') after close()",
+                                         __FILE__, __LINE__, name));
+    }
+  }
+
+  std::size_t indexOf(std::string_view name) const {
+    auto it = lookup.find(std::string(name));
+    if (it == lookup.end()) {
+      throw std::runtime_error(
+          fmt::format("{}:{} key '{}' not found", __FILE__, __LINE__, name));
+    }
+    return it->second;
+  }
+
+  // Writes a checked range of tensor `i`.
+  void writeRange(const std::size_t i, const std::size_t offset,
+                  std::span<const std::byte> data) {
+    if (data.empty()) return;
+    const Tensor& t = tensors[i];
+    const std::uint32_t crc =
+        options.checksums ? crc32c(data.data(), data.size()) : 0;
+    file->writeAt(data.data(), data.size(), data_offset + t.begin + offset);
+    std::size_t before;
+    std::size_t after;
+    {
+      std::lock_guard<std::mutex> lock(coverage_mutex);
+      before = covered_bytes[i];
+      if (!cover(i, offset, offset + data.size()) && options.checksums) {
+        // The bytes on disk may be either write's; none of the pieces'
+        // checksums can be trusted any more.
+        overlapped = true;
+        throw std::invalid_argument(fmt::format(
+            "{}:{} write of [{}, {}) overlaps bytes of '{}' already written, "
+            "cannot checksum it",
+            __FILE__, __LINE__, offset, offset + data.size(), t.name));
+      }
+      if (options.checksums) {
+        pieces[i].push_back(Piece{offset, data.size(), crc});
+      }
+      after = covered_bytes[i];
+    }
+    if (options.sync == Sync::PerTensor && before < t.size &&
+        after == t.size) {
+      file->sync();
+    }
+  }
+
+  // Adds [first, last) to the bytes of tensor `i` written so far, merging
+  // it with the intervals it touches. False if it overlaps one of them.
+  bool cover(const std::size_t i, const std::size_t first,
+             const std::size_t last) {
+    std::map<std::size_t, std::size_t>& intervals = covered[i];
+    std::size_t begin = first;
+    std::size_t end = last;
+    std::size_t overlap = 0;
+    auto it = intervals.upper_bound(first);
+    if (it != intervals.begin() && std::prev(it)->second >= first) --it;
+    // Every interval overlapping or adjacent to [first, last).
+    while (it != intervals.end() && it->first <= last) {
+      const std::size_t lo = std::max(first, it->first);
+      const std::size_t hi = std::min(last, it->second);
+      if (hi > lo) overlap += hi - lo;
+      begin = std::min(begin, it->first);
+      end = std::max(end, it->second);
+      it = intervals.erase(it);
+    }
+    intervals.emplace(begin, end);
+    covered_bytes[i] += last - first - overlap;
+    return overlap == 0;
+  }
+
+  void write(std::string_view name, const std::size_t offset,
+             std::span<const std::byte> data) {
+    checkOpen(name);
+    begin();
+    std::size_t i = indexOf(name);
+    const Tensor& t = tensors[i];
+    if (offset > t.size || data.size() > t.size - offset) {
+      throw std::out_of_range(fmt::format(
+          "{}:{} write of [{}, {}) outside '{}' ({} bytes)", __FILE__,
+          __LINE__, offset, offset + data.size(), name, t.size));
+    }
+    writeRange(i, offset, data);
+  }
+
+  void write(std::span<const TensorWrite> batch) {
+    struct Chunk {
+      std::size_t tensor;
+      std::size_t offset;
+      std::span<const std::byte> data;
+    };
+    std::vector<Chunk> chunks;
+    const std::size_t step = std::max<std::size_t>(1, options.chunk_bytes);
+    for (const TensorWrite& w : batch) {
+      checkOpen(w.key);
+      std::size_t i = indexOf(w.key);
+      if (w.data.size() != tensors[i].size) {
+        throw std::invalid_argument(fmt::format(
+            "{}:{} '{}' has {} bytes, expected {}", __FILE__, __LINE__, w.key,
+            w.data.size(), tensors[i].size));
+      }
+      for (std::size_t off = 0; off < w.data.size(); off += step) {
+        chunks.push_back(Chunk{
+            i, off, w.data.subspan(off, std::min(step, w.data.size() - off))});
+      }
+    }
+    begin();
+    detail::parallelFor(chunks.size(), options.threads, [&](std::size_t c) {
+      writeRange(chunks[c].tensor, chunks[c].offset, chunks[c].data);
+    });
+  }
+
+  // Combines the pieces of each tensor in offset order and overwrites the
+  // placeholder in the header.
+  void writeChecksums() {
+    std::string text;
+    for (const Tensor* p : layout) {
+      const Tensor& t = *p;
+      if (t.size == 0) continue;
+      std::uint32_t crc = 0;
+      auto it = lookup.find(t.name);
+      if (it == lookup.end()) {
+        crc = zerosCrc(t.size);  // a filler
+      } else {
+        std::vector<Piece>& list = pieces[it->second];
+        std::sort(list.begin(), list.end(),
+                  [](const Piece& a, const Piece& b) {
+                    return a.offset < b.offset;
+                  });
+        // Disjoint and complete, which write() and close() checked.
+        for (const Piece& piece : list) {
+          crc = crc32c_combine(crc, piece.crc, piece.size);
+        }
+      }
+      fmt::format_to(std::back_inserter(text), "{:08x}", crc);
+    }
+    file->writeAt(text.data(), text.size(), checksum_offset);
+  }
+
+  void close() {
+    if (closed) return;
+    begin();
+    if (overlapped) {
+      throw std::runtime_error(
+          fmt::format("{}:{} overlapping writes, the checksums are unknown",
+                      __FILE__, __LINE__));
+    }
+    for (std::size_t i : order) {
+      const Tensor& t = tensors[i];
+      std::size_t done = covered_bytes[i];
+      if (done < t.size) {
+        throw std::runtime_error(
+            fmt::format("{}:{} '{}' incomplete: {} of {} bytes written",
+                        __FILE__, __LINE__, t.name, done, t.size));
+      }
+    }
+    if (options.checksums) writeChecksums();
+    if (options.sync != Sync::None) file->sync();
+    file.reset();
+    if (options.atomic) {
+      std::filesystem::rename(target, path);
+    }
+    closed = true;
+  }
+
+  std::filesystem::path path;
+  std::filesystem::path target;
+  WriterOptions options;
+  std::unique_ptr<File> file;
+
+  std::vector<Tensor> tensors;
+  std::unordered_map<std::string, std::size_t> lookup;
+  std::map<std::string, std::string> metadata;
+
+  // Tensor indices in data order, fillers in front of aligned tensors,
+  // both merged in data order, and the file offset of the data.
+  std::vector<std::size_t> order;
+  std::vector<Tensor> padding;
+  std::vector<const Tensor*> layout;
+  std::size_t data_offset = 0;
+  // Checksum pieces per tensor and the file offset of their placeholder.
+  std::vector<std::vector<Piece>> pieces;
+  std::size_t checksum_offset = 0;
+  // Per tensor, the disjoint intervals written so far, begin to end, and
+  // their total; guarded by `coverage_mutex` like `pieces`.
+  std::vector<std::map<std::size_t, std::size_t>> covered;
+  std::vector<std::size_t> covered_bytes;
+  std::mutex coverage_mutex;
+  bool overlapped = false;
+  bool begun = false;
+  bool closed = false;
+};
+
+SafeWriter::SafeWriter(const std::filesystem::path& path,
+                       const WriterOptions& options)
+    : pimpl(std::make_unique<impl>(path, options)) {}
+
+SafeWriter::SafeWriter(SafeWriter&&) noexcept = default;
+SafeWriter& SafeWriter::operator=(SafeWriter&&) noexcept = default;
+SafeWriter::~SafeWriter() = default;
+
+void SafeWriter::add_tensor(std::string_view name, const Dtype dtype,
+                            std::span<const std::size_t> shape) {
+  pimpl->addTensor(name, dtype, shape);
+}
+
+void SafeWriter::add_metadata(std::string_view key, std::string_view value) {
+  pimpl->addMetadata(key, value);
+}
+
+void SafeWriter::begin() { pimpl->begin(); }
+
+void SafeWriter::write(std::string_view name, const std::size_t offset,
+                       std::span<const std::byte> data) {
+  pimpl->write(name, offset, data);
+}
+
+std::size_t SafeWriter::size_of(std::string_view name) const {
+  return pimpl->tensors[pimpl->indexOf(name)].size;
+}
+
+void SafeWriter::write(std::span<const TensorWrite> tensors) {
+  pimpl->write(tensors);
+}
+
+void SafeWriter::close() { pimpl->close(); }
+
+}  // namespace safetensors
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+// Just enough of a test harness to keep the tests free of dependencies:
+// every test file is a program of TEST cases that exits non-zero if a
+// CHECK failed or a case threw.
+
+namespace safetensors::test {
+
+struct Case {
+  const char* name;
+  void (*fn)();
+};
+
+inline std::vector<Case>& cases() {
+  static std::vector<Case> all;
+  return all;
+}
+
+inline int& failures() {
+  static int count = 0;
+  return count;
+}
+
+struct Register {
+  Register(const char* name, void (*fn)()) { cases().push_back({name, fn}); }
+};
+
+inline void fail(const char* file, const int line, const std::string& what) {
+  std::fprintf(stderr, "%s:%d: %s\n", file, line, what.c_str());
+  ++failures();
+}
+
+// Runs every case, or those named on the command line.
+inline int run(const int argc, char** argv) {
+  int failed_cases = 0;
+  for (const Case& c : cases()) {
+    if (argc > 1) {
+      bool wanted = false;
+      for (int i = 1; i < argc; ++i) wanted |= c.name == std::string(argv[i]);
+      if (!wanted) continue;
+    }
+    const int before = failures();
+    try {
+      c.fn();
+    } catch (const std::exception& e) {
+      fail(__FILE__, __LINE__, std::string("uncaught exception: ") + e.what());
+    }
+    const bool ok = failures() == before;
+    failed_cases += !ok;
+    std::printf("[%s] %s\n", ok ? "  OK  " : " FAIL ", c.name);
+  }
+  return failed_cases ? 1 : 0;
+}
+
+// A fresh directory under the system temporary one, removed with its
+// contents on destruction.
+class TempDir {
+ public:
+  explicit TempDir(const std::string& name) {
+    path_ = std::filesystem::temp_directory_path() /
+            (name + "-" + std::to_string(getpid()));
+    std::filesystem::remove_all(path_);
+    std::filesystem::create_directories(path_);
+  }
+
+  TempDir(const TempDir&) = delete;
+  TempDir& operator=(const TempDir&) = delete;
+
+  ~TempDir() {
+    std::error_code ec;
+    std::filesystem::remove_all(path_, ec);
+  }
+
+  std::filesystem::path operator/(const std::string& name) const {
+    return path_ / name;
+  }
+
+ private:
+  std::filesystem::path path_;
+};
+
+}  // namespace safetensors::test
+
+#define TEST(name)                                                  \
+  static void name();                                               \
+  static const ::safetensors::test::Register name##_registered(#name, \
+                                                                name); \
+  static void name()
+
+#define CHECK(cond)                                                 \
+  do {                                                              \
+    if (!(cond)) ::safetensors::test::fail(__FILE__, __LINE__, #cond); \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                  \
+  do {                                                                  \
+    if (!((a) == (b)))                                                  \
+      ::safetensors::test::fail(__FILE__, __LINE__, #a " == " #b);      \
+  } while (0)
+
+#define CHECK_THROWS(expr, type)                                        \
+  do {                                                                  \
+    bool thrown = false;                                                \
+    try {                                                               \
+      static_cast<void>(expr);                                          \
+    } catch (const type&) {                                             \
+      thrown = true;                                                    \
+    } catch (...) {                                                     \
+    }                                                                   \
+    if (!thrown)                                                        \
+      ::safetensors::test::fail(__FILE__, __LINE__,                     \
+                                #expr " does not throw " #type);        \
+  } while (0)
+
+#define TEST_MAIN() \
+  int main(int argc, char** argv) { return ::safetensors::test::run(argc, argv); }
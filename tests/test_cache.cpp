@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/cache.hpp"
+#include "safetensors/safetensors.hpp"
+#include "safetensors/writer.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace safetensors;
+
+namespace {
+
+void writeCheckpoint(const std::filesystem::path& path, const float value) {
+  const std::vector<float> data(1000, value);
+  SafeWriter writer(path);
+  writer.add_tensor("a", Dtype::F32, std::array<std::size_t, 1>{1000});
+  writer.add_tensor("b", Dtype::F32, std::array<std::size_t, 1>{1000});
+  writer.write("a", std::as_bytes(std::span(data)));
+  writer.write("b", std::as_bytes(std::span(data)));
+  writer.close();
+}
+
+OpenOptions cached(const CheckpointCache cache) {
+  OpenOptions options;
+  options.prefetch = 0;
+  options.cache = cache;
+  return options;
+}
+
+bool correct(const SafeOpen& f, const float value) {
+  const std::span<const float> b = f.get_tensor<float>("b");
+  return f.keys().size() == 2 && b.size() == 1000 && b[0] == value &&
+         b[999] == value;
+}
+
+// The bytes of the segment for `path`, or none if there is no segment.
+std::vector<std::byte> segment(const std::filesystem::path& path) {
+  const int fd = shm_open(shared_index_name(path).c_str(), O_RDONLY, 0);
+  if (fd < 0) return {};
+  struct stat st;
+  std::vector<std::byte> out;
+  if (fstat(fd, &st) == 0) {
+    out.resize(static_cast<std::size_t>(st.st_size));
+    out.resize(
+        static_cast<std::size_t>(pread(fd, out.data(), out.size(), 0)));
+  }
+  close(fd);
+  return out;
+}
+
+// Creates the segment for `path` as a publisher that died right after
+// creating it would have left it: zeros, last written `age_s` ago.
+void plantIncomplete(const std::filesystem::path& path, const int age_s) {
+  const int fd = shm_open(shared_index_name(path).c_str(),
+                          O_CREAT | O_EXCL | O_RDWR, 0600);
+  CHECK(fd >= 0);
+  if (fd < 0) return;
+  CHECK_EQ(ftruncate(fd, 4096), 0);
+  struct timespec times[2];
+  clock_gettime(CLOCK_REALTIME, &times[0]);
+  times[0].tv_sec -= age_s;
+  times[1] = times[0];
+  CHECK_EQ(futimens(fd, times), 0);
+  close(fd);
+}
+
+}  // namespace
+
+TEST(shares_one_checkpoint_in_process) {
+  test::TempDir dir("safetensors-cache");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 1.0f);
+  CHECK_EQ(cached_checkpoints(), 0u);
+  {
+    SafeOpen f(path, cached(CheckpointCache::Process));
+    SafeOpen g(path, cached(CheckpointCache::Process));
+    CHECK_EQ(cached_checkpoints(), 1u);
+    CHECK(correct(f, 1.0f) && correct(g, 1.0f));
+    CHECK(f.get_tensor("a").data_ptr == g.get_tensor("a").data_ptr);
+
+    // Concurrent first opens wait for one parse.
+    std::vector<std::shared_ptr<Checkpoint>> opened(8);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < opened.size(); ++i) {
+      threads.emplace_back([&, i] { opened[i] = open_checkpoint(path); });
+    }
+    for (std::thread& t : threads) t.join();
+    for (const auto& c : opened) CHECK(c == opened[0]);
+
+    // A rewritten file is a new entry; live users keep the old one.
+    writeCheckpoint(path, 2.0f);
+    SafeOpen h(path, cached(CheckpointCache::Process));
+    CHECK(correct(h, 2.0f));
+    CHECK(correct(f, 1.0f));
+  }
+  CHECK_EQ(cached_checkpoints(), 0u);
+}
+
+TEST(publishes_and_attaches_across_opens) {
+  test::TempDir dir("safetensors-cache");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 3.0f);
+  unlink_shared_index(path);
+  { SafeOpen f(path, cached(CheckpointCache::SharedMemory)); }
+  const std::vector<std::byte> published = segment(path);
+  CHECK(published.size() > 64);
+  {
+    // Attached, with no live instance left in this process.
+    SafeOpen f(path, cached(CheckpointCache::SharedMemory));
+    CHECK(correct(f, 3.0f));
+  }
+  CHECK(segment(path) == published);
+  CHECK(unlink_shared_index(path));
+  CHECK(!unlink_shared_index(path));
+}
+
+TEST(replaces_corrupt_segments) {
+  test::TempDir dir("safetensors-cache");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 4.0f);
+  unlink_shared_index(path);
+  { SafeOpen f(path, cached(CheckpointCache::SharedMemory)); }
+  const std::vector<std::byte> published = segment(path);
+  CHECK(!published.empty());
+
+  // Some byte of the blob, which the checksum covers.
+  const int fd = shm_open(shared_index_name(path).c_str(), O_RDWR, 0);
+  CHECK(fd >= 0);
+  const std::byte garbage{0x5a};
+  CHECK_EQ(pwrite(fd, &garbage, 1,
+                  static_cast<off_t>(published.size() - 8)),
+           1);
+  close(fd);
+  CHECK(segment(path) != published);
+  {
+    SafeOpen f(path, cached(CheckpointCache::SharedMemory));
+    CHECK(correct(f, 4.0f));
+  }
+  CHECK(segment(path) == published);
+  unlink_shared_index(path);
+}
+
+TEST(replaces_abandoned_segments) {
+  test::TempDir dir("safetensors-cache");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 5.0f);
+  unlink_shared_index(path);
+
+  // One being written is left alone, and the index stays private.
+  plantIncomplete(path, 0);
+  {
+    SafeOpen f(path, cached(CheckpointCache::SharedMemory));
+    CHECK(correct(f, 5.0f));
+  }
+  CHECK(segment(path) == std::vector<std::byte>(4096));
+
+  // One that has not been touched for a minute is republished.
+  unlink_shared_index(path);
+  plantIncomplete(path, 60);
+  {
+    SafeOpen f(path, cached(CheckpointCache::SharedMemory));
+    CHECK(correct(f, 5.0f));
+  }
+  {
+    SafeOpen f(path, cached(CheckpointCache::SharedMemory));
+    CHECK(correct(f, 5.0f));
+  }
+  const std::vector<std::byte> published = segment(path);
+  CHECK(!published.empty() && published != std::vector<std::byte>(4096));
+  unlink_shared_index(path);
+}
+
+TEST_MAIN()
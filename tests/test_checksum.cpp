@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/checksum.hpp"
+#include "safetensors/mmap.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+// Bit by bit, from the reflected Castagnoli polynomial.
+std::uint32_t reference(const std::uint8_t* data, const std::size_t size,
+                        std::uint32_t crc = 0) {
+  crc = ~crc;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc ^= data[i];
+    for (int k = 0; k < 8; ++k) crc = crc >> 1 ^ (0x82f63b78 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+std::vector<std::uint8_t> randomBytes(const std::size_t n,
+                                      const unsigned seed) {
+  std::mt19937 rng(seed);
+  std::vector<std::uint8_t> out(n);
+  for (std::uint8_t& b : out) b = static_cast<std::uint8_t>(rng());
+  return out;
+}
+
+}  // namespace
+
+TEST(matches_known_values) {
+  const std::string_view digits = "123456789";
+  CHECK_EQ(crc32c(digits.data(), digits.size()), 0xe3069283u);
+  CHECK_EQ(crc32c(nullptr, 0), 0u);
+  // RFC 3720, B.4.
+  std::vector<std::uint8_t> bytes(32, 0);
+  CHECK_EQ(crc32c(bytes.data(), bytes.size()), 0x8a9136aau);
+  std::fill(bytes.begin(), bytes.end(), 0xff);
+  CHECK_EQ(crc32c(bytes.data(), bytes.size()), 0x62a8ab43u);
+  for (std::size_t i = 0; i < bytes.size(); ++i) {
+    bytes[i] = static_cast<std::uint8_t>(i);
+  }
+  CHECK_EQ(crc32c(bytes.data(), bytes.size()), 0x46dd794eu);
+  const std::string_view isa = crc32c_isa();
+  CHECK(isa == "sse4.2" || isa == "armv8" || isa == "scalar");
+}
+
+TEST(matches_reference_at_any_length_and_alignment) {
+  // Long enough for the three-stream loops, at every start within a word.
+  const std::vector<std::uint8_t> data = randomBytes(70000, 1);
+  std::mt19937 rng(2);
+  for (int round = 0; round < 300; ++round) {
+    const std::size_t offset = rng() % 64;
+    const std::size_t size = round < 100
+                                 ? static_cast<std::size_t>(round)
+                                 : rng() % (data.size() - offset);
+    const std::uint32_t expected = reference(data.data() + offset, size);
+    if (crc32c(data.data() + offset, size) != expected) {
+      CHECK_EQ(crc32c(data.data() + offset, size), expected);
+      break;
+    }
+  }
+  // Continuing from a previous checksum.
+  const std::uint32_t head = crc32c(data.data(), 1000);
+  CHECK_EQ(crc32c(data.data() + 1000, 5000, head),
+           reference(data.data(), 6000));
+}
+
+TEST(combines_pieces) {
+  const std::vector<std::uint8_t> data = randomBytes(1 << 20, 3);
+  const std::uint32_t whole = crc32c(data.data(), data.size());
+  std::mt19937 rng(4);
+  for (int round = 0; round < 50; ++round) {
+    const std::size_t split = round == 0 ? 0 : rng() % data.size();
+    const std::uint32_t a = crc32c(data.data(), split);
+    const std::uint32_t b =
+        crc32c(data.data() + split, data.size() - split);
+    CHECK_EQ(crc32c_combine(a, b, data.size() - split), whole);
+  }
+  CHECK_EQ(crc32c_combine(whole, 0, 0), whole);
+
+  // Many small pieces, folded left to right.
+  std::uint32_t crc = 0;
+  for (std::size_t pos = 0; pos < data.size(); pos += 4099) {
+    const std::size_t n = std::min<std::size_t>(4099, data.size() - pos);
+    crc = crc32c_combine(crc, crc32c(data.data() + pos, n), n);
+  }
+  CHECK_EQ(crc, whole);
+}
+
+TEST(checksums_mapped_ranges_in_parallel) {
+  test::TempDir dir("safetensors-checksum");
+  const auto path = dir / "data.bin";
+  const std::vector<std::uint8_t> data = randomBytes(3 << 20, 5);
+  std::ofstream(path, std::ios::binary)
+      .write(reinterpret_cast<const char*>(data.data()),
+             static_cast<std::streamsize>(data.size()));
+
+  File file(path);
+  Mmap mmap(&file, 0);
+  // Ranges split over several work items, one empty and one tiny.
+  const std::vector<ByteRange> ranges = {
+      {0, 1 << 20}, {1 << 20, 1 << 20}, {(1 << 20) + 1, (1 << 20) + 3},
+      {100, data.size()}};
+  PrefetchOptions options;
+  options.threads = 4;
+  options.chunk_bytes = 64 << 10;
+  PrefetchStats stats;
+  const std::vector<std::uint32_t> crcs =
+      crc32c_ranges(mmap, ranges, options, &stats);
+  CHECK_EQ(crcs.size(), ranges.size());
+  for (std::size_t i = 0; i < ranges.size() && i < crcs.size(); ++i) {
+    CHECK_EQ(crcs[i], reference(data.data() + ranges[i].first,
+                                ranges[i].last - ranges[i].first));
+  }
+}
+
+TEST_MAIN()
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/convert.hpp"
+
+using namespace safetensors;
+
+// The references below decode from the definitions of the formats and
+// encode by searching the values of the narrow type, so that they share
+// no bit tricks with the kernels they check.
+
+namespace {
+
+float bitsToFloat(const std::uint32_t bits) {
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+std::uint32_t floatToBits(const float f) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+// A binary floating-point format with an implicit leading one.
+double decode(const std::uint32_t code, const int exponent_bits,
+              const int mantissa_bits, const int bias) {
+  const std::uint32_t mantissa = code & ((1u << mantissa_bits) - 1);
+  const std::uint32_t exponent =
+      (code >> mantissa_bits) & ((1u << exponent_bits) - 1);
+  const bool negative = code >> (exponent_bits + mantissa_bits) & 1;
+  double value;
+  if (exponent == 0) {
+    value = std::ldexp(static_cast<double>(mantissa), 1 - bias - mantissa_bits);
+  } else {
+    value = std::ldexp(static_cast<double>(mantissa + (1u << mantissa_bits)),
+                       static_cast<int>(exponent) - bias - mantissa_bits);
+  }
+  return negative ? -value : value;
+}
+
+double f16(const std::uint16_t h) {
+  if ((h & 0x7c00) == 0x7c00) {
+    if (h & 0x3ff) return std::numeric_limits<double>::quiet_NaN();
+    return h & 0x8000 ? -INFINITY : INFINITY;
+  }
+  return decode(h, 5, 10, 15);
+}
+
+double e4m3(const std::uint8_t b) {
+  if ((b & 0x7f) == 0x7f) return std::numeric_limits<double>::quiet_NaN();
+  return decode(b, 4, 3, 7);
+}
+
+double e2m1(const std::uint8_t nibble) { return decode(nibble, 2, 1, 1); }
+
+// Nearest of the non-negative codes [0, count) of a format whose values
+// grow with the code, ties to the even code. Past the largest value
+// `overflow` is returned if set, the largest code otherwise.
+template <typename Decode>
+std::uint32_t nearest(const double x, const std::uint32_t count,
+                      Decode&& value, const std::int64_t overflow = -1) {
+  const double a = std::fabs(x);
+  std::uint32_t lo = 0;
+  std::uint32_t hi = count - 1;
+  if (a >= value(hi)) {
+    if (overflow < 0 || a == value(hi)) return hi;
+    // Rounds to infinity from half an ulp past the largest value on.
+    const double half_ulp = (value(hi) - value(hi - 1)) / 2;
+    return a < value(hi) + half_ulp ? hi
+                                    : static_cast<std::uint32_t>(overflow);
+  }
+  while (hi - lo > 1) {
+    const std::uint32_t mid = (lo + hi) / 2;
+    (value(mid) <= a ? lo : hi) = mid;
+  }
+  const double below = a - value(lo);
+  const double above = value(hi) - a;
+  if (below < above) return lo;
+  if (above < below) return hi;
+  return lo % 2 == 0 ? lo : hi;
+}
+
+std::uint16_t toF16(const float x) {
+  const std::uint16_t sign = std::signbit(x) ? 0x8000 : 0;
+  if (std::isnan(x)) return 0x7e00;
+  return sign | static_cast<std::uint16_t>(nearest(
+                    x, 0x7c00, [](std::uint32_t c) { return f16(c); }, 0x7c00));
+}
+
+std::uint16_t toBF16(const float x) {
+  const std::uint16_t sign = std::signbit(x) ? 0x8000 : 0;
+  if (std::isinf(x)) return sign | 0x7f80;
+  const auto value = [](std::uint32_t c) { return decode(c, 8, 7, 127); };
+  return sign |
+         static_cast<std::uint16_t>(nearest(x, 0x7f80, value, 0x7f80));
+}
+
+std::uint8_t toE4M3(const float x) {
+  const std::uint8_t sign = std::signbit(x) ? 0x80 : 0;
+  return sign | static_cast<std::uint8_t>(nearest(
+                    x, 0x7f, [](std::uint32_t c) { return e4m3(c); }));
+}
+
+std::uint8_t toE2M1(const float x) {
+  const std::uint8_t sign = std::signbit(x) ? 0x8 : 0;
+  return sign | static_cast<std::uint8_t>(nearest(
+                    x, 8, [](std::uint32_t c) { return e2m1(c); }));
+}
+
+bool sameFloat(const float a, const double b) {
+  if (std::isnan(b)) return std::isnan(a);
+  return a == static_cast<float>(b) && std::signbit(a) == std::signbit(b);
+}
+
+// Random finite floats over the whole range, plus the edge cases.
+std::vector<float> samples(const std::size_t n) {
+  std::vector<float> out = {0.0f,     -0.0f,          1.0f,    -1.0f,
+                            65504.0f, 65519.99f,      65520.0f, 1e-8f,
+                            6e-5f,    -3.4e38f,       INFINITY, -INFINITY,
+                            1.5f,     bitsToFloat(1), 448.0f,  1e30f};
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<std::uint32_t> bits;
+  while (out.size() < n) {
+    const float f = bitsToFloat(bits(rng));
+    if (std::isfinite(f)) out.push_back(f);
+  }
+  return out;
+}
+
+}  // namespace
+
+TEST(decodes_f16_and_bf16_exhaustively) {
+  std::vector<std::uint16_t> codes(1 << 16);
+  for (std::uint32_t i = 0; i < codes.size(); ++i) {
+    codes[i] = static_cast<std::uint16_t>(i);
+  }
+  std::vector<float> out(codes.size());
+  convert(codes.data(), Dtype::F16, out.data(), Dtype::F32, codes.size());
+  for (std::uint32_t i = 0; i < codes.size(); ++i) {
+    if (!sameFloat(out[i], f16(codes[i]))) {
+      CHECK(sameFloat(out[i], f16(codes[i])));
+      break;
+    }
+  }
+  convert(codes.data(), Dtype::BF16, out.data(), Dtype::F32, codes.size());
+  for (std::uint32_t i = 0; i < codes.size(); ++i) {
+    const float expected = bitsToFloat(static_cast<std::uint32_t>(i) << 16);
+    if (std::isnan(expected) ? !std::isnan(out[i])
+                             : floatToBits(out[i]) != floatToBits(expected)) {
+      CHECK_EQ(floatToBits(out[i]), floatToBits(expected));
+      break;
+    }
+  }
+}
+
+TEST(encodes_f16_and_bf16_to_nearest_even) {
+  const std::vector<float> in = samples(50000);
+  std::vector<std::uint16_t> out(in.size());
+  convert(in.data(), Dtype::F32, out.data(), Dtype::F16, in.size());
+  for (std::size_t i = 0; i < in.size(); ++i) {
+    if (out[i] != toF16(in[i])) {
+      CHECK_EQ(out[i], toF16(in[i]));
+      break;
+    }
+  }
+  convert(in.data(), Dtype::F32, out.data(), Dtype::BF16, in.size());
+  for (std::size_t i = 0; i < in.size(); ++i) {
+    if (out[i] != toBF16(in[i])) {
+      CHECK_EQ(out[i], toBF16(in[i]));
+      break;
+    }
+  }
+  // Ties: halfway between 1 and the next BF16 rounds to even, just above
+  // it rounds up.
+  const float ties[] = {bitsToFloat(0x3f808000), bitsToFloat(0x3f818000),
+                        bitsToFloat(0x3f808001)};
+  std::uint16_t tied[3];
+  convert(ties, Dtype::F32, tied, Dtype::BF16, 3);
+  CHECK_EQ(tied[0], 0x3f80);
+  CHECK_EQ(tied[1], 0x3f82);
+  CHECK_EQ(tied[2], 0x3f81);
+  // NaN stays NaN.
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  convert(&nan, Dtype::F32, tied, Dtype::BF16, 1);
+  CHECK((tied[0] & 0x7f80) == 0x7f80 && (tied[0] & 0x7f));
+}
+
+TEST(decodes_f8_and_f4_exhaustively) {
+  std::vector<std::uint8_t> codes(256);
+  for (std::uint32_t i = 0; i < 256; ++i) {
+    codes[i] = static_cast<std::uint8_t>(i);
+  }
+  std::vector<float> out(512);
+  convert(codes.data(), Dtype::F8_E4M3, out.data(), Dtype::F32, 256);
+  for (std::uint32_t i = 0; i < 256; ++i) {
+    CHECK(sameFloat(out[i], e4m3(codes[i])));
+  }
+  convert(codes.data(), Dtype::F8_E5M2, out.data(), Dtype::F32, 256);
+  for (std::uint32_t i = 0; i < 256; ++i) {
+    CHECK(sameFloat(out[i], f16(static_cast<std::uint16_t>(i << 8))));
+  }
+  // Two F4 values per byte, the first in the low nibble.
+  convert(codes.data(), Dtype::F4, out.data(), Dtype::F32, 512);
+  for (std::uint32_t i = 0; i < 256; ++i) {
+    CHECK(sameFloat(out[2 * i], e2m1(i & 0xf)));
+    CHECK(sameFloat(out[2 * i + 1], e2m1(i >> 4)));
+  }
+}
+
+TEST(encodes_f8_and_f4_saturating) {
+  // Every value, every midpoint between neighbours, and a random spread.
+  std::vector<float> in;
+  for (std::uint32_t c = 0; c < 0x7f; ++c) {
+    in.push_back(static_cast<float>(e4m3(c)));
+    in.push_back(-static_cast<float>(e4m3(c)));
+    if (c + 1 < 0x7f) {
+      in.push_back(static_cast<float>((e4m3(c) + e4m3(c + 1)) / 2));
+    }
+  }
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> spread(-1000.0f, 1000.0f);
+  for (int i = 0; i < 10000; ++i) in.push_back(spread(rng));
+  std::vector<std::uint8_t> out(in.size());
+  convert(in.data(), Dtype::F32, out.data(), Dtype::F8_E4M3, in.size());
+  for (std::size_t i = 0; i < in.size(); ++i) {
+    if (out[i] != toE4M3(in[i])) {
+      CHECK_EQ(int{out[i]}, int{toE4M3(in[i])});
+      break;
+    }
+  }
+
+  in.clear();
+  for (std::uint32_t c = 0; c < 8; ++c) {
+    in.push_back(static_cast<float>(e2m1(c)));
+    in.push_back(-static_cast<float>(e2m1(c)));
+    if (c + 1 < 8) {
+      in.push_back(static_cast<float>((e2m1(c) + e2m1(c + 1)) / 2));
+    }
+  }
+  std::uniform_real_distribution<float> small(-10.0f, 10.0f);
+  while (in.size() < 2000) in.push_back(small(rng));
+  std::vector<std::uint8_t> packed(in.size() / 2);
+  convert(in.data(), Dtype::F32, packed.data(), Dtype::F4, in.size());
+  for (std::size_t i = 0; i < in.size(); ++i) {
+    const std::uint8_t nibble = i % 2 ? packed[i / 2] >> 4 : packed[i / 2] & 0xf;
+    if (nibble != toE2M1(in[i])) {
+      CHECK_EQ(int{nibble}, int{toE2M1(in[i])});
+      break;
+    }
+  }
+}
+
+TEST(applies_block_scales) {
+  // 64 F4 values in two blocks, scaled by 2^-1 and 2^3 as F8_E8M0.
+  std::vector<std::uint8_t> codes(32);
+  for (std::size_t i = 0; i < codes.size(); ++i) {
+    codes[i] = static_cast<std::uint8_t>(i * 37);
+  }
+  const std::uint8_t scales[] = {126, 130};
+  BlockScales block;
+  block.data = scales;
+  std::vector<float> out(64);
+  convert(codes.data(), Dtype::F4, out.data(), Dtype::F32, 64, &block);
+  for (std::size_t i = 0; i < 64; ++i) {
+    const std::uint8_t nibble =
+        i % 2 ? codes[i / 2] >> 4 : codes[i / 2] & 0xf;
+    const double scale = i < 32 ? 0.5 : 8.0;
+    CHECK(sameFloat(out[i], e2m1(nibble) * scale));
+  }
+}
+
+TEST(rejects_unsupported_pairs) {
+  CHECK(can_convert(Dtype::I32, Dtype::F32));
+  CHECK(can_convert(Dtype::F16, Dtype::F16));
+  CHECK(!can_convert(Dtype::F32, Dtype::I32));
+  CHECK(!can_convert(Dtype::I8, Dtype::F8_E4M3));
+  const float x = 1.0f;
+  std::int32_t y;
+  CHECK_THROWS(convert(&x, Dtype::F32, &y, Dtype::I32, 1),
+               std::invalid_argument);
+}
+
+TEST_MAIN()
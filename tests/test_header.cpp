@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "json.hpp"
+#include "safetensors/header.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+// A file made of the length, `json` and `data_bytes` of data.
+std::vector<std::uint8_t> file(const std::string& json,
+                               const std::size_t data_bytes) {
+  std::vector<std::uint8_t> out(8 + json.size() + data_bytes);
+  const std::uint64_t n = json.size();
+  for (std::size_t i = 0; i < 8; ++i) {
+    out[i] = static_cast<std::uint8_t>(n >> (8 * i));
+  }
+  std::memcpy(out.data() + 8, json.data(), json.size());
+  return out;
+}
+
+TensorIndex parse(const std::vector<std::uint8_t>& bytes,
+                  const HeaderParser parser = HeaderParser::Native) {
+  return parse_header(bytes.data(), bytes.size(), parser);
+}
+
+bool validUtf8(std::string_view s) {
+  return detail::isValidUtf8(reinterpret_cast<const std::uint8_t*>(s.data()),
+                             s.size());
+}
+
+const std::string kValid =
+    R"({"__metadata__":{"format":"pt","b":"x"},)"
+    R"("w":{"dtype":"F32","shape":[2,3],"data_offsets":[0,24]},)"
+    R"("h":{"dtype":"BF16","shape":[4],"data_offsets":[24,32]},)"
+    R"("s":{"dtype":"I64","shape":[],"data_offsets":[32,40]},)"
+    R"("e":{"dtype":"U8","shape":[0,5],"data_offsets":[40,40]},)"
+    R"("café":{"dtype":"U8","shape":[3],"data_offsets":[40,43]}})";
+
+}  // namespace
+
+TEST(parses_valid_header) {
+  const std::vector<std::uint8_t> bytes = file(kValid, 43);
+  const TensorIndex index = parse(bytes);
+  CHECK_EQ(index.size(), 5u);
+  CHECK_EQ(index.header_size(), kValid.size());
+  CHECK_EQ(index.data_offset(), 8 + kValid.size());
+  CHECK_EQ(index.buffer_size(), 43u);
+  const std::size_t w = index.find("w");
+  CHECK(w != TensorIndex::npos);
+  CHECK(index.entry(w).dtype == Dtype::F32);
+  CHECK_EQ(index.shape(w).size(), 2u);
+  CHECK_EQ(index.shape(w)[1], 3u);
+  CHECK_EQ(index.shape(index.find("s")).size(), 0u);
+  CHECK(index.find("caf\xc3\xa9") != TensorIndex::npos);
+  CHECK(index.metadata("format") == "pt");
+  CHECK(!index.metadata("missing"));
+}
+
+TEST(native_matches_rust) {
+  const std::vector<std::uint8_t> bytes = file(kValid, 43);
+  const TensorIndex native = parse(bytes, HeaderParser::Native);
+  const TensorIndex rust = parse(bytes, HeaderParser::Rust);
+  CHECK_EQ(native.size(), rust.size());
+  CHECK_EQ(native.data_offset(), rust.data_offset());
+  for (std::size_t i = 0; i < native.size() && i < rust.size(); ++i) {
+    CHECK(native.name(i) == rust.name(i));
+    CHECK(native.entry(i).dtype == rust.entry(i).dtype);
+    CHECK_EQ(native.entry(i).begin, rust.entry(i).begin);
+    CHECK_EQ(native.entry(i).end, rust.entry(i).end);
+    const auto a = native.shape(i);
+    const auto b = rust.shape(i);
+    CHECK(std::vector<std::size_t>(a.begin(), a.end()) ==
+          std::vector<std::size_t>(b.begin(), b.end()));
+  }
+  CHECK_EQ(native.metadata().size(), rust.metadata().size());
+  for (std::size_t i = 0;
+       i < native.metadata().size() && i < rust.metadata().size(); ++i) {
+    CHECK(native.metadata()[i] == rust.metadata()[i]);
+  }
+}
+
+TEST(rejects_invalid_headers) {
+  struct Bad {
+    std::string json;
+    std::size_t data_bytes;
+  };
+  const std::vector<Bad> cases = {
+      // Not JSON, or not an object.
+      {"", 0},
+      {"[]", 0},
+      {R"({"w":{"dtype":"F32","shape":[1],"data_offsets":[0,4]})", 4},
+      {R"({"w":{"dtype":"F32","shape":[1],"data_offsets":[0,4]}} x)", 4},
+      // Unknown dtype, missing and duplicate fields.
+      {R"({"w":{"dtype":"F33","shape":[1],"data_offsets":[0,4]}})", 4},
+      {R"({"w":{"dtype":"F32","data_offsets":[0,4]}})", 4},
+      {R"({"w":{"dtype":"F32","dtype":"F32","shape":[1],)"
+       R"("data_offsets":[0,4]}})",
+       4},
+      // Size of the data does not match the shape.
+      {R"({"w":{"dtype":"F32","shape":[2],"data_offsets":[0,4]}})", 4},
+      // Offsets reversed, with a hole, overlapping, or short of the buffer.
+      {R"({"w":{"dtype":"U8","shape":[0],"data_offsets":[4,0]}})", 4},
+      {R"({"a":{"dtype":"U8","shape":[4],"data_offsets":[0,4]},)"
+       R"("b":{"dtype":"U8","shape":[4],"data_offsets":[8,12]}})",
+       12},
+      {R"({"a":{"dtype":"U8","shape":[4],"data_offsets":[0,4]},)"
+       R"("b":{"dtype":"U8","shape":[4],"data_offsets":[2,6]}})",
+       6},
+      {R"({"w":{"dtype":"U8","shape":[4],"data_offsets":[0,4]}})", 8},
+      {R"({"w":{"dtype":"U8","shape":[8],"data_offsets":[0,8]}})", 4},
+      // Duplicate names, invalid UTF-8 in a name.
+      {R"({"w":{"dtype":"U8","shape":[4],"data_offsets":[0,4]},)"
+       R"("w":{"dtype":"U8","shape":[4],"data_offsets":[4,8]}})",
+       8},
+      {"{\"\xff\":{\"dtype\":\"U8\",\"shape\":[4],\"data_offsets\":[0,4]}}",
+       4},
+      // Shape overflowing the element count.
+      {R"({"w":{"dtype":"U8","shape":[4294967296,4294967296],)"
+       R"("data_offsets":[0,0]}})",
+       0},
+  };
+  for (const Bad& bad : cases) {
+    const std::vector<std::uint8_t> bytes = file(bad.json, bad.data_bytes);
+    CHECK_THROWS(parse(bytes, HeaderParser::Native), std::runtime_error);
+    CHECK_THROWS(parse(bytes, HeaderParser::Rust), std::exception);
+  }
+
+  // Too short for the length, and a length past the end.
+  const std::vector<std::uint8_t> short_file = {1, 0, 0};
+  CHECK_THROWS(parse(short_file), std::runtime_error);
+  std::vector<std::uint8_t> long_header = file("{}", 0);
+  long_header[0] = 200;
+  CHECK_THROWS(parse(long_header), std::runtime_error);
+}
+
+TEST(validates_utf8) {
+  CHECK(validUtf8(""));
+  CHECK(validUtf8("ascii"));
+  CHECK(validUtf8("caf\xc3\xa9"));
+  CHECK(validUtf8("\xe2\x82\xac"));          // U+20AC
+  CHECK(validUtf8("\xf0\x9f\x98\x80"));      // U+1F600
+  CHECK(validUtf8("\xf4\x8f\xbf\xbf"));      // U+10FFFF
+  CHECK(!validUtf8("\xff"));
+  CHECK(!validUtf8("\x80"));                  // lone continuation
+  CHECK(!validUtf8("\xc3"));                  // truncated
+  CHECK(!validUtf8("\xe2\x82"));              // truncated
+  CHECK(!validUtf8("\xc0\xaf"));              // overlong '/'
+  CHECK(!validUtf8("\xe0\x80\xaf"));          // overlong '/'
+  CHECK(!validUtf8("\xed\xa0\x80"));          // surrogate U+D800
+  CHECK(!validUtf8("\xf4\x90\x80\x80"));      // above U+10FFFF
+  CHECK(!validUtf8("\xf8\x88\x80\x80\x80"));  // five bytes
+  // Long runs take the ASCII fast path, if any; the error is at the end.
+  CHECK(!validUtf8(std::string(100, 'a') + "\xc3"));
+}
+
+TEST_MAIN()
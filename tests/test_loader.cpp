@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/loader.hpp"
+#include "safetensors/writer.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+const std::size_t kPage = Mmap::pageSize();
+
+// `t0`, `t1`, ... of the given sizes in pages; every byte of `t<i>` is i.
+void writeCheckpoint(const std::filesystem::path& path,
+                     const std::vector<std::size_t>& pages) {
+  SafeWriter writer(path);
+  for (std::size_t i = 0; i < pages.size(); ++i) {
+    writer.add_tensor("t" + std::to_string(i), Dtype::U8,
+                      std::array<std::size_t, 1>{pages[i] * kPage});
+  }
+  for (std::size_t i = 0; i < pages.size(); ++i) {
+    const std::vector<std::byte> data(pages[i] * kPage,
+                                      static_cast<std::byte>(i));
+    writer.write("t" + std::to_string(i), data);
+  }
+  writer.close();
+}
+
+OpenOptions openOptions() {
+  OpenOptions options;
+  options.prefetch = 0;
+  return options;
+}
+
+bool holds(const LoadedTensor& tensor, const std::size_t i) {
+  for (std::byte b : tensor.data()) {
+    if (b != static_cast<std::byte>(i)) return false;
+  }
+  return tensor.key() == "t" + std::to_string(i);
+}
+
+template <typename T>
+bool ready(std::future<T>& future) {
+  return future.wait_for(std::chrono::seconds(10)) ==
+         std::future_status::ready;
+}
+
+}  // namespace
+
+TEST(loads_through_futures_and_callbacks) {
+  test::TempDir dir("safetensors-loader");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, {1, 3, 2, 1, 5, 1});
+  SafeOpen f(path, openOptions());
+
+  LoaderOptions options;
+  options.threads = 3;
+  options.max_in_flight = 2;
+  options.staging_bytes = 8 * kPage;
+  AsyncLoader loader(f, options);
+  std::vector<std::future<LoadedTensor>> futures;
+  for (std::size_t i = 0; i < 6; ++i) {
+    futures.push_back(loader.load("t" + std::to_string(i)));
+  }
+  for (std::size_t i = 0; i < futures.size(); ++i) {
+    const LoadedTensor tensor = futures[i].get();
+    CHECK(holds(tensor, i));
+    CHECK_EQ(reinterpret_cast<std::uintptr_t>(tensor.data().data()) % kPage,
+             reinterpret_cast<std::uintptr_t>(f.tensors()[i].data_ptr) %
+                 kPage);
+  }
+
+  std::atomic<std::size_t> delivered{0};
+  for (std::size_t i = 0; i < 6; ++i) {
+    loader.load("t" + std::to_string(i), [&, i](LoadedTensor tensor) {
+      if (holds(tensor, i)) ++delivered;
+    });
+  }
+  loader.wait();
+  CHECK_EQ(delivered.load(), 6u);
+  const LoaderStats stats = loader.stats();
+  CHECK_EQ(stats.tensors, 12u);
+  CHECK_EQ(stats.bytes, 2u * 13 * kPage);
+  CHECK(stats.peak_staged_bytes <= options.staging_bytes);
+}
+
+TEST(reports_errors) {
+  test::TempDir dir("safetensors-loader");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, {1, 1});
+  SafeOpen f(path, openOptions());
+  AsyncLoader loader(f);
+  CHECK_THROWS(loader.load("missing"), std::runtime_error);
+  CHECK_THROWS(loader.load("t0", nullptr), std::invalid_argument);
+  loader.load("t0", [](LoadedTensor) { throw std::logic_error("boom"); });
+  loader.load("t1", [](LoadedTensor) {});
+  CHECK_THROWS(loader.wait(), std::logic_error);
+  loader.wait();
+
+  f.release("t1", Release::Unmap);
+  CHECK_THROWS(loader.load("t1"), std::runtime_error);
+}
+
+TEST(stays_within_the_staging_budget) {
+  test::TempDir dir("safetensors-loader");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, {8, 1, 1, 1, 1});
+  SafeOpen f(path, openOptions());
+  LoaderOptions options;
+  options.threads = 2;
+  options.max_in_flight = 8;
+  options.staging_bytes = 4 * kPage;
+  AsyncLoader loader(f, options);
+
+  // Larger than the budget, so loaded alone; its buffer is then cached.
+  { const LoadedTensor big = loader.load("t0").get(); }
+  CHECK(loader.stats().peak_staged_bytes > options.staging_bytes);
+
+  // Small ones that fit together must not take the cached big buffer,
+  // which would leave no room for the next one while the first is held.
+  for (std::size_t i = 1; i < 5; i += 2) {
+    std::future<LoadedTensor> a = loader.load("t" + std::to_string(i));
+    std::future<LoadedTensor> b = loader.load("t" + std::to_string(i + 1));
+    CHECK(ready(a) && ready(b));
+    if (!ready(a) || !ready(b)) return;
+    const LoadedTensor ta = a.get();
+    const LoadedTensor tb = b.get();
+    CHECK(holds(ta, i) && holds(tb, i + 1));
+  }
+}
+
+TEST(consumes_tensors_when_read) {
+  test::TempDir dir("safetensors-loader");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, {2, 2, 2});
+  OpenOptions open = openOptions();
+  open.trace.first_touch = true;
+  SafeOpen f(path, open);
+  LoaderOptions options;
+  options.threads = 1;
+  options.max_in_flight = 1;
+  AsyncLoader loader(f, options);
+
+  std::future<LoadedTensor> first = loader.load("t0");
+  CHECK(ready(first));
+  if (!ready(first)) return;
+  LoadedTensor t0 = first.get();
+  // Queued behind t0, which holds the only slot.
+  std::future<LoadedTensor> second = loader.load("t1");
+  f.release_consumed(Release::Unmap);
+  CHECK(f.is_unmapped("t0"));
+  CHECK(!f.is_unmapped("t1"));
+  CHECK(holds(t0, 0));
+  t0 = LoadedTensor();
+  CHECK(holds(second.get(), 1));
+  CHECK(!f.is_unmapped("t1"));
+  CHECK(f.release_consumed(Release::Unmap) > 0);
+  // Neither submitting nor reading faulted the mapping in.
+  CHECK_EQ(f.load_stats().touched, 0u);
+}
+
+TEST_MAIN()
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/safetensors.hpp"
+#include "safetensors/writer.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+const std::size_t kPage = Mmap::pageSize();
+
+// `t0` to `t3` of four pages each, each starting on a page, every byte of
+// `t<i>` equal to i. Well within the usual RLIMIT_MEMLOCK.
+void writeCheckpoint(const std::filesystem::path& path) {
+  WriterOptions options;
+  options.alignment = kPage;
+  SafeWriter writer(path, options);
+  for (std::size_t i = 0; i < 4; ++i) {
+    writer.add_tensor("t" + std::to_string(i), Dtype::U8,
+                      std::array<std::size_t, 1>{4 * kPage});
+  }
+  for (std::size_t i = 0; i < 4; ++i) {
+    const std::vector<std::byte> data(4 * kPage, static_cast<std::byte>(i));
+    writer.write("t" + std::to_string(i), data);
+  }
+  writer.close();
+}
+
+OpenOptions openOptions(const MlockPolicy policy) {
+  OpenOptions options;
+  options.prefetch = 0;
+  options.mlock = policy;
+  return options;
+}
+
+std::size_t covered(const MlockStats& stats) {
+  return stats.locked_bytes + stats.failed_bytes;
+}
+
+bool holds(const SafeOpen& f, const std::size_t i) {
+  const SafeOpen::TensorView& view = f.get_tensor("t" + std::to_string(i));
+  const auto* data = static_cast<const std::byte*>(view.data_ptr);
+  for (std::size_t k = 0; k < view.data_len; ++k) {
+    if (data[k] != static_cast<std::byte>(i)) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST(locks_by_policy) {
+  test::TempDir dir("safetensors-mlock");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  CHECK_EQ(covered(SafeOpen(path, openOptions(MlockPolicy::None))
+                       .mlock_stats()),
+           0u);
+
+  // Everything past the header, from its last page on.
+  SafeOpen all(path, openOptions(MlockPolicy::All));
+  CHECK(covered(all.mlock_stats()) >= 16 * kPage);
+  CHECK(covered(all.mlock_stats()) <= 17 * kPage);
+
+  OpenOptions filter = openOptions(MlockPolicy::Filter);
+  filter.mlock_filter = [](std::string_view key) {
+    return key == "t1" || key == "t2";
+  };
+  CHECK_EQ(covered(SafeOpen(path, filter).mlock_stats()), 8 * kPage);
+
+  OpenOptions prefix = openOptions(MlockPolicy::Prefix);
+  prefix.mlock_bytes = 4 * kPage;
+  const MlockStats first = SafeOpen(path, prefix).mlock_stats();
+  CHECK(covered(first) >= 4 * kPage && covered(first) <= 5 * kPage);
+  // Locking never consumes anything.
+  CHECK_EQ(all.release_consumed(), 0u);
+  CHECK(holds(all, 3));
+}
+
+TEST(locks_keys_on_demand) {
+  test::TempDir dir("safetensors-mlock");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  SafeOpen f(path, openOptions(MlockPolicy::None));
+  const std::string_view keys[] = {"t1"};
+  const MlockStats stats = f.lock(keys);
+  CHECK_EQ(covered(stats), 4 * kPage);
+  CHECK_EQ(covered(f.mlock_stats()), 4 * kPage);
+  const std::string_view missing[] = {"missing"};
+  CHECK_THROWS(f.lock(missing), std::runtime_error);
+  // The key is not consumed, so consumed releases leave the lock alone.
+  CHECK_EQ(f.release_consumed(Release::Unmap), 0u);
+  CHECK(!f.is_unmapped("t1"));
+
+  // Discarding skips the locked pages and releases the rest.
+  CHECK(holds(f, 0) && holds(f, 1) && holds(f, 2));
+  const std::size_t discarded = f.release_consumed();
+  if (stats.locked_bytes == 4 * kPage) CHECK_EQ(discarded, 8 * kPage);
+  CHECK(holds(f, 1));
+  if (stats.locked_bytes == 4 * kPage) CHECK_EQ(f.release("t1"), 0u);
+
+  // Unmapping drops the lock along with the pages.
+  CHECK_EQ(f.release("t1", Release::Unmap), 4 * kPage);
+  CHECK(f.is_unmapped("t1"));
+  const std::string_view gone[] = {"t1"};
+  CHECK_THROWS(f.lock(gone), std::runtime_error);
+}
+
+TEST(unmapping_keeps_neighbours_locked) {
+  test::TempDir dir("safetensors-mlock");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  SafeOpen f(path, openOptions(MlockPolicy::None));
+  // One lock over all three, with a hole punched in the middle.
+  const std::string_view keys[] = {"t0", "t1", "t2"};
+  if (f.lock(keys).locked_bytes != 12 * kPage) return;
+  CHECK_EQ(f.release("t1", Release::Unmap), 4 * kPage);
+  CHECK_EQ(f.release("t0"), 0u);
+  CHECK_EQ(f.release("t2"), 0u);
+  CHECK(holds(f, 0) && holds(f, 2));
+  CHECK_EQ(f.release("t3"), 4 * kPage);
+}
+
+TEST_MAIN()
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/numa.hpp"
+#include "safetensors/safetensors.hpp"
+#include "safetensors/writer.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+const std::size_t kPage = Mmap::pageSize();
+
+// `t0`, `t1`, `t2` of two pages each, every byte of `t<i>` equal to i.
+void writeCheckpoint(const std::filesystem::path& path) {
+  WriterOptions options;
+  options.alignment = kPage;
+  SafeWriter writer(path, options);
+  for (std::size_t i = 0; i < 3; ++i) {
+    writer.add_tensor("t" + std::to_string(i), Dtype::U8,
+                      std::array<std::size_t, 1>{2 * kPage});
+  }
+  for (std::size_t i = 0; i < 3; ++i) {
+    const std::vector<std::byte> data(2 * kPage, static_cast<std::byte>(i));
+    writer.write("t" + std::to_string(i), data);
+  }
+  writer.close();
+}
+
+OpenOptions openOptions() {
+  OpenOptions options;
+  options.prefetch = 0;
+  return options;
+}
+
+bool holds(const SafeOpen::TensorView& view, const std::size_t i) {
+  const auto* data = static_cast<const std::byte*>(view.data_ptr);
+  for (std::size_t k = 0; k < view.data_len; ++k) {
+    if (data[k] != static_cast<std::byte>(i)) return false;
+  }
+  return true;
+}
+
+bool validNode(const int node) {
+  return node >= -1 && node < static_cast<int>(numa_nodes());
+}
+
+}  // namespace
+
+TEST(reports_nodes) {
+  CHECK(numa_nodes() >= 1);
+  NodeBuffer buffer(3 * kPage + 1, 0);
+  CHECK_EQ(buffer.bytes().size(), 3 * kPage + 1);
+  CHECK_EQ(buffer.node(), 0);
+  CHECK(validNode(numa_node_of(buffer.bytes().data())));
+  buffer.bytes()[0] = std::byte{1};
+  // Resident once written, where the kernel answers queries at all: the
+  // stack always is.
+  if (numa_node_of(&buffer) != -1) {
+    CHECK(numa_node_of(buffer.bytes().data()) != -1);
+  }
+  const NodeBuffer moved = std::move(buffer);
+  CHECK(buffer.bytes().empty());
+  CHECK_EQ(moved.bytes()[0], std::byte{1});
+  CHECK_THROWS(
+      numa_bind(moved.bytes().data(), kPage, static_cast<int>(numa_nodes()),
+                false),
+      std::out_of_range);
+}
+
+TEST(places_tensors_without_consuming_them) {
+  test::TempDir dir("safetensors-numa");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  SafeOpen f(path, openOptions());
+  const std::string_view keys[] = {"t0", "t2"};
+  // The kernel may refuse, e.g. in a container, but the data stays
+  // readable either way.
+  static_cast<void>(f.bind_to_node(keys, 0));
+  CHECK(validNode(f.numa_node("t0")));
+  CHECK_THROWS(f.bind_to_node(keys, static_cast<int>(numa_nodes())),
+               std::out_of_range);
+  CHECK_THROWS(f.numa_node("missing"), std::runtime_error);
+  // Neither call counts as a lookup, so nothing is released here.
+  CHECK_EQ(f.release_consumed(), 0u);
+  CHECK(holds(f.get_tensor("t0"), 0));
+  CHECK(validNode(f.numa_node("t0")));
+
+  f.release("t1", Release::Unmap);
+  const std::string_view gone[] = {"t1"};
+  CHECK_THROWS(f.bind_to_node(gone, 0), std::runtime_error);
+  CHECK_THROWS(f.numa_node("t1"), std::runtime_error);
+}
+
+TEST(replicates_tensors_per_node) {
+  test::TempDir dir("safetensors-numa");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  SafeOpen f(path, openOptions());
+  CHECK(f.find_tensor("t1", 0) == f.find_tensor("t1"));
+
+  const std::string_view keys[] = {"t1", "t2"};
+  const int nodes[] = {0};
+  f.replicate(keys, nodes);
+  const SafeOpen::TensorView* local = f.find_tensor("t1", 0);
+  CHECK(local && local != f.find_tensor("t1"));
+  if (local) CHECK(holds(*local, 1));
+  CHECK(f.find_tensor("t2", 0) && holds(*f.find_tensor("t2", 0), 2));
+  // Other keys and nodes fall back to the mapping.
+  CHECK(f.find_tensor("t0", 0) == f.find_tensor("t0"));
+  CHECK(f.find_tensor("t1", 1) == f.find_tensor("t1"));
+  CHECK(!f.find_tensor("missing", 0));
+
+  // The mapped pages of replicated keys can go; the copies stay.
+  CHECK(f.release_consumed(Release::Unmap) > 0);
+  CHECK(f.is_unmapped("t1"));
+  CHECK(local && f.find_tensor("t1", 0) == local && holds(*local, 1));
+}
+
+TEST_MAIN()
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/mmap.hpp"
+#include "safetensors/reader.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+constexpr std::size_t kSize = (3 << 20) + 12345;
+
+// Byte `i` of the file is a hash of `i`, so misplaced reads show up.
+std::uint8_t byteAt(const std::size_t i) {
+  return static_cast<std::uint8_t>((i * 2654435761u) >> 13);
+}
+
+std::filesystem::path writeFile(const test::TempDir& dir) {
+  const auto path = dir / "data.bin";
+  std::vector<char> data(kSize);
+  for (std::size_t i = 0; i < kSize; ++i) {
+    data[i] = static_cast<char>(byteAt(i));
+  }
+  std::ofstream(path, std::ios::binary).write(data.data(), kSize);
+  return path;
+}
+
+bool matches(const std::vector<std::uint8_t>& buf, const std::size_t offset,
+             const std::size_t skip = 0) {
+  for (std::size_t i = skip; i < buf.size(); ++i) {
+    if (buf[i] != byteAt(offset + i - skip)) return false;
+  }
+  return true;
+}
+
+ReaderOptions readerOptions(const IoBackend backend) {
+  ReaderOptions options;
+  options.backend = backend;
+  // Small blocks and a shallow queue, so requests are split and slots
+  // are reused.
+  options.block_size = 64 << 10;
+  options.queue_depth = 4;
+  return options;
+}
+
+constexpr IoBackend kBackends[] = {IoBackend::Mmap, IoBackend::Buffered,
+                                   IoBackend::Direct};
+
+}  // namespace
+
+TEST(reads_ranges_with_every_backend) {
+  test::TempDir dir("safetensors-reader");
+  const auto path = writeFile(dir);
+  for (const IoBackend backend : kBackends) {
+    const std::unique_ptr<Reader> reader =
+        open_reader(path, readerOptions(backend));
+    CHECK_EQ(reader->size(), kSize);
+    CHECK(reader->backend() != IoBackend::Remote);
+
+    // Unaligned offsets, sizes and destinations, up to the last byte.
+    const std::size_t offsets[] = {0, 1, 4095, 65537, 1 << 20, kSize - 777};
+    const std::size_t sizes[] = {kSize, 300000, 1, 200000, 8192, 777};
+    std::vector<std::vector<std::uint8_t>> bufs;
+    std::vector<ReadRequest> requests;
+    for (std::size_t i = 0; i < std::size(offsets); ++i) {
+      bufs.emplace_back(sizes[i] + 3);
+    }
+    for (std::size_t i = 0; i < std::size(offsets); ++i) {
+      requests.push_back({offsets[i], sizes[i], bufs[i].data() + 3});
+    }
+    reader->read(requests);
+    for (std::size_t i = 0; i < std::size(offsets); ++i) {
+      CHECK(matches(bufs[i], offsets[i], 3));
+    }
+    reader->read({});
+  }
+
+  // The same ranges out of a mapping.
+  File file(path);
+  Mmap mmap(&file, 0);
+  std::vector<std::uint8_t> buf(100001);
+  const ReadRequest request{54321, buf.size(), buf.data()};
+  read_mapped(mmap, {&request, 1}, readerOptions(IoBackend::Mmap));
+  CHECK(matches(buf, 54321));
+}
+
+TEST(rejects_reads_past_the_end) {
+  test::TempDir dir("safetensors-reader");
+  const auto path = writeFile(dir);
+  for (const IoBackend backend : kBackends) {
+    const std::unique_ptr<Reader> reader =
+        open_reader(path, readerOptions(backend));
+    std::vector<std::uint8_t> buf(4096);
+    const ReadRequest past{kSize - 100, buf.size(), buf.data()};
+    CHECK_THROWS(reader->read({&past, 1}), std::runtime_error);
+    const ReadRequest beyond{kSize + 1, 1, buf.data()};
+    CHECK_THROWS(reader->read({&beyond, 1}), std::runtime_error);
+
+    // Still usable afterwards.
+    const ReadRequest ok{kSize - buf.size(), buf.size(), buf.data()};
+    reader->read({&ok, 1});
+    CHECK(matches(buf, kSize - buf.size()));
+  }
+  CHECK_THROWS(open_reader(dir / "missing.bin"), std::exception);
+  CHECK_THROWS(open_reader(path, readerOptions(IoBackend::Remote)),
+               std::invalid_argument);
+}
+
+TEST(reads_from_several_threads) {
+  test::TempDir dir("safetensors-reader");
+  const auto path = writeFile(dir);
+  for (const IoBackend backend : kBackends) {
+    const std::unique_ptr<Reader> reader =
+        open_reader(path, readerOptions(backend));
+    std::vector<std::thread> threads;
+    std::vector<int> ok(8);
+    for (std::size_t t = 0; t < ok.size(); ++t) {
+      threads.emplace_back([&, t] {
+        bool good = true;
+        for (std::size_t round = 0; round < 4; ++round) {
+          const std::size_t offset = (t * 4 + round) * 87654;
+          std::vector<std::uint8_t> buf(150001);
+          const ReadRequest request{offset, buf.size(), buf.data()};
+          reader->read({&request, 1});
+          good &= matches(buf, offset);
+        }
+        ok[t] = good;
+      });
+    }
+    for (std::thread& t : threads) t.join();
+    for (const int good : ok) CHECK(good);
+  }
+}
+
+TEST_MAIN()
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/safetensors.hpp"
+#include "safetensors/writer.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+const std::size_t kPage = Mmap::pageSize();
+
+// `t0`, `t1`, ... of `pages` pages each, every byte of `t<i>` equal to i.
+// With `aligned`, every tensor starts on a page.
+void writeCheckpoint(const std::filesystem::path& path, const std::size_t n,
+                     const std::size_t pages, const bool aligned) {
+  WriterOptions options;
+  if (aligned) options.alignment = kPage;
+  SafeWriter writer(path, options);
+  for (std::size_t i = 0; i < n; ++i) {
+    writer.add_tensor("t" + std::to_string(i), Dtype::U8,
+                      std::array<std::size_t, 1>{pages * kPage});
+  }
+  for (std::size_t i = 0; i < n; ++i) {
+    const std::vector<std::byte> data(pages * kPage,
+                                      static_cast<std::byte>(i));
+    writer.write("t" + std::to_string(i), data);
+  }
+  writer.close();
+}
+
+OpenOptions openOptions(const CheckpointCache cache = CheckpointCache::None) {
+  OpenOptions options;
+  options.prefetch = 0;
+  options.cache = cache;
+  return options;
+}
+
+bool holds(const SafeOpen& f, const std::size_t i) {
+  const SafeOpen::TensorView* view = f.find_tensor("t" + std::to_string(i));
+  if (!view) return false;
+  const auto* data = static_cast<const std::byte*>(view->data_ptr);
+  for (std::size_t k = 0; k < view->data_len; k += 997) {
+    if (data[k] != static_cast<std::byte>(i)) return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST(discards_whole_pages) {
+  test::TempDir dir("safetensors-release");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 3, 4, true);
+  SafeOpen f(path, openOptions());
+  CHECK(holds(f, 0) && holds(f, 1) && holds(f, 2));
+
+  CHECK_EQ(f.release("t1"), 4 * kPage);
+  CHECK(f.released("t1"));
+  CHECK(!f.released("t0"));
+  // Discarded pages come back from the file on the next lookup.
+  CHECK(holds(f, 1));
+  CHECK(!f.released("t1"));
+  CHECK_THROWS(f.release("missing"), std::runtime_error);
+
+  // Unaligned neighbours share pages, which are kept until both go.
+  const auto packed = dir / "packed.safetensors";
+  writeCheckpoint(packed, 3, 1, false);
+  SafeOpen g(packed, openOptions());
+  const std::size_t first = g.release("t1");
+  CHECK(first < kPage);
+  CHECK(g.release("t0") + g.release("t2") + first >= kPage);
+  CHECK(holds(g, 0) && holds(g, 1) && holds(g, 2));
+}
+
+TEST(releases_what_was_consumed) {
+  test::TempDir dir("safetensors-release");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 4, 2, true);
+  SafeOpen f(path, openOptions());
+  CHECK_EQ(f.release_consumed(), 0u);
+  CHECK(holds(f, 0) && holds(f, 2));
+  CHECK_EQ(f.release_consumed(), 2 * 2 * kPage);
+  CHECK(f.released("t0") && f.released("t2"));
+  CHECK(!f.released("t1") && !f.released("t3"));
+  CHECK_EQ(f.release_consumed(), 0u);
+
+  // Neighbours consumed together go in one run.
+  CHECK(holds(f, 1) && holds(f, 2) && holds(f, 3));
+  CHECK_EQ(f.release_consumed(Release::Unmap), 3 * 2 * kPage);
+  CHECK(f.is_unmapped("t1") && f.is_unmapped("t3"));
+  CHECK(!f.is_unmapped("t0"));
+  CHECK(holds(f, 0));
+}
+
+TEST(unmapped_tensors_are_gone) {
+  test::TempDir dir("safetensors-release");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 3, 3, false);
+  SafeOpen f(path, openOptions());
+  CHECK(f.release("t1", Release::Unmap) > 0);
+  CHECK(!f.find_tensor("t1"));
+  CHECK(!f.try_get_tensor("t1"));
+  CHECK_THROWS(f.get_tensor("t1"), std::runtime_error);
+  CHECK(f.is_unmapped("t1") && f.released("t1"));
+  // It stays unmapped, and the pages it shared are still readable.
+  CHECK_EQ(f.release("t1"), 0u);
+  CHECK(f.is_unmapped("t1"));
+  CHECK(holds(f, 0) && holds(f, 2));
+
+  // Prefetching skips it instead of faulting on the hole.
+  for (const Prefault mode : {Prefault::Populate, Prefault::Touch}) {
+    PrefetchOptions options;
+    options.mode = mode;
+    options.threads = 2;
+    CHECK_EQ(f.prefetch(options).bytes, 2 * 3 * kPage);
+    const std::string_view keys[] = {"t1", "t2"};
+    CHECK_EQ(f.prefetch(keys, options).bytes, 3 * kPage);
+    CHECK_EQ(f.prefetch_if([](std::string_view) { return true; }, options)
+                 .bytes,
+             2 * 3 * kPage);
+  }
+}
+
+TEST(shared_checkpoints_only_discard) {
+  test::TempDir dir("safetensors-release");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 2, 2, true);
+  SafeOpen f(path, openOptions(CheckpointCache::Process));
+  SafeOpen g(path, openOptions(CheckpointCache::Process));
+  CHECK(f.release("t0", Release::Unmap) > 0);
+  CHECK(!f.find_tensor("t0"));
+  // The mapping is shared, so the other instance still reads it.
+  CHECK(holds(g, 0));
+  CHECK(!g.is_unmapped("t0"));
+}
+
+TEST_MAIN()
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "fmt/format.h"
+#include "safetensors/remote.hpp"
+#include "safetensors/writer.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace safetensors;
+
+namespace {
+
+// `a` and `b` back to back, then `c`; every element equals its tensor's
+// position.
+std::vector<char> checkpoint(const test::TempDir& dir) {
+  const auto path = dir / "model.safetensors";
+  SafeWriter writer(path);
+  writer.add_tensor("a", Dtype::F32, std::array<std::size_t, 1>{1000});
+  writer.add_tensor("b", Dtype::F32, std::array<std::size_t, 1>{3000});
+  writer.add_tensor("c", Dtype::F32, std::array<std::size_t, 1>{500});
+  float value = 0.0f;
+  const std::pair<const char*, std::size_t> tensors[] = {
+      {"a", 1000}, {"b", 3000}, {"c", 500}};
+  for (const auto& [key, n] : tensors) {
+    const std::vector<float> data(n, value++);
+    writer.write(key, std::as_bytes(std::span(data)));
+  }
+  writer.close();
+  std::ifstream in(path, std::ios::binary);
+  return {std::istreambuf_iterator<char>(in), {}};
+}
+
+// A keep-alive HTTP/1.1 server on the loopback interface answering ranged
+// GETs for one object, one thread per connection.
+class Server {
+ public:
+  explicit Server(std::vector<char> object) : object_(std::move(object)) {
+    listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    auto* any = reinterpret_cast<sockaddr*>(&addr);
+    if (listen_ < 0 || bind(listen_, any, len) != 0 ||
+        listen(listen_, 64) != 0 || getsockname(listen_, any, &len) != 0) {
+      throw std::runtime_error("cannot listen on the loopback interface");
+    }
+    port_ = ntohs(addr.sin_port);
+    acceptor_ = std::thread([this] { acceptLoop(); });
+  }
+
+  ~Server() {
+    shutdown(listen_, SHUT_RDWR);
+    acceptor_.join();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (int fd : connections_) shutdown(fd, SHUT_RDWR);
+    }
+    for (std::thread& t : handlers_) t.join();
+    for (int fd : connections_) close(fd);
+    close(listen_);
+  }
+
+  std::string url(const std::string& target = "/model.safetensors") const {
+    return "http://127.0.0.1:" + std::to_string(port_) + target;
+  }
+  std::uint16_t port() const { return port_; }
+
+  // Answer everything with 200 and the whole object, as a server without
+  // range support does.
+  std::atomic<bool> ignore_ranges{false};
+  std::string host() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return host_;
+  }
+
+ private:
+  void acceptLoop() {
+    for (;;) {
+      const int fd = accept(listen_, nullptr, nullptr);
+      if (fd < 0) return;
+      std::lock_guard<std::mutex> lock(mutex_);
+      connections_.push_back(fd);
+      handlers_.emplace_back([this, fd] { serve(fd); });
+    }
+  }
+
+  void serve(const int fd) {
+    std::string buffered;
+    char buf[4096];
+    for (;;) {
+      std::size_t end;
+      while ((end = buffered.find("\r\n\r\n")) == std::string::npos) {
+        const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) return;
+        buffered.append(buf, static_cast<std::size_t>(n));
+      }
+      const std::string head = buffered.substr(0, end);
+      buffered.erase(0, end + 4);
+      if (!respond(fd, head)) return;
+    }
+  }
+
+  static std::string header(const std::string& head,
+                            const std::string& name) {
+    const std::size_t at = head.find("\r\n" + name + ": ");
+    if (at == std::string::npos) return {};
+    const std::size_t begin = at + name.size() + 4;
+    return head.substr(begin, head.find("\r\n", begin) - begin);
+  }
+
+  // False once the connection should close.
+  bool respond(const int fd, const std::string& head) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      host_ = header(head, "Host");
+    }
+    const std::string target = head.substr(4, head.find(' ', 4) - 4);
+    if (target != "/model.safetensors") {
+      return send("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", fd);
+    }
+    if (ignore_ranges) {
+      std::string response = fmt::format(
+          "HTTP/1.1 200 OK\r\nContent-Length: {}\r\n\r\n", object_.size());
+      response.append(object_.data(), object_.size());
+      return send(response, fd);
+    }
+    // "bytes=first-last"
+    const std::string range = header(head, "Range");
+    const std::size_t first = std::stoull(range.substr(6));
+    std::size_t last = std::stoull(range.substr(range.find('-') + 1));
+    last = std::min(last, object_.size() - 1);
+    std::string response = fmt::format(
+        "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes {}-{}/{}\r\n"
+        "Content-Length: {}\r\n\r\n",
+        first, last, object_.size(), last - first + 1);
+    response.append(object_.data() + first, last - first + 1);
+    return send(response, fd);
+  }
+
+  static bool send(const std::string& data, const int fd) {
+    for (std::size_t sent = 0; sent < data.size();) {
+      const ssize_t n =
+          ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) return false;
+      sent += static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+
+  std::vector<char> object_;
+  int listen_ = -1;
+  std::uint16_t port_ = 0;
+  std::thread acceptor_;
+  mutable std::mutex mutex_;
+  std::vector<int> connections_;
+  std::vector<std::thread> handlers_;
+  std::string host_;
+};
+
+bool filled(std::span<const float> data, const float value) {
+  for (float x : data) {
+    if (x != value) return false;
+  }
+  return true;
+}
+
+RemoteOptions smallRanges() {
+  RemoteOptions options;
+  // A tiny prefix and blocks, so that the header takes a second request
+  // and tensors are split over several connections.
+  options.prefix = 16;
+  options.block_size = 4096;
+  options.connections = 4;
+  return options;
+}
+
+}  // namespace
+
+TEST(reads_tensors_over_http) {
+  test::TempDir dir("safetensors-remote");
+  Server server(checkpoint(dir));
+  RemoteOpen f(open_http_reader(server.url(), smallRanges()));
+  CHECK_EQ(f.keys().size(), 3u);
+  CHECK_EQ(f.reader().backend(), IoBackend::Remote);
+  CHECK_EQ(f.get_tensor("b").data_len, 3000u * 4);
+
+  std::vector<float> a(1000), b(3000), c(500);
+  const RemoteOpen::TensorRead reads[] = {
+      {"c", std::as_writable_bytes(std::span(c))},
+      {"a", std::as_writable_bytes(std::span(a))},
+      {"b", std::as_writable_bytes(std::span(b))},
+  };
+  f.read_into(reads);
+  CHECK(filled(a, 0.0f) && filled(b, 1.0f) && filled(c, 2.0f));
+  // The port is not the default one, so it is part of the Host header.
+  CHECK(server.host() == "127.0.0.1:" + std::to_string(server.port()));
+
+  CHECK(!f.find_tensor("missing"));
+  CHECK_THROWS(f.get_tensor("missing"), std::runtime_error);
+  CHECK_THROWS(f.read_into("a", std::as_writable_bytes(std::span(c))),
+               std::runtime_error);
+}
+
+TEST(reports_http_errors) {
+  test::TempDir dir("safetensors-remote");
+  Server server(checkpoint(dir));
+  CHECK_THROWS(open_http_reader(server.url("/missing")), std::runtime_error);
+  CHECK_THROWS(open_http_reader("https://example.com/model.safetensors"),
+               std::invalid_argument);
+  CHECK_THROWS(open_http_reader("http:///model.safetensors"),
+               std::invalid_argument);
+
+  // The first request covers the whole object and still succeeds; later
+  // ones cannot be served without ranges.
+  server.ignore_ranges = true;
+  RemoteOptions options = smallRanges();
+  options.retries = 0;
+  std::unique_ptr<Reader> reader = open_http_reader(server.url(), options);
+  std::array<std::byte, 8> buf;
+  const ReadRequest request{100, buf.size(), buf.data()};
+  CHECK_THROWS(reader->read({&request, 1}), std::runtime_error);
+}
+
+TEST(merges_and_retries_ranges) {
+  test::TempDir dir("safetensors-remote");
+  const std::vector<char> object = checkpoint(dir);
+  std::atomic<std::size_t> fetches{0};
+  std::atomic<std::size_t> failures{0};
+  RangeFetch fetch = [&](std::size_t offset, std::size_t size, void* dst) {
+    ++fetches;
+    if (failures > 0) {
+      --failures;
+      throw std::runtime_error("transient");
+    }
+    std::memcpy(dst, object.data() + offset, size);
+  };
+  RemoteOptions options;
+  options.retries = 2;
+  const std::vector<std::byte> prefix(
+      reinterpret_cast<const std::byte*>(object.data()),
+      reinterpret_cast<const std::byte*>(object.data()) + 100);
+  std::unique_ptr<Reader> reader =
+      open_remote_reader(object.size(), fetch, options, prefix);
+
+  // Inside the prefix: no fetch at all.
+  std::array<char, 64> head;
+  const ReadRequest in_prefix{8, head.size(), head.data()};
+  reader->read({&in_prefix, 1});
+  CHECK_EQ(fetches.load(), 0u);
+  CHECK(std::memcmp(head.data(), object.data() + 8, head.size()) == 0);
+
+  // Neighbours within the merge gap come in one range, into separate
+  // buffers.
+  std::vector<char> x(1000), y(1000);
+  const ReadRequest near[] = {{3000, x.size(), x.data()},
+                              {1000, y.size(), y.data()}};
+  reader->read(near);
+  CHECK_EQ(fetches.load(), 1u);
+  CHECK(std::memcmp(x.data(), object.data() + 3000, x.size()) == 0);
+  CHECK(std::memcmp(y.data(), object.data() + 1000, y.size()) == 0);
+
+  // Up to `retries` failures are absorbed, one more is not.
+  failures = 2;
+  reader->read(near);
+  CHECK_EQ(fetches.load(), 4u);
+  failures = 3;
+  CHECK_THROWS(reader->read(near), std::runtime_error);
+
+  const ReadRequest past{object.size() - 10, 20, x.data()};
+  CHECK_THROWS(reader->read({&past, 1}), std::runtime_error);
+  CHECK_THROWS(open_remote_reader(object.size(), nullptr),
+               std::invalid_argument);
+}
+
+TEST_MAIN()
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/safetensors.hpp"
+#include "safetensors/writer.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace safetensors;
+
+namespace {
+
+const std::size_t kPage = Mmap::pageSize();
+
+// `t0` to `t3` of eight pages each, each starting on a page.
+void writeCheckpoint(const std::filesystem::path& path) {
+  WriterOptions options;
+  options.alignment = kPage;
+  SafeWriter writer(path, options);
+  for (std::size_t i = 0; i < 4; ++i) {
+    writer.add_tensor("t" + std::to_string(i), Dtype::U8,
+                      std::array<std::size_t, 1>{8 * kPage});
+  }
+  for (std::size_t i = 0; i < 4; ++i) {
+    const std::vector<std::byte> data(8 * kPage, static_cast<std::byte>(i));
+    writer.write("t" + std::to_string(i), data);
+  }
+  writer.close();
+}
+
+// Drops the clean pages of `path` from the page cache, as far as the file
+// system allows: tmpfs, for one, keeps them.
+void evict(const std::filesystem::path& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  fdatasync(fd);
+  static_cast<void>(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED));
+  close(fd);
+}
+
+OpenOptions openOptions() {
+  OpenOptions options;
+  options.prefetch = 0;
+  return options;
+}
+
+}  // namespace
+
+TEST(reports_residency_per_tensor) {
+  test::TempDir dir("safetensors-residency");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  SafeOpen f(path, openOptions());
+  CHECK_EQ(f.prefetch().bytes, f.index().buffer_size());
+
+  SafeOpen::Residency r = f.residency();
+  CHECK_EQ(r.tensors.size(), f.keys().size());
+  CHECK_EQ(r.total_bytes, f.index().buffer_size());
+  CHECK(r.resident_bytes <= r.total_bytes);
+  // Just prefetched, so all of it unless memory is very tight.
+  CHECK(r.fraction() > 0.5);
+  for (std::size_t i = 0; i < f.keys().size(); ++i) {
+    CHECK(r.tensors[i] <= f.tensors()[i].data_len);
+  }
+  CHECK_EQ(f.resident_bytes("t2"), r.tensors[f.index().find("t2")]);
+  CHECK_THROWS(f.resident_bytes("missing"), std::runtime_error);
+}
+
+TEST(warms_only_what_is_missing) {
+  test::TempDir dir("safetensors-residency");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  evict(path);
+  SafeOpen f(path, openOptions());
+  const std::string_view keys[] = {"t1"};
+  f.prefetch(keys);
+  const SafeOpen::Residency before = f.residency();
+  // Fully resident tensors are skipped.
+  std::size_t missing = 0;
+  for (std::size_t i = 0; i < f.keys().size(); ++i) {
+    if (before.tensors[i] < f.tensors()[i].data_len) {
+      missing += f.tensors()[i].data_len;
+    }
+  }
+  CHECK_EQ(f.warm().bytes, missing);
+  CHECK(f.residency().fraction() > 0.5);
+}
+
+TEST(leaves_unmapped_tensors_out) {
+  test::TempDir dir("safetensors-residency");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  evict(path);
+  SafeOpen f(path, openOptions());
+  const std::size_t total = f.residency().total_bytes;
+  f.release("t2", Release::Unmap);
+  const SafeOpen::Residency r = f.residency();
+  CHECK_EQ(r.total_bytes, total - 8 * kPage);
+  CHECK_EQ(r.tensors[f.index().find("t2")], 0u);
+  CHECK_EQ(f.resident_bytes("t2"), 0u);
+  // Warming skips the hole instead of faulting on it.
+  const std::size_t warmed = f.warm().bytes;
+  CHECK(warmed <= total - 8 * kPage);
+  CHECK(f.residency().resident_bytes <= total - 8 * kPage);
+}
+
+TEST_MAIN()
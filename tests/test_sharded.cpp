@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/sharded.hpp"
+#include "safetensors/writer.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+// Two shards: `a` and `b` in the first, `c` in the second, each 100
+// floats equal to its position in the weight map.
+std::filesystem::path writeCheckpoint(const test::TempDir& dir) {
+  auto shard = [&](const std::string& name,
+                   const std::vector<std::string>& keys, float value) {
+    SafeWriter writer(dir / name);
+    for (const std::string& key : keys) {
+      writer.add_tensor(key, Dtype::F32, std::array<std::size_t, 1>{100});
+    }
+    for (const std::string& key : keys) {
+      const std::vector<float> data(100, value++);
+      writer.write(key, std::as_bytes(std::span(data)));
+    }
+    writer.close();
+  };
+  shard("model-00001-of-00002.safetensors", {"a", "b"}, 0.0f);
+  shard("model-00002-of-00002.safetensors", {"c"}, 2.0f);
+  const auto index = dir / "model.safetensors.index.json";
+  std::ofstream(index) << R"({
+    "metadata": {"total_size": 1200, "format": "pt"},
+    "weight_map": {
+      "c": "model-00002-of-00002.safetensors",
+      "a": "model-00001-of-00002.safetensors",
+      "b": "model-00001-of-00002.safetensors"
+    }
+  })";
+  return index;
+}
+
+ShardedOptions shardedOptions(const bool lazy) {
+  ShardedOptions options;
+  options.lazy = lazy;
+  options.prefetch = !lazy;
+  return options;
+}
+
+}  // namespace
+
+TEST(looks_up_tensors_across_shards) {
+  test::TempDir dir("safetensors-sharded");
+  const auto index = writeCheckpoint(dir);
+  ShardedSafeOpen f(index, shardedOptions(false));
+  CHECK_EQ(f.keys().size(), 3u);
+  CHECK(f.keys()[0] == "c" && f.keys()[1] == "a" && f.keys()[2] == "b");
+  CHECK_EQ(f.num_shards(), 2u);
+  CHECK_EQ(f.shard_of("a"), f.shard_of("b"));
+  CHECK(f.shard_of("c") != f.shard_of("a"));
+  CHECK_EQ(f.shard_of("missing"), f.num_shards());
+  for (std::size_t i = 0; i < 3; ++i) {
+    const char* key = i == 0 ? "a" : i == 1 ? "b" : "c";
+    const std::span<const float> data = f.get_tensor<float>(key);
+    CHECK_EQ(data.size(), 100u);
+    CHECK_EQ(data[99], static_cast<float>(i));
+  }
+  CHECK(!f.find_tensor("missing"));
+  CHECK(!f.try_get_tensor("missing"));
+  CHECK_THROWS(f.get_tensor("missing"), std::runtime_error);
+  CHECK_THROWS(f.shard(2), std::out_of_range);
+
+  // Metadata sorted by key, non-strings as their JSON text.
+  CHECK_EQ(f.get_metadata().size(), 2u);
+  CHECK(f.get_metadata()[0].first == "format");
+  CHECK(f.get_metadata()[1].second == "1200");
+  for (const ShardTiming& timing : f.timings()) CHECK(timing.opened);
+}
+
+TEST(opens_shards_lazily) {
+  test::TempDir dir("safetensors-sharded");
+  const auto index = writeCheckpoint(dir);
+  ShardedSafeOpen f(index, shardedOptions(true));
+  CHECK(!f.timings()[0].opened && !f.timings()[1].opened);
+  CHECK(!f.find_tensor("missing"));
+  CHECK(!f.timings()[0].opened && !f.timings()[1].opened);
+
+  // Racing first lookups open the shard once.
+  std::vector<std::thread> threads;
+  std::vector<const SafeOpen::TensorView*> views(8);
+  for (std::size_t i = 0; i < views.size(); ++i) {
+    threads.emplace_back([&, i] { views[i] = f.find_tensor("c"); });
+  }
+  for (std::thread& t : threads) t.join();
+  for (const auto* view : views) CHECK(view && view == views[0]);
+  CHECK(f.timings()[0].opened && !f.timings()[1].opened);
+  f.open_all();
+  CHECK(f.timings()[1].opened);
+}
+
+TEST(releases_tensors_from_their_shard) {
+  test::TempDir dir("safetensors-sharded");
+  const auto index = writeCheckpoint(dir);
+  ShardedSafeOpen f(index, shardedOptions(true));
+  CHECK_EQ(f.get_tensor<float>("b")[0], 1.0f);
+  f.release("b");
+  CHECK_EQ(f.get_tensor<float>("b")[0], 1.0f);
+  f.release("b", Release::Unmap);
+  CHECK(!f.find_tensor("b"));
+  CHECK(!f.try_get_tensor("b"));
+  CHECK_THROWS(f.get_tensor("b"), std::runtime_error);
+  CHECK(f.shard(f.shard_of("b")).is_unmapped("b"));
+  CHECK_EQ(f.get_tensor<float>("a")[99], 0.0f);
+  CHECK_THROWS(f.release("missing"), std::runtime_error);
+}
+
+TEST(rejects_bad_indexes) {
+  test::TempDir dir("safetensors-sharded");
+  const auto index = writeCheckpoint(dir);
+  auto write = [&](const std::string& text) {
+    std::ofstream(dir / "bad.index.json") << text;
+    return dir / "bad.index.json";
+  };
+  CHECK_THROWS(ShardedSafeOpen(write(R"({"metadata": {}})")),
+               std::runtime_error);
+  CHECK_THROWS(ShardedSafeOpen(write(R"({"weight_map": {"a": "x", "a": "y"}})")),
+               std::runtime_error);
+  CHECK_THROWS(ShardedSafeOpen(write(R"({"weight_map": {"a": )")),
+               std::runtime_error);
+  // A missing shard fails up front, or on first access when lazy.
+  const auto missing =
+      write(R"({"weight_map": {"a": "model-00001-of-00002.safetensors",)"
+            R"( "z": "missing.safetensors"}})");
+  CHECK_THROWS(ShardedSafeOpen(missing), std::exception);
+  ShardedSafeOpen lazy(missing, shardedOptions(true));
+  CHECK(lazy.find_tensor("a"));
+  CHECK_THROWS(lazy.find_tensor("z"), std::exception);
+
+  // A tensor the weight map puts in the wrong shard.
+  ShardedSafeOpen wrong(
+      write(R"({"weight_map": {"c": "model-00001-of-00002.safetensors"}})"));
+  CHECK_THROWS(wrong.find_tensor("c"), std::runtime_error);
+}
+
+TEST_MAIN()
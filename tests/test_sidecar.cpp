@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/safetensors.hpp"
+#include "safetensors/sidecar.hpp"
+#include "safetensors/writer.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+void writeCheckpoint(const std::filesystem::path& path, const std::size_t n) {
+  std::vector<float> data(n);
+  for (std::size_t i = 0; i < n; ++i) data[i] = static_cast<float>(i);
+  SafeWriter writer(path);
+  writer.add_tensor("a", Dtype::F32, std::array<std::size_t, 1>{n});
+  writer.add_tensor("b", Dtype::F32, std::array<std::size_t, 2>{2, n / 2});
+  writer.add_tensor("c", Dtype::F32, std::array<std::size_t, 1>{n});
+  writer.add_metadata("format", "pt");
+  for (const char* key : {"a", "b", "c"}) {
+    writer.write(key, std::as_bytes(std::span(data)));
+  }
+  writer.close();
+}
+
+TensorIndex parseFile(const std::filesystem::path& path) {
+  File file(path);
+  Mmap mmap(&file, 0);
+  return parse_header(mmap.data(), mmap.size(), HeaderParser::Native);
+}
+
+// An 8-byte aligned copy of `index`'s arena, to tamper with.
+std::vector<std::uint64_t> copyBlob(const TensorIndex& index) {
+  const std::span<const std::byte> blob = index.blob();
+  std::vector<std::uint64_t> out(blob.size() / sizeof(std::uint64_t));
+  std::memcpy(out.data(), blob.data(), blob.size());
+  return out;
+}
+
+TensorIndex::Entry* entryIn(std::vector<std::uint64_t>* copy,
+                            const TensorIndex& index, const std::size_t i) {
+  const std::ptrdiff_t offset =
+      reinterpret_cast<const std::byte*>(&index.entry(i)) -
+      index.blob().data();
+  return reinterpret_cast<TensorIndex::Entry*>(
+      reinterpret_cast<std::byte*>(copy->data()) + offset);
+}
+
+TensorIndex attach(const std::vector<std::uint64_t>& copy) {
+  return TensorIndex::from_blob(
+      nullptr, std::as_bytes(std::span(copy.data(), copy.size())));
+}
+
+}  // namespace
+
+TEST(reopens_through_the_sidecar) {
+  test::TempDir dir("safetensors-sidecar");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 1000);
+  const std::filesystem::path sidecar = sidecar_path(path);
+  CHECK(sidecar.string().ends_with(".stidx"));
+  CHECK(!load_sidecar(path, sidecar));
+
+  OpenOptions options;
+  options.sidecar = true;
+  {
+    SafeOpen f(path, options);
+    CHECK_EQ(f.keys().size(), 3u);
+  }
+  CHECK(std::filesystem::exists(sidecar));
+  const std::optional<TensorIndex> loaded = load_sidecar(path, sidecar);
+  CHECK(loaded.has_value());
+  if (loaded) {
+    const TensorIndex parsed = parseFile(path);
+    CHECK_EQ(loaded->size(), parsed.size());
+    CHECK_EQ(loaded->data_offset(), parsed.data_offset());
+    CHECK_EQ(loaded->buffer_size(), parsed.buffer_size());
+    CHECK(loaded->metadata("format") == "pt");
+    const std::size_t b = loaded->find("b");
+    CHECK(b != TensorIndex::npos);
+    CHECK_EQ(loaded->shape(b)[1], 500u);
+  }
+
+  SafeOpen f(path, options);
+  const std::span<const float> c = f.get_tensor<float>("c");
+  CHECK_EQ(c.size(), 1000u);
+  CHECK_EQ(c[999], 999.0f);
+
+  // Into a directory of sidecars, one per canonical path.
+  test::TempDir cache("safetensors-sidecar-dir");
+  options.sidecar_dir = cache / "";
+  { SafeOpen g(path, options); }
+  CHECK(std::filesystem::exists(sidecar_path(path, cache / "")));
+}
+
+TEST(ignores_stale_and_corrupt_sidecars) {
+  test::TempDir dir("safetensors-sidecar");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 1000);
+  const std::filesystem::path sidecar = sidecar_path(path);
+  CHECK(write_sidecar(path, parseFile(path), sidecar));
+  CHECK(load_sidecar(path, sidecar).has_value());
+
+  // A flipped byte in the arena fails the checksum.
+  const std::uintmax_t size = std::filesystem::file_size(sidecar);
+  {
+    std::fstream out(sidecar, std::ios::in | std::ios::out | std::ios::binary);
+    out.seekp(static_cast<std::streamoff>(size - 20));
+    out.put('\x7f');
+  }
+  CHECK(!load_sidecar(path, sidecar));
+  std::filesystem::resize_file(sidecar, 40);
+  CHECK(!load_sidecar(path, sidecar));
+
+  // Rewritten with another size, the checkpoint is parsed again.
+  CHECK(write_sidecar(path, parseFile(path), sidecar));
+  writeCheckpoint(path, 2000);
+  CHECK(!load_sidecar(path, sidecar));
+  OpenOptions options;
+  options.sidecar = true;
+  SafeOpen f(path, options);
+  CHECK_EQ(f.get_tensor("a").data_len, 2000u * 4);
+  CHECK(load_sidecar(path, sidecar).has_value());
+}
+
+TEST(rejects_tampered_blobs) {
+  test::TempDir dir("safetensors-sidecar");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path, 1000);
+  const TensorIndex index = parseFile(path);
+  CHECK_EQ(attach(copyBlob(index)).size(), 3u);
+
+  // Data past the end of the buffer.
+  std::vector<std::uint64_t> copy = copyBlob(index);
+  entryIn(&copy, index, 2)->end += 1 << 20;
+  CHECK_THROWS(attach(copy), std::runtime_error);
+  // A tensor moved over the next one, and one past the whole file.
+  copy = copyBlob(index);
+  entryIn(&copy, index, 1)->begin -= 4;
+  CHECK_THROWS(attach(copy), std::runtime_error);
+  copy = copyBlob(index);
+  TensorIndex::Entry* e = entryIn(&copy, index, 2);
+  e->begin += 1ULL << 40;
+  e->end += 1ULL << 40;
+  CHECK_THROWS(attach(copy), std::runtime_error);
+  // Reversed, and a hole between two tensors.
+  copy = copyBlob(index);
+  entryIn(&copy, index, 0)->end = 0;
+  entryIn(&copy, index, 0)->begin = 4;
+  CHECK_THROWS(attach(copy), std::runtime_error);
+  copy = copyBlob(index);
+  entryIn(&copy, index, 0)->end -= 4;
+  CHECK_THROWS(attach(copy), std::runtime_error);
+
+  // Truncated, and misaligned.
+  copy = copyBlob(index);
+  CHECK_THROWS(TensorIndex::from_blob(
+                   nullptr, std::as_bytes(std::span(copy.data(), 4))),
+               std::runtime_error);
+  CHECK_THROWS(
+      TensorIndex::from_blob(
+          nullptr, std::as_bytes(std::span(copy.data(), copy.size()))
+                       .subspan(4)),
+      std::runtime_error);
+}
+
+TEST_MAIN()
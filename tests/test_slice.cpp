@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/safetensors.hpp"
+#include "safetensors/writer.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+using Range = SafeOpen::SliceRange;
+
+constexpr std::size_t kDims[] = {4, 5, 6};
+
+// `t` of shape kDims holding its own flat index, and an F4 `q` of shape
+// {2, 8}.
+void writeCheckpoint(const std::filesystem::path& path) {
+  std::vector<float> t(4 * 5 * 6);
+  for (std::size_t i = 0; i < t.size(); ++i) t[i] = static_cast<float>(i);
+  std::vector<std::uint8_t> q(8);
+  for (std::size_t i = 0; i < q.size(); ++i) {
+    q[i] = static_cast<std::uint8_t>(i * 0x11);
+  }
+  SafeWriter writer(path);
+  writer.add_tensor("t", Dtype::F32, std::array<std::size_t, 3>{4, 5, 6});
+  writer.add_tensor("q", Dtype::F4, std::array<std::size_t, 2>{2, 8});
+  writer.write("t", std::as_bytes(std::span(t)));
+  writer.write("q", std::as_bytes(std::span(q)));
+  writer.close();
+}
+
+OpenOptions openOptions(const IoBackend backend = IoBackend::Mmap) {
+  OpenOptions options;
+  options.prefetch = 0;
+  options.io.backend = backend;
+  return options;
+}
+
+// Element (i, j, k) of `box`, read through its strides.
+float at(const SafeOpen::SliceView& box, const std::size_t i,
+         const std::size_t j, const std::size_t k) {
+  const auto* data = static_cast<const float*>(box.data_ptr);
+  return data[i * box.strides[0] + j * box.strides[1] + k * box.strides[2]];
+}
+
+float flat(const std::size_t i, const std::size_t j, const std::size_t k) {
+  return static_cast<float>((i * kDims[1] + j) * kDims[2] + k);
+}
+
+}  // namespace
+
+TEST(views_slices_in_place) {
+  test::TempDir dir("safetensors-slice");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  SafeOpen f(path, openOptions());
+
+  // A block of rows is one run.
+  const Range rows[] = {{1, 3}};
+  const SafeOpen::SliceView block = f.slice("t", rows);
+  CHECK(block.shape == std::vector<std::size_t>({2, 5, 6}));
+  CHECK(block.strides == std::vector<std::size_t>({30, 6, 1}));
+  CHECK(block.contiguous());
+  CHECK_EQ(block.data_len, 2u * 30 * 4);
+  CHECK_EQ(at(block, 0, 0, 0), flat(1, 0, 0));
+
+  // Strided in the middle and inner dimensions, open ended in the first.
+  const Range box_ranges[] = {{2}, {1, 4}, {3, 5}};
+  const SafeOpen::SliceView box = f.slice("t", box_ranges);
+  CHECK(box.shape == std::vector<std::size_t>({2, 3, 2}));
+  CHECK(!box.contiguous());
+  CHECK_EQ(box.numel(), 12u);
+  bool same = true;
+  for (std::size_t i = 0; i < 2; ++i) {
+    for (std::size_t j = 0; j < 3; ++j) {
+      for (std::size_t k = 0; k < 2; ++k) {
+        same &= at(box, i, j, k) == flat(2 + i, 1 + j, 3 + k);
+      }
+    }
+  }
+  CHECK(same);
+
+  // Nothing selected, and the whole tensor.
+  const Range empty[] = {{2, 2}};
+  CHECK_EQ(f.slice("t", empty).numel(), 0u);
+  CHECK_EQ(f.slice("t", {}).data_len, f.get_tensor("t").data_len);
+}
+
+TEST(gathers_slices_with_every_backend) {
+  test::TempDir dir("safetensors-slice");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  for (const IoBackend backend :
+       {IoBackend::Mmap, IoBackend::Buffered, IoBackend::Direct}) {
+    SafeOpen f(path, openOptions(backend));
+    const Range ranges[] = {{1, 4}, {0, 5}, {2, 3}};
+    std::vector<float> out(3 * 5);
+    CHECK_EQ(f.read_slice("t", ranges, std::as_writable_bytes(std::span(out))),
+             out.size() * 4);
+    bool same = true;
+    for (std::size_t i = 0; i < 3; ++i) {
+      for (std::size_t j = 0; j < 5; ++j) {
+        same &= out[i * 5 + j] == flat(1 + i, j, 2);
+      }
+    }
+    CHECK(same);
+    std::vector<float> small(14);
+    CHECK_THROWS(
+        f.read_slice("t", ranges, std::as_writable_bytes(std::span(small))),
+        std::runtime_error);
+  }
+}
+
+TEST(rejects_bad_slices) {
+  test::TempDir dir("safetensors-slice");
+  const auto path = dir / "model.safetensors";
+  writeCheckpoint(path);
+  SafeOpen f(path, openOptions());
+  const Range too_many[] = {{}, {}, {}, {}};
+  CHECK_THROWS(f.slice("t", too_many), std::out_of_range);
+  const Range past[] = {{0, 5}};
+  CHECK_THROWS(f.slice("t", past), std::out_of_range);
+  const Range reversed[] = {{3, 1}};
+  CHECK_THROWS(f.slice("t", reversed), std::out_of_range);
+  CHECK_THROWS(f.slice("missing", {}), std::runtime_error);
+
+  // F4 runs have to start and end on a byte: columns [2, 4) of each row
+  // do, [1, 3) do not.
+  const Range even[] = {{}, {2, 4}};
+  const SafeOpen::SliceView q = f.slice("q", even);
+  CHECK(q.shape == std::vector<std::size_t>({2, 2}));
+  CHECK_EQ(q.data_len, 2u);
+  std::array<std::uint8_t, 2> out;
+  f.read_slice("q", even, std::as_writable_bytes(std::span(out)));
+  CHECK_EQ(out[0], 0x11u);
+  CHECK_EQ(out[1], 0x55u);
+  const Range odd[] = {{}, {1, 3}};
+  CHECK_THROWS(f.slice("q", odd), std::invalid_argument);
+}
+
+TEST_MAIN()
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/convert.hpp"
+#include "safetensors/transform.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+constexpr std::size_t kRows = 64;
+constexpr std::size_t kCols = 1000;
+
+OpenOptions openOptions() {
+  OpenOptions options;
+  options.prefetch = 0;
+  return options;
+}
+
+// Three layers of a column-parallel `w`, a row-parallel `o`, a bias kept
+// whole and an optimizer state that the plans below drop.
+std::vector<float> writeSource(const std::filesystem::path& path) {
+  std::vector<float> w(kRows * kCols);
+  std::vector<float> b(kCols);
+  std::vector<float> m(kRows * kCols, -1.0f);
+  for (std::size_t i = 0; i < w.size(); ++i) {
+    w[i] = static_cast<float>(i) * 0.5f;
+  }
+  for (std::size_t i = 0; i < b.size(); ++i) b[i] = static_cast<float>(i);
+  SafeWriter writer(path);
+  const std::array<std::size_t, 2> matrix{kRows, kCols};
+  const std::array<std::size_t, 1> vector{kCols};
+  for (int l = 0; l < 3; ++l) {
+    const std::string layer = "model.l" + std::to_string(l);
+    writer.add_tensor(layer + ".w", Dtype::F32, matrix);
+    writer.add_tensor(layer + ".o", Dtype::F32, matrix);
+    writer.add_tensor(layer + ".b", Dtype::F32, vector);
+    writer.add_tensor("opt.l" + std::to_string(l) + ".m", Dtype::F32, matrix);
+  }
+  writer.add_metadata("format", "pt");
+  for (int l = 0; l < 3; ++l) {
+    const std::string layer = "model.l" + std::to_string(l);
+    writer.write(layer + ".w", std::as_bytes(std::span(w)));
+    writer.write(layer + ".o", std::as_bytes(std::span(w)));
+    writer.write(layer + ".b", std::as_bytes(std::span(b)));
+    writer.write("opt.l" + std::to_string(l) + ".m",
+                 std::as_bytes(std::span(m)));
+  }
+  writer.close();
+  return w;
+}
+
+std::uint16_t bf16(const float x) {
+  std::uint16_t out;
+  convert(&x, Dtype::F32, &out, Dtype::BF16, 1);
+  return out;
+}
+
+}  // namespace
+
+TEST(splits_and_shards_for_tensor_parallel_ranks) {
+  test::TempDir dir("safetensors-transform");
+  const std::vector<float> w = writeSource(dir / "source.safetensors");
+  SafeOpen source(dir / "source.safetensors", openOptions());
+
+  TransformOptions options;
+  options.ranks = 2;
+  options.max_shard_bytes = 100000;
+  options.chunk_bytes = 4096;
+  options.threads = 4;
+  options.writer.checksums = true;
+  options.metadata = {{"converted", "yes"}};
+  options.plan = [](std::string_view name, const SafeOpen::TensorView&)
+      -> std::optional<TensorPlan> {
+    if (name.starts_with("opt.")) return std::nullopt;
+    TensorPlan plan{std::string(name.substr(6)), Dtype::BF16};
+    if (name.ends_with(".w")) plan.split_dim = 0;
+    if (name.ends_with(".o")) plan.split_dim = 1;
+    if (name.ends_with(".b")) plan.dtype = Dtype::F32;
+    return plan;
+  };
+  std::size_t last_done = 0;
+  std::size_t total = 0;
+  options.progress = [&](std::size_t done, std::size_t all) {
+    CHECK(done >= last_done && done <= all);
+    last_done = done;
+    total = all;
+  };
+  std::filesystem::create_directories(dir / "out");
+  const TransformResult result =
+      transform(source, dir / "out" / "model.safetensors", options);
+  CHECK_EQ(result.outputs.size(), 2u);
+  CHECK(result.files.size() > 2);
+  CHECK_EQ(result.tensors, 2u * 9);
+  CHECK_EQ(last_done, total);
+  CHECK_EQ(result.bytes, total);
+
+  for (std::size_t rank = 0; rank < result.outputs.size(); ++rank) {
+    CHECK(result.outputs[rank].string().ends_with(".index.json"));
+    ShardedOptions sharded;
+    sharded.open = openOptions();
+    sharded.open.verify = true;
+    ShardedSafeOpen shards(result.outputs[rank], sharded);
+    CHECK_EQ(shards.keys().size(), 9u);
+
+    const auto& column = shards.get_tensor("l1.w");
+    CHECK(column.dtype == Dtype::BF16);
+    CHECK_EQ(column.shape[0], kRows / 2);
+    CHECK_EQ(column.shape[1], kCols);
+    const std::span<const bfloat16> cs = shards.get_tensor<bfloat16>("l1.w");
+    for (std::size_t i = 0; i < cs.size(); ++i) {
+      if (cs[i].bits != bf16(w[rank * kRows / 2 * kCols + i])) {
+        CHECK_EQ(cs[i].bits, bf16(w[rank * kRows / 2 * kCols + i]));
+        break;
+      }
+    }
+
+    CHECK_EQ(shards.get_tensor("l2.o").shape[1], kCols / 2);
+    const std::span<const bfloat16> rs = shards.get_tensor<bfloat16>("l2.o");
+    bool rows_match = true;
+    for (std::size_t r = 0; r < kRows; ++r) {
+      for (std::size_t c = 0; c < kCols / 2; ++c) {
+        rows_match &= rs[r * kCols / 2 + c].bits ==
+                      bf16(w[r * kCols + rank * kCols / 2 + c]);
+      }
+    }
+    CHECK(rows_match);
+
+    const std::span<const float> bias = shards.get_tensor<float>("l0.b");
+    CHECK_EQ(bias.size(), kCols);
+    CHECK_EQ(bias[kCols - 1], static_cast<float>(kCols - 1));
+
+    CHECK(shards.shard(0).get_metadata("format") == "pt");
+    CHECK(shards.shard(0).get_metadata("converted") == "yes");
+  }
+
+  // And back into a single file, unchanged.
+  ShardedOptions sharded;
+  sharded.open = openOptions();
+  sharded.prefetch = false;
+  ShardedSafeOpen shards(result.outputs[0], sharded);
+  const TransformResult merged =
+      transform(shards, dir / "out" / "merged.safetensors");
+  CHECK_EQ(merged.outputs.size(), 1u);
+  SafeOpen single(merged.outputs[0], openOptions());
+  CHECK_EQ(single.keys().size(), 9u);
+  // The source's checksums are not copied, with none asked for.
+  CHECK(!single.get_metadata(CHECKSUM_KEY));
+  const std::span<const bfloat16> whole = single.get_tensor<bfloat16>("l1.w");
+  const std::span<const bfloat16> part = shards.get_tensor<bfloat16>("l1.w");
+  CHECK(std::equal(whole.begin(), whole.end(), part.begin(), part.end(),
+                   [](bfloat16 a, bfloat16 b) { return a.bits == b.bits; }));
+}
+
+TEST(rejects_uneven_splits) {
+  test::TempDir dir("safetensors-transform");
+  writeSource(dir / "source.safetensors");
+  SafeOpen source(dir / "source.safetensors", openOptions());
+  TransformOptions options;
+  options.ranks = 3;
+  options.plan = [](std::string_view name, const SafeOpen::TensorView& view) {
+    return std::optional<TensorPlan>(
+        TensorPlan{std::string(name), view.dtype, 0});
+  };
+  CHECK_THROWS(transform(source, dir / "bad.safetensors", options),
+               std::invalid_argument);
+  CHECK(!std::filesystem::exists(dir / "bad-rank0.safetensors"));
+}
+
+TEST_MAIN()
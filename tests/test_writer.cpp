@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2025 Dapeng Feng
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "check.hpp"
+#include "safetensors/safetensors.hpp"
+#include "safetensors/writer.hpp"
+
+using namespace safetensors;
+
+namespace {
+
+OpenOptions openOptions() {
+  OpenOptions options;
+  options.prefetch = 0;
+  return options;
+}
+
+std::vector<std::byte> pattern(const std::size_t n, const unsigned seed) {
+  std::vector<std::byte> out(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    out[i] = static_cast<std::byte>((i * 131 + seed * 17) & 0xff);
+  }
+  return out;
+}
+
+// Keys without SafeWriter's `__padding_` fillers.
+std::size_t tensorCount(const SafeOpen& f) {
+  std::size_t n = 0;
+  for (std::string_view key : f.keys()) n += !key.starts_with(PADDING_PREFIX);
+  return n;
+}
+
+bool same(const SafeOpen::TensorView& view,
+          const std::vector<std::byte>& data) {
+  return view.data_len == data.size() &&
+         std::equal(data.begin(), data.end(),
+                    static_cast<const std::byte*>(view.data_ptr));
+}
+
+}  // namespace
+
+TEST(round_trip_with_alignment_and_checksums) {
+  test::TempDir dir("safetensors-writer");
+  const auto path = dir / "model.safetensors";
+  const std::vector<std::byte> w = pattern(4 * 3 * 100, 1);
+  const std::vector<std::byte> b = pattern(2 * 7, 2);
+  const std::vector<std::byte> u = pattern(5000, 3);
+  {
+    WriterOptions options;
+    options.alignment = 4096;
+    options.checksums = true;
+    options.chunk_bytes = 1000;
+    options.threads = 4;
+    SafeWriter writer(path, options);
+    writer.add_tensor("w", Dtype::F32, std::array<std::size_t, 2>{3, 100});
+    writer.add_tensor("b", Dtype::BF16, std::array<std::size_t, 1>{7});
+    writer.add_tensor("u", Dtype::U8, std::array<std::size_t, 1>{5000});
+    writer.add_tensor("empty", Dtype::F32, std::array<std::size_t, 2>{0, 4});
+    writer.add_metadata("format", "pt");
+    CHECK_EQ(writer.size_of("w"), w.size());
+    // `u` in pieces, out of order; the others in one batch.
+    writer.write("u", 3000, std::span(u).subspan(3000));
+    writer.write("u", 0, std::span(u).first(3000));
+    const TensorWrite batch[] = {{"w", w}, {"b", b}};
+    writer.write(batch);
+    writer.close();
+  }
+
+  SafeOpen f(path, openOptions());
+  CHECK_EQ(tensorCount(f), 4u);
+  CHECK(f.keys().size() > 4);
+  CHECK(f.alignment() >= 4096);
+  CHECK(std::filesystem::file_size(path) % 4096 == 0);
+  CHECK(same(f.get_tensor("w"), w));
+  CHECK(same(f.get_tensor("b"), b));
+  CHECK(same(f.get_tensor("u"), u));
+  CHECK_EQ(f.get_tensor("empty").data_len, 0u);
+  CHECK_EQ(f.get_tensor("w").shape[1], 100u);
+  CHECK(f.get_metadata("format") == "pt");
+  CHECK(f.get_metadata(CHECKSUM_KEY));
+  for (std::string_view key : {"w", "b", "u"}) {
+    const auto& view = f.get_tensor(key);
+    CHECK_EQ(reinterpret_cast<std::uintptr_t>(view.data_ptr) % 4096, 0u);
+  }
+  const VerifyResult result = f.verify();
+  CHECK(result.ok());
+  CHECK(result.tensors >= 3);
+
+  OpenOptions verified = openOptions();
+  verified.verify = true;
+  SafeOpen g(path, verified);
+  CHECK_EQ(tensorCount(g), 4u);
+}
+
+TEST(verify_finds_corruption) {
+  test::TempDir dir("safetensors-writer");
+  const auto path = dir / "model.safetensors";
+  const std::vector<std::byte> a = pattern(1 << 12, 4);
+  const std::vector<std::byte> c = pattern(1 << 12, 5);
+  std::size_t c_offset = 0;
+  {
+    WriterOptions options;
+    options.checksums = true;
+    SafeWriter writer(path, options);
+    writer.add_tensor("a", Dtype::U8, std::array<std::size_t, 1>{a.size()});
+    writer.add_tensor("c", Dtype::U8, std::array<std::size_t, 1>{c.size()});
+    writer.write("a", a);
+    writer.write("c", c);
+    writer.close();
+    SafeOpen f(path, openOptions());
+    c_offset = f.index().data_offset() +
+               static_cast<std::size_t>(
+                   f.index().entry(f.index().find("c")).begin);
+  }
+  {
+    std::fstream out(path, std::ios::in | std::ios::out | std::ios::binary);
+    out.seekp(static_cast<std::streamoff>(c_offset + 100));
+    out.put('\x5a' ^ static_cast<char>(c[100]));
+  }
+  SafeOpen f(path, openOptions());
+  const VerifyResult result = f.verify();
+  CHECK_EQ(result.mismatched.size(), 1u);
+  CHECK(!result.mismatched.empty() && result.mismatched[0] == "c");
+
+  OpenOptions verified = openOptions();
+  verified.verify = true;
+  CHECK_THROWS(SafeOpen(path, verified), std::runtime_error);
+}
+
+TEST(close_rejects_missing_bytes) {
+  test::TempDir dir("safetensors-writer");
+  const std::vector<std::byte> data = pattern(200, 6);
+  for (const bool checksums : {false, true}) {
+    WriterOptions options;
+    options.checksums = checksums;
+    SafeWriter writer(dir / "holes.safetensors", options);
+    writer.add_tensor("t", Dtype::U8, std::array<std::size_t, 1>{200});
+    writer.write("t", 0, std::span(data).first(100));
+    if (checksums) {
+      // Written twice, the bytes cannot be checksummed.
+      CHECK_THROWS(writer.write("t", 50, std::span(data).first(100)),
+                   std::invalid_argument);
+    } else {
+      writer.write("t", 0, std::span(data).first(100));
+    }
+    CHECK_THROWS(writer.close(), std::runtime_error);
+  }
+  CHECK(!std::filesystem::exists(dir / "holes.safetensors"));
+
+  // Rewrites are fine without checksums once every byte is in.
+  SafeWriter writer(dir / "rewritten.safetensors");
+  writer.add_tensor("t", Dtype::U8, std::array<std::size_t, 1>{200});
+  writer.write("t", 0, std::span(data).first(150));
+  writer.write("t", 100, std::span(data).subspan(100));
+  writer.close();
+  SafeOpen f(dir / "rewritten.safetensors", openOptions());
+  CHECK(same(f.get_tensor("t"), data));
+}
+
+TEST(rejects_bad_writes) {
+  test::TempDir dir("safetensors-writer");
+  SafeWriter writer(dir / "bad.safetensors");
+  writer.add_tensor("t", Dtype::F32, std::array<std::size_t, 1>{4});
+  CHECK_THROWS(writer.add_tensor("t", Dtype::F32,
+                                 std::array<std::size_t, 1>{4}),
+               std::exception);
+  CHECK_THROWS(writer.add_tensor("f4", Dtype::F4,
+                                 std::array<std::size_t, 1>{3}),
+               std::exception);
+  const std::vector<std::byte> data = pattern(20, 7);
+  CHECK_THROWS(writer.write("t", 0, data), std::out_of_range);
+  CHECK_THROWS(writer.write("missing", 0, std::span(data).first(4)),
+               std::runtime_error);
+  CHECK_THROWS(writer.add_tensor("late", Dtype::F32,
+                                 std::array<std::size_t, 1>{1}),
+               std::logic_error);
+}
+
+TEST_MAIN()